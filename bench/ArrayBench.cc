@@ -0,0 +1,99 @@
+// ArrayBench - the cost of indexing arrays & of their bulk operations,
+//  against the same work done one element at a time by a script.
+//
+//  usage: array_bench [n]
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include "VM/VM.h"
+
+using namespace loxy;
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+struct Script {
+  const char *name;
+  const char *source;
+};
+
+// E is replaced with the elements of the array & S with how many times
+// it's gone over, n elements in all. The array is built first, "push"
+// alone times that.
+const Script scripts[] = {
+  { "push",
+    "{ var xs = [];"
+    "  for (var i = 0; i < E; i = i + 1) xs.push(i);"
+    "  print xs.length(); }" },
+  { "indexed sum",
+    "{ var xs = []; var s = 0;"
+    "  for (var i = 0; i < E; i = i + 1) xs.push(i);"
+    "  for (var r = 0; r < S; r = r + 1)"
+    "    for (var i = 0; i < E; i = i + 1) s = s + xs[i];"
+    "  print s; }" },
+  { "unpacked sum",
+    "{ var xs = [nil]; var s = 0;"
+    "  for (var i = 0; i < E; i = i + 1) xs.push(i);"
+    "  for (var r = 0; r < S; r = r + 1)"
+    "    for (var i = 1; i <= E; i = i + 1) s = s + xs[i];"
+    "  print s; }" },
+  { "sum()",
+    "{ var xs = []; var s = 0;"
+    "  for (var i = 0; i < E; i = i + 1) xs.push(i);"
+    "  for (var r = 0; r < S; r = r + 1) s = s + xs.sum();"
+    "  print s; }" },
+  { "dot()",
+    "{ var xs = []; var s = 0;"
+    "  for (var i = 0; i < E; i = i + 1) xs.push(i);"
+    "  for (var r = 0; r < S; r = r + 1) s = s + xs.dot(xs);"
+    "  print s; }" },
+  { "mul() scalar",
+    "{ var xs = []; var s = 0;"
+    "  for (var i = 0; i < E; i = i + 1) xs.push(i);"
+    "  for (var r = 0; r < S; r = r + 1) s = s + xs.mul(2).length();"
+    "  print s; }" },
+};
+
+// elements per array.
+const long ELEMENTS = 100000;
+
+double run(const std::string &source) {
+  VM vm;
+
+  auto start = Clock::now();
+  InterpretResult result = vm.interpret(source.c_str(), "bench");
+  double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+  vm.output().flush();
+  if (result != InterpretResult::Ok) {
+    fprintf(stderr, "failed to run:\n%s\n", source.c_str());
+    exit(1);
+  }
+  return ms;
+}
+
+void replace(std::string &source, char name, long value) {
+  for (size_t at = source.find(name); at != std::string::npos; at = source.find(name, at)) {
+    source.replace(at, 1, std::to_string(value));
+  }
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  long n = argc > 1 ? atol(argv[1]) : 100000000;
+  long elements = n < ELEMENTS ? n : ELEMENTS;
+  setvbuf(stdout, nullptr, _IONBF, 0);
+
+  printf("n = %ld, %ld elements\n", n, elements);
+  for (const Script &script : scripts) {
+    std::string source = script.source;
+    replace(source, 'E', elements);
+    replace(source, 'S', n / elements);
+
+    printf("%-14s %8.1f ms\n", script.name, run(source));
+  }
+  return 0;
+}
@@ -0,0 +1,86 @@
+// CallBench - the cost of calls & returns, each pushing a frame & sharing
+//  the stack with its caller.
+//
+//  usage: call_bench [n]
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include "VM/VM.h"
+
+using namespace loxy;
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+struct Script {
+  const char *name;
+  const char *source;
+};
+
+// N is replaced with n, the loops & count make N calls, fib(30) 2.7
+// million.
+const Script scripts[] = {
+  { "recursive fib",
+    "fun fib(n) { if (n < 2) return n; return fib(n - 1) + fib(n - 2); }"
+    "print fib(30);" },
+  { "call in a loop",
+    "fun add(a, b) { return a + b; }"
+    "{ var s = 0;"
+    "  for (var i = 0; i < N; i = i + 1) s = add(s, i);"
+    "  print s; }" },
+  { "empty calls",
+    "fun f() {}"
+    "{ for (var i = 0; i < N; i = i + 1) f(); }" },
+  { "tail calls",
+    "fun count(n, acc) { if (n == 0) return acc; return count(n - 1, acc + 1); }"
+    "print count(N, 0);" },
+  { "stack closure",
+    "{ var s = 0;"
+    "  fun add(i) { s = s + i; }"
+    "  for (var i = 0; i < N; i = i + 1) add(i);"
+    "  print s; }" },
+  { "boxed closure",
+    "fun counter() { var c = 0; fun inc() { c = c + 1; return c; } return inc; }"
+    "{ var inc = counter();"
+    "  for (var i = 0; i < N; i = i + 1) inc();"
+    "  print inc(); }" },
+};
+
+double run(const std::string &source, bool jit) {
+  VM vm;
+  vm.setJit(jit);
+
+  auto start = Clock::now();
+  InterpretResult result = vm.interpret(source.c_str(), "bench");
+  double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+  vm.output().flush();
+  if (result != InterpretResult::Ok) {
+    fprintf(stderr, "failed to run:\n%s\n", source.c_str());
+    exit(1);
+  }
+  return ms;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  long n = argc > 1 ? atol(argv[1]) : 10000000;
+  setvbuf(stdout, nullptr, _IONBF, 0);
+
+  printf("n = %ld\n", n);
+  for (const Script &script : scripts) {
+    std::string source = script.source;
+    for (size_t at = source.find('N'); at != std::string::npos; at = source.find('N', at)) {
+      source.replace(at, 1, std::to_string(n));
+    }
+
+    double interpreted = run(source, false);
+    double jitted = run(source, true);
+    printf("%-16s interpreter %8.1f ms   jit %8.1f ms\n",
+      script.name, interpreted, jitted);
+  }
+  return 0;
+}
@@ -0,0 +1,136 @@
+// FiberBench - the cost of switching between fibers, resumed by scripts &
+//  by the host's scheduler, & the memory a fiber takes.
+//
+//  usage: fiber_bench [n]
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include "VM/VM.h"
+#include "VM/Module.h"
+
+using namespace loxy;
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+struct Script {
+  const char *name;
+  const char *source;
+};
+
+// N is replaced with n. Each loop makes N calls, or N resumes & as many
+// yields.
+const Script scripts[] = {
+  { "call",
+    "fun f(x) { return x; }"
+    "{ var s = 0;"
+    "  for (var i = 0; i < N; i = i + 1) s = s + f(i);"
+    "  print s; }" },
+  { "resume/yield",
+    "fun count() { var i = 0; while (true) { yield(i); i = i + 1; } }"
+    "{ var g = fiber(count); var s = 0;"
+    "  for (var i = 0; i < N; i = i + 1) s = s + resume(g);"
+    "  print s; }" },
+  { "nested fibers",
+    "fun count() { var i = 0; while (true) { yield(i); i = i + 1; } }"
+    "fun relay() { var g = fiber(count); while (true) yield(resume(g)); }"
+    "{ var r = fiber(relay); var s = 0;"
+    "  for (var i = 0; i < N; i = i + 1) s = s + resume(r);"
+    "  print s; }" },
+};
+
+// fibers run by the host's scheduler at once, & spawned to measure their
+// size.
+const long TASKS = 1000;
+const long SPAWNED = 100000;
+
+const char *tasks =
+  "var rounds = 0;"
+  "fun task() { for (var i = 0; i < rounds; i = i + 1) yield(); }";
+
+void check(InterpretResult result, const char *source) {
+  if (result != InterpretResult::Ok) {
+    fprintf(stderr, "failed to run:\n%s\n", source);
+    exit(1);
+  }
+}
+
+double run(const std::string &source, bool jit) {
+  VM vm;
+  vm.setJit(jit);
+
+  // fiber & resume are natives, see VM::addIo.
+  auto start = Clock::now();
+  Module *module = vm.compile(source.c_str(), "bench");
+  if (module == nullptr) check(InterpretResult::Compile_Error, source.c_str());
+  vm.addIo(module);
+  InterpretResult result = vm.run(module);
+  double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+  vm.output().flush();
+  check(result, source.c_str());
+  return ms;
+}
+
+// global - the value of variable [name] of [module].
+Value global(VM &vm, Module *module, const char *name) {
+  Value value;
+  if (!module->getVariable(String::create(vm, name), &value)) {
+    fprintf(stderr, "no variable %s\n", name);
+    exit(1);
+  }
+  return value;
+}
+
+// schedule - spawns [count] fibers of task(), each yielding [rounds]
+//  times, & runs them to completion. Returns the ms it took, & the bytes
+//  each fiber took before it ran into [perFiber].
+double schedule(long count, long rounds, double *perFiber) {
+  VM vm;
+  Module *module = vm.compile(tasks, "tasks");
+  if (module == nullptr) exit(1);
+  check(vm.run(module), tasks);
+  module->setVariable(String::create(vm, "rounds"), Value((int64_t)rounds));
+  Value task = global(vm, module, "task");
+
+  size_t before = vm.heapSize();
+  for (long i = 0; i < count; i++) vm.spawn(module, task);
+  *perFiber = (double)(vm.heapSize() - before) / count;
+
+  auto start = Clock::now();
+  check(vm.runScheduled(), tasks);
+  return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  long n = argc > 1 ? atol(argv[1]) : 10000000;
+  setvbuf(stdout, nullptr, _IONBF, 0);
+
+  printf("n = %ld\n", n);
+  for (const Script &script : scripts) {
+    std::string source = script.source;
+    for (size_t at = source.find('N'); at != std::string::npos; at = source.find('N', at)) {
+      source.replace(at, 1, std::to_string(n));
+    }
+
+    double interpreted = run(source, false);
+    double jitted = run(source, true);
+    printf("%-16s interpreter %8.1f ms   jit %8.1f ms   %6.1f ns a switch\n",
+      script.name, interpreted, jitted, interpreted * 1e6 / (2.0 * n));
+  }
+
+  // every round resumes each fiber from the host & yields back.
+  long rounds = n / TASKS > 0 ? n / TASKS : 1;
+  double perFiber;
+  double ms = schedule(TASKS, rounds, &perFiber);
+  printf("%-16s %ld fibers x %ld rounds %8.1f ms   %6.1f ns a switch\n",
+    "scheduler", TASKS, rounds, ms, ms * 1e6 / (2.0 * TASKS * rounds));
+
+  schedule(SPAWNED, 0, &perFiber);
+  printf("%-16s %.0f bytes a fiber\n", "memory", perFiber);
+  return 0;
+}
@@ -0,0 +1,150 @@
+// FuelBench - the cost of metering fuel, how soon an interrupt from
+//  another thread stops a runaway loop, & fibers preempted by a timer
+//  thread sharing the VM.
+//
+//  usage: fuel_bench [n]
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include "VM/VM.h"
+#include "VM/Module.h"
+
+using namespace loxy;
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+struct Script {
+  const char *name;
+  const char *source;
+};
+
+// N is replaced with n, each loop runs N times.
+const Script scripts[] = {
+  { "loop",
+    "{ var s = 0;"
+    "  for (var i = 0; i < N; i = i + 1) s = s + i;"
+    "  print s; }" },
+  { "calls",
+    "fun f(x) { return x; }"
+    "{ var s = 0;"
+    "  for (var i = 0; i < N; i = i + 1) s = s + f(i);"
+    "  print s; }" },
+};
+
+const char *runaway = "var i = 0; while (true) i = i + 1;";
+
+// two fibers spinning, each counting its rounds.
+const char *spinners =
+  "var a = 0; var b = 0;"
+  "fun spinA() { while (true) a = a + 1; }"
+  "fun spinB() { while (true) b = b + 1; }"
+  "spawn(spinA); spawn(spinB);";
+
+// ms before the interrupt, & between preemptions.
+const long INTERRUPT_AFTER = 50;
+const long PREEMPT_EVERY = 1;
+const long PREEMPTIONS = 100;
+
+double run(const std::string &source, bool jit, int64_t fuel) {
+  VM vm;
+  vm.setJit(jit);
+  vm.setFuel(fuel);
+
+  auto start = Clock::now();
+  InterpretResult result = vm.interpret(source.c_str(), "bench");
+  double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+  vm.output().flush();
+  if (result != InterpretResult::Ok) {
+    fprintf(stderr, "failed to run:\n%s\n", source.c_str());
+    exit(1);
+  }
+  return ms;
+}
+
+// latency - ms from aborting [runaway] from another thread until the run
+//  returned.
+double latency(bool jit) {
+  VM vm;
+  vm.setJit(jit);
+
+  std::atomic<Clock::rep> interrupted(0);
+  std::thread timer([&] {
+    std::this_thread::sleep_for(std::chrono::milliseconds(INTERRUPT_AFTER));
+    interrupted = Clock::now().time_since_epoch().count();
+    vm.interrupt(Interrupt::Abort);
+  });
+
+  InterpretResult result = vm.interpret(runaway, "runaway");
+  Clock::time_point stopped = Clock::now();
+  timer.join();
+
+  if (result != InterpretResult::Runtime_Error) {
+    fprintf(stderr, "the runaway loop wasn't aborted\n");
+    exit(1);
+  }
+  Clock::time_point at{Clock::duration(interrupted.load())};
+  return std::chrono::duration<double, std::milli>(stopped - at).count();
+}
+
+// preempt - runs [spinners] with a timer thread asking the running fiber
+//  to yield every PREEMPT_EVERY ms, then aborting. The rounds of both go
+//  into [a] & [b].
+void preempt(double *a, double *b) {
+  VM vm;
+  Module *module = vm.compile(spinners, "spinners");
+  if (module == nullptr) exit(1);
+  vm.addIo(module);
+
+  std::thread timer([&] {
+    for (long i = 0; i < PREEMPTIONS; i++) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(PREEMPT_EVERY));
+      vm.interrupt(Interrupt::Yield);
+    }
+    vm.interrupt(Interrupt::Abort);
+  });
+  vm.run(module);
+  timer.join();
+
+  Value value;
+  module->getVariable(String::create(vm, "a"), &value);
+  *a = (double)value;
+  module->getVariable(String::create(vm, "b"), &value);
+  *b = (double)value;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  long n = argc > 1 ? atol(argv[1]) : 10000000;
+  setvbuf(stdout, nullptr, _IONBF, 0);
+
+  // metered runs get more fuel than they need, charged all the same.
+  printf("n = %ld\n", n);
+  for (const Script &script : scripts) {
+    std::string source = script.source;
+    for (size_t at = source.find('N'); at != std::string::npos; at = source.find('N', at)) {
+      source.replace(at, 1, std::to_string(n));
+    }
+
+    for (bool jit : { false, true }) {
+      double unlimited = run(source, jit, -1);
+      double metered = run(source, jit, 4 * (int64_t)n);
+      printf("%-6s %-11s unlimited %8.1f ms   metered %8.1f ms\n",
+        script.name, jit ? "jit" : "interpreter", unlimited, metered);
+    }
+  }
+
+  printf("%-18s interpreter %6.3f ms   jit %6.3f ms\n",
+    "interrupt latency", latency(false), latency(true));
+
+  double a, b;
+  preempt(&a, &b);
+  printf("%-18s %ld preemptions: %.0f & %.0f rounds\n", "preempted fibers", PREEMPTIONS, a, b);
+  return 0;
+}
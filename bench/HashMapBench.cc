@@ -0,0 +1,229 @@
+// HashMapBench - compares HashMap against the linear probing map it replaced.
+//
+//  usage: hashmap_bench [entries]
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include "VM/Module.h"
+#include "VM/VM.h"
+#include "VM/Value.h"
+#include "Data/HashMap.h"
+
+using namespace loxy;
+
+namespace {
+
+// LinearProbeMap - the previous HashMap: one array of {key, value} entries,
+//  linear probing, tombstones encoded through the value.
+class LinearProbeMap {
+  struct Entry {
+    String *key;
+    Value value;
+
+    Entry() : key(nullptr), value(Value::Nil) {}
+  };
+
+  VM &vm;
+  int count_;
+  int tombstones_;
+  int capacityMask_;
+  Entry *entries_;
+
+  static bool isEmpty(Entry *entry) { return entry->key == nullptr && entry->value == Value::Nil; }
+  static bool isTombstone(Entry *entry) { return entry->key == nullptr && entry->value == Value::True; }
+
+  Entry *_find(String *key) const {
+    Hash index = key->hash() & capacityMask_;
+    Entry *tombstone = nullptr;
+
+    while (true) {
+      Entry *entry = &entries_[index];
+      if (isEmpty(entry)) return tombstone != nullptr ? tombstone : entry;
+      if (isTombstone(entry)) {
+        if (tombstone == nullptr) tombstone = entry;
+      } else if (entry->key == key) {
+        return entry;
+      }
+      index = (index + 1) & capacityMask_;
+    }
+  }
+
+  void ensureCapacity(int leastCap) {
+    if (leastCap <= (capacityMask_ + 1) * TABLE_MAX_LOAD) return;
+
+    int capacity = tombstones_ >= count_ ? 8 : (capacityMask_ + 1) * 2;
+    while (count_ + 1 > capacity * TABLE_MAX_LOAD) capacity *= 2;
+
+    Entry *entries = (Entry*)vm.reallocate(nullptr, 0, capacity * sizeof(Entry));
+    for (int i = 0; i < capacity; i++) entries[i] = Entry();
+
+    Entry *oldEntries = entries_;
+    int oldCapacity = capacityMask_ + 1;
+    entries_ = entries;
+    capacityMask_ = capacity - 1;
+    count_ = 0;
+    tombstones_ = 0;
+
+    for (int i = 0; i < oldCapacity; i++) {
+      Entry *entry = &oldEntries[i];
+      if (entry->key == nullptr) continue;
+
+      Entry *dest = _find(entry->key);
+      dest->key = entry->key;
+      dest->value = entry->value;
+      count_++;
+    }
+    vm.reallocate(oldEntries, oldCapacity * sizeof(Entry), 0);
+  }
+
+public:
+  explicit LinearProbeMap(VM &vm)
+    : vm(vm), count_(0), tombstones_(0), capacityMask_(-1), entries_(nullptr) {}
+
+  ~LinearProbeMap() {
+    vm.reallocate(entries_, (capacityMask_ + 1) * sizeof(Entry), 0);
+  }
+
+  bool del(String *key) {
+    if (count_ == 0) return false;
+
+    Entry *entry = _find(key);
+    if (entry->key == nullptr) return false;
+
+    entry->key = nullptr;
+    entry->value = Value::True;
+    count_--;
+    tombstones_++;
+    return true;
+  }
+
+  bool get(String *key, Value *value) const {
+    if (entries_ == nullptr) return false;
+
+    Entry *entry = _find(key);
+    if (entry->key == nullptr) return false;
+
+    *value = entry->value;
+    return true;
+  }
+
+  bool set(String *key, Value value) {
+    ensureCapacity(count_ + tombstones_ + 1);
+
+    Entry *entry = _find(key);
+    bool isNewKey = entry->key == nullptr;
+    if (isNewKey) {
+      count_++;
+      if (isTombstone(entry)) tombstones_--;
+    }
+
+    entry->key = key;
+    entry->value = value;
+    return isNewKey;
+  }
+};
+
+typedef std::chrono::steady_clock Clock;
+
+double elapsedNs(Clock::time_point start, long ops) {
+  auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+  return (double)ns / ops;
+}
+
+template<typename Map>
+void run(const char *name, Map &map, const std::vector<String*> &keys,
+         const std::vector<String*> &misses, const std::vector<int> &order) {
+  long n = keys.size();
+  Value value;
+  long found = 0;
+
+  auto start = Clock::now();
+  for (long i = 0; i < n; i++) map.set(keys[i], Value((double)i));
+  double insert = elapsedNs(start, n);
+
+  start = Clock::now();
+  for (int round = 0; round < 4; round++) {
+    for (long i = 0; i < n; i++) found += map.get(keys[order[i]], &value);
+  }
+  double hit = elapsedNs(start, n * 4);
+
+  start = Clock::now();
+  for (int round = 0; round < 4; round++) {
+    for (long i = 0; i < n; i++) found += map.get(misses[order[i]], &value);
+  }
+  double miss = elapsedNs(start, n * 4);
+
+  // delete every other key, then put them back.
+  start = Clock::now();
+  for (long i = 0; i < n; i += 2) map.del(keys[order[i]]);
+  for (long i = 0; i < n; i += 2) map.set(keys[order[i]], Value::True);
+  double churn = elapsedNs(start, n);
+
+  printf("%-16s insert %7.1f ns  hit %7.1f ns  miss %7.1f ns  del+set %7.1f ns  (%ld)\n",
+    name, insert, hit, miss, churn, found);
+}
+
+// times every single insertion into an empty map, resizes included.
+void latency(const char *name, VM &vm, bool incremental, const std::vector<String*> &keys) {
+  HashMap *map = HashMap::create(vm);
+  map->setIncremental(incremental);
+
+  std::vector<long> samples;
+  samples.reserve(keys.size());
+  for (size_t i = 0; i < keys.size(); i++) {
+    auto start = Clock::now();
+    map->set(keys[i], Value::True);
+    samples.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count());
+  }
+
+  std::sort(samples.begin(), samples.end());
+  size_t n = samples.size();
+  printf("%-16s insert p50 %6ld ns  p99.9 %8ld ns  max %10ld ns\n",
+    name, samples[n / 2], samples[n - 1 - n / 1000], samples[n - 1]);
+
+  HashMap::destroy(vm, &map);
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  long n = argc > 1 ? atol(argv[1]) : 1 << 20;
+
+  VM vm;
+  std::vector<String*> keys, misses;
+  std::vector<int> order;
+  char buffer[32];
+
+  // every key is interned & kept alive as a global of [roots].
+  Module *roots = Module::create(vm, nullptr, nullptr, nullptr);
+  vm.addModule(roots);
+  for (long i = 0; i < 2 * n; i++) {
+    snprintf(buffer, sizeof(buffer), "key_%ld", i);
+    String *key = String::create(vm, buffer);
+    vm.pushRoot(key);
+    roots->addVariable(key, Value::True);
+    vm.popRoot();
+    (i < n ? keys : misses).push_back(key);
+  }
+
+  for (long i = 0; i < n; i++) order.push_back(i);
+  srand(42);
+  for (long i = n - 1; i > 0; i--) std::swap(order[i], order[rand() % (i + 1)]);
+
+  printf("%ld entries\n", n);
+  {
+    LinearProbeMap map(vm);
+    run("linear probing", map, keys, misses, order);
+  }
+  {
+    HashMap *map = HashMap::create(vm);
+    run("swiss table", *map, keys, misses, order);
+    HashMap::destroy(vm, &map);
+  }
+
+  latency("stop-the-world", vm, false, keys);
+  latency("incremental", vm, true, keys);
+  return 0;
+}
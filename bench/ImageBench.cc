@@ -0,0 +1,137 @@
+// ImageBench - how soon a VM with a prelude reaches the first line of a
+//  script: compiling & running the prelude in every VM, against loading
+//  the image of a VM that ran it once.
+//
+//  usage: image_bench [modules]
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "VM/VM.h"
+#include "VM/Module.h"
+
+using namespace loxy;
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+// VMs started each way.
+const int STARTS = 50;
+
+// functions of each prelude module, a chunk holds 256 constants at most.
+const long FUNCTIONS = 40;
+
+// prelude - module [m] of the prelude: FUNCTIONS functions, a class for
+//  every 10 of them & a map of them all, about what a module of a
+//  standard library defines.
+std::string prelude(long m) {
+  std::string source;
+  std::string table = "m" + std::to_string(m);
+  for (long i = m * FUNCTIONS; i < (m + 1) * FUNCTIONS; i++) {
+    std::string n = std::to_string(i);
+    source += "fun f" + n + "(a, b) {"
+              "  var s = 0;"
+              "  for (var i = a; i < b; i = i + 1) s = s + i * " + n + ";"
+              "  if (s > 100) return \"big " + n + "\";"
+              "  return s;"
+              "}\n";
+    if (i % 10 == 9) {
+      source += "class C" + n + " {"
+                "  init(x) { this.x = x; this.name = \"c" + n + "\"; }"
+                "  get() { return this.x; }"
+                "  add(y) { return C" + n + "(this.x + y); }"
+                "}\n";
+    }
+  }
+  source += "var " + table + " = {};\n";
+  for (long i = m * FUNCTIONS; i < (m + 1) * FUNCTIONS; i++) {
+    source += table + "[\"f" + std::to_string(i) + "\"] = f" + std::to_string(i) + ";\n";
+  }
+  return source;
+}
+
+// the script, its first line needs the prelude.
+const char *script = "var first = m0[\"f1\"](0, 3);";
+
+double ms(Clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+// runPrelude - compiles & runs the [sources] of the prelude on [vm], its
+//  globals going into [module] unless it's nullptr.
+void runPrelude(VM &vm, const std::vector<std::string> &sources, Module *module) {
+  for (const std::string &source : sources) {
+    Module *prelude = vm.compile(source.c_str(), "prelude");
+    if (prelude == nullptr || vm.run(prelude) != InterpretResult::Ok) exit(1);
+    if (module != nullptr) module->importVariables(prelude);
+  }
+}
+
+// compiled - starts a VM running the prelude before the script, returns
+//  the ms until the script ran. The script sees the prelude through its
+//  globals, as it does with an image.
+double compiled(const std::vector<std::string> &sources) {
+  auto start = Clock::now();
+  VM vm;
+  vm.setJit(false);
+
+  Module *module = vm.compile(script, "script");
+  if (module == nullptr) exit(1);
+  runPrelude(vm, sources, module);
+  if (vm.run(module) != InterpretResult::Ok) exit(1);
+  return ms(start);
+}
+
+// loaded - starts a VM from the image at [path], like [compiled].
+double loaded(const char *path) {
+  auto start = Clock::now();
+  VM vm;
+  vm.setJit(false);
+
+  Module *module = vm.compile(script, "script");
+  if (module == nullptr || !vm.loadImage(path, module)) exit(1);
+  if (vm.run(module) != InterpretResult::Ok) exit(1);
+  return ms(start);
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  long modules = argc > 1 ? atol(argv[1]) : 25;
+  std::vector<std::string> sources;
+  size_t size = 0;
+  for (long m = 0; m < modules; m++) {
+    sources.push_back(prelude(m));
+    size += sources.back().size();
+  }
+  std::string path = "/tmp/image_bench." + std::to_string(getpid()) + ".img";
+
+  // the prelude runs once to save its image.
+  {
+    VM vm;
+    vm.setJit(false);
+    runPrelude(vm, sources, nullptr);
+    if (!vm.saveImage(path.c_str())) exit(1);
+  }
+  struct stat status;
+  stat(path.c_str(), &status);
+
+  double compiling = 0;
+  double loading = 0;
+  for (int i = 0; i < STARTS; i++) {
+    compiling += compiled(sources);
+    loading += loaded(path.c_str());
+  }
+  unlink(path.c_str());
+
+  setvbuf(stdout, nullptr, _IONBF, 0);
+  printf("%ld modules of %ld functions, %zu bytes of source, %lld bytes of image\n",
+    modules, FUNCTIONS, size, (long long)status.st_size);
+  printf("%-9s %8.3f ms to the first line\n", "compiled", compiling / STARTS);
+  printf("%-9s %8.3f ms to the first line\n", "loaded", loading / STARTS);
+  return 0;
+}
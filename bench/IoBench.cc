@@ -0,0 +1,113 @@
+// IoBench - the cost of fibers blocking on I/O & woken by the event loop:
+//  pairs of fibers echoing messages over socketpairs & pipes, many pairs
+//  driven at once by one VM.
+//
+//  usage: io_bench [n]
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include "VM/VM.h"
+#include "VM/Module.h"
+
+using namespace loxy;
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+struct Script {
+  const char *name;
+  const char *source;
+};
+
+// P is replaced with the pairs of fibers, R with the round trips each pair
+// makes, n round trips in all. Every round trip blocks both fibers once.
+const Script scripts[] = {
+  { "socketpair",
+    "var trips = 0;"
+    "fun pair(fds) {"
+    "  fun echo() {"
+    "    var s = read(fds[1]);"
+    "    while (s != nil) { write(fds[1], s); s = read(fds[1]); }"
+    "    close(fds[1]);"
+    "  }"
+    "  fun ping() {"
+    "    for (var i = 0; i < R; i = i + 1) { write(fds[0], \"ping\"); read(fds[0]); }"
+    "    trips = trips + R; close(fds[0]);"
+    "  }"
+    "  spawn(echo); spawn(ping);"
+    "}"
+    "for (var i = 0; i < P; i = i + 1) pair(socketpair());" },
+  { "pipes",
+    "var trips = 0;"
+    "fun pair(there, back) {"
+    "  fun echo() {"
+    "    var s = read(there[0]);"
+    "    while (s != nil) { write(back[1], s); s = read(there[0]); }"
+    "    close(back[1]);"
+    "  }"
+    "  fun ping() {"
+    "    for (var i = 0; i < R; i = i + 1) { write(there[1], \"ping\"); read(back[0]); }"
+    "    trips = trips + R; close(there[1]);"
+    "  }"
+    "  spawn(echo); spawn(ping);"
+    "}"
+    "for (var i = 0; i < P; i = i + 1) pair(pipe(), pipe());" },
+};
+
+// pairs run at once.
+const long PAIRS[] = { 1, 100 };
+
+void replace(std::string &source, char name, long value) {
+  for (size_t at = source.find(name); at != std::string::npos; at = source.find(name, at)) {
+    source.replace(at, 1, std::to_string(value));
+  }
+}
+
+// run - runs [source] to completion, the loop included. returns the ms it
+//  took & the round trips it made into [trips].
+double run(const std::string &source, long *trips) {
+  VM vm;
+
+  auto start = Clock::now();
+  Module *module = vm.compile(source.c_str(), "bench");
+  InterpretResult result = InterpretResult::Compile_Error;
+  if (module != nullptr) {
+    vm.addIo(module);
+    result = vm.run(module);
+  }
+  double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+  vm.output().flush();
+  Value value;
+  if (result != InterpretResult::Ok ||
+      !module->getVariable(String::create(vm, "trips"), &value)) {
+    fprintf(stderr, "failed to run:\n%s\n", source.c_str());
+    exit(1);
+  }
+  *trips = (long)(double)value;
+  return ms;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  long n = argc > 1 ? atol(argv[1]) : 200000;
+  setvbuf(stdout, nullptr, _IONBF, 0);
+
+  printf("n = %ld\n", n);
+  for (const Script &script : scripts) {
+    for (long pairs : PAIRS) {
+      std::string source = script.source;
+      replace(source, 'P', pairs);
+      replace(source, 'R', n / pairs > 0 ? n / pairs : 1);
+
+      long trips;
+      double ms = run(source, &trips);
+      printf("%-10s %4ld pairs %8.1f ms   %6.2f us a round trip\n",
+        script.name, pairs, ms, ms * 1e3 / trips);
+    }
+  }
+  return 0;
+}
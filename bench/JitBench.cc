@@ -0,0 +1,82 @@
+// JitBench - hot loops run by the interpreter & by the baseline JIT.
+//
+//  usage: jit_bench [iterations]
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include "VM/VM.h"
+
+using namespace loxy;
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+struct Script {
+  const char *name;
+  const char *source;
+};
+
+// each loops N times, N is replaced with the iterations.
+const Script scripts[] = {
+  { "int locals",
+    "{ var i = 0; var s = 0;"
+    "  while (i < N) { s = s + i * 2; i = i + 1; }"
+    "  print s; }" },
+  { "double locals",
+    "{ var i = 0; var x = 0.5;"
+    "  while (i < N) { x = x * 0.999 + 1.5; i = i + 1; }"
+    "  print x; }" },
+  { "mixed locals",
+    "{ var i = 0; var x = 0.5;"
+    "  while (i < N) { x = x + i; i = i + 1; }"
+    "  print x; }" },
+  { "globals",
+    "var i = 0; var s = 0;"
+    "while (i < N) { s = s + i; i = i + 1; }"
+    "print s;" },
+  { "nested loops",
+    "{ var n = 0;"
+    "  for (var i = 0; i < N / 1000; i = i + 1) {"
+    "    for (var j = 0; j < 1000; j = j + 1) { if (j > i) n = n + 1; }"
+    "  }"
+    "  print n; }" },
+};
+
+double run(const std::string &source, bool jit) {
+  VM vm;
+  vm.setJit(jit);
+
+  auto start = Clock::now();
+  InterpretResult result = vm.interpret(source.c_str(), "bench");
+  double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+  vm.output().flush();
+  if (result != InterpretResult::Ok) {
+    fprintf(stderr, "failed to run:\n%s\n", source.c_str());
+    exit(1);
+  }
+  return ms;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  long n = argc > 1 ? atol(argv[1]) : 10000000;
+  setvbuf(stdout, nullptr, _IONBF, 0);
+
+  printf("%ld iterations\n", n);
+  for (const Script &script : scripts) {
+    std::string source = script.source;
+    for (size_t at = source.find('N'); at != std::string::npos; at = source.find('N', at)) {
+      source.replace(at, 1, std::to_string(n));
+    }
+
+    double interpreted = run(source, false);
+    double jitted = run(source, true);
+    printf("%-16s interpreter %8.1f ms   jit %8.1f ms   %5.2fx\n",
+      script.name, interpreted, jitted, interpreted / jitted);
+  }
+  return 0;
+}
@@ -0,0 +1,93 @@
+// NativeBench - the cost of calling host functions, boxed & with typed
+//  number signatures, against a script function doing the same work.
+//
+//  usage: native_bench [n]
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include "VM/VM.h"
+#include "VM/Module.h"
+
+using namespace loxy;
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+struct Script {
+  const char *name;
+  const char *source;
+};
+
+double add(double a, double b) { return a + b; }
+
+bool addValues(VM &vm, Value *args, int) {
+  if (!args[0].isNumber() || !args[1].isNumber()) {
+    vm.nativeError("add takes numbers");
+    return false;
+  }
+  args[-1] = Value((double)args[0] + (double)args[1]);
+  return true;
+}
+
+// N is replaced with n, each loop makes N calls. "boxed" & "typed" are
+// natives, see [run].
+const Script scripts[] = {
+  { "script",
+    "fun add(a, b) { return a + b; }"
+    "{ var s = 0;"
+    "  for (var i = 0; i < N; i = i + 1) s = add(s, i);"
+    "  print s; }" },
+  { "native boxed",
+    "{ var s = 0;"
+    "  for (var i = 0; i < N; i = i + 1) s = boxed(s, i);"
+    "  print s; }" },
+  { "native typed",
+    "{ var s = 0;"
+    "  for (var i = 0; i < N; i = i + 1) s = typed(s, i);"
+    "  print s; }" },
+};
+
+double run(const std::string &source, bool jit) {
+  VM vm;
+  vm.setJit(jit);
+
+  auto start = Clock::now();
+  Module *module = vm.compile(source.c_str(), "bench");
+  InterpretResult result = InterpretResult::Compile_Error;
+  if (module != nullptr) {
+    module->addNative("boxed", 2, addValues);
+    module->addNative("typed", add);
+    result = vm.run(module);
+  }
+  double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+  vm.output().flush();
+  if (result != InterpretResult::Ok) {
+    fprintf(stderr, "failed to run:\n%s\n", source.c_str());
+    exit(1);
+  }
+  return ms;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  long n = argc > 1 ? atol(argv[1]) : 10000000;
+  setvbuf(stdout, nullptr, _IONBF, 0);
+
+  printf("n = %ld\n", n);
+  for (const Script &script : scripts) {
+    std::string source = script.source;
+    for (size_t at = source.find('N'); at != std::string::npos; at = source.find('N', at)) {
+      source.replace(at, 1, std::to_string(n));
+    }
+
+    double interpreted = run(source, false);
+    double jitted = run(source, true);
+    printf("%-14s interpreter %8.1f ms   jit %8.1f ms\n",
+      script.name, interpreted, jitted);
+  }
+  return 0;
+}
@@ -0,0 +1,79 @@
+// NumberBench - parsing the number literals of a literal-heavy source.
+//
+//  usage: number_bench [literals]
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+#include "Compiler/Scanner.h"
+#include "VM/Number.h"
+
+using namespace loxy;
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+// a generated data script: one map literal per line, mixing integers,
+// short decimals, long decimals & exponents.
+std::string generate(long n) {
+  std::mt19937_64 rng(42);
+  std::string source;
+  char buffer[64];
+
+  for (long i = 0; i < n; i += 4) {
+    snprintf(buffer, sizeof(buffer), "{\"id\": %lu, ", (unsigned long)(rng() % 1000000));
+    source += buffer;
+    snprintf(buffer, sizeof(buffer), "\"price\": %.2f, ", (double)(rng() % 100000) / 100);
+    source += buffer;
+    snprintf(buffer, sizeof(buffer), "\"x\": %.17g, ", (double)rng() / (double)UINT64_MAX);
+    source += buffer;
+    snprintf(buffer, sizeof(buffer), "\"y\": %.6e};\n", (double)rng() / 1e10);
+    source += buffer;
+  }
+  return source;
+}
+
+template<typename Parse>
+void run(const char *name, const std::vector<Token> &numbers, Parse parse) {
+  double sum = 0;
+
+  auto start = Clock::now();
+  for (int round = 0; round < 5; round++) {
+    for (const Token &token : numbers) sum += parse(token);
+  }
+  double ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+  printf("%-16s %6.1f ns/literal  (%g)\n", name, ns / (5 * numbers.size()), sum);
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  long n = argc > 1 ? atol(argv[1]) : 1 << 20;
+  std::string source = generate(n);
+
+  std::vector<Token> numbers;
+  Scanner scanner(source.c_str());
+  for (Token token = scanner.scanToken(); token.type != Tok::_EOF; token = scanner.scanToken()) {
+    if (token.type == Tok::NUMBER) numbers.push_back(token);
+  }
+
+  printf("%zu literals, %zu bytes\n", numbers.size(), source.size());
+  run("strtod", numbers, [](const Token &token) {
+    return strtod(token.start, nullptr);
+  });
+  run("parseNumber", numbers, [](const Token &token) {
+    return parseNumber(token.start, token.length);
+  });
+
+  // both must agree on every literal.
+  for (const Token &token : numbers) {
+    if (strtod(token.start, nullptr) != parseNumber(token.start, token.length)) {
+      printf("mismatch on %.*s\n", token.length, token.start);
+      return 1;
+    }
+  }
+  return 0;
+}
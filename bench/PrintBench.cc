@@ -0,0 +1,86 @@
+// PrintBench - number formatting & buffered output of print.
+//
+//  usage: print_bench [numbers]
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <random>
+#include <sstream>
+#include <unistd.h>
+#include <vector>
+#include "VM/Number.h"
+#include "VM/Output.h"
+
+using namespace loxy;
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+double elapsedNs(Clock::time_point start, long n) {
+  return std::chrono::duration<double, std::nano>(Clock::now() - start).count() / n;
+}
+
+template<typename Format>
+void format(const char *name, const std::vector<double> &numbers, Format fn) {
+  char buffer[64];
+  long chars = 0;
+
+  auto start = Clock::now();
+  for (double number : numbers) chars += fn(number, buffer);
+  printf("%-24s %7.1f ns/number  (%ld chars)\n", name, elapsedNs(start, numbers.size()), chars);
+}
+
+void output(const char *name, FlushPolicy policy, const std::vector<double> &numbers) {
+  int fd = open("/dev/null", O_WRONLY);
+  size_t syscalls;
+
+  auto start = Clock::now();
+  {
+    Output out(fd, policy);
+    for (double number : numbers) {
+      out.writeNumber(number);
+      out.newline();
+    }
+    out.flush();
+    syscalls = out.syscalls();
+  }
+  printf("%-24s %7.1f ns/line  %8zu write calls\n", name, elapsedNs(start, numbers.size()), syscalls);
+  close(fd);
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  long n = argc > 1 ? atol(argv[1]) : 1 << 20;
+
+  // half integers, half arbitrary doubles of varying magnitude.
+  std::mt19937_64 rng(42);
+  std::uniform_real_distribution<double> mantissa(1.0, 10.0);
+  std::uniform_int_distribution<int> exponent(-20, 20);
+  std::vector<double> numbers;
+  for (long i = 0; i < n; i++) {
+    if (i & 1) numbers.push_back(mantissa(rng) * pow(10, exponent(rng)));
+    else numbers.push_back((double)(rng() % 1000000));
+  }
+
+  printf("%ld numbers\n", n);
+  format("stringstream", numbers, [](double number, char *) {
+    std::stringstream ss;
+    ss << number;
+    return (int)ss.str().size();
+  });
+  format("snprintf %.17g", numbers, [](double number, char *buffer) {
+    return snprintf(buffer, 64, "%.17g", number);
+  });
+  format("formatNumber", numbers, [](double number, char *buffer) {
+    return formatNumber(number, buffer);
+  });
+
+  output("line flushed", FlushPolicy::Line, numbers);
+  output("size flushed", FlushPolicy::Size, numbers);
+  output("explicitly flushed", FlushPolicy::Explicit, numbers);
+  return 0;
+}
@@ -0,0 +1,98 @@
+// PropertyBench - the cost of field & method accesses through the inline
+//  caches, at sites seeing one, a few & too many shapes.
+//
+//  usage: property_bench [n]
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include "VM/VM.h"
+
+using namespace loxy;
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+struct Script {
+  const char *name;
+  const char *source;
+};
+
+// N is replaced with n, each loop makes N accesses or calls.
+const Script scripts[] = {
+  { "field get",
+    "class P { init() { this.x = 1; } }"
+    "{ var p = P(); var s = 0;"
+    "  for (var i = 0; i < N; i = i + 1) s = s + p.x;"
+    "  print s; }" },
+  { "field set",
+    "class P { init() { this.x = 0; } }"
+    "{ var p = P();"
+    "  for (var i = 0; i < N; i = i + 1) p.x = i;"
+    "  print p.x; }" },
+  { "method invoke",
+    "class P { init() { this.x = 0; } inc() { this.x = this.x + 1; } }"
+    "{ var p = P();"
+    "  for (var i = 0; i < N; i = i + 1) p.inc();"
+    "  print p.x; }" },
+  { "polymorphic",
+    "class A { init() { this.x = 1; } }"
+    "class B { init() { this.y = 0; this.x = 2; } }"
+    "class C { init() { this.z = 0; this.y = 0; this.x = 3; } }"
+    "{ var o0 = A(); var o1 = B(); var o2 = C(); var s = 0;"
+    "  for (var i = 0; i < N; i = i + 3) s = s + o0.x + o1.x + o2.x;"
+    "  print s; }" },
+  { "megamorphic",
+    "class A { v() { return 1; } }  class B { v() { return 2; } }"
+    "class C { v() { return 3; } }  class D { v() { return 4; } }"
+    "class E { v() { return 5; } }  class F { v() { return 6; } }"
+    "{ var all = { 0: A(), 1: B(), 2: C(), 3: D(), 4: E(), 5: F() };"
+    "  var s = 0; var k = 0;"
+    "  for (var i = 0; i < N; i = i + 1) {"
+    "    s = s + all[k].v(); k = k + 1; if (k == 6) k = 0;"
+    "  }"
+    "  print s; }" },
+};
+
+double run(const std::string &source, bool jit, double *hitRate) {
+  VM vm;
+  vm.setJit(jit);
+
+  auto start = Clock::now();
+  InterpretResult result = vm.interpret(source.c_str(), "bench");
+  double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+  vm.output().flush();
+  if (result != InterpretResult::Ok) {
+    fprintf(stderr, "failed to run:\n%s\n", source.c_str());
+    exit(1);
+  }
+
+  const PropertyCacheStats &stats = vm.propertyCacheStats();
+  size_t accesses = stats.hits + stats.misses;
+  *hitRate = accesses > 0 ? 100.0 * stats.hits / accesses : 0;
+  return ms;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  long n = argc > 1 ? atol(argv[1]) : 10000000;
+  setvbuf(stdout, nullptr, _IONBF, 0);
+
+  printf("n = %ld\n", n);
+  for (const Script &script : scripts) {
+    std::string source = script.source;
+    for (size_t at = source.find('N'); at != std::string::npos; at = source.find('N', at)) {
+      source.replace(at, 1, std::to_string(n));
+    }
+
+    double hitRate;
+    double interpreted = run(source, false, &hitRate);
+    double jitted = run(source, true, &hitRate);
+    printf("%-14s interpreter %8.1f ms   jit %8.1f ms   %5.1f%% hits\n",
+      script.name, interpreted, jitted, hitRate);
+  }
+  return 0;
+}
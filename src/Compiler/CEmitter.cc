@@ -0,0 +1,220 @@
+#include <string.h>
+#include <vector>
+#include "CEmitter.h"
+#include "VM/Chunk.h"
+#include "VM/OpCode.h"
+#include "VM/Value.h"
+
+namespace loxy {
+
+// writes [chars] as a C string literal. Octal escapes are always 3 digits,
+// so they don't run into the next char.
+static void emitString(FILE *out, const char *chars, int length) {
+  fputc('"', out);
+  for (int i = 0; i < length; i++) {
+    unsigned char c = (unsigned char)chars[i];
+    if (c == '"' || c == '\\' || c == '?') {
+      fprintf(out, "\\%c", c);
+    } else if (c < ' ' || c >= 127) {
+      fprintf(out, "\\%03o", c);
+    } else {
+      fputc(c, out);
+    }
+  }
+  fputc('"', out);
+}
+
+static void emitConstant(FILE *out, Value value) {
+  if (value.isInt()) {
+    fprintf(out, "  { LOXY_INT, 0x%016llxull, 0, 0 },\n", (unsigned long long)value.asInt());
+  } else if (value.isNumber()) {
+    double number = (double)value;
+    uint64_t bits;
+    memcpy(&bits, &number, sizeof(bits));
+    fprintf(out, "  { LOXY_NUMBER, 0x%016llxull, 0, 0 },\n", (unsigned long long)bits);
+  } else {
+    assert(value.isString() && "Constants are numbers or strings");
+    String *string = (String*)value;
+    fprintf(out, "  { LOXY_STRING, 0, ");
+    emitString(out, string->cString(), string->length());
+    fprintf(out, ", %d },\n", string->length());
+  }
+}
+
+// the target of the jump at [ip].
+static int jumpTarget(const uint8_t *code, int ip) {
+  int offset = code[ip + 1] << 8 | code[ip + 2];
+  return (OpCode)code[ip] == OpCode::LOOP ? ip + 3 - offset : ip + 3 + offset;
+}
+
+// the targets of a FOR_LOOP at [ip], its body & past the loop.
+static int forBody(const uint8_t *code, int ip) { return ip + 9 - (code[ip + 5] << 8 | code[ip + 6]); }
+static int forDone(const uint8_t *code, int ip) { return ip + 9 + (code[ip + 7] << 8 | code[ip + 8]); }
+
+// the runtime function of a binary op, quickened, unchecked or not.
+static const char *binaryFunction(OpCode op) {
+  switch (op) {
+  case OpCode::EQUAL: case OpCode::EQUAL_INT: case OpCode::EQUAL_NUMBER:
+    return "loxy_equal";
+  case OpCode::GREATER: case OpCode::GREATER_INT: case OpCode::GREATER_NUMBER:
+  case OpCode::GREATER_NUM:
+    return "loxy_greater";
+  case OpCode::LESS: case OpCode::LESS_INT: case OpCode::LESS_NUMBER:
+  case OpCode::LESS_NUM:
+    return "loxy_less";
+  case OpCode::ADD: case OpCode::ADD_INT: case OpCode::ADD_NUMBER:
+  case OpCode::ADD_NUM:
+    return "loxy_add";
+  case OpCode::SUBTRACT: case OpCode::SUBTRACT_INT: case OpCode::SUBTRACT_NUMBER:
+  case OpCode::SUBTRACT_NUM:
+    return "loxy_subtract";
+  case OpCode::MULTIPLY: case OpCode::MULTIPLY_INT: case OpCode::MULTIPLY_NUMBER:
+  case OpCode::MULTIPLY_NUM:
+    return "loxy_multiply";
+  case OpCode::DIVIDE: case OpCode::DIVIDE_NUM:
+    return "loxy_divide";
+  default:
+    return nullptr;
+  }
+}
+
+static void emitInstruction(FILE *out, const Chunk *chunk, int ip) {
+  const uint8_t *code = chunk->code().data();
+  OpCode op = (OpCode)code[ip];
+  int arg = ip + 1 < (int)chunk->size() ? code[ip + 1] : 0;
+  int line = chunk->lines()[ip];
+
+  if (const char *function = binaryFunction(op)) {
+    fprintf(out, "  if (!%s(f, %d)) return false;\n", function, line);
+    return;
+  }
+
+  switch (op) {
+  case OpCode::CONSTANT:      fprintf(out, "  *f->top++ = f->constants[%d];\n", arg); break;
+  case OpCode::NIL:           fprintf(out, "  loxy_push_nil(f);\n"); break;
+  case OpCode::TRUE:          fprintf(out, "  loxy_push_bool(f, true);\n"); break;
+  case OpCode::FALSE:         fprintf(out, "  loxy_push_bool(f, false);\n"); break;
+  case OpCode::POP:           fprintf(out, "  f->top--;\n"); break;
+  case OpCode::GET_LOCAL:     fprintf(out, "  *f->top++ = f->stack[%d];\n", arg); break;
+  case OpCode::SET_LOCAL:     fprintf(out, "  f->stack[%d] = f->top[-1];\n", arg); break;
+  case OpCode::DEFINE_GLOBAL: fprintf(out, "  loxy_define_global(f, %d);\n", arg); break;
+  case OpCode::NOT:           fprintf(out, "  loxy_not(f);\n"); break;
+  case OpCode::PRINT:         fprintf(out, "  loxy_print(f);\n"); break;
+  case OpCode::MAP:           fprintf(out, "  loxy_map(f);\n"); break;
+  case OpCode::RETURN:        fprintf(out, "  f->top--;\n  return true;\n"); break;
+
+  case OpCode::GET_GLOBAL:
+    fprintf(out, "  if (!loxy_get_global(f, %d, %d)) return false;\n", arg, line);
+    break;
+  case OpCode::SET_GLOBAL:
+    fprintf(out, "  if (!loxy_set_global(f, %d, %d)) return false;\n", arg, line);
+    break;
+  case OpCode::NEGATE:
+  case OpCode::NEGATE_NUM:
+    fprintf(out, "  if (!loxy_negate(f, %d)) return false;\n", line);
+    break;
+  case OpCode::MAP_INSERT:
+    fprintf(out, "  if (!loxy_map_insert(f, %d)) return false;\n", line);
+    break;
+  case OpCode::GET_INDEX:
+    fprintf(out, "  if (!loxy_get_index(f, %d)) return false;\n", line);
+    break;
+  case OpCode::SET_INDEX:
+    fprintf(out, "  if (!loxy_set_index(f, %d)) return false;\n", line);
+    break;
+
+  // a tail call returns through the RETURN after it.
+  case OpCode::CALL:
+  case OpCode::TAIL_CALL:
+    fprintf(out, "  if (!loxy_call(f, %d, %d)) return false;\n", arg, line);
+    break;
+
+  case OpCode::JUMP:
+  case OpCode::LOOP:
+    fprintf(out, "  goto L%d;\n", jumpTarget(code, ip));
+    break;
+  case OpCode::JUMP_IF_FALSE:
+    fprintf(out, "  if (loxy_falsey(f->top - 1)) goto L%d;\n", jumpTarget(code, ip));
+    break;
+
+  case OpCode::FOR_LOOP: {
+    uint8_t flags = code[ip + 2];
+    fprintf(out, "  switch (loxy_for_loop(&f->stack[%d], &f->%s[%d], &f->%s[%d], %d)) {\n",
+      arg, flags & FOR_LIMIT_LOCAL ? "stack" : "constants", code[ip + 3],
+      flags & FOR_STEP_LOCAL ? "stack" : "constants", code[ip + 4], flags);
+    fprintf(out, "  case 1: goto L%d;\n  case 0: goto L%d;\n  }\n",
+      forBody(code, ip), forDone(code, ip));
+    break;
+  }
+
+  default:
+    UNREACHABLE();
+  }
+}
+
+bool EmitC(const Chunk *chunk, const char *name, FILE *out) {
+  const uint8_t *code = chunk->code().data();
+  int size = (int)chunk->size();
+
+  // functions are constants, calls are left to the VM.
+  for (int i = 0; i < chunk->constants().count(); i++) {
+    Value constant = chunk->constants()[i];
+    if (!constant.isNumber() && !constant.isString()) {
+      fprintf(stderr, "%s: functions & classes can't be translated to C yet.\n", name);
+      return false;
+    }
+  }
+
+  // only jump targets get labels, C warns about unused ones.
+  std::vector<bool> targets(size + 1, false);
+  for (int ip = 0; ip < size; ip += instructionSize((OpCode)code[ip])) {
+    OpCode op = (OpCode)code[ip];
+    if (op == OpCode::CLOSURE || op == OpCode::CLASS || op == OpCode::GET_PROPERTY ||
+        op == OpCode::SET_PROPERTY || op == OpCode::INVOKE) {
+      fprintf(stderr, "%s: functions & classes can't be translated to C yet.\n", name);
+      return false;
+    }
+    if (op == OpCode::ARRAY) {
+      fprintf(stderr, "%s: arrays can't be translated to C yet.\n", name);
+      return false;
+    }
+    if (op == OpCode::YIELD) {
+      fprintf(stderr, "%s: fibers can't be translated to C yet.\n", name);
+      return false;
+    }
+
+    if (op == OpCode::JUMP || op == OpCode::JUMP_IF_FALSE || op == OpCode::LOOP) {
+      targets[jumpTarget(code, ip)] = true;
+    } else if (op == OpCode::FOR_LOOP) {
+      targets[forBody(code, ip)] = true;
+      targets[forDone(code, ip)] = true;
+    }
+  }
+
+  fprintf(out, "/* translated by loxy --emit-c, see Runtime.h. */\n");
+  fprintf(out, "#include \"Runtime.h\"\n\n");
+
+  // an empty array isn't C.
+  int constants = chunk->constants().count();
+  fprintf(out, "static const LoxyConstant constants[%d] = {\n", constants > 0 ? constants : 1);
+  for (int i = 0; i < constants; i++) emitConstant(out, chunk->constants()[i]);
+  if (constants == 0) fprintf(out, "  { 0, 0, 0, 0 },\n");
+  fprintf(out, "};\n\n");
+
+  fprintf(out, "static bool body(LoxyFrame *f) {\n");
+  for (int ip = 0; ip < size; ip += instructionSize((OpCode)code[ip])) {
+    if (targets[ip]) fprintf(out, "L%d:\n", ip);
+    emitInstruction(out, chunk, ip);
+  }
+  // chunks end with RETURN, the label of a jump past the end needs a
+  // statement.
+  if (targets[size]) fprintf(out, "L%d:\n  return true;\n", size);
+  fprintf(out, "}\n\n");
+
+  fprintf(out, "LOXY_MODULE(");
+  emitString(out, name, (int)strlen(name));
+  fprintf(out, ", %d, constants, body)\n", constants);
+  return true;
+}
+
+} // namespace loxy
@@ -0,0 +1,20 @@
+#ifndef loxy_c_emitter_h
+#define loxy_c_emitter_h
+
+#include <stdio.h>
+
+namespace loxy {
+
+class Chunk;
+
+// EmitC - writes [chunk], compiled from the module [name], to [out] as a C
+//  translation unit against VM/Runtime.h. Every instruction becomes a few
+//  lines of C on the interpreter's stack & jumps become gotos, so the C
+//  compiler sees the whole module at once. Returns false, writing
+//  nothing, for modules calling functions, creating closures or using
+//  classes or arrays.
+bool EmitC(const Chunk *chunk, const char *name, FILE *out);
+
+} // namespace loxy
+
+#endif
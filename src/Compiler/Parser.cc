@@ -3,26 +3,49 @@
 #include <string>
 #include <sstream>
 #include "Data/SmallVector.h"
+#include "VM/Number.h"
 #include "VM/Chunk.h"
 #include "Parser.h"
 #include "VM/Value.h"
+#include "VM/VM.h"
 
 namespace loxy {
 
 Parser::Parser(VM &vm)
   : scanner_(nullptr), vm(vm),
     hadError(false), panicMode(false),
-    currentChunk_(nullptr), currentFunc_(nullptr) {}
+    currentChunk_(nullptr), enclosing_(vm.parser_),
+    currentFunc_(nullptr), callee_(-1), lastCallee_(-1), lastCall_(-1), classDepth_(0) {
+  // constants of the chunk being compiled are only reachable from here.
+  vm.parser_ = this;
+}
 
-bool Parser::parse(Chunk *compilingChunk, const char *source) {
-  currentChunk_ = compilingChunk;
+Parser::~Parser() {
+  vm.parser_ = enclosing_;
+}
+
+void Parser::markRoots() {
+  if (currentChunk_ != nullptr) currentChunk_->mark(vm);
 
+  // functions are only reachable from here until they're compiled.
+  for (FunctionScope *scope = currentFunc_; scope != nullptr; scope = scope->enclosing) {
+    if (scope->function != nullptr) {
+      vm.markObject(scope->function);
+    } else {
+      scope->chunk->mark(vm);
+    }
+  }
+
+  if (enclosing_ != nullptr) enclosing_->markRoots();
+}
+
+bool Parser::parse(Chunk *compilingChunk, const char *source) {
   // create a scanner.
   Scanner scanner(source);
   scanner_ = &scanner;
 
   // begin a new function here.
-  FunctionScope function;
+  FunctionScope function(nullptr, compilingChunk);
   beginFunction(&function);
 
   // initialize [current] with the first token.
@@ -31,7 +54,8 @@ bool Parser::parse(Chunk *compilingChunk, const char *source) {
   while (!match(Tok::_EOF)) {
     declaration();
   }
-  
+
+  endFunction();
   return !hadError;
 }
 
@@ -56,6 +80,7 @@ void Parser::errorAt(const Token &token, const char *msg) {
   if (panicMode)  return;
 
   panicMode = true;
+  hadError = true;
 
   std::cerr << "[line " << token.line 
     << "] compilation error at\n"
@@ -114,12 +139,15 @@ enum class Precedence : int {
 };
 
 Parser::ParseRule Parser::rules[] = {
-  { &Parser::grouping, nullptr,        static_cast<int>(Precedence::CALL) },       // Tok::LEFT_PAREN
+  { &Parser::grouping, &Parser::call,  static_cast<int>(Precedence::CALL) },       // Tok::LEFT_PAREN
   { nullptr,          nullptr,        static_cast<int>(Precedence::NONE) },       // Tok::RIGHT_PAREN
-  { nullptr,          nullptr,        static_cast<int>(Precedence::NONE) },       // Tok::LEFT_BRACE
+  { &Parser::map,     nullptr,        static_cast<int>(Precedence::NONE) },       // Tok::LEFT_BRACE
   { nullptr,          nullptr,        static_cast<int>(Precedence::NONE) },       // Tok::RIGHT_BRACE
+  { &Parser::array,   &Parser::subscript, static_cast<int>(Precedence::CALL) },   // Tok::LEFT_BRACKET
+  { nullptr,          nullptr,        static_cast<int>(Precedence::NONE) },       // Tok::RIGHT_BRACKET
+  { nullptr,          nullptr,        static_cast<int>(Precedence::NONE) },       // Tok::COLON
   { nullptr,          nullptr,        static_cast<int>(Precedence::NONE) },       // Tok::COMMA
-  { nullptr,          nullptr,        static_cast<int>(Precedence::CALL) },       // Tok::DOT
+  { nullptr,          &Parser::dot,    static_cast<int>(Precedence::CALL) },       // Tok::DOT
   { &Parser::unary,   &Parser::binary, static_cast<int>(Precedence::TERM) },       // Tok::MINUS
   { nullptr,          &Parser::binary, static_cast<int>(Precedence::TERM) },       // Tok::PLUS
   { nullptr,          nullptr,        static_cast<int>(Precedence::NONE) },       // Tok::SEMICOLON
@@ -148,10 +176,11 @@ Parser::ParseRule Parser::rules[] = {
   { nullptr,          nullptr,        static_cast<int>(Precedence::NONE) },       // Tok::PRINT
   { nullptr,          nullptr,        static_cast<int>(Precedence::NONE) },       // Tok::RETURN
   { nullptr,          nullptr,        static_cast<int>(Precedence::NONE) },       // Tok::SUPER
-  { nullptr,          nullptr,        static_cast<int>(Precedence::NONE) },       // Tok::THIS
+  { &Parser::this_,   nullptr,        static_cast<int>(Precedence::NONE) },       // Tok::THIS
   { &Parser::atom,     nullptr,        static_cast<int>(Precedence::NONE) },       // Tok::TRUE
   { nullptr,          nullptr,        static_cast<int>(Precedence::NONE) },       // Tok::VAR
   { nullptr,          nullptr,        static_cast<int>(Precedence::NONE) },       // Tok::WHILE
+  { &Parser::yield,    nullptr,        static_cast<int>(Precedence::NONE) },       // Tok::YIELD
   { nullptr,          nullptr,        static_cast<int>(Precedence::NONE) },       // Tok::ERROR
   { nullptr,          nullptr,        static_cast<int>(Precedence::NONE) },       // Tok::EOF
 };
@@ -186,6 +215,16 @@ bool Parser::match(Tok type) {
   return false;
 }
 
+uint8_t Parser::makeCache() {
+  int cache = currentChunk().addCache();
+
+  if (cache > UINT8_MAX) {
+    error("too many property accesses in one chunk");
+    return 0;
+  }
+  return (uint8_t)cache;
+}
+
 uint8_t Parser::makeConstant(Value value) {
   int constant = currentChunk().addConstant(value);
 
@@ -196,10 +235,55 @@ uint8_t Parser::makeConstant(Value value) {
   return (uint8_t)constant;
 }
 
-// only global variable names are stored.
+// only global variable & property names are stored.
 uint8_t Parser::identifierConstant(Token name) {
   String *identifier = String::create(vm, name.start, name.length);
-  return makeConstant(Value(identifier, ValueType::String));
+
+  // not reachable until it lands in the constant pool.
+  vm.pushRoot(identifier);
+  uint8_t constant = makeConstant(Value(identifier, ValueType::String));
+  vm.popRoot();
+  return constant;
+}
+
+bool Parser::proven(const Inferred &type) const {
+  if (!type.number) return false;
+
+  for (int local : type.locals) {
+    if (!currentFunc_->types[local].number) return false;
+  }
+  return true;
+}
+
+void Parser::assignLocal(int slot) {
+  int type = currentFunc_->vars[slot].type;
+  if (!proven(inferred_)) {
+    disprove(type);
+    return;
+  }
+
+  // the local stays a number as long as the ones of its value do.
+  for (int local : inferred_.locals) {
+    if (local != type) currentFunc_->types[local].dependents.push_back(type);
+  }
+}
+
+void Parser::disprove(FunctionScope *function, int type) {
+  LocalType &local = function->types[type];
+  if (!local.number) return;
+  local.number = false;
+
+  // ops resting on more than one local may be patched already.
+  for (int site : local.sites) {
+    OpCode op = (OpCode)function->chunk->code()[site];
+    if (checkedOp(op) == op) continue;
+
+    function->chunk->code()[site] = (uint8_t)checkedOp(op);
+    vm.inferenceStats_.unchecked--;
+    vm.inferenceStats_.reverted++;
+  }
+
+  for (int dependent : local.dependents) disprove(function, dependent);
 }
 
 bool Parser::identifiersEqual(const Token &a, const Token &b) {
@@ -230,7 +314,15 @@ uint8_t Parser::declareLocal() {
 
   // checks for conflicts.
   for (int i = function->count - 1; i >= 0; i--) {
-    const Variable &var = function->getLocal(i);
+    const Variable &var = function->vars[i];
+
+    // declared in this scope but not defined yet.
+    if (var.depth == -1) {
+      if (identifiersEqual(name, var.name)) {
+        error("variable with this name has already been declared in this scope");
+      }
+      continue;
+    }
 
     // shadowing is fine.
     if (var.depth < depth)  break;
@@ -245,10 +337,99 @@ uint8_t Parser::declareLocal() {
   return 0;
 }
 
+int Parser::resolveCapture(FunctionScope *function, const Token &name) {
+  FunctionScope *enclosing = function->enclosing;
+  if (enclosing == nullptr) return -1;
+
+  for (int i = enclosing->count - 1; i >= 0; i--) {
+    if (!identifiersEqual(enclosing->vars[i].name, name)) continue;
+
+    // methods are shared by every instance, they don't close over anything.
+    if (function->type != FunctionType::Function) {
+      error("methods can't capture local variables");
+      return -1;
+    }
+    int escape = escapeOf(enclosing, i);
+    escapes_[escape].captured = true;
+    return addCapture(function, (uint8_t)i, CAPTURE_LOCAL, escape);
+  }
+
+  // captured by the enclosing function on behalf of this one.
+  int capture = resolveCapture(enclosing, name);
+  if (capture == -1) return -1;
+  if (function->type != FunctionType::Function) {
+    error("methods can't capture local variables");
+    return -1;
+  }
+  return addCapture(function, (uint8_t)capture, 0, enclosing->captured[capture]);
+}
+
+int Parser::addCapture(FunctionScope *function, uint8_t index, uint8_t flags, int escape) {
+  int count = (int)function->captures.size();
+  for (int i = 0; i < count; i++) {
+    const Capture &capture = function->captures[i];
+    if (capture.index == index && capture.flags == flags) return i;
+  }
+
+  if (count == UINT8_MAX) {
+    error("too many captured variables in function");
+    return 0;
+  }
+  function->captures.push_back({ index, flags });
+  function->captured.push_back(escape);
+  escapes_[escape].descriptors.emplace_back(function->function, count);
+  return count;
+}
+
+int Parser::escapeOf(FunctionScope *function, int slot) {
+  Variable &var = function->vars[slot];
+  if (var.escape == -1) {
+    var.escape = (int)escapes_.size();
+    escapes_.emplace_back();
+    escapes_.back().function = function;
+    escapes_.back().type = var.type;
+  }
+  return var.escape;
+}
+
+bool Parser::settleLocal(const Variable &var) {
+  if (var.escape == -1) return false;
+
+  // closures capturing it are settled by now, they're declared in its
+  // scope, later on or in nested functions.
+  Escape &local = escapes_[var.escape];
+  if (local.escapes) {
+    // what an escaping closure captures may outlive the frame too.
+    for (int captured : local.captures) {
+      escapes_[captured].boxed = true;
+      escapes_[captured].escapes = true;
+    }
+  }
+  if (!local.captured) return false;
+
+  if (!local.boxed) {
+    vm.captureStats_.unboxed++;
+    return false;
+  }
+
+  for (auto &site : local.sites) {
+    uint8_t &op = site.first->code()[site.second];
+    op = (uint8_t)((OpCode)op == OpCode::GET_OUTER ? OpCode::GET_UPVALUE : OpCode::SET_UPVALUE);
+  }
+  for (auto &descriptor : local.descriptors) {
+    Function *function = descriptor.first;
+    if (descriptor.second < function->captureCount) {
+      function->captures[descriptor.second].flags |= CAPTURE_BOXED;
+    }
+  }
+  vm.captureStats_.boxed++;
+  return true;
+}
+
 int Parser::resolveLocal(const Token &name) {
-  for (int i = currentFunc_->count; i >= 0; i--) {
-    if (identifiersEqual(currentFunc_->getLocal(i).name, name)) {
-      if (currentFunc_->getLocal(i).depth == -1) {
+  for (int i = currentFunc_->count - 1; i >= 0; i--) {
+    if (identifiersEqual(currentFunc_->vars[i].name, name)) {
+      if (currentFunc_->vars[i].depth == -1) {
         error("cannot read an uninitialized local variable");
       }
       return i;
@@ -277,10 +458,48 @@ void Parser::emit(OpCode op) {
   emit(static_cast<uint8_t>(op));
 }
 
-void Parser::emitReturn() {
-  // TODO:
-  // implicit return for initializer
+void Parser::emitBinary(OpCode op) {
+  emit(op);
+  // the inline cache of the op, see [VM::run].
+  emit(0);
+}
 
+void Parser::emitNumeric(OpCode op, const Inferred &a, const Inferred &b) {
+  InferenceStats &stats = vm.inferenceStats_;
+  bool numbers = proven(a) && proven(b);
+  int site = currentChunk().size();
+  stats.sites++;
+
+  if (numbers) {
+    emit(uncheckedOp(op));
+    stats.unchecked++;
+    for (int local : a.locals) currentFunc_->types[local].sites.push_back(site);
+    for (int local : b.locals) currentFunc_->types[local].sites.push_back(site);
+  } else {
+    emit(op);
+  }
+  // the inline cache of the checked op, see [VM::run].
+  if (op != OpCode::DIVIDE && op != OpCode::NEGATE) emit(0);
+
+  // arithmetics on numbers are numbers, comparisons are bools.
+  Inferred result;
+  if (numbers && op != OpCode::GREATER && op != OpCode::LESS) {
+    result.number = true;
+    result.locals = a.locals;
+    result.locals.insert(result.locals.end(), b.locals.begin(), b.locals.end());
+  }
+  inferred_ = std::move(result);
+}
+
+void Parser::emitReturn() {
+  // initializers return their instance, other functions without a return
+  // statement return nil.
+  if (currentFunc_->type == FunctionType::Initializer) {
+    emit(OpCode::GET_LOCAL);
+    emit(0);
+  } else {
+    emit(OpCode::NIL);
+  }
   emit(OpCode::RETURN);
 }
 
@@ -339,6 +558,7 @@ void Parser::parsePrecedence(int prec) {
   ParseFn prefix = rules[ruleIndex].prefix;
   if (prefix == nullptr) {
     error("expect expression");
+    inferred_ = Inferred();
     return;
   }
 
@@ -372,6 +592,10 @@ void Parser::parsePrecedence(int prec) {
 void Parser::declaration() {
   if (match(Tok::VAR)) {
     varDeclaration();
+  } else if (match(Tok::FUN)) {
+    funDeclaration();
+  } else if (match(Tok::CLASS)) {
+    classDeclaration();
   } else {
     // top-level statement
     statement();
@@ -389,15 +613,139 @@ void Parser::varDeclaration() {
     expression();
   } else {
     emit(OpCode::NIL);
+    inferred_ = Inferred();
   }
 
   // optional
   match(Tok::SEMICOLON);
 
+  // locals start as the type of their initializer.
+  if (currentFunc_->depth > 0) assignLocal(currentFunc_->count - 1);
+
   // define this variable.
   defineVariable(global);
 }
 
+void Parser::funDeclaration() {
+  uint8_t global = declareVariable("expect function name");
+  Token name = previous;
+
+  // local functions may call themselves, they're captured like any local.
+  int escape = -1;
+  if (currentFunc_->depth > 0) {
+    int slot = currentFunc_->count - 1;
+    currentFunc_->initLocal(slot);
+    escape = escapeOf(currentFunc_, slot);
+  }
+
+  function(name, escape);
+
+  // locals holding functions aren't numbers.
+  if (currentFunc_->depth > 0) assignLocal(currentFunc_->count - 1);
+  defineVariable(global);
+}
+
+void Parser::classDeclaration() {
+  uint8_t global = declareVariable("expect class name");
+  Token name = previous;
+
+  emit(OpCode::CLASS);
+  emit(identifierConstant(name));
+  if (currentFunc_->depth > 0) {
+    inferred_ = Inferred();
+    assignLocal(currentFunc_->count - 1);
+  }
+  defineVariable(global);
+
+  // the class stays on the stack while its methods are added.
+  namedVariable(name, false);
+  classDepth_++;
+  consume(Tok::LEFT_BRACE, "expect '{' before class body");
+  while (!check(Tok::RIGHT_BRACE) && !check(Tok::_EOF)) {
+    method();
+  }
+  consume(Tok::RIGHT_BRACE, "expect '}' after class body");
+  classDepth_--;
+  emit(OpCode::POP);
+}
+
+void Parser::method() {
+  consume(Tok::IDENTIFIER, "expect method name");
+  Token name = previous;
+  uint8_t constant = identifierConstant(name);
+
+  FunctionType type = FunctionType::Method;
+  if (name.length == 4 && memcmp(name.start, "init", 4) == 0) {
+    type = FunctionType::Initializer;
+  }
+  function(name, -1, type);
+  emit(OpCode::METHOD);
+  emit(constant);
+}
+
+void Parser::function(const Token &name, int escape, FunctionType type) {
+  String *functionName = String::create(vm, name.start, name.length);
+  vm.pushRoot(functionName);
+  Function *object = Function::create(vm, functionName);
+  vm.popRoot();
+
+  FunctionScope function(object, object->chunk, type);
+  beginFunction(&function);
+
+  // slot 0 holds the callee, it has no name. Methods find their instance
+  // there instead, as this.
+  Token callee = name;
+  callee.length = 0;
+  if (type != FunctionType::Function) {
+    callee.start = "this";
+    callee.length = 4;
+  }
+  function.initLocal(function.createLocal(callee));
+  disprove(function.vars[0].type);
+
+  consume(Tok::LEFT_PAREN, "expect '(' after function name");
+  if (!check(Tok::RIGHT_PAREN)) {
+    do {
+      if (object->arity == UINT8_MAX) errorAtCurrent("can't have more than 255 parameters");
+      object->arity++;
+
+      declareVariable("expect parameter name");
+      defineVariable(0);
+
+      // arguments can be anything.
+      disprove(function.vars[function.count - 1].type);
+    } while (match(Tok::COMMA));
+  }
+  consume(Tok::RIGHT_PAREN, "expect ')' after parameters");
+
+  // the body's locals go with the frame, the scope isn't ended.
+  consume(Tok::LEFT_BRACE, "expect '{' before function body");
+  block();
+  endFunction();
+
+  // only reachable from the enclosing chunk once it's a constant.
+  vm.pushRoot(object);
+  if (function.captures.empty()) {
+    emitConstant(Value(object));
+  } else {
+    object->setCaptures(vm, function.captures.data(), (int)function.captures.size());
+    emit(OpCode::CLOSURE);
+    emit(makeConstant(Value(object)));
+
+    if (escape != -1) {
+      escapes_[escape].captures = function.captured;
+    } else {
+      // held by a global, it may outlive anything it captures.
+      for (int captured : function.captured) {
+        escapes_[captured].boxed = true;
+        escapes_[captured].escapes = true;
+      }
+    }
+  }
+  vm.popRoot();
+  inferred_ = Inferred();
+}
+
 void Parser::statement() {
   if (match(Tok::FOR)) {
     forStatement();
@@ -405,6 +753,10 @@ void Parser::statement() {
     whileStatement();
   } else if (match(Tok::IF)) {
     ifStatement();
+  } else if (match(Tok::PRINT)) {
+    printStatement();
+  } else if (match(Tok::RETURN)) {
+    returnStatement();
   } else if (match(Tok::LEFT_BRACE)) {
     // push a new lexical scope
     beginScope();
@@ -437,10 +789,6 @@ void Parser::forStatement() {
   // loops always start at conditions.
   int loopStart = currentChunk().size();
 
-  // remember the position of the start of the increment such that
-  // we can jump back here later.
-  int incrStart;
-
   // condition.
   if (!check(Tok::SEMICOLON)) {
     expression();
@@ -457,34 +805,136 @@ void Parser::forStatement() {
   // pop condition.
   emit(OpCode::POP);
 
-  // increment.
-  if (!check(Tok::RIGHT_PAREN)) {
-    incrStart = currentChunk().size();
-    expression();
-    emit(OpCode::POP);
-    // loop back to condition
-    emitLoop(loopStart);
-  } else {
-    // points back to condition instead.
-    incrStart = loopStart;
+  // the increment runs after the body, so it's compiled after it too.
+  // Skip it for now, remembering where it starts & its first tokens.
+  Scanner incrementScanner = *scanner_;
+  Token incrementStart = current;
+  Token increment[6];
+  int count = 0;
+  int depth = 0;
+
+  while (!check(Tok::_EOF) && !(depth == 0 && check(Tok::RIGHT_PAREN))) {
+    if (check(Tok::LEFT_PAREN)) depth++;
+    if (check(Tok::RIGHT_PAREN)) depth--;
+    if (count < 6) increment[count] = current;
+    count++;
+    advance();
   }
 
   consume(Tok::RIGHT_PAREN, "expect ')' after 'for' loop");
 
+  uint8_t operands[4];
+  bool counting = numericFor(loopStart, increment, count, operands);
+
   // body
+  int bodyStart = currentChunk().size();
   statement();
 
-  // always loop to increment
-  emitLoop(incrStart);
+  // counting loops step & test in one instruction, their increment &
+  // condition are left for operands other than numbers.
+  int counted = -1;
+  if (counting) {
+    emit(OpCode::FOR_LOOP);
+    for (uint8_t operand : operands) emit(operand);
+
+    int offset = currentChunk().size() + 4 - bodyStart;
+    if (offset > UINT16_MAX)  error("loop body too large");
+    emit((offset >> 8) & 0xff);
+    emit(offset & 0xff);
+
+    // patched once the loop is done.
+    emit(0xff);
+    emit(0xff);
+    counted = currentChunk().size() - 2;
+  }
+
+  // increment.
+  if (count > 0) {
+    Scanner bodyEnd = *scanner_;
+    Token next = current;
+    Token last = previous;
+
+    *scanner_ = incrementScanner;
+    current = incrementStart;
+    expression();
+    if (!check(Tok::RIGHT_PAREN)) errorAtCurrent("expect ')' after 'for' loop");
+    emit(OpCode::POP);
+
+    *scanner_ = bodyEnd;
+    current = next;
+    previous = last;
+  }
+
+  // loop back to condition
+  emitLoop(loopStart);
 
   // exit
   patchJump(exitLoop);
 
   // pop condition.
   emit(OpCode::POP);
+  if (counted >= 0) patchJump(counted);
   endScope();
 }
 
+bool Parser::numericFor(int condStart, const Token *increment, int count, uint8_t operands[4]) {
+  // i < limit, compiled as GET_LOCAL i, CONSTANT limit | GET_LOCAL limit,
+  // LESS & its cache. <= & >= are followed by NOT.
+  const uint8_t *code = currentChunk().code().data() + condStart;
+  int size = currentChunk().size() - 4 - condStart;
+  if (size != 6 && size != 7) return false;
+  if ((OpCode)code[0] != OpCode::GET_LOCAL) return false;
+  if ((OpCode)code[2] != OpCode::CONSTANT && (OpCode)code[2] != OpCode::GET_LOCAL) return false;
+  if (size == 7 && (OpCode)code[6] != OpCode::NOT) return false;
+
+  uint8_t flags = size == 7 ? FOR_NEGATE : 0;
+  switch (checkedOp((OpCode)code[4])) {
+  case OpCode::LESS:    break;
+  case OpCode::GREATER: flags |= FOR_GREATER; break;
+  default:              return false;
+  }
+  if ((OpCode)code[2] == OpCode::GET_LOCAL) flags |= FOR_LIMIT_LOCAL;
+
+  // i = i + step, step a number or a local.
+  if (count != 5) return false;
+  if (increment[0].type != Tok::IDENTIFIER || increment[1].type != Tok::EQUAL ||
+      increment[2].type != Tok::IDENTIFIER) {
+    return false;
+  }
+  if (!identifiersEqual(increment[0], increment[2]) || resolveLocal(increment[0]) != code[1]) {
+    return false;
+  }
+
+  switch (increment[3].type) {
+  case Tok::PLUS:   break;
+  case Tok::MINUS:  flags |= FOR_SUBTRACT; break;
+  default:          return false;
+  }
+
+  const Token &step = increment[4];
+  uint8_t stepOperand;
+  if (step.type == Tok::NUMBER) {
+    int64_t integer;
+    Value value = parseInteger(step.start, step.length, &integer)
+      ? Value(integer)
+      : Value(parseNumber(step.start, step.length));
+    stepOperand = makeConstant(value);
+  } else if (step.type == Tok::IDENTIFIER) {
+    int slot = resolveLocal(step);
+    if (slot == -1) return false;
+    stepOperand = (uint8_t)slot;
+    flags |= FOR_STEP_LOCAL;
+  } else {
+    return false;
+  }
+
+  operands[0] = code[1];
+  operands[1] = flags;
+  operands[2] = code[3];
+  operands[3] = stepOperand;
+  return true;
+}
+
 void Parser::whileStatement() {
   // remember the position of loop start.
   // loops always start at condition.  
@@ -538,6 +988,34 @@ void Parser::ifStatement() {
   patchJump(endJump);
 }
 
+// returnStatement := "return" expression? ;
+void Parser::returnStatement() {
+  if (currentFunc_->function == nullptr) error("can't return from top-level code");
+
+  if (match(Tok::SEMICOLON) || check(Tok::RIGHT_BRACE)) {
+    emitReturn();
+    return;
+  }
+
+  if (currentFunc_->type == FunctionType::Initializer) {
+    error("can't return a value from an initializer");
+  }
+
+  lastCall_ = -1;
+  expression();
+  match(Tok::SEMICOLON);
+
+  // the call the value comes from is the last instruction, make it reuse
+  // the frame. Jumps past it, e.g: return a or f(), still land on RETURN.
+  // Closures of this function are left a plain CALL, they may read its
+  // locals in place.
+  bool inPlace = lastCallee_ != -1 && !escapes_[lastCallee_].captures.empty();
+  if (lastCall_ >= 0 && lastCall_ == (int)currentChunk().size() - 2 && !inPlace) {
+    currentChunk_->code()[lastCall_] = (uint8_t)OpCode::TAIL_CALL;
+  }
+  emit(OpCode::RETURN);
+}
+
 void Parser::block() {
   while (!check(Tok::RIGHT_BRACE)) {
     declaration();
@@ -554,10 +1032,11 @@ void Parser::expressionStatement() {
 
 // printStatement := "print" expression ;
 void Parser::printStatement() {
-  emit(OpCode::PRINT);
   expression();
   match(Tok::SEMICOLON);
-  emit(OpCode::POP);
+
+  // PRINT pops the printed value.
+  emit(OpCode::PRINT);
 }
 
 // parse from lowest possible precedence expression
@@ -579,6 +1058,7 @@ void Parser::or_(bool _) {
   // rhs
   parsePrecedence(static_cast<int>(Precedence::OR));
   patchJump(endJump);
+  inferred_ = Inferred();
 }
 
 // infix
@@ -596,31 +1076,37 @@ void Parser::and_(bool _) {
 
   // patch the arg to jump over all bytecode emitted by [parsePrecedence].
   patchJump(jumpArg);
+  inferred_ = Inferred();
 }
 
 // infix
 void Parser::binary(bool _) {
   Tok op = previous.type;
+  Inferred a = std::move(inferred_);
 
   // this is to ensure the current binary expression
   // does not contain lower precedent binary expression.
   int precedence = rules[static_cast<int>(previous.type)].precedence;
   parsePrecedence(precedence);
+  Inferred b = std::move(inferred_);
 
   switch (op)
   {
-  case Tok::BANG_EQUAL:     emit(OpCode::EQUAL); emit(OpCode::NOT); break;
-  case Tok::EQUAL_EQUAL:    emit(OpCode::EQUAL); break;
-  case Tok::GREATER:        emit(OpCode::GREATER); break;
-  case Tok::GREATER_EQUAL:  emit(OpCode::LESS); emit(OpCode::NOT); break;
-  case Tok::LESS:           emit(OpCode::LESS); break;
-  case Tok::LESS_EQUAL:     emit(OpCode::GREATER); emit(OpCode::NOT); break;
-  case Tok::PLUS:           emit(OpCode::ADD); break;
-  case Tok::MINUS:          emit(OpCode::SUBTRACT); break;
-  case Tok::STAR:           emit(OpCode::MULTIPLY); break;
-  case Tok::SLASH:          emit(OpCode::DIVIDE); break;
+  case Tok::BANG_EQUAL:     emitBinary(OpCode::EQUAL); emit(OpCode::NOT); break;
+  case Tok::EQUAL_EQUAL:    emitBinary(OpCode::EQUAL); break;
+  case Tok::GREATER:        emitNumeric(OpCode::GREATER, a, b); break;
+  case Tok::GREATER_EQUAL:  emitNumeric(OpCode::LESS, a, b); emit(OpCode::NOT); break;
+  case Tok::LESS:           emitNumeric(OpCode::LESS, a, b); break;
+  case Tok::LESS_EQUAL:     emitNumeric(OpCode::GREATER, a, b); emit(OpCode::NOT); break;
+  case Tok::PLUS:           emitNumeric(OpCode::ADD, a, b); break;
+  case Tok::MINUS:          emitNumeric(OpCode::SUBTRACT, a, b); break;
+  case Tok::STAR:           emitNumeric(OpCode::MULTIPLY, a, b); break;
+  case Tok::SLASH:          emitNumeric(OpCode::DIVIDE, a, b); break;
   default:                  UNREACHABLE();
   }
+
+  // comparisons leave bools.
+  if (op == Tok::BANG_EQUAL || op == Tok::EQUAL_EQUAL) inferred_ = Inferred();
 }
 
 // grouping := '(' expression ')' ;
@@ -637,8 +1123,19 @@ void Parser::unary(bool _) {
   parsePrecedence(static_cast<int>(Precedence::UNARY));
   switch (op)
   {
-  case Tok::BANG:   emit(OpCode::NOT); break;
-  case Tok::MINUS:  emit(OpCode::NEGATE); break;
+  case Tok::BANG:
+    emit(OpCode::NOT);
+    inferred_ = Inferred();
+    break;
+
+  case Tok::MINUS: {
+    // NEGATE has a single operand, the other one is any number.
+    Inferred operand = std::move(inferred_);
+    Inferred number;
+    number.number = true;
+    emitNumeric(OpCode::NEGATE, operand, number);
+    break;
+  }
   default:          UNREACHABLE();
   }
 }
@@ -647,44 +1144,229 @@ void Parser::unary(bool _) {
 // getVar := identifier ;
 // setVar := identifier '=' expression ;
 void Parser::variable(bool assignable) {
-  // this is where you might wanna consume the equal sign.
+  namedVariable(previous, assignable);
+}
+
+// this := "this" ;
+void Parser::this_(bool _) {
+  if (classDepth_ == 0) {
+    error("can't use 'this' outside of a class");
+    return;
+  }
+
+  // read like the local it is in methods, captured by their closures.
   Token name = previous;
+  name.type = Tok::IDENTIFIER;
+  namedVariable(name, false);
+}
+
+void Parser::namedVariable(const Token &name, bool assignable) {
+  // this is where you might wanna consume the equal sign.
   OpCode getOp, setOp;
-  int index = resolveLocal(name);
 
-  if (index == -1) {
-    getOp = OpCode::GET_GLOBAL;
-    setOp = OpCode::SET_GLOBAL;
+  // locals captured or declared by fun are tracked by escape analysis.
+  int escape = -1;
+  int index = resolveLocal(name);
+  if (index != -1) {
+    getOp = OpCode::GET_LOCAL;
+    setOp = OpCode::SET_LOCAL;
+    escape = currentFunc_->vars[index].escape;
+  } else if ((index = resolveCapture(currentFunc_, name)) != -1) {
+    // read in place until the local is settled boxed.
+    getOp = OpCode::GET_OUTER;
+    setOp = OpCode::SET_OUTER;
+    escape = currentFunc_->captured[index];
   } else {
     // find the index of [name] in vm's global symbol table.
     index = identifierConstant(name);
-    getOp = OpCode::GET_LOCAL;
-    setOp = OpCode::SET_LOCAL;
+    getOp = OpCode::GET_GLOBAL;
+    setOp = OpCode::SET_GLOBAL;
   }
 
   if (assignable && match(Tok::EQUAL)) {
-    // parse the assigned expression & emit it first.
+    // parse the assigned expression & emit it first. The assignment
+    // evaluates to it, [inferred_] stays its type.
     expression();
+    if (setOp == OpCode::SET_LOCAL) {
+      assignLocal(index);
+    } else {
+      // closures may assign the local anything, behind its function's back.
+      if (setOp == OpCode::SET_OUTER) {
+        const Escape &local = escapes_[escape];
+        disprove(local.function, local.type);
+        escapes_[escape].sites.emplace_back(currentChunk_, (int)currentChunk().size());
+      }
+      inferred_ = Inferred();
+    }
     emit(setOp);
     emit(index);
   } else {
+    // a closure called right away lives no longer than its caller, calls
+    // from its own function are followed by [returnStatement].
+    bool called = check(Tok::LEFT_PAREN);
+    if (escape != -1 && !called) escapes_[escape].escapes = true;
+    callee_ = called && getOp == OpCode::GET_LOCAL ? escape : -1;
+
+    if (getOp == OpCode::GET_OUTER) {
+      escapes_[escape].sites.emplace_back(currentChunk_, (int)currentChunk().size());
+    }
     emit(getOp);
     emit(index);
+
+    inferred_ = Inferred();
+    if (getOp == OpCode::GET_LOCAL) {
+      inferred_.number = true;
+      inferred_.locals.push_back(currentFunc_->vars[index].type);
+    }
+  }
+}
+
+// map := '{' (expression ':' expression (',' expression ':' expression)*)? '}' ;
+void Parser::map(bool _) {
+  emit(OpCode::MAP);
+
+  if (!check(Tok::RIGHT_BRACE)) {
+    do {
+      // key.
+      expression();
+      consume(Tok::COLON, "expect ':' after map key");
+
+      // value.
+      expression();
+      emit(OpCode::MAP_INSERT);
+    } while (match(Tok::COMMA));
+  }
+
+  consume(Tok::RIGHT_BRACE, "expect '}' after map entries");
+  inferred_ = Inferred();
+}
+
+// array := '[' (expression (',' expression)*)? ']' ;
+void Parser::array(bool _) {
+  int count = 0;
+  if (!check(Tok::RIGHT_BRACKET)) {
+    do {
+      expression();
+      if (count == UINT8_MAX) error("can't have more than 255 elements in an array literal");
+      count++;
+    } while (match(Tok::COMMA));
+  }
+  consume(Tok::RIGHT_BRACKET, "expect ']' after array elements");
+
+  emit(OpCode::ARRAY);
+  emit((uint8_t)count);
+  inferred_ = Inferred();
+}
+
+// yield := 'yield' '(' expression? ')' ;
+void Parser::yield(bool _) {
+  if (currentFunc_->function == nullptr) error("can't yield from top-level code");
+  consume(Tok::LEFT_PAREN, "expect '(' after 'yield'");
+  if (check(Tok::RIGHT_PAREN)) {
+    emit(OpCode::NIL);
+  } else {
+    expression();
+  }
+  consume(Tok::RIGHT_PAREN, "expect ')' after the yielded value");
+
+  emit(OpCode::YIELD);
+  inferred_ = Inferred();
+}
+
+// subscript := call '[' expression ']' ('=' expression)? ;
+void Parser::subscript(bool assignable) {
+  // index.
+  expression();
+  consume(Tok::RIGHT_BRACKET, "expect ']' after index");
+
+  if (assignable && match(Tok::EQUAL)) {
+    expression();
+    emit(OpCode::SET_INDEX);
+  } else {
+    emit(OpCode::GET_INDEX);
   }
+  inferred_ = Inferred();
+}
+
+// call := call '(' (expression (',' expression)*)? ')' ;
+void Parser::call(bool _) {
+  int callee = callee_;
+  callee_ = -1;
+
+  uint8_t argCount = argumentList();
+
+  lastCall_ = (int)currentChunk().size();
+  lastCallee_ = callee;
+  emit(OpCode::CALL);
+  emit(argCount);
+  inferred_ = Inferred();
+}
+
+uint8_t Parser::argumentList() {
+  int argCount = 0;
+  if (!check(Tok::RIGHT_PAREN)) {
+    do {
+      expression();
+      if (argCount == UINT8_MAX) error("can't have more than 255 arguments");
+      argCount++;
+    } while (match(Tok::COMMA));
+  }
+  consume(Tok::RIGHT_PAREN, "expect ')' after arguments");
+  return (uint8_t)argCount;
+}
+
+// dot := call '.' identifier ('=' expression | '(' arguments? ')')? ;
+void Parser::dot(bool assignable) {
+  consume(Tok::IDENTIFIER, "expect property name after '.'");
+  uint8_t name = identifierConstant(previous);
+  callee_ = -1;
+
+  if (assignable && match(Tok::EQUAL)) {
+    expression();
+    emit(OpCode::SET_PROPERTY);
+    emit(name);
+    emit(makeCache());
+  } else if (match(Tok::LEFT_PAREN)) {
+    // a method called right away isn't bound to its instance.
+    uint8_t argCount = argumentList();
+    emit(OpCode::INVOKE);
+    emit(name);
+    emit(argCount);
+    emit(makeCache());
+  } else {
+    emit(OpCode::GET_PROPERTY);
+    emit(name);
+    emit(makeCache());
+  }
+  inferred_ = Inferred();
 }
 
 // primary
 void Parser::string(bool _) { 
-  String *str = String::create(vm, previous.start, previous.length);
+  // strip the quotes.
+  String *str = String::create(vm, previous.start + 1, previous.length - 2);
 
   // emit the string on the stack.
+  vm.pushRoot(str);
   emitConstant(Value(str, ValueType::String));
+  vm.popRoot();
+  inferred_ = Inferred();
 }
 
 // primary
 void Parser::number(bool _) {
-  double value = strtod(previous.start, nullptr);
-  
+  inferred_ = Inferred();
+  inferred_.number = true;
+
+  // integer literals stay exact as ints while they fit.
+  int64_t integer;
+  if (parseInteger(previous.start, previous.length, &integer)) {
+    emitConstant(Value(integer));
+    return;
+  }
+
+  double value = parseNumber(previous.start, previous.length);
+
   // emit the number on the stack.
   emitConstant(Value(value));
 }
@@ -698,6 +1380,7 @@ void Parser::atom(bool _) {
   case Tok::NIL:    emit(OpCode::NIL);   break;
   default:          UNREACHABLE();
   }
+  inferred_ = Inferred();
 }
 
 } // namespace loxy
\ No newline at end of file
@@ -2,9 +2,11 @@
 #define loxy_parser_h
 
 #include <functional>
+#include <vector>
 #include "Scanner.h"
 #include "VM/OpCode.h"
 #include "VM/Chunk.h"
+#include "VM/Value.h"
 
 namespace loxy {
 
@@ -13,6 +15,7 @@ struct Token;
 class Scanner;
 class Value;
 class Chunk;
+class Function;
 class VM;
 
 enum class OpCode: uint8_t;
@@ -29,20 +32,28 @@ private:
   bool hadError;
   bool panicMode;
 
+  // the chunk of the function being compiled.
   Chunk *currentChunk_;
 
+  // the parser that was compiling when this one started, if any.
+  Parser *enclosing_;
+
   class FunctionScope;
   FunctionScope *currentFunc_;
 
 public:
 
   Parser(VM &vm);
+  ~Parser();
 
   // TODO: return [Function].
   /// parse - main interface for parsing [source] code and emitting
   ///   corresponding bytecode to [compilingChunk].
   bool parse(Chunk *compilingChunk, const char *source);
 
+  /// markRoots - marks objects the parser is holding, called by the collector.
+  void markRoots();
+
 private:
   // data types for compiling.
 
@@ -57,6 +68,15 @@ private:
     int precedence;
   };
 
+  // FunctionType - what a function is compiled as. Methods & initializers
+  //  run on their instance, in their first slot as this.
+  enum class FunctionType {
+    Function,
+    Method,
+    // init methods, returning their instance.
+    Initializer,
+  };
+
   // struct Variable - represents local variables accessible by function scope.
   //  top-level variable is not represented by this struct.
   struct Variable {
@@ -66,6 +86,68 @@ private:
     // The depth of the variable. Top-level variable has depth of 0.
     // -1 means the name is being declared yet usable.
     int   depth = -1;
+
+    // index of its [LocalType] in the function.
+    int   type = -1;
+
+    // index of its [Escape] in the parser, for locals closures capture or
+    // declared by fun. -1 for others.
+    int   escape = -1;
+  };
+
+  // struct LocalType - what type inference knows of a local over its
+  //  whole life: it's a number while all values assigned to it are.
+  //  Kept past the local's scope, ops proven on it may still be patched.
+  struct LocalType {
+    bool number = true;
+
+    // offsets of unchecked ops proven on this local.
+    std::vector<int> sites;
+
+    // locals assigned values proven on this one.
+    std::vector<int> dependents;
+  };
+
+  // struct Escape - what escape analysis knows of a local captured by
+  //  closures or holding one. Captured locals are read in place on the
+  //  stack unless a closure capturing them may outlive their frame, then
+  //  they're boxed into Upvalues. Settled once the local's scope ends, see
+  //  [Parser::settleLocal].
+  struct Escape {
+    // the function declaring it, while it's compiled, & its [LocalType].
+    FunctionScope *function = nullptr;
+    int type = -1;
+
+    // for a local declared by fun: its closure is used other than called
+    // directly, or captured by a closure that escapes.
+    bool escapes = false;
+
+    // for a local declared by fun, the Escapes of what its closure
+    // captures.
+    std::vector<int> captures;
+
+    bool captured = false;
+    // captured by a closure that escapes.
+    bool boxed = false;
+
+    // where it's accessed from closures: GET_OUTER & SET_OUTER ops, & the
+    // captures of functions, patched if it's boxed.
+    std::vector<std::pair<Chunk*, int>> sites;
+    std::vector<std::pair<Function*, int>> descriptors;
+  };
+  std::vector<Escape> escapes_;
+
+  // the Escape of a local just compiled as the callee of a call, & of the
+  // last call compiled, see [returnStatement].
+  int callee_;
+  int lastCallee_;
+
+  // struct Inferred - the type of the expression just compiled: whether
+  //  it's a number, & the locals that rests on. Locals may be disproved
+  //  later, see [Parser::disprove].
+  struct Inferred {
+    bool number = false;
+    std::vector<int> locals;
   };
 
   // class FunctionScope - one scope stack per function.
@@ -78,25 +160,37 @@ private:
     // count of [vars]
     int count;
 
+    // types of all locals declared so far, by [Variable::type].
+    std::vector<LocalType> types;
+
+    // the variables it captures, & the Escape of each.
+    std::vector<Capture> captures;
+    std::vector<int> captured;
+
     // current depth.
     int depth;
 
     // enclosing function.
     FunctionScope *enclosing;
 
-    // TODO:
-    // current function being compiled.
-    // Function *function;
+    // current function being compiled, nullptr for the module body, & the
+    // chunk its code goes to.
+    Function *function;
+    Chunk *chunk;
+    FunctionType type;
   public:
 
-    FunctionScope(FunctionScope *enclosing = nullptr, int depth = 0)
-      : count(0), depth(depth),
-        enclosing(enclosing) {}
+    FunctionScope(Function *function, Chunk *chunk, FunctionType type = FunctionType::Function)
+      : count(0), depth(0),
+        enclosing(nullptr), function(function), chunk(chunk), type(type) {}
 
     // marks a local variable comes into scope yet available.
     int createLocal(Token name) {
       vars[count].name = name;
-      vars[count].depth = depth;
+      vars[count].depth = -1;
+      vars[count].type = (int)types.size();
+      vars[count].escape = -1;
+      types.emplace_back();
       count++;
       return count - 1;
     }
@@ -116,15 +210,23 @@ private:
     }
 
     // pops [n] local variables.
-    void pop(size_t n) {
-      assert(count > n && "Popping too many variables!");
+    void pop(int n) {
+      assert(count >= n && "Popping too many variables!");
       count -= n;
-
-      // reset depth.
-      depth = vars[count - 1].depth;
     }
   };  // class ScopeInfo
 
+  // the type of the last expression compiled, every parser of expressions
+  // sets it.
+  Inferred inferred_;
+
+  // offset of the last CALL compiled, see [returnStatement].
+  int lastCall_;
+
+  // classes being compiled, nested in one another. this is only valid
+  // inside one.
+  int classDepth_;
+
 private:
 
   // driver table for pratt parsing.
@@ -147,31 +249,40 @@ private:
     int varCount = 0;
     int depth = current->depth;
 
-    while (current->count > 0 && current->getLocal(varCount - 1).depth >= depth) {
+    // locals of this scope are on top of the stack, boxed ones are closed
+    // over as they go.
+    while (varCount < current->count &&
+           current->vars[current->count - 1 - varCount].depth >= depth) {
+      bool boxed = settleLocal(current->vars[current->count - 1 - varCount]);
+      emit(boxed ? OpCode::CLOSE_UPVALUE : OpCode::POP);
       varCount++;
     }
-    
+
     current->pop(varCount);
+    current->depth--;
   }
 
   void beginFunction(FunctionScope *function) {
     function->enclosing = currentFunc_;
     function->count = 0;
 
-    if (currentFunc_ != nullptr) {
-      function->depth = currentFunc_->depth;
-    } else {
-      function->depth = 0;
-    }
+    // the module body declares globals, functions only locals.
+    function->depth = function->function != nullptr ? 1 : 0;
 
-    // TODO: add function's type.
+    currentFunc_ = function;
+    currentChunk_ = function->chunk;
   }
 
   void endFunction() {
     emitReturn();
+
+    // the rest of the locals go with the frame, RETURN closes their
+    // upvalues.
+    for (int i = currentFunc_->count - 1; i >= 0; i--) settleLocal(currentFunc_->vars[i]);
     currentFunc_ = currentFunc_->enclosing;
 
-    // TODO: return the function Object.
+    // the module body stays the current chunk once it's done.
+    if (currentFunc_ != nullptr) currentChunk_ = currentFunc_->chunk;
   }
 
 private:
@@ -195,10 +306,47 @@ private:
   //    uninitialized local variable.
   int resolveLocal(const Token &name);
 
+  /// resolveCapture - finds [name] among the locals of the functions
+  ///   enclosing [function], capturing it into each function in between.
+  ///   Returns the index of the capture in [function], -1 if not found.
+  int resolveCapture(FunctionScope *function, const Token &name);
+
+  /// addCapture - adds the capture of the local or enclosing capture at
+  ///   [index] to [function], once.
+  int addCapture(FunctionScope *function, uint8_t index, uint8_t flags, int escape);
+
+  /// escapeOf - the Escape of the local at [slot] of [function], created
+  ///   on first use.
+  int escapeOf(FunctionScope *function, int slot);
+
+  /// settleLocal - settles whether closures capturing [var] box it once
+  ///   its scope ends, patching the ops & captures reading it in place
+  ///   into boxed ones if so. A closure escapes when it's used other than
+  ///   called directly, or captured by one that escapes. Returns whether
+  ///   [var] is boxed.
+  bool settleLocal(const Variable &var);
+
+  /// makeCache - adds an inline cache for a property access to
+  ///   [currentChunk], returning its index. See [PropertyCache].
+  uint8_t makeCache();
+
   /// identifierConstant - stores [name] which is an identifier, as a constant to
   ///   [currentChunk]'s constant table.
   uint8_t identifierConstant(Token name);
 
+  // type inference of locals, see [emitNumeric].
+  //
+  /// proven - whether [type] is a number, with all the locals that rests on.
+  bool proven(const Inferred &type) const;
+
+  /// assignLocal - joins [inferred_] into the type of the local at [slot].
+  void assignLocal(int slot);
+
+  /// disprove - marks the local of [type] as not a number, patching the
+  ///   ops proven on it & on locals depending on it back into checked ones.
+  void disprove(int type) { disprove(currentFunc_, type); }
+  void disprove(FunctionScope *function, int type);
+
   /// identifiersEqual - compares the chars contained in [a] & [b].
   bool identifiersEqual(const Token &a, const Token &b);
 
@@ -210,10 +358,32 @@ private:
 
   /// varDeclaration := "var" identifier ("=" expression)?
   void varDeclaration();
+
+  /// funDeclaration := "fun" identifier function
+  void funDeclaration();
+
+  /// classDeclaration := "class" identifier "{" method* "}"
+  void classDeclaration();
+
+  /// method := identifier function
+  void method();
+
+  /// function := "(" parameters? ")" block
+  ///   compiles a function named [name] into its own chunk, & emits it
+  ///   as a constant, or a closure if it captures variables. [escape] is
+  ///   the Escape of the local holding it, -1 for globals & methods.
+  void function(const Token &name, int escape, FunctionType type = FunctionType::Function);
   void statement();
   void whileStatement();
   void forStatement();
+
+  /// numericFor - whether the for loop with the condition compiled from
+  ///   [condStart] & the [count] tokens of its [increment] counts a local
+  ///   up or down by a constant or local step, see OpCode::FOR_LOOP. Fills
+  ///   in the operands of its FOR_LOOP if so.
+  bool numericFor(int condStart, const Token *increment, int count, uint8_t operands[4]);
   void ifStatement();
+  void returnStatement();
   void block();
   void expressionStatement();
   void printStatement();
@@ -232,6 +402,25 @@ private:
   void number(bool _);
   void string(bool _);
   void variable(bool assignable);
+  void this_(bool _);
+
+  /// namedVariable - reads [name] or assigns it, if [assignable] & an '='
+  ///   follows. Locals first, then captures & globals.
+  void namedVariable(const Token &name, bool assignable);
+  void map(bool _);
+  void array(bool _);
+
+  /// yield - yields from the running fiber, see OpCode::YIELD. A call in
+  ///   form, the value is parenthesized. Fibers are made & resumed by the
+  ///   natives fiber & resume, see [VM::addIo].
+  void yield(bool _);
+  void subscript(bool assignable);
+  void call(bool _);
+  void dot(bool assignable);
+
+  /// argumentList - compiles the arguments of a call up to its ')',
+  ///   returns how many there are.
+  uint8_t argumentList();
   void unary(bool _);
   void grouping(bool _);
 
@@ -250,6 +439,16 @@ private:
   void emit(uint8_t byte);
   void emit(OpCode op);
   void emitReturn();
+
+  /// emitBinary - emits a quickenable binary [op] & its inline cache.
+  void emitBinary(OpCode op);
+
+  /// emitNumeric - emits the arithmetic or comparison [op] on operands of
+  ///   types [a] & [b], unchecked where both are proven numbers. Unchecked
+  ///   ops are patched back into [op] if a local they rest on is assigned
+  ///   something else later on. Leaves the type of the result in
+  ///   [inferred_].
+  void emitNumeric(OpCode op, const Inferred &a, const Inferred &b);
   void emitConstant(Value value);
 
   /// emitJump - emits [jumpInst] and a 2-byte offset for jump. 
@@ -115,6 +115,7 @@ Tok Scanner::identifierType() {
     break;
   case 'v': return checkKeyword(1, 2, "ar", Tok::VAR);
   case 'w': return checkKeyword(1, 4, "hile", Tok::WHILE);
+  case 'y': return checkKeyword(1, 4, "ield", Tok::YIELD);
   }
 
   return Tok::IDENTIFIER;
@@ -136,7 +137,18 @@ Token Scanner::number() {
     
     while (isDigit(peek())) advance();
   }
-  
+
+  // exponent, the source is terminated so looking 2 chars ahead is fine.
+  if (peek() == 'e' || peek() == 'E') {
+    const char *next = current + 1;
+    if (*next == '+' || *next == '-') next++;
+
+    if (isDigit(*next)) {
+      current = next;
+      while (isDigit(peek())) advance();
+    }
+  }
+
   return makeToken(Tok::NUMBER);
 }
 
@@ -173,6 +185,9 @@ Token Scanner::scanToken() {
   case ')': return makeToken(Tok::RIGHT_PAREN);
   case '{': return makeToken(Tok::LEFT_BRACE);
   case '}': return makeToken(Tok::RIGHT_BRACE);
+  case '[': return makeToken(Tok::LEFT_BRACKET);
+  case ']': return makeToken(Tok::RIGHT_BRACKET);
+  case ':': return makeToken(Tok::COLON);
   case ';': return makeToken(Tok::SEMICOLON);
   case ',': return makeToken(Tok::COMMA);
   case '.': return makeToken(Tok::DOT);
@@ -10,7 +10,8 @@ enum class Tok : int {
   // Single-character tokens.     
   LEFT_PAREN, RIGHT_PAREN,
   LEFT_BRACE, RIGHT_BRACE,
-  COMMA, DOT, MINUS, PLUS,
+  LEFT_BRACKET, RIGHT_BRACKET,
+  COLON, COMMA, DOT, MINUS, PLUS,
   SEMICOLON, SLASH, STAR,
 
   // One or two character tokens.           
@@ -26,7 +27,7 @@ enum class Tok : int {
   AND, CLASS, ELSE, FALSE,
   FOR, FUN, IF, NIL, OR,
   PRINT, RETURN, SUPER, THIS,
-  TRUE, VAR, WHILE, 
+  TRUE, VAR, WHILE, YIELD,
 
   ERROR,
   _EOF,
@@ -1,8 +1,12 @@
+#include <cstring>
 #include "HashMap.h"
+#include "SwissGroup.h"
 #include "VM/VM.h"
 
 namespace loxy {
 
+using namespace swiss;
+
 HashMap *HashMap::create(VM &vm) {
   void *mem = vm.reallocate(nullptr, 0, sizeof(HashMap));
 
@@ -15,98 +19,254 @@ void HashMap::destroy(VM &vm, HashMap **mapPtr) {
   if (map == nullptr)  return;
 
   // free owned resource.
-  vm.reallocate(map->entries_, (map->capacityMask_ + 1) * sizeof(Entry), 0);
+  map->freeTable(&map->table_);
+  map->freeTable(&map->old_);
 
   // free itself.
   vm.reallocate(map, sizeof(HashMap), 0);
-  map = nullptr;
+  *mapPtr = nullptr;
 }
 
-Entry *HashMap::_find(String *key) const {
-  Hash index = key->hash() & capacityMask_;
-  Entry *tombstone = nullptr;
+HashMap::Table HashMap::allocateTable(int capacity) {
+  Table table;
+  table.capacity = capacity;
+  table.ctrl = (int8_t*)vm.reallocate(nullptr, 0, allocationSize(capacity));
+  table.keys = reinterpret_cast<String**>(table.ctrl + capacity);
+  table.values = reinterpret_cast<Value*>(table.keys + capacity);
+  memset(table.ctrl, EMPTY, capacity);
+  return table;
+}
 
-  while (true) {
-    Entry *entry = &entries_[index];
-    if (isEmpty(entry)) return tombstone != nullptr ? tombstone : entry;
-    if (isTombstone(entry)) tombstone = entry;
-    if (entry->key == key)  return entry; // found entry
+void HashMap::freeTable(Table *table) {
+  vm.reallocate(table->ctrl, allocationSize(table->capacity), 0);
+  *table = Table();
+}
 
-    index = (index + 1) & capacityMask_;
+int HashMap::_find(const Table &table, String *key) {
+  assert(key->isInterned() && "HashMap keys must be interned");
+  return probe(table.ctrl, table.capacity, key->hash(),
+               [&table, key](int slot) { return table.keys[slot] == key; });
+}
+
+bool HashMap::lookup(String *key, Table **table, int *slot) const {
+  Table *current = const_cast<Table*>(&table_);
+  *slot = _find(*current, key);
+
+  if (*slot == -1 && isMigrating()) {
+    current = const_cast<Table*>(&old_);
+    *slot = _find(*current, key);
   }
+
+  *table = current;
+  return *slot != -1;
+}
+
+String *HashMap::findString(const char *chars, int length, Hash hash) const {
+  // same probe sequence as [_find], comparing chars instead of identity.
+  const Table *tables[] = { &table_, &old_ };
+
+  for (const Table *table : tables) {
+    int slot = probe(table->ctrl, table->capacity, hash, [table, chars, length, hash](int slot) {
+      String *key = table->keys[slot];
+      return key->hash() == hash &&
+             key->length() == length &&
+             memcmp(key->cString(), chars, length) == 0;
+    });
+    if (slot != -1) return table->keys[slot];
+  }
+  return nullptr;
+}
+
+void HashMap::_erase(int slot) {
+  table_.keys[slot] = nullptr;
+  table_.values[slot] = Value::Nil;
+
+  table_.ctrl[slot] = erasedCtrl(table_.ctrl, slot);
+  if (table_.ctrl[slot] == DELETED) tombstones_++;
+}
+
+String *HashMap::lookupKey(String *key) const {
+  if (key->isInterned()) return key;
+  return vm.findString(key->cString(), key->length(), key->hash());
 }
 
 bool HashMap::del(String *key) {
   if (count_ == 0) return false;
+  if (isMigrating()) migrate(TABLE_MIGRATE_GROUPS);
+
+  key = lookupKey(key);
+  if (key == nullptr) return false;
 
-  Entry *entry = _find(key);
-  
-  // empty or tombstone entry
-  if (entry->key == nullptr)  return false;
+  Table *table;
+  int slot;
+  if (!lookup(key, &table, &slot)) return false;
 
-  // set tombstone
-  entry->key = nullptr;
-  entry->value = Value::True;
+  if (table == &table_) {
+    _erase(slot);
+  } else {
+    // [old_] is drained anyway, no need to track its tombstones.
+    old_.ctrl[slot] = DELETED;
+  }
+  count_--;
   return true;
 }
 
 bool HashMap::get(String *key, Value *value) const {
-  if (entries_ == nullptr) return false;
+  if (count_ == 0) return false;
 
-  Entry *entry = _find(key);
+  key = lookupKey(key);
+  if (key == nullptr) return false;
 
-  // empty or tombstone entry
-  if (entry->key == nullptr) return false;
+  Table *table;
+  int slot;
+  if (!lookup(key, &table, &slot)) return false;
 
-  *value = entry->value;
+  *value = table->values[slot];
   return true;
 }
 
 bool HashMap::set(String *key, Value value) {
-  ensureCapacity(count_ + 1);
+  key = vm.intern(key);
+  if (isMigrating()) migrate(TABLE_MIGRATE_GROUPS);
+
+  Table *table;
+  int slot;
+  if (lookup(key, &table, &slot)) {
+    table->values[slot] = value;
+    return false;
+  }
+
+  ensureCapacity(count_ + tombstones_ + 1);
+
+  Hash hash = key->hash();
+  slot = findInsertSlot(table_.ctrl, table_.capacity, hash);
+  if (table_.ctrl[slot] == DELETED) tombstones_--;
+
+  table_.ctrl[slot] = h2(hash);
+  table_.keys[slot] = key;
+  table_.values[slot] = value;
+  count_++;
+  return true;
+}
 
-  Entry *entry = _find(key);
-  bool isNewKey = entry->key == nullptr;
+void HashMap::setIncremental(bool incremental) {
+  incremental_ = incremental;
+  if (!incremental && isMigrating()) migrate(old_.capacity / GROUP_SIZE);
+}
+
+void HashMap::mark() {
+  const Table *tables[] = { &table_, &old_ };
+
+  for (const Table *table : tables) {
+    for (int i = 0; i < table->capacity; i++) {
+      if (table->ctrl[i] < 0) continue;
+
+      vm.markObject(table->keys[i]);
+      vm.markValue(table->values[i]);
+    }
+  }
+}
+
+void HashMap::removeUnmarked() {
+  for (int i = 0; i < table_.capacity; i++) {
+    if (table_.ctrl[i] < 0 || table_.keys[i]->isDark) continue;
+    _erase(i);
+    count_--;
+  }
+
+  for (int i = 0; i < old_.capacity; i++) {
+    if (old_.ctrl[i] < 0 || old_.keys[i]->isDark) continue;
+    old_.ctrl[i] = DELETED;
+    count_--;
+  }
+}
+
+HashMapStats HashMap::stats() const {
+  HashMapStats stats;
+  stats.capacity = table_.capacity;
+  stats.count = count_;
+  stats.tombstones = tombstones_;
+  stats.loadFactor = table_.capacity == 0 ? 0 : (double)(count_ + tombstones_) / table_.capacity;
+  stats.maxProbe = 0;
+  stats.pending = 0;
+
+  long totalProbe = 0;
+  for (int i = 0; i < table_.capacity; i++) {
+    if (table_.ctrl[i] < 0) continue;
 
-  if (isEmpty(entry)) count_++;
+    int probe = probeLength(table_.capacity, table_.keys[i]->hash(), i);
 
-  entry->key = key;
-  entry->value = value;
-  return isNewKey;
+    totalProbe += probe;
+    if (probe > stats.maxProbe) stats.maxProbe = probe;
+  }
+
+  for (int i = 0; i < old_.capacity; i++) {
+    if (old_.ctrl[i] >= 0) stats.pending++;
+  }
+
+  int migrated = count_ - stats.pending;
+  stats.avgProbe = migrated == 0 ? 0 : (double)totalProbe / migrated;
+  return stats;
 }
 
-// [desiredCapMask] will always be 8n - 1.
+// [leastCap] counts tombstones since they occupy slots as well.
 void HashMap::ensureCapacity(int leastCap) {
   // enough memory for now
-  if (capacityMask_ + 1 > leastCap) return;
+  if (leastCap <= table_.capacity * TABLE_MAX_LOAD) return;
 
-  // grow.
-  int capacityMask = growCapacity(capacityMask_ + 1);
-  while (capacityMask + 1 < leastCap) capacityMask = growCapacity(capacityMask + 1) - 1;
+  // a resize outpaced by insertions, finish it first.
+  if (isMigrating()) migrate(old_.capacity / GROUP_SIZE);
+
+  // when at least half of the occupied slots are tombstones, compact to
+  // whatever fits the live entries (possibly shrinking), otherwise grow.
+  int capacity = tombstones_ >= count_ ? growCapacity(0) : growCapacity(table_.capacity);
+  while (count_ + 1 > capacity * TABLE_MAX_LOAD) capacity = growCapacity(capacity);
+
+  resize(capacity);
+}
 
-  Entry *entries = (Entry*)vm.reallocate(nullptr, 0, (capacityMask + 1) * sizeof(Entry));
-  for (int i = 0; i <= capacityMask; i++) {
-    // initialization
-    entries[i] = Entry();
+void HashMap::resize(int capacity) {
+  // allocate first, a collection may remove entries from the current table.
+  Table table = allocateTable(capacity);
+
+  old_ = table_;
+  table_ = table;
+  tombstones_ = 0;
+  migrated_ = 0;
+
+  // shrinking tables are migrated at once, they might not get enough
+  // insertions to drain the old table.
+  if (incremental_ && old_.capacity >= TABLE_INCREMENTAL_MIN && capacity >= old_.capacity) {
+    migrate(TABLE_MIGRATE_GROUPS);
+  } else {
+    migrate(old_.capacity / GROUP_SIZE);
   }
+}
 
-  // filter tombstone
-  count_ = 0;
-  for (int i = 0; i <= capacityMask_; i++) {
-    Entry *entry = &entries_[i];
-    if (entry->key == nullptr) continue;
+void HashMap::migrate(int groups) {
+  int totalGroups = old_.capacity / GROUP_SIZE;
+  int end = migrated_ + groups < totalGroups ? migrated_ + groups : totalGroups;
 
-    Entry *dest = _find(entry->key);
-    dest->key = entry->key;
-    dest->value = entry->value;
+  for (int i = migrated_ * GROUP_SIZE; i < end * GROUP_SIZE; i++) {
+    if (old_.ctrl[i] < 0) continue;
 
-    count_++;
+    Hash hash = old_.keys[i]->hash();
+    int slot = findInsertSlot(table_.ctrl, table_.capacity, hash);
+    if (table_.ctrl[slot] == DELETED) tombstones_--;
+
+    table_.ctrl[slot] = h2(hash);
+    table_.keys[slot] = old_.keys[i];
+    table_.values[slot] = old_.values[i];
+
+    // keeps the probe sequences of [old_] intact.
+    old_.ctrl[i] = DELETED;
   }
 
-  // free old entries
-  vm.reallocate(entries_, (capacityMask_ + 1) * sizeof(Entry), 0);
-  entries_ = entries;
-  capacityMask_ = capacityMask;
+  migrated_ = end;
+  if (migrated_ == totalGroups) {
+    freeTable(&old_);
+    migrated_ = 0;
+  }
 }
 
 } // namespace loxy
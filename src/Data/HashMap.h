@@ -2,6 +2,7 @@
 #define loxy_hash_map_h
 
 #include "Common.h"
+#include "SwissGroup.h"
 #include "Value.h"
 #include "VM/Managed.h"
 
@@ -10,67 +11,162 @@ namespace loxy
 
 class String;
 class VM;
-class StringPool;
 
 typedef uint32_t Hash;
 
-struct Entry {
-  // TODO: replace [key] with Value.
-  // 
-  String *key;
-  Value value;
+// HashMapStats - a snapshot of a HashMap's occupancy, see [HashMap::stats].
+struct HashMapStats {
+  int capacity;
 
-  // an empty entry
-  Entry()
-  : key(nullptr),
-    value(Value::Nil) {}
+  // number of live entries.
+  int count;
+
+  // number of deleted entries still occupying slots.
+  int tombstones;
+
+  // (count + tombstones) / capacity.
+  double loadFactor;
+
+  // number of groups visited to reach a live entry, average & worst case.
+  double avgProbe;
+  int maxProbe;
+
+  // live entries not migrated yet by an incremental resize.
+  int pending;
 };
 
+// class HashMap - an open addressing hash map from interned strings to values.
+//
+//  The layout follows Swiss tables (see SwissGroup.h): slots are split into
+//  groups of 16, & each slot has a control byte which is either EMPTY,
+//  DELETED or the lowest 7 bits of the hash of its key. A lookup compares a whole
+//  group of control bytes at once (SSE2 where available), & only touches the
+//  keys whose control byte matches. Keys & values live in separate arrays.
+//
+//  Large tables grow incrementally: the old table stays live & every
+//  insertion or deletion moves a few of its groups to the new one, while
+//  lookups consult both. Each key lives in exactly one of them.
 class HashMap : public Managed {
-  // StringPool will search from [entries_].
-  friend class StringPool;
-
 private:
+  // Table - [capacity] control bytes, keys & values, carved from one allocation.
+  struct Table {
+    int capacity;
+    int8_t *ctrl;
+    String **keys;
+    Value *values;
+
+    Table() : capacity(0), ctrl(nullptr), keys(nullptr), values(nullptr) {}
+  };
+
   VM &vm;
 
-  // number of entries
+  // number of live entries, in both tables.
   int count_;
 
-  // capacity is always 8n. This mask is 8n - 1.
-  int capacityMask_;
+  // number of tombstones in [table_]. Tombstones occupy slots until the next resize.
+  int tombstones_;
+
+  // capacity is always 16 * 2^n, or 0.
+  Table table_;
+
+  // the table being migrated to [table_], empty if there's no resize going on.
+  Table old_;
+
+  // groups of [old_] migrated so far.
+  int migrated_;
 
-  // blob of memory holding entries
-  Entry *entries_;
+  // whether large tables grow incrementally.
+  bool incremental_;
 
-  static bool isEmpty(Entry *entry) { return entry->key == nullptr && entry->value == Value::Nil; }
-  static bool isTombstone(Entry *entry) { return entry->key == nullptr && entry->value == Value::True; }
+  // returns the slot of [table] holding [key], -1 if there's none.
+  // [key] must be interned.
+  static int _find(const Table &table, String *key);
 
-  // find an entry from [entries]. This method will always return since
-  // [key] is hashable.
-  Entry *_find(String *key) const;
+  // looks [key] up in both tables.
+  bool lookup(String *key, Table **table, int *slot) const;
 
-  // ensures entries has at least [desiredCap].
+  // turns [slot] of [table_] into a tombstone, or an empty slot when that's safe.
+  void _erase(int slot);
+
+  // returns the interned string equal to [key], nullptr if there is none.
+  String *lookupKey(String *key) const;
+
+  // ensures entries has room for [leastCap] occupied slots under TABLE_MAX_LOAD.
+  //  when most occupied slots are tombstones, the table is rehashed to fit the
+  //  live entries instead of being grown.
   void ensureCapacity(int leastCap);
-  int growCapacity(int old) { return old < 8 ? 8 : old * 2; }
+  int growCapacity(int old) { return old < swiss::GROUP_SIZE ? swiss::GROUP_SIZE : old * 2; }
+
+  // rehashes live entries into a table of [capacity] slots, dropping tombstones.
+  //  large tables are migrated incrementally when growing.
+  void resize(int capacity);
+
+  // migrate - moves up to [groups] groups from [old_] to [table_].
+  void migrate(int groups);
+  bool isMigrating() const { return old_.capacity != 0; }
+
+  Table allocateTable(int capacity);
+  void freeTable(Table *table);
+
+  static size_t allocationSize(int capacity) {
+    return capacity * (sizeof(int8_t) + sizeof(String*) + sizeof(Value));
+  }
 
   HashMap(VM &vm)
   : vm(vm),
     count_(0),
-    capacityMask_(-1),
-    entries_(nullptr) {}
+    tombstones_(0),
+    migrated_(0),
+    incremental_(true) {}
 
 public:
 
   static HashMap *create(VM &vm);
   static void destroy(VM &vm, HashMap **map);
 
+  int count() const { return count_; }
+  int capacity() const { return table_.capacity; }
+
+  // setIncremental - turns incremental resizing on/off, on by default.
+  //  turning it off finishes a resize going on.
+  void setIncremental(bool incremental);
+
+  // keys are compared by identity: [set] interns transient keys, [get] & [del]
+  // look up their interned counterpart. Callers keep [key] & [value] reachable,
+  // [set] may trigger a collection.
+  //
   // sets entry with [key] to a tombstone if it exists. returns true indicating success.
   bool del(String *key);
   bool get(String *key, Value *result) const;
   bool set(String *key, Value value);
+
+  // findString - looks up a key by its chars, used by the string pool.
+  String *findString(const char *chars, int length, Hash hash) const;
+
+  // each - calls [fn] with the key & value of every entry, in no particular
+  //  order. [fn] must not change the map.
+  template <typename Fn>
+  void each(Fn fn) const {
+    const Table *tables[] = { &table_, &old_ };
+    for (const Table *table : tables) {
+      for (int i = 0; i < table->capacity; i++) {
+        if (table->ctrl[i] >= 0) fn(table->keys[i], table->values[i]);
+      }
+    }
+  }
+
+  // mark - marks every key & value as reachable.
+  void mark();
+
+  // removeUnmarked - turns entries whose key was not marked by the current
+  //  collection into tombstones. Used by weak tables.
+  void removeUnmarked();
+
+  // stats - walks the table & reports its occupancy.
+  HashMapStats stats() const;
 };
 
 } // namespace loxy
 
 
-#endif
\ No newline at end of file
+#endif
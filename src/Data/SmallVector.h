@@ -1,84 +1,128 @@
 #ifndef loxy_small_vector_h
 #define loxy_small_vector_h
 
+#include <cstring>
+#include <new>
+#include <type_traits>
+#include <utility>
 #include "Common.h"
-#include "Managed.h"
 #include "VM/VM.h"
 
 namespace loxy {
 
 // class SmallVector - a vector class used by Loxy's VM.
-//  T must be primitive types or pointer types.
-template<typename T>
-class SmallVector : public Managed {
-  friend class VM;
+//  The first [N] elements live inline, in the vector itself; the buffer
+//  only moves to the heap once it outgrows them. Instances can live on the
+//  stack or inside other objects, [create] & [destroy] are there for the
+//  ones that must be heap allocated.
+//
+//  Heap buffers are allocated through [VM::reallocate] so they're counted
+//  towards the next collection, hence the [VM] reference.
+template<typename T, int N>
+class SmallVector {
+  static_assert(N > 0, "SmallVector needs at least one inline element");
 
 public:
-  static const size_t MIN_CAP = 8;
-  static const size_t GROW_PERCENT = 2;
+  static const int GROW_FACTOR = 2;
 
 private:
   VM &vm;
   int count_;
   int capacity_;
 
-  // underlying blob of memory
+  // points to [inline_] or to a heap buffer of [capacity_] elements.
   T *buffer_;
 
-  explicit SmallVector(VM &vm, size_t cap = MIN_CAP)
+  // storage of the first [N] elements.
+  alignas(T) unsigned char inline_[N * sizeof(T)];
+
+  T *inlineBuffer() { return reinterpret_cast<T*>(inline_); }
+  const T *inlineBuffer() const { return reinterpret_cast<const T*>(inline_); }
+
+public:
+
+  explicit SmallVector(VM &vm)
   : vm(vm),
     count_(0),
-    capacity_(0),
-    buffer_(nullptr) {
-    ensureCapacity(cap < MIN_CAP ? MIN_CAP : cap);
+    capacity_(N),
+    buffer_(inlineBuffer()) {}
+
+  SmallVector(SmallVector &&another)
+  : vm(another.vm),
+    count_(0),
+    capacity_(N),
+    buffer_(inlineBuffer()) {
+    takeFrom(another);
   }
 
-public:
+  SmallVector &operator=(SmallVector &&another) {
+    if (this != &another) {
+      clear();
+      takeFrom(another);
+    }
+    return *this;
+  }
+
+  // avoid copy, buffers are owned.
+  SmallVector(const SmallVector &) = delete;
+  SmallVector &operator=(const SmallVector &) = delete;
+
+  ~SmallVector() { clear(); }
 
   // creates a VM managed SmallVector instance.
-  static SmallVector<T> *create(VM &vm, size_t cap = MIN_CAP) {
-    void *mem = vm.reallocate(nullptr, 0, sizeof(SmallVector<T>));
+  static SmallVector *create(VM &vm) {
+    void *mem = vm.reallocate(nullptr, 0, sizeof(SmallVector));
 
     assert(mem != nullptr && "Out of memory");
-    return ::new(mem) SmallVector<T>(vm, cap);
+    return ::new(mem) SmallVector(vm);
   }
 
-  static void destroy(VM &vm, SmallVector<T> **vector) {
+  static void destroy(VM &vm, SmallVector **vector) {
     if (*vector == nullptr) return;
 
-    // free buffer_
-    vm.reallocate((*vector)->buffer_, (*vector)->capacity_ * sizeof(T), 0);
-    (*vector)->count_ = 0;
-    (*vector)->capacity_ = 0;
-    (*vector)->buffer_ = nullptr;
-
-    // free the vector itself
-    vm.reallocate(*vector, sizeof(SmallVector<T>), 0);
+    (*vector)->~SmallVector();
+    vm.reallocate(*vector, sizeof(SmallVector), 0);
     (*vector) = nullptr;
   }
 
-  void freeChildren() {
-    vm.reallocate(buffer_, capacity_ * sizeof(T), 0);
-  }
-
   int count() const { return count_; }
   int capacity() const { return capacity_; }
   bool isEmpty() const { return count_ == 0; }
 
-  void push(T elem) {
-    ensureCapacity(count_ + 1);
-    buffer_[count_++] = elem;
+  // true while the elements are stored inline.
+  bool isSmall() const { return buffer_ == inlineBuffer(); }
+
+  T *data() { return buffer_; }
+  const T *data() const { return buffer_; }
+
+  T *begin() { return buffer_; }
+  T *end() { return buffer_ + count_; }
+  const T *begin() const { return buffer_; }
+  const T *end() const { return buffer_ + count_; }
+
+  void push(const T &elem) { emplace(elem); }
+  void push(T &&elem) { emplace(std::move(elem)); }
+
+  template<int M>
+  void push(const SmallVector<T, M> &another) {
+    reserve(count_ + another.count());
+    for (int i = 0; i < another.count(); i++) ::new(buffer_ + count_++) T(another[i]);
   }
 
-  void push(const SmallVector<T> &another) {
-    ensureCapacity(count_ + another.count_);
-    for (int i = 0; i < another.count_; i++) buffer_[count_++] = another[i];
+  // constructs an element in place from [args]. [args] may refer to
+  // elements of this vector.
+  template<typename... Args>
+  T &emplace(Args&&... args) {
+    if (count_ == capacity_) return growAndEmplace(std::forward<Args>(args)...);
+
+    ::new(buffer_ + count_) T(std::forward<Args>(args)...);
+    return buffer_[count_++];
   }
 
   T pop() {
     assert(count_ > 0 && "Popping an empty vector!");
-    T elem = buffer_[count_ - 1];
-    count_--;
+    T elem = std::move(buffer_[count_ - 1]);
+    buffer_[--count_].~T();
     return elem;
   }
 
@@ -92,19 +136,42 @@ public:
     return buffer_[index];
   }
 
-  T back() {
+  T &back() {
     assert(count_ > 0 && "Reading an empty vector!");
     return buffer_[count_ - 1];
   }
 
+  const T &back() const {
+    assert(count_ > 0 && "Reading an empty vector!");
+    return buffer_[count_ - 1];
+  }
+
+  // removes every element but keeps the buffer.
   void reset() {
+    destroyRange(buffer_, buffer_ + count_);
     count_ = 0;
   }
 
+  // removes every element & releases the heap buffer, if any.
   void clear() {
-    vm.reallocate(buffer_, capacity_ * sizeof(T), 0);
-    count_ = 0;
-    capacity_ = 0;
+    reset();
+    if (!isSmall()) {
+      vm.reallocate(buffer_, capacity_ * sizeof(T), 0);
+      buffer_ = inlineBuffer();
+      capacity_ = N;
+    }
+  }
+
+  // makes room for at least [cap] elements.
+  void reserve(int cap) {
+    if (cap > capacity_) moveTo(cap);
+  }
+
+  // releases unused capacity, moving the elements back inline when
+  // they fit.
+  void shrinkToFit() {
+    if (isSmall() || count_ == capacity_) return;
+    moveTo(count_ <= N ? N : count_);
   }
 
   int indexOf(const T& elem) const {
@@ -116,21 +183,85 @@ public:
 
 private:
 
-  inline void ensureCapacity(size_t size) {
-    // enough memory for now.
-    if (capacity_ > size) return;
+  static void destroyRange(T *first, T *last) {
+    if (std::is_trivially_destructible<T>::value) return;
+    for (; first != last; ++first) first->~T();
+  }
 
-    // grow
-    int newCap = capacity_ == 0 ? MIN_CAP : capacity_ * GROW_PERCENT;
-    while (newCap < size) newCap *= GROW_PERCENT;
-    
-    // update
-    buffer_ = (T*)vm.reallocate(buffer_, capacity_ * sizeof(T), newCap * sizeof(T));
+  // moves [count] elements from [from] to uninitialized [to].
+  static void relocate(T *from, int count, T *to) {
+    if (std::is_trivially_copyable<T>::value) {
+      if (count > 0) memcpy((void*)to, (const void*)from, count * sizeof(T));
+      return;
+    }
+
+    for (int i = 0; i < count; i++) {
+      ::new(to + i) T(std::move(from[i]));
+      from[i].~T();
+    }
+  }
+
+  int grownCapacity(int least) const {
+    int newCap = capacity_ * GROW_FACTOR;
+    return newCap < least ? least : newCap;
+  }
+
+  T *allocate(int cap) {
+    // may collect, the current buffer stays valid meanwhile.
+    T *mem = (T*)vm.reallocate(nullptr, 0, cap * sizeof(T));
+    assert(mem != nullptr && "Out of memory");
+    return mem;
+  }
+
+  void release(T *buffer, int cap) {
+    if (buffer != inlineBuffer()) vm.reallocate(buffer, cap * sizeof(T), 0);
+  }
+
+  // moves the elements to a buffer of [cap] elements, the inline one if
+  // [cap] is [N].
+  void moveTo(int cap) {
+    assert(cap >= count_ && "Buffer too small!");
+    T *newBuffer = cap == N ? inlineBuffer() : allocate(cap);
+
+    relocate(buffer_, count_, newBuffer);
+    release(buffer_, capacity_);
+    buffer_ = newBuffer;
+    capacity_ = cap;
+  }
+
+  template<typename... Args>
+  T &growAndEmplace(Args&&... args) {
+    int newCap = grownCapacity(count_ + 1);
+    T *newBuffer = allocate(newCap);
+
+    // construct first, [args] may live in the old buffer.
+    ::new(newBuffer + count_) T(std::forward<Args>(args)...);
+
+    relocate(buffer_, count_, newBuffer);
+    release(buffer_, capacity_);
+    buffer_ = newBuffer;
     capacity_ = newCap;
+    return buffer_[count_++];
+  }
+
+  // takes [another]'s elements, leaving it empty.
+  void takeFrom(SmallVector &another) {
+    assert(&vm == &another.vm && "Vectors of different VMs!");
+
+    if (another.isSmall()) {
+      relocate(another.buffer_, another.count_, buffer_);
+    } else {
+      buffer_ = another.buffer_;
+      capacity_ = another.capacity_;
+      another.buffer_ = another.inlineBuffer();
+      another.capacity_ = N;
+    }
+    count_ = another.count_;
+    another.count_ = 0;
   }
 };
 
 } // namespace loxy
 
 
-#endif
\ No newline at end of file
+#endif
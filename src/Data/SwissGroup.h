@@ -0,0 +1,134 @@
+#ifndef loxy_swiss_group_h
+#define loxy_swiss_group_h
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "Common.h"
+
+namespace loxy {
+
+// Helpers shared by the Swiss table layouts of HashMap & ValueMap.
+//
+//  every slot has a control byte which is EMPTY, DELETED, or the lowest 7
+//  bits of the hash of its key. Control bytes are matched a group at a time.
+namespace swiss {
+
+static const int GROUP_SIZE = 16;
+
+static const int8_t EMPTY = -128;   // 0b10000000
+static const int8_t DELETED = -2;   // 0b11111110
+
+// h1 picks the group a probe starts at, h2 is stored in control bytes.
+inline uint32_t h1(uint32_t hash) { return hash >> 7; }
+inline int8_t h2(uint32_t hash) { return (int8_t)(hash & 0x7f); }
+
+// Group - the control bytes of one group, matched all at once.
+//  every match returns a bitmask where bit i stands for the i-th slot.
+struct Group {
+#ifdef __SSE2__
+  __m128i ctrl;
+
+  explicit Group(const int8_t *pos)
+    : ctrl(_mm_loadu_si128(reinterpret_cast<const __m128i*>(pos))) {}
+
+  uint32_t match(int8_t byte) const {
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(byte)));
+  }
+
+  // empty & deleted are the only control bytes with the sign bit set.
+  uint32_t matchEmptyOrDeleted() const {
+    return _mm_movemask_epi8(ctrl);
+  }
+#else
+  const int8_t *ctrl;
+
+  explicit Group(const int8_t *pos) : ctrl(pos) {}
+
+  uint32_t match(int8_t byte) const {
+    uint32_t mask = 0;
+    for (int i = 0; i < GROUP_SIZE; i++) {
+      if (ctrl[i] == byte) mask |= 1u << i;
+    }
+    return mask;
+  }
+
+  uint32_t matchEmptyOrDeleted() const {
+    uint32_t mask = 0;
+    for (int i = 0; i < GROUP_SIZE; i++) {
+      if (ctrl[i] < 0) mask |= 1u << i;
+    }
+    return mask;
+  }
+#endif
+
+  uint32_t matchEmpty() const { return match(EMPTY); }
+};
+
+// lowest set bit of [mask], which must not be 0.
+inline int lowestBit(uint32_t mask) { return __builtin_ctz(mask); }
+
+// the probe sequence visits groups h1, h1 + 1, h1 + 3, h1 + 6, ... which
+// covers every group since the number of groups is a power of 2. Probing
+// stops at the first group with an empty slot: the key would have been
+// inserted there.
+//
+// returns the first slot whose key satisfies [match], -1 if there's none.
+template<typename Match>
+inline int probe(const int8_t *ctrl, int capacity, uint32_t hash, Match match) {
+  if (capacity == 0) return -1;
+
+  int8_t tag = h2(hash);
+  int groupMask = capacity / GROUP_SIZE - 1;
+  int group = h1(hash) & groupMask;
+
+  for (int step = 1; ; step++) {
+    int base = group * GROUP_SIZE;
+    Group g(ctrl + base);
+
+    for (uint32_t mask = g.match(tag); mask != 0; mask &= mask - 1) {
+      int slot = base + lowestBit(mask);
+      if (match(slot)) return slot;
+    }
+    if (g.matchEmpty() != 0) return -1;
+
+    group = (group + step) & groupMask;
+  }
+}
+
+// returns the first empty or deleted slot on the probe sequence of [hash].
+inline int findInsertSlot(const int8_t *ctrl, int capacity, uint32_t hash) {
+  int groupMask = capacity / GROUP_SIZE - 1;
+  int group = h1(hash) & groupMask;
+
+  for (int step = 1; ; step++) {
+    int base = group * GROUP_SIZE;
+    uint32_t mask = Group(ctrl + base).matchEmptyOrDeleted();
+    if (mask != 0) return base + lowestBit(mask);
+
+    group = (group + step) & groupMask;
+  }
+}
+
+// a group that still has an empty slot has never been full, so no probe
+// sequence ever went past it & an erased slot can simply become empty
+// again. Returns the control byte for erasing [slot].
+inline int8_t erasedCtrl(const int8_t *ctrl, int slot) {
+  return Group(ctrl + (slot & ~(GROUP_SIZE - 1))).matchEmpty() != 0 ? EMPTY : DELETED;
+}
+
+// number of groups visited to reach [slot] from the start of [hash]'s probe.
+inline int probeLength(int capacity, uint32_t hash, int slot) {
+  int groupMask = capacity / GROUP_SIZE - 1;
+  int group = h1(hash) & groupMask;
+  int length = 1;
+  for (int step = 1; group != slot / GROUP_SIZE; step++, length++) {
+    group = (group + step) & groupMask;
+  }
+  return length;
+}
+
+} // namespace swiss
+} // namespace loxy
+
+#endif
@@ -0,0 +1,190 @@
+#include <cstring>
+#include "ValueMap.h"
+#include "VM/VM.h"
+
+namespace loxy {
+
+using namespace swiss;
+
+ValueMap *ValueMap::create(VM &vm) {
+  void *mem = vm.reallocate(nullptr, 0, sizeof(ValueMap));
+
+  assert(mem != nullptr && "Out of memory!");
+  return ::new(mem) ValueMap(vm);
+}
+
+void ValueMap::destroy(VM &vm, ValueMap **mapPtr) {
+  ValueMap *map = *mapPtr;
+  if (map == nullptr)  return;
+
+  // free owned resource.
+  vm.reallocate(map->ctrl_, allocationSize(map->capacity_), 0);
+
+  // free itself.
+  vm.reallocate(map, sizeof(ValueMap), 0);
+  *mapPtr = nullptr;
+}
+
+// ints that convert to doubles exactly are stored as such, so they share
+// the number paths with doubles. Other ints never equal a double.
+static Value normalize(Value key) {
+  if (key.isInt() && Value::isExactDouble(key.asInt())) return Value((double)key.asInt());
+  return key;
+}
+
+int ValueMap::_find(Value key) const {
+  if (key.isDouble()) return _findNumber((double)key);
+
+  return probe(ctrl_, capacity_, key.hash(),
+               [this, &key](int slot) { return keys_[slot] == key; });
+}
+
+int ValueMap::_findNumber(double key) const {
+  Hash hash = Value::hashNumber(key);
+
+  // all keys are numbers, compare the doubles right away.
+  if (numberKeys_) {
+    return probe(ctrl_, capacity_, hash,
+                 [this, key](int slot) { return (double)keys_[slot] == key; });
+  }
+
+  return probe(ctrl_, capacity_, hash, [this, key](int slot) {
+    return keys_[slot].isDouble() && (double)keys_[slot] == key;
+  });
+}
+
+void ValueMap::_insert(Value key, Value value) {
+  ensureCapacity(count_ + tombstones_ + 1);
+
+  Hash hash = key.hash();
+  int slot = findInsertSlot(ctrl_, capacity_, hash);
+  if (ctrl_[slot] == DELETED) tombstones_--;
+
+  ctrl_[slot] = h2(hash);
+  keys_[slot] = key;
+  values_[slot] = value;
+  count_++;
+  if (!key.isDouble()) numberKeys_ = false;
+}
+
+void ValueMap::_erase(int slot) {
+  keys_[slot] = Value::Nil;
+  values_[slot] = Value::Nil;
+  count_--;
+
+  ctrl_[slot] = erasedCtrl(ctrl_, slot);
+  if (ctrl_[slot] == DELETED) tombstones_++;
+}
+
+bool ValueMap::get(Value key, Value *result) const {
+  if (count_ == 0) return false;
+
+  int slot = _find(normalize(key));
+  if (slot == -1) return false;
+
+  *result = values_[slot];
+  return true;
+}
+
+bool ValueMap::getNumber(double key, Value *result) const {
+  if (count_ == 0) return false;
+
+  int slot = _findNumber(key);
+  if (slot == -1) return false;
+
+  *result = values_[slot];
+  return true;
+}
+
+bool ValueMap::set(Value key, Value value) {
+  key = normalize(key);
+  int slot = _find(key);
+  if (slot != -1) {
+    values_[slot] = value;
+    return false;
+  }
+
+  _insert(key, value);
+  return true;
+}
+
+bool ValueMap::setNumber(double key, Value value) {
+  int slot = _findNumber(key);
+  if (slot != -1) {
+    values_[slot] = value;
+    return false;
+  }
+
+  _insert(Value(key), value);
+  return true;
+}
+
+bool ValueMap::del(Value key) {
+  if (count_ == 0) return false;
+
+  int slot = _find(normalize(key));
+  if (slot == -1) return false;
+
+  _erase(slot);
+  return true;
+}
+
+void ValueMap::clear() {
+  vm.reallocate(ctrl_, allocationSize(capacity_), 0);
+  ctrl_ = nullptr;
+  keys_ = values_ = nullptr;
+  count_ = tombstones_ = capacity_ = 0;
+  numberKeys_ = true;
+}
+
+void ValueMap::mark() {
+  for (int i = 0; i < capacity_; i++) {
+    if (ctrl_[i] < 0) continue;
+
+    vm.markValue(keys_[i]);
+    vm.markValue(values_[i]);
+  }
+}
+
+void ValueMap::ensureCapacity(int leastCap) {
+  // enough memory for now
+  if (leastCap <= capacity_ * TABLE_MAX_LOAD) return;
+
+  int capacity = tombstones_ >= count_ ? growCapacity(0) : growCapacity(capacity_);
+  while (count_ + 1 > capacity * TABLE_MAX_LOAD) capacity = growCapacity(capacity);
+
+  resize(capacity);
+}
+
+void ValueMap::resize(int capacity) {
+  int8_t *ctrl = (int8_t*)vm.reallocate(nullptr, 0, allocationSize(capacity));
+  memset(ctrl, EMPTY, capacity);
+
+  int8_t *oldCtrl = ctrl_;
+  Value *oldKeys = keys_;
+  Value *oldValues = values_;
+  int oldCapacity = capacity_;
+
+  ctrl_ = ctrl;
+  keys_ = reinterpret_cast<Value*>(ctrl + capacity);
+  values_ = keys_ + capacity;
+  capacity_ = capacity;
+  tombstones_ = 0;
+
+  // deleted keys no longer count against the number path.
+  numberKeys_ = true;
+  for (int i = 0; i < oldCapacity; i++) {
+    if (oldCtrl[i] < 0) continue;
+
+    Hash hash = oldKeys[i].hash();
+    int slot = findInsertSlot(ctrl_, capacity_, hash);
+    ctrl_[slot] = h2(hash);
+    keys_[slot] = oldKeys[i];
+    values_[slot] = oldValues[i];
+    if (!oldKeys[i].isDouble()) numberKeys_ = false;
+  }
+
+  vm.reallocate(oldCtrl, allocationSize(oldCapacity), 0);
+}
+
+} // namespace loxy
@@ -0,0 +1,116 @@
+#ifndef loxy_value_map_h
+#define loxy_value_map_h
+
+#include "Common.h"
+#include "SwissGroup.h"
+#include "Value.h"
+#include "VM/Managed.h"
+
+namespace loxy
+{
+
+class VM;
+
+typedef uint32_t Hash;
+
+// class ValueMap - a hash map from values to values, backing loxy maps &
+//  the constant pool of chunks.
+//
+//  Same Swiss table layout as HashMap. Keys hash through [Value::hash]:
+//  numbers by their normalized bits, strings by their cached hash, so keys
+//  compare by content & need no interning. Ints that doubles represent
+//  exactly are stored as doubles. While every key is a double, number
+//  lookups take a path that compares raw doubles.
+//
+//  NaN never equals itself & can't be found once inserted, callers reject it.
+class ValueMap : public Managed {
+private:
+  VM &vm;
+
+  // number of live entries
+  int count_;
+
+  // number of tombstones. Tombstones occupy slots until the next resize.
+  int tombstones_;
+
+  // capacity is always 16 * 2^n, or 0.
+  int capacity_;
+
+  // [capacity_] control bytes, keys & values, carved from one allocation.
+  int8_t *ctrl_;
+  Value *keys_;
+  Value *values_;
+
+  // true while every key is a double.
+  bool numberKeys_;
+
+  // returns the slot holding [key], -1 if there's none.
+  int _find(Value key) const;
+  int _findNumber(double key) const;
+
+  // inserts a new entry, [key] must not be in the map.
+  void _insert(Value key, Value value);
+
+  void _erase(int slot);
+
+  // same policy as HashMap::ensureCapacity.
+  void ensureCapacity(int leastCap);
+  int growCapacity(int old) { return old < swiss::GROUP_SIZE ? swiss::GROUP_SIZE : old * 2; }
+  void resize(int capacity);
+
+  static size_t allocationSize(int capacity) {
+    return capacity * (sizeof(int8_t) + 2 * sizeof(Value));
+  }
+
+  ValueMap(VM &vm)
+  : vm(vm),
+    count_(0),
+    tombstones_(0),
+    capacity_(0),
+    ctrl_(nullptr),
+    keys_(nullptr),
+    values_(nullptr),
+    numberKeys_(true) {}
+
+public:
+
+  static ValueMap *create(VM &vm);
+  static void destroy(VM &vm, ValueMap **map);
+
+  int count() const { return count_; }
+  int capacity() const { return capacity_; }
+
+  // returns true if [key] exists & writes its value to [result].
+  bool get(Value key, Value *result) const;
+
+  // returns true if [key] is a new key. Callers keep [key] & [value]
+  // reachable, [set] may trigger a collection.
+  bool set(Value key, Value value);
+
+  // removes [key]. returns true if it existed.
+  bool del(Value key);
+
+  // removes every entry & frees the table.
+  void clear();
+
+  // number keyed versions of [get] & [set], no boxing on the fast path.
+  bool getNumber(double key, Value *result) const;
+  bool setNumber(double key, Value value);
+
+  // each - calls [fn] with the key & value of every entry, in no particular
+  //  order. [fn] must not change the map.
+  template <typename Fn>
+  void each(Fn fn) const {
+    for (int i = 0; i < capacity_; i++) {
+      if (ctrl_[i] >= 0) fn(keys_[i], values_[i]);
+    }
+  }
+
+  // mark - marks every key & value as reachable.
+  void mark();
+};
+
+} // namespace loxy
+
+
+#endif
@@ -1,6 +1,8 @@
 #include <stdio.h>
 #include "Data/SmallVector.h"
+#include "Data/ValueMap.h"
 #include "Chunk.h"
+#include "Jit.h"
 #include "Value.h"
 #include "VM.h"
 
@@ -10,52 +12,71 @@ Chunk *Chunk::create(VM &vm) {
   void *mem = vm.reallocate(nullptr, 0, sizeof(Chunk));
   assert(mem != nullptr && "Out of memory");
 
-  auto code_ = SmallVector<uint8_t>::create(vm);
-  auto lines_ = SmallVector<int>::create(vm);
-  auto constants_ = SmallVector<Value>::create(vm);
+  auto constantIndex_ = ValueMap::create(vm);
 
-  return ::new(mem) Chunk(vm, code_, lines_, constants_);
+  return ::new(mem) Chunk(vm, constantIndex_);
 }
 
 void Chunk::destroy(VM &vm, Chunk **chunk) {
   if (*chunk == nullptr)  return;
 
   // free owned resources.
-  SmallVector<uint8_t>::destroy(vm, &((*chunk)->code_));
-  SmallVector<int>::destroy(vm, &((*chunk)->lines_));
-  SmallVector<Value>::destroy(vm, &((*chunk)->constants_));
+  ValueMap::destroy(vm, &((*chunk)->constantIndex_));
+  JitCode::destroy(vm, &((*chunk)->jit_));
+  (*chunk)->~Chunk();
 
   // free chunk itself
   vm.reallocate(*chunk, sizeof(Chunk), 0);
   *chunk = nullptr;
 }
 
-uint8_t Chunk::read(size_t offset) const { return code()[offset]; }
-
-size_t Chunk::size() const noexcept { return code_->count(); }
-
 void Chunk::write(uint8_t byte, int line) {
-  code_->push(byte);
-  lines_->push(byte);
+  code_.push(byte);
+  lines_.push(line);
+  maxStack_ = -1;
 }
 
 void Chunk::clear() {
-  code_->clear();
-  lines_->clear();
-  constants_->clear();
+  code_.clear();
+  lines_.clear();
+  constants_.clear();
+  caches_.clear();
+  constantIndex_->clear();
+  maxStack_ = -1;
 }
 
 int Chunk::addConstant(Value value) {
   // check for existence.
-  if (constants_->indexOf(value) != -1) return constants_->indexOf(value);
+  // 1 & 1.0 are equal keys but different constants.
+  Value index;
+  if (constantIndex_->get(value, &index) &&
+      constants_[(int)(double)index].isInt() == value.isInt()) {
+    return (int)(double)index;
+  }
 
-  constants_->push(value);
-  return constants_->count() - 1;
+  constants_.push(value);
+  // [value] is reachable from the pool by now.
+  constantIndex_->set(value, Value((double)(constants_.count() - 1)));
+  return constants_.count() - 1;
 }
 
-Value Chunk::getConstant(size_t index) const {
-  assert(index < constants_->count() && "Index is too large in constant pool");
-  return constants()[index];
+int Chunk::addCache() {
+  PropertyCache cache = {};
+  caches_.push(cache);
+  return caches_.count() - 1;
+}
+
+void Chunk::mark(VM &vm) const {
+  for (int i = 0; i < constants_.count(); i++) vm.markValue(constants()[i]);
+
+  // cached shapes must outlive the code, or another shape could take
+  // their place.
+  for (const PropertyCache &cache : caches_) {
+    for (int i = 0; i < cache.count; i++) {
+      vm.markObject(cache.entries[i].shape);
+      vm.markObject(cache.entries[i].target);
+    }
+  }
 }
 
 //----========= helpers for printing chunks ===========----//
@@ -89,6 +110,44 @@ static int jumpInst(const char *name, int sign, Chunk *chunk, int offset)
   return offset + 3;
 }
 
+static int forInst(const char *name, Chunk *chunk, int offset)
+{
+  const uint8_t *code = chunk->code().data() + offset;
+  uint16_t back = (uint16_t)(code[5] << 8 | code[6]);
+  uint16_t done = (uint16_t)(code[7] << 8 | code[8]);
+  printf("%-16s %4d flags %02x limit %d step %d -> %d, %d\n", name, code[1], code[2],
+    code[3], code[4], offset + 9 - back, offset + 9 + done);
+  return offset + 9;
+}
+
+// lists the captures of the function after it.
+static int closureInst(const char *name, Chunk *chunk, int offset)
+{
+  int result = constInst(name, chunk, offset);
+
+  Function *function = static_cast<Function*>((Object*)chunk->getConstant(chunk->code()[offset + 1]));
+  for (int i = 0; i < function->captureCount; i++) {
+    const Capture &capture = function->captures[i];
+    printf("     |                     %s %s %d\n",
+      capture.flags & CAPTURE_BOXED ? "boxed" : "stack",
+      capture.flags & CAPTURE_LOCAL ? "local" : "capture", capture.index);
+  }
+  return result;
+}
+
+// property ops: the name, the argument count of INVOKE & the cache.
+static int propertyInst(const char *name, Chunk *chunk, int offset)
+{
+  const uint8_t *code = chunk->code().data() + offset;
+  const char *property = chunk->getConstant(code[1]).cString();
+  if ((OpCode)code[0] == OpCode::INVOKE) {
+    printf("%-16s %4d '%s' (%d args) cache %d\n", name, code[1], property, code[2], code[3]);
+    return offset + 4;
+  }
+  printf("%-16s %4d '%s' cache %d\n", name, code[1], property, code[2]);
+  return offset + 3;
+}
+
 static int Inst(Chunk *chunk, int offset) {
   printf("%04d ", offset);
   if (offset > 0 && chunk->lines()[offset] == chunk->lines()[offset - 1]) {
@@ -111,19 +170,58 @@ static int Inst(Chunk *chunk, int offset) {
   case OpCode::DEFINE_GLOBAL: return constInst("DEFINE_GLOBAL", chunk, offset);
   case OpCode::SET_GLOBAL:    return constInst("SET_GLOBAL", chunk, offset);
   case OpCode::GET_GLOBAL:    return constInst("GET_GLOBAL", chunk, offset);
-  case OpCode::EQUAL:         return simpleInst("EQUAL", offset);
-  case OpCode::LESS:          return simpleInst("LESS", offset);
-  case OpCode::GREATER:       return simpleInst("GREATER", offset);
-  case OpCode::ADD:           return simpleInst("ADD", offset);
-  case OpCode::SUBTRACT:      return simpleInst("SUBTRACT", offset);
-  case OpCode::MULTIPLY:      return simpleInst("MULTIPLY", offset);
+  case OpCode::EQUAL:         return byteInst("EQUAL", chunk, offset);
+  case OpCode::LESS:          return byteInst("LESS", chunk, offset);
+  case OpCode::GREATER:       return byteInst("GREATER", chunk, offset);
+  case OpCode::ADD:           return byteInst("ADD", chunk, offset);
+  case OpCode::SUBTRACT:      return byteInst("SUBTRACT", chunk, offset);
+  case OpCode::MULTIPLY:      return byteInst("MULTIPLY", chunk, offset);
   case OpCode::DIVIDE:        return simpleInst("DIVIDE", offset);
   case OpCode::NOT:           return simpleInst("NOT", offset);
   case OpCode::NEGATE:        return simpleInst("NEGATE", offset);
   case OpCode::PRINT:         return simpleInst("PRINT", offset);
+  case OpCode::YIELD:         return simpleInst("YIELD", offset);
   case OpCode::JUMP:          return jumpInst("JUMP", 1, chunk, offset);
   case OpCode::JUMP_IF_FALSE: return jumpInst("JUMP_IF_FALSE", 1, chunk, offset);
   case OpCode::LOOP:          return jumpInst("LOOP", -1, chunk, offset);
+  case OpCode::FOR_LOOP:      return forInst("FOR_LOOP", chunk, offset);
+  case OpCode::MAP:           return simpleInst("MAP", offset);
+  case OpCode::MAP_INSERT:    return simpleInst("MAP_INSERT", offset);
+  case OpCode::ARRAY:         return byteInst("ARRAY", chunk, offset);
+  case OpCode::GET_INDEX:     return simpleInst("GET_INDEX", offset);
+  case OpCode::SET_INDEX:     return simpleInst("SET_INDEX", offset);
+  case OpCode::EQUAL_INT:     return byteInst("EQUAL_INT", chunk, offset);
+  case OpCode::EQUAL_NUMBER:  return byteInst("EQUAL_NUMBER", chunk, offset);
+  case OpCode::GREATER_INT:   return byteInst("GREATER_INT", chunk, offset);
+  case OpCode::GREATER_NUMBER: return byteInst("GREATER_NUMBER", chunk, offset);
+  case OpCode::LESS_INT:      return byteInst("LESS_INT", chunk, offset);
+  case OpCode::LESS_NUMBER:   return byteInst("LESS_NUMBER", chunk, offset);
+  case OpCode::ADD_INT:       return byteInst("ADD_INT", chunk, offset);
+  case OpCode::ADD_NUMBER:    return byteInst("ADD_NUMBER", chunk, offset);
+  case OpCode::SUBTRACT_INT:  return byteInst("SUBTRACT_INT", chunk, offset);
+  case OpCode::SUBTRACT_NUMBER: return byteInst("SUBTRACT_NUMBER", chunk, offset);
+  case OpCode::MULTIPLY_INT:  return byteInst("MULTIPLY_INT", chunk, offset);
+  case OpCode::MULTIPLY_NUMBER: return byteInst("MULTIPLY_NUMBER", chunk, offset);
+  case OpCode::GREATER_NUM:   return byteInst("GREATER_NUM", chunk, offset);
+  case OpCode::LESS_NUM:      return byteInst("LESS_NUM", chunk, offset);
+  case OpCode::ADD_NUM:       return byteInst("ADD_NUM", chunk, offset);
+  case OpCode::SUBTRACT_NUM:  return byteInst("SUBTRACT_NUM", chunk, offset);
+  case OpCode::MULTIPLY_NUM:  return byteInst("MULTIPLY_NUM", chunk, offset);
+  case OpCode::DIVIDE_NUM:    return simpleInst("DIVIDE_NUM", offset);
+  case OpCode::NEGATE_NUM:    return simpleInst("NEGATE_NUM", offset);
+  case OpCode::CALL:          return byteInst("CALL", chunk, offset);
+  case OpCode::TAIL_CALL:     return byteInst("TAIL_CALL", chunk, offset);
+  case OpCode::CLOSURE:       return closureInst("CLOSURE", chunk, offset);
+  case OpCode::GET_UPVALUE:   return byteInst("GET_UPVALUE", chunk, offset);
+  case OpCode::SET_UPVALUE:   return byteInst("SET_UPVALUE", chunk, offset);
+  case OpCode::GET_OUTER:     return byteInst("GET_OUTER", chunk, offset);
+  case OpCode::SET_OUTER:     return byteInst("SET_OUTER", chunk, offset);
+  case OpCode::CLOSE_UPVALUE: return simpleInst("CLOSE_UPVALUE", offset);
+  case OpCode::CLASS:         return constInst("CLASS", chunk, offset);
+  case OpCode::METHOD:        return constInst("METHOD", chunk, offset);
+  case OpCode::GET_PROPERTY:  return propertyInst("GET_PROPERTY", chunk, offset);
+  case OpCode::SET_PROPERTY:  return propertyInst("SET_PROPERTY", chunk, offset);
+  case OpCode::INVOKE:        return propertyInst("INVOKE", chunk, offset);
   case OpCode::RETURN:        return simpleInst("RETURN", offset);
   }
 }
@@ -135,6 +233,15 @@ void DisassembleChunk(Chunk *chunk, const char *name)
   for (int offset = 0; offset < chunk->size();) {
     offset = Inst(chunk, offset);
   }
+
+  // functions declared in the chunk.
+  for (int i = 0; i < chunk->constants().count(); i++) {
+    Value constant = chunk->constants()[i];
+    if (!constant.isFunction()) continue;
+
+    Function *function = static_cast<Function*>((Object*)constant);
+    DisassembleChunk(function->chunk, function->name->cString());
+  }
 }
 
 } // namespace loxy
\ No newline at end of file
@@ -4,36 +4,60 @@
 #include <vector>
 #include "Common.h"
 #include "OpCode.h"
+#include "Data/SmallVector.h"
 
 namespace loxy {
 
-template<typename T>
-class SmallVector;
 class Value;
+class ValueMap;
 class Chunk;
+class JitCode;
 class VM;
 
 // class Chunk - a structure contains compiled bytecode for LoxyVM.
 class Chunk {
 public:
   // bytecode is designed to be of 1-byte length.
-  SmallVector<uint8_t> *code_;
+  SmallVector<uint8_t, 64> code_;
 
   // Correspondance line info in source code.
-  SmallVector<int> *lines_;
+  SmallVector<int, 64> lines_;
 
   // Constant pool.
-  SmallVector<Value> *constants_;
+  SmallVector<Value, 8> constants_;
+
+  // inline caches of property accesses, by the index in their operand.
+  SmallVector<PropertyCache, 2> caches_;
+
+  // maps each constant to its index in [constants_], for deduplication.
+  ValueMap *constantIndex_;
+
+  // the baseline code of the chunk once it's hot, see [VM::runJit].
+  JitCode *jit_;
+
+  // loop back-edges taken by the interpreter, up to JIT_THRESHOLD.
+  int hotness_;
+  int compilations_;
+
+  // the deepest the stack gets running the chunk, -1 until it's been
+  // verified, -2 if it gets deeper than STACK_MAX: that's left to run
+  // checked & overflow. See [VerifyChunk].
+  int maxStack_;
 
   // helpers.
-  SmallVector<uint8_t> &code() const { return *code_; }
-  SmallVector<int> &lines() const { return *lines_; }
-  SmallVector<Value> &constants() const { return *constants_; }
+  SmallVector<uint8_t, 64> &code() { return code_; }
+  SmallVector<int, 64> &lines() { return lines_; }
+  SmallVector<Value, 8> &constants() { return constants_; }
+  SmallVector<PropertyCache, 2> &caches() { return caches_; }
+  const SmallVector<uint8_t, 64> &code() const { return code_; }
+  const SmallVector<int, 64> &lines() const { return lines_; }
+  const SmallVector<Value, 8> &constants() const { return constants_; }
+  const SmallVector<PropertyCache, 2> &caches() const { return caches_; }
 
 private:
-  explicit Chunk(VM &vm, SmallVector<uint8_t> *code, 
-    SmallVector<int> *lines, SmallVector<Value> *constants)
-    : code_(code), lines_(lines), constants_(constants) {}
+  explicit Chunk(VM &vm, ValueMap *constantIndex)
+    : code_(vm), lines_(vm), constants_(vm), caches_(vm), constantIndex_(constantIndex),
+      jit_(nullptr), hotness_(0), compilations_(0), maxStack_(-1) {}
 
 public:
 
@@ -44,17 +68,27 @@ public:
   void clear();
 
   /// read - reads a piece of bytecode.
-  uint8_t read(size_t offset) const;
+  uint8_t read(size_t offset) const { return code_[offset]; }
 
   /// size - returns the size of the bytecode array.
-  size_t size() const noexcept;
+  size_t size() const noexcept { return code_.count(); }
   
   /// addConstant - adds [value] to its constant pool & returns the index
   ///   of it in the pool.
   int addConstant(Value value);
 
+  /// addCache - adds an empty property cache & returns its index.
+  int addCache();
+
   /// getConstants - returns the constant value at [index].
-  Value getConstant(size_t index) const;
+  Value getConstant(size_t index) const {
+    assert(index < (size_t)constants_.count() && "Index is too large in constant pool");
+    return constants_[index];
+  }
+
+  /// mark - marks objects in the constant pool & the property caches,
+  ///   called by the collector.
+  void mark(VM &vm) const;
 
   // a convenient creator.
   static Chunk *create(VM &vm);
@@ -62,7 +96,7 @@ public:
   static void destroy(VM &vm, Chunk **chunk);
 };
 
-void DissambleChunk(Chunk *chunk, const char *name);
+void DisassembleChunk(Chunk *chunk, const char *name);
 
 } // namespace loxy
 
@@ -0,0 +1,125 @@
+#include <errno.h>
+#include <math.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <functional>
+
+#include "EventLoop.h"
+#include "VM.h"
+
+namespace loxy {
+
+EventLoop::EventLoop() : epoll_(epoll_create1(EPOLL_CLOEXEC)), timerOrder_(0) {
+  assert(epoll_ >= 0 && "Can't create an epoll instance");
+}
+
+EventLoop::~EventLoop() {
+  close(epoll_);
+}
+
+double EventLoop::now() {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return time.tv_sec * 1e3 + time.tv_nsec / 1e6;
+}
+
+bool EventLoop::update(int fd, const Watch &watch, bool added) {
+  struct epoll_event event;
+  memset(&event, 0, sizeof(event));
+  event.events = (watch.reader != nullptr ? (uint32_t)EPOLLIN : 0) |
+                 (watch.writer != nullptr ? (uint32_t)EPOLLOUT : 0);
+  event.data.fd = fd;
+
+  if (event.events == 0) return epoll_ctl(epoll_, EPOLL_CTL_DEL, fd, nullptr) == 0;
+  return epoll_ctl(epoll_, added ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, fd, &event) == 0;
+}
+
+bool EventLoop::watch(VM &vm, int fd, bool write, Fiber *fiber) {
+  auto found = watches_.find(fd);
+  bool added = found == watches_.end();
+  Watch watch = added ? Watch{ nullptr, nullptr } : found->second;
+
+  Fiber *&waiting = write ? watch.writer : watch.reader;
+  if (waiting != nullptr && waiting != fiber) {
+    vm.nativeError("Another fiber is already %s fd %d", write ? "writing" : "reading", fd);
+    return false;
+  }
+  waiting = fiber;
+
+  // regular files are always ready, epoll refuses them with EPERM.
+  if (!update(fd, watch, added)) {
+    vm.nativeError("Can't wait on fd %d: %s", fd, strerror(errno));
+    return false;
+  }
+  watches_[fd] = watch;
+  return true;
+}
+
+void EventLoop::sleep(double ms, Fiber *fiber) {
+  timers_.push_back({ now() + (ms > 0 ? ms : 0), timerOrder_++, fiber });
+  std::push_heap(timers_.begin(), timers_.end(), std::greater<Timer>());
+}
+
+void EventLoop::forget(VM &vm, int fd) {
+  auto found = watches_.find(fd);
+  if (found == watches_.end()) return;
+
+  // they're called again on the closed fd, & fail.
+  Watch watch = found->second;
+  watches_.erase(found);
+  epoll_ctl(epoll_, EPOLL_CTL_DEL, fd, nullptr);
+  if (watch.reader != nullptr) vm.wake(watch.reader);
+  if (watch.writer != nullptr) vm.wake(watch.writer);
+}
+
+void EventLoop::poll(VM &vm) {
+  int timeout = -1;
+  if (!timers_.empty()) {
+    double wait = ceil(timers_.front().deadline - now());
+    timeout = wait > 0 ? (int)wait : 0;
+  }
+
+  struct epoll_event events[IO_EVENTS];
+  int count = epoll_wait(epoll_, events, IO_EVENTS, timeout);
+  for (int i = 0; i < count; i++) {
+    int fd = events[i].data.fd;
+    auto found = watches_.find(fd);
+    if (found == watches_.end()) continue;
+
+    // errors & hang ups wake both, their next read or write tells.
+    Watch &watch = found->second;
+    uint32_t ready = events[i].events;
+    if (watch.reader != nullptr && (ready & (EPOLLIN | EPOLLHUP | EPOLLERR))) {
+      vm.wake(watch.reader);
+      watch.reader = nullptr;
+    }
+    if (watch.writer != nullptr && (ready & (EPOLLOUT | EPOLLHUP | EPOLLERR))) {
+      vm.wake(watch.writer);
+      watch.writer = nullptr;
+    }
+
+    // level triggered, a fd nobody waits on any more must stop waking us.
+    update(fd, watch, false);
+    if (watch.reader == nullptr && watch.writer == nullptr) watches_.erase(found);
+  }
+
+  double time = now();
+  while (!timers_.empty() && timers_.front().deadline <= time) {
+    std::pop_heap(timers_.begin(), timers_.end(), std::greater<Timer>());
+    vm.wake(timers_.back().fiber);
+    timers_.pop_back();
+  }
+}
+
+void EventLoop::mark(VM &vm) const {
+  for (const auto &entry : watches_) {
+    vm.markObject(entry.second.reader);
+    vm.markObject(entry.second.writer);
+  }
+  for (const Timer &timer : timers_) vm.markObject(timer.fiber);
+}
+
+} // namespace loxy
@@ -0,0 +1,83 @@
+#ifndef loxy_event_loop_h
+#define loxy_event_loop_h
+
+#include <unordered_map>
+#include <vector>
+#include "Common.h"
+
+namespace loxy {
+
+class VM;
+class Fiber;
+
+// class EventLoop - the file descriptors & timers blocked fibers wait on,
+//  waited for with epoll. Woken fibers are scheduled on their VM, see
+//  [VM::runLoop].
+class EventLoop {
+private:
+  // Watch - the fibers waiting to read & to write a file descriptor, one
+  //  of each at most.
+  struct Watch {
+    Fiber *reader;
+    Fiber *writer;
+  };
+
+  // Timer - a fiber sleeping until [deadline], in ms. [order] keeps
+  //  timers of the same deadline in the order they were set.
+  struct Timer {
+    double deadline;
+    uint64_t order;
+    Fiber *fiber;
+
+    bool operator>(const Timer &other) const {
+      return deadline != other.deadline ? deadline > other.deadline : order > other.order;
+    }
+  };
+
+  int epoll_;
+  std::unordered_map<int, Watch> watches_;
+
+  // a min-heap on the deadline, see [poll].
+  std::vector<Timer> timers_;
+  uint64_t timerOrder_;
+
+  // update - registers the events [watch] waits on for [fd] with epoll,
+  //  none removing it. returns false, with errno set, if epoll refuses.
+  bool update(int fd, const Watch &watch, bool added);
+
+public:
+  EventLoop();
+  ~EventLoop();
+
+  EventLoop(const EventLoop&) = delete;
+  EventLoop &operator=(const EventLoop&) = delete;
+
+  // watch - wakes [fiber] once [fd] is readable, or writable if [write].
+  //  returns false, reporting why through [VM::nativeError], if another
+  //  fiber waits the same way or epoll can't wait on [fd].
+  bool watch(VM &vm, int fd, bool write, Fiber *fiber);
+
+  // sleep - wakes [fiber] after [ms] milliseconds.
+  void sleep(double ms, Fiber *fiber);
+
+  // forget - wakes the fibers waiting on [fd] & stops watching it, before
+  //  it's closed.
+  void forget(VM &vm, int fd);
+
+  // pending - whether any fiber waits on the loop.
+  bool pending() const { return !watches_.empty() || !timers_.empty(); }
+
+  // poll - waits until a watched fd is ready or the next timer is due, &
+  //  schedules the fibers waiting on them.
+  void poll(VM &vm);
+
+  // mark - marks the waiting fibers, they're roots while they wait.
+  void mark(VM &vm) const;
+
+  // now - milliseconds on the monotonic clock.
+  static double now();
+};
+
+} // namespace loxy
+
+#endif
@@ -0,0 +1,886 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+
+#include "Data/HashMap.h"
+#include "Data/ValueMap.h"
+#include "Chunk.h"
+#include "Image.h"
+#include "Module.h"
+#include "Verifier.h"
+#include "VM.h"
+
+namespace loxy {
+
+static const char IMAGE_MAGIC[8] = { 'L', 'O', 'X', 'Y', 'I', 'M', 'G', '\0' };
+static const uint32_t IMAGE_VERSION = 3;
+
+// reads back the other way round on a host of the other byte order.
+static const uint32_t IMAGE_BYTE_ORDER = 0x01020304;
+
+// FNV-1a, 64-bit, taking 8 bytes a step: records are 8-aligned, & a byte
+// a step would take as long as the rest of loading.
+static uint64_t checksum(const uint8_t *data, size_t size) {
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  size_t i = 0;
+  for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+    uint64_t word;
+    memcpy(&word, data + i, sizeof(word));
+    hash ^= word;
+    hash *= 0x100000001b3ULL;
+  }
+  for (; i < size; i++) {
+    hash ^= data[i];
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+// rank - the position of objects of [type] in the image: each is made
+//  from objects of the kinds before it. -1 for those without records.
+static int rank(ObjectType type) {
+  switch (type) {
+  case ObjectType::String:      return 0;
+  case ObjectType::Function:    return 1;
+  case ObjectType::Upvalue:     return 2;
+  case ObjectType::Closure:     return 3;
+  case ObjectType::Class:       return 4;
+  case ObjectType::Instance:    return 5;
+  case ObjectType::Map:         return 6;
+  case ObjectType::Array:       return 7;
+  case ObjectType::BoundMethod: return 8;
+  default:                      return -1;
+  }
+}
+
+// class ImageWriter
+//
+bool ImageWriter::fail(const char *format, ...) {
+  char buffer[256];
+  va_list args;
+  va_start(args, format);
+  vsnprintf(buffer, sizeof(buffer), format, args);
+  va_end(args);
+  error_ = buffer;
+  return false;
+}
+
+bool ImageWriter::add(Object *object, std::vector<Object*> &pending) {
+  if (object == nullptr || ids_.count(object) != 0) return true;
+
+  if (object->type == ObjectType::NativeFunction) {
+    return fail("native %s is reachable from outside the globals",
+                static_cast<NativeFunction*>(object)->name->cString());
+  }
+  if (object->type == ObjectType::Fiber) return fail("fibers can't be saved");
+  assert(rank(object->type) >= 0 && "Object without a record");
+
+  ids_[object] = 0;
+  objects_.push_back(object);
+  pending.push_back(object);
+  return true;
+}
+
+bool ImageWriter::addValue(Value value, std::vector<Object*> &pending) {
+  if (!value.isObj() && !value.isString()) return true;
+  return add((Object*)value, pending);
+}
+
+bool ImageWriter::addChunk(const Chunk *chunk, std::vector<Object*> &pending) {
+  for (const Value &constant : chunk->constants()) {
+    if (!addValue(constant, pending)) return false;
+  }
+  return true;
+}
+
+bool ImageWriter::collect() {
+  std::vector<Object*> pending;
+
+  for (int i = 0; i < vm.modules_->count(); i++) {
+    Module *module = (*vm.modules_)[i];
+    if (module->bytecode_ == nullptr) continue;
+
+    if (!add(module->name_, pending) || !add(module->path_, pending) ||
+        !add(module->src_, pending) || !addChunk(module->bytecode_, pending)) {
+      return false;
+    }
+
+    bool added = true;
+    module->variables_->each([&](String *name, Value value) {
+      if (!added || value.isNative()) return;
+      added = add(name, pending) && addValue(value, pending);
+    });
+    if (!added) return false;
+  }
+
+  // a work list rather than recursion, lists of instances run deep.
+  while (!pending.empty()) {
+    Object *object = pending.back();
+    pending.pop_back();
+
+    bool added = true;
+    switch (object->type) {
+    case ObjectType::Function: {
+      Function *function = static_cast<Function*>(object);
+      added = add(function->name, pending) && addChunk(function->chunk, pending);
+      break;
+    }
+    case ObjectType::Upvalue: {
+      Upvalue *upvalue = static_cast<Upvalue*>(object);
+      if (upvalue->isOpen()) return fail("a captured variable is still on a fiber's stack");
+      added = addValue(upvalue->closed, pending);
+      break;
+    }
+    case ObjectType::Closure: {
+      Closure *closure = static_cast<Closure*>(object);
+      added = add(closure->function, pending);
+      for (int i = 0; added && i < closure->count; i++) {
+        if (closure->captured[i].upvalue == nullptr) {
+          return fail("%s captures a variable on the stack", closure->function->cString());
+        }
+        added = add(closure->captured[i].upvalue, pending);
+      }
+      break;
+    }
+    case ObjectType::Class: {
+      Class *klass = static_cast<Class*>(object);
+      added = add(klass->name, pending) && add(klass->initializer, pending);
+      klass->methods->each([&](String *name, Value method) {
+        added = added && add(name, pending) && addValue(method, pending);
+      });
+      break;
+    }
+    case ObjectType::Instance: {
+      Instance *instance = static_cast<Instance*>(object);
+      added = add(instance->klass(), pending);
+      for (Shape *shape = instance->shape; added && shape->parent != nullptr; shape = shape->parent) {
+        added = add(shape->name, pending) && addValue(instance->fields[shape->count - 1], pending);
+      }
+      break;
+    }
+    case ObjectType::Map:
+      static_cast<Map*>(object)->entries->each([&](Value key, Value value) {
+        added = added && addValue(key, pending) && addValue(value, pending);
+      });
+      break;
+    case ObjectType::Array: {
+      Array *array = static_cast<Array*>(object);
+      for (int i = 0; added && !array->packed && i < array->count; i++) {
+        added = addValue(array->values[i], pending);
+      }
+      break;
+    }
+    case ObjectType::BoundMethod: {
+      BoundMethod *bound = static_cast<BoundMethod*>(object);
+      added = addValue(bound->receiver, pending) && add(bound->method, pending);
+      break;
+    }
+    default:
+      break;
+    }
+    if (!added) return false;
+  }
+
+  std::stable_sort(objects_.begin(), objects_.end(), [](const Object *a, const Object *b) {
+    return rank(a->type) < rank(b->type);
+  });
+  for (size_t i = 0; i < objects_.size(); i++) ids_[objects_[i]] = (uint32_t)(i + 1);
+  return true;
+}
+
+void ImageWriter::u32(uint32_t value) {
+  bytes(&value, sizeof(value));
+}
+
+void ImageWriter::u64(uint64_t value) {
+  bytes(&value, sizeof(value));
+}
+
+void ImageWriter::bytes(const void *data, size_t size) {
+  const uint8_t *from = static_cast<const uint8_t*>(data);
+  out_.insert(out_.end(), from, from + size);
+}
+
+void ImageWriter::align() {
+  while (out_.size() % 8 != 0) out_.push_back(0);
+}
+
+void ImageWriter::id(const Object *object) {
+  u32(object != nullptr ? ids_.at(const_cast<Object*>(object)) : 0);
+}
+
+void ImageWriter::value(Value value) {
+  ValueType type;
+  uint64_t bits = 0;
+  if (value.isUndef()) {
+    type = ValueType::Undef;
+  } else if (value.isNil()) {
+    type = ValueType::Nil;
+  } else if (value.isBool()) {
+    type = ValueType::Bool;
+    bits = (bool)value ? 1 : 0;
+  } else if (value.isDouble()) {
+    type = ValueType::Number;
+    double number = value;
+    memcpy(&bits, &number, sizeof(bits));
+  } else if (value.isInt()) {
+    type = ValueType::Int;
+    bits = (uint64_t)value.asInt();
+  } else {
+    type = value.isString() ? ValueType::String : ValueType::Obj;
+    bits = ids_.at((Object*)value);
+  }
+  u32((uint32_t)type);
+  u32(0);
+  u64(bits);
+}
+
+// the caches start out empty, the shapes they saw aren't saved.
+void ImageWriter::chunk(const Chunk *chunk) {
+  u32((uint32_t)chunk->size());
+  u32((uint32_t)chunk->constants().count());
+  u32((uint32_t)chunk->caches().count());
+  bytes(chunk->code().data(), chunk->size());
+  bytes(chunk->lines().data(), sizeof(int) * chunk->size());
+  for (const Value &constant : chunk->constants()) value(constant);
+}
+
+void ImageWriter::object(Object *object) {
+  u32((uint32_t)object->type);
+
+  switch (object->type) {
+  case ObjectType::String: {
+    String *string = static_cast<String*>(object);
+    u32(string->isInterned() ? 1 : 0);
+    u32((uint32_t)string->length());
+    bytes(string->cString(), string->length());
+    break;
+  }
+  case ObjectType::Function: {
+    Function *function = static_cast<Function*>(object);
+    id(function->name);
+    u32((uint32_t)function->arity);
+    u32((uint32_t)function->captureCount);
+    bytes(function->captures, sizeof(Capture) * function->captureCount);
+    chunk(function->chunk);
+    break;
+  }
+  case ObjectType::Upvalue:
+    value(static_cast<Upvalue*>(object)->closed);
+    break;
+  case ObjectType::Closure: {
+    Closure *closure = static_cast<Closure*>(object);
+    id(closure->function);
+    u32((uint32_t)closure->count);
+    for (int i = 0; i < closure->count; i++) id(closure->captured[i].upvalue);
+    break;
+  }
+  case ObjectType::Class: {
+    Class *klass = static_cast<Class*>(object);
+    id(klass->name);
+    id(klass->initializer);
+    u32((uint32_t)klass->fieldHint);
+    u32((uint32_t)klass->methods->count());
+    klass->methods->each([&](String *name, Value method) {
+      id(name);
+      value(method);
+    });
+    break;
+  }
+  // fields in slot order, adding them in turn gets the same shape back.
+  case ObjectType::Instance: {
+    Instance *instance = static_cast<Instance*>(object);
+    std::vector<String*> names(instance->shape->count);
+    for (Shape *shape = instance->shape; shape->parent != nullptr; shape = shape->parent) {
+      names[shape->count - 1] = shape->name;
+    }
+
+    id(instance->klass());
+    u32((uint32_t)names.size());
+    for (size_t i = 0; i < names.size(); i++) {
+      id(names[i]);
+      value(instance->fields[i]);
+    }
+    break;
+  }
+  case ObjectType::Map: {
+    ValueMap *entries = static_cast<Map*>(object)->entries;
+    u32((uint32_t)entries->count());
+    entries->each([&](Value key, Value entry) {
+      value(key);
+      value(entry);
+    });
+    break;
+  }
+  case ObjectType::Array: {
+    Array *array = static_cast<Array*>(object);
+    u32((uint32_t)array->count);
+    for (int i = 0; i < array->count; i++) value(array->get(i));
+    break;
+  }
+  case ObjectType::BoundMethod: {
+    BoundMethod *bound = static_cast<BoundMethod*>(object);
+    id(bound->method);
+    value(bound->receiver);
+    break;
+  }
+  default:
+    UNREACHABLE();
+  }
+}
+
+void ImageWriter::module(Module *module) {
+  id(module->name_);
+  id(module->path_);
+  id(module->src_);
+
+  uint32_t count = 0;
+  module->variables_->each([&](String *, Value value) {
+    if (!value.isNative()) count++;
+  });
+  u32(count);
+  module->variables_->each([&](String *name, Value variable) {
+    if (variable.isNative()) return;
+    id(name);
+    value(variable);
+  });
+
+  chunk(module->bytecode_);
+}
+
+bool ImageWriter::write(const char *path) {
+  if (!collect()) return false;
+
+  std::vector<Module*> modules;
+  for (int i = 0; i < vm.modules_->count(); i++) {
+    if ((*vm.modules_)[i]->bytecode_ != nullptr) modules.push_back((*vm.modules_)[i]);
+  }
+
+  // the header & the offsets are filled in last.
+  size_t records = objects_.size() + modules.size();
+  std::vector<uint64_t> offsets;
+  offsets.reserve(records);
+  out_.assign(sizeof(ImageHeader) + sizeof(uint64_t) * records, 0);
+
+  for (Object *object : objects_) {
+    offsets.push_back(out_.size());
+    this->object(object);
+    align();
+  }
+  for (Module *module : modules) {
+    offsets.push_back(out_.size());
+    this->module(module);
+    align();
+  }
+  memcpy(out_.data() + sizeof(ImageHeader), offsets.data(), sizeof(uint64_t) * records);
+
+  ImageHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, IMAGE_MAGIC, sizeof(header.magic));
+  header.version = IMAGE_VERSION;
+  header.byteOrder = IMAGE_BYTE_ORDER;
+  header.objects = (uint32_t)objects_.size();
+  header.modules = (uint32_t)modules.size();
+  header.size = out_.size();
+  header.checksum = checksum(out_.data() + sizeof(header), out_.size() - sizeof(header));
+  memcpy(out_.data(), &header, sizeof(header));
+
+  FILE *file = fopen(path, "wb");
+  if (file == nullptr) return fail("%s", strerror(errno));
+  bool written = fwrite(out_.data(), 1, out_.size(), file) == out_.size();
+  if (fclose(file) != 0 || !written) return fail("%s", strerror(errno));
+  return true;
+}
+
+// class ImageReader
+//
+uint32_t ImageReader::Cursor::u32() {
+  uint32_t value = 0;
+  const uint8_t *from = bytes(sizeof(value));
+  if (from != nullptr) memcpy(&value, from, sizeof(value));
+  return value;
+}
+
+uint64_t ImageReader::Cursor::u64() {
+  uint64_t value = 0;
+  const uint8_t *from = bytes(sizeof(value));
+  if (from != nullptr) memcpy(&value, from, sizeof(value));
+  return value;
+}
+
+const uint8_t *ImageReader::Cursor::bytes(size_t size) {
+  if (failed || (size_t)(end - at) < size) {
+    failed = true;
+    return nullptr;
+  }
+  const uint8_t *from = at;
+  at += size;
+  return from;
+}
+
+ImageReader::~ImageReader() {
+  if (data_ != nullptr) munmap(const_cast<uint8_t*>(data_), size_);
+}
+
+bool ImageReader::fail(const char *format, ...) {
+  char buffer[256];
+  va_list args;
+  va_start(args, format);
+  vsnprintf(buffer, sizeof(buffer), format, args);
+  va_end(args);
+  error_ = buffer;
+  return false;
+}
+
+bool ImageReader::map(const char *path) {
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return fail("%s", strerror(errno));
+
+  struct stat status;
+  if (fstat(fd, &status) < 0) {
+    int error = errno;
+    close(fd);
+    return fail("%s", strerror(error));
+  }
+  if ((size_t)status.st_size < sizeof(ImageHeader)) {
+    close(fd);
+    return fail("not an image");
+  }
+
+  void *data = mmap(nullptr, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  int error = errno;
+  close(fd);
+  if (data == MAP_FAILED) return fail("%s", strerror(error));
+  data_ = static_cast<const uint8_t*>(data);
+  size_ = status.st_size;
+  header_ = reinterpret_cast<const ImageHeader*>(data_);
+
+  if (memcmp(header_->magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC)) != 0) return fail("not an image");
+  if (header_->version != IMAGE_VERSION || header_->byteOrder != IMAGE_BYTE_ORDER) {
+    return fail("saved by another version of loxy");
+  }
+  uint64_t records = (uint64_t)header_->objects + header_->modules;
+  if (header_->size != size_ ||
+      records > (size_ - sizeof(ImageHeader)) / sizeof(uint64_t) ||
+      header_->checksum != checksum(data_ + sizeof(ImageHeader), size_ - sizeof(ImageHeader))) {
+    return fail("the image is corrupt");
+  }
+  return true;
+}
+
+bool ImageReader::record(uint32_t index, Cursor *cursor) {
+  uint64_t offset;
+  memcpy(&offset, data_ + sizeof(ImageHeader) + sizeof(uint64_t) * index, sizeof(offset));
+
+  size_t records = (size_t)header_->objects + header_->modules;
+  if (offset < sizeof(ImageHeader) + sizeof(uint64_t) * records || offset >= size_) {
+    return fail("record %u is out of the image", index);
+  }
+  *cursor = Cursor{ data_ + offset, data_ + size_, false };
+  return true;
+}
+
+Object *ImageReader::object(uint32_t id, ObjectType type, bool optional) {
+  if (id == 0 && optional) return nullptr;
+  if (id == 0 || id > objects_.size() || objects_[id - 1]->type != type) {
+    fail("bad reference to object %u", id);
+    return nullptr;
+  }
+  return objects_[id - 1];
+}
+
+String *ImageReader::string(Cursor &cursor, bool optional) {
+  return static_cast<String*>(object(cursor.u32(), ObjectType::String, optional));
+}
+
+bool ImageReader::value(Cursor &cursor, Value *value) {
+  uint32_t type = cursor.u32();
+  cursor.u32();
+  uint64_t bits = cursor.u64();
+  if (cursor.failed) return fail("truncated value");
+
+  switch ((ValueType)type) {
+  case ValueType::Undef: *value = Value::Undef; return true;
+  case ValueType::Nil:   *value = Value::Nil; return true;
+  case ValueType::Bool:  *value = bits != 0 ? Value::True : Value::False; return true;
+  case ValueType::Int:   *value = Value((int64_t)bits); return true;
+  case ValueType::Number: {
+    double number;
+    memcpy(&number, &bits, sizeof(number));
+    *value = Value(number);
+    return true;
+  }
+  case ValueType::String: {
+    Object *string = object((uint32_t)bits, ObjectType::String);
+    if (string == nullptr) return false;
+    *value = Value(string, ValueType::String);
+    return true;
+  }
+  // upvalues are no values.
+  case ValueType::Obj: {
+    if (bits == 0 || bits > objects_.size()) return fail("bad reference to object %llu", (unsigned long long)bits);
+    Object *object = objects_[bits - 1];
+    if (object->type == ObjectType::String || object->type == ObjectType::Upvalue) {
+      return fail("bad reference to object %llu", (unsigned long long)bits);
+    }
+    *value = Value(object);
+    return true;
+  }
+  }
+  return fail("bad value type %u", type);
+}
+
+// creates [index] from what it needs of its record, the rest is read by
+// [fill].
+bool ImageReader::create(uint32_t index) {
+  Cursor cursor;
+  if (!record(index, &cursor)) return false;
+
+  ObjectType type = (ObjectType)cursor.u32();
+  if (rank(type) < 0 || (!objects_.empty() && rank(type) < rank(objects_.back()->type))) {
+    return fail("record %u is out of order", index);
+  }
+
+  Object *object = nullptr;
+  switch (type) {
+  case ObjectType::String: {
+    bool interned = cursor.u32() != 0;
+    uint32_t length = cursor.u32();
+    const uint8_t *chars = cursor.bytes(length);
+    if (chars == nullptr || length > INT32_MAX) break;
+    object = interned ? String::create(vm, (const char*)chars, (int)length)
+                      : String::createTransient(vm, (const char*)chars, (int)length);
+    break;
+  }
+  case ObjectType::Function: {
+    // closures are sized by its captures, they're read right away.
+    String *name = string(cursor);
+    uint32_t arity = cursor.u32();
+    uint32_t count = cursor.u32();
+    const uint8_t *captures = cursor.bytes(sizeof(Capture) * (size_t)count);
+    if (name == nullptr) return false;
+    if (captures == nullptr) break;
+    if (arity > UINT8_MAX || count > UINT8_COUNT) return fail("bad function %s", name->cString());
+
+    Function *function = Function::create(vm, name);
+    objects_.push_back(function);
+    function->arity = (int)arity;
+    if (count > 0) function->setCaptures(vm, reinterpret_cast<const Capture*>(captures), (int)count);
+    return true;
+  }
+  case ObjectType::Upvalue: {
+    Upvalue *upvalue = Upvalue::create(vm, nullptr, nullptr);
+    upvalue->location = &upvalue->closed;
+    object = upvalue;
+    break;
+  }
+  case ObjectType::Closure: {
+    Function *function = static_cast<Function*>(this->object(cursor.u32(), ObjectType::Function));
+    if (function == nullptr) return false;
+    object = Closure::create(vm, function);
+    break;
+  }
+  case ObjectType::Class: {
+    String *name = string(cursor);
+    if (name == nullptr) return false;
+    cursor.u32();
+    uint32_t fieldHint = cursor.u32();
+    if (fieldHint < 1 || fieldHint > UINT8_COUNT * UINT8_COUNT) return fail("bad class %s", name->cString());
+    Class *klass = Class::create(vm, name);
+    klass->fieldHint = (int)fieldHint;
+    object = klass;
+    break;
+  }
+  case ObjectType::Instance: {
+    Class *klass = static_cast<Class*>(this->object(cursor.u32(), ObjectType::Class));
+    if (klass == nullptr) return false;
+    object = Instance::create(vm, klass);
+    break;
+  }
+  case ObjectType::Map:
+    object = Map::create(vm);
+    break;
+  case ObjectType::Array:
+    object = Array::create(vm);
+    break;
+  case ObjectType::BoundMethod: {
+    Function *method = static_cast<Function*>(this->object(cursor.u32(), ObjectType::Function));
+    if (method == nullptr) return false;
+    object = BoundMethod::create(vm, Value::Nil, method);
+    break;
+  }
+  default:
+    break;
+  }
+
+  if (cursor.failed || object == nullptr) return fail("record %u is truncated", index);
+  objects_.push_back(object);
+  return true;
+}
+
+bool ImageReader::chunk(Cursor &cursor, Chunk *chunk) {
+  uint32_t size = cursor.u32();
+  uint32_t constants = cursor.u32();
+  uint32_t caches = cursor.u32();
+  const uint8_t *code = cursor.bytes(size);
+  const uint8_t *lines = cursor.bytes(sizeof(int) * (size_t)size);
+  if (code == nullptr || lines == nullptr || caches > size ||
+      constants > (size_t)(cursor.end - cursor.at) / (2 * sizeof(uint64_t))) {
+    return fail("truncated chunk");
+  }
+
+  chunk->code_.reserve(size);
+  chunk->lines_.reserve(size);
+  for (uint32_t i = 0; i < size; i++) {
+    int line;
+    memcpy(&line, lines + sizeof(int) * i, sizeof(line));
+    chunk->write(code[i], line);
+  }
+
+  // nothing is compiled into it any more, [Chunk::constantIndex_] stays
+  // empty.
+  chunk->constants_.reserve(constants);
+  for (uint32_t i = 0; i < constants; i++) {
+    Value constant;
+    if (!value(cursor, &constant)) return false;
+    chunk->constants_.push(constant);
+  }
+  for (uint32_t i = 0; i < caches; i++) chunk->addCache();
+  return true;
+}
+
+// fill - fills in [index], all objects are made by now.
+bool ImageReader::fill(uint32_t index) {
+  Cursor cursor;
+  if (!record(index, &cursor)) return false;
+  cursor.u32();
+
+  // counts are checked against what's left of the record before anything
+  // is allocated for them.
+  auto fits = [&cursor](uint64_t count, size_t size) {
+    return count <= (size_t)(cursor.end - cursor.at) / size;
+  };
+
+  Object *object = objects_[index];
+  switch (object->type) {
+  case ObjectType::String:
+    return true;
+
+  case ObjectType::Function: {
+    Function *function = static_cast<Function*>(object);
+    cursor.u32();
+    cursor.u32();
+    uint32_t count = cursor.u32();
+    cursor.bytes(sizeof(Capture) * (size_t)count);
+    return chunk(cursor, function->chunk);
+  }
+
+  case ObjectType::Upvalue: {
+    Upvalue *upvalue = static_cast<Upvalue*>(object);
+    return value(cursor, &upvalue->closed);
+  }
+
+  case ObjectType::Closure: {
+    Closure *closure = static_cast<Closure*>(object);
+    cursor.u32();
+    if (cursor.u32() != (uint32_t)closure->count) {
+      return fail("bad closure of %s", closure->function->cString());
+    }
+    for (int i = 0; i < closure->count; i++) {
+      Upvalue *upvalue = static_cast<Upvalue*>(this->object(cursor.u32(), ObjectType::Upvalue));
+      if (upvalue == nullptr) return false;
+      closure->captured[i] = { upvalue, 0 };
+    }
+    break;
+  }
+
+  case ObjectType::Class: {
+    Class *klass = static_cast<Class*>(object);
+    cursor.u32();
+    uint32_t initializer = cursor.u32();
+    klass->initializer = static_cast<Function*>(this->object(initializer, ObjectType::Function, true));
+    if (klass->initializer == nullptr && initializer != 0) return false;
+    cursor.u32();
+    uint32_t count = cursor.u32();
+    if (!fits(count, 5 * sizeof(uint32_t))) return fail("record %u is truncated", index);
+
+    for (uint32_t i = 0; i < count; i++) {
+      String *name = string(cursor);
+      Value method;
+      if (name == nullptr || !value(cursor, &method)) return false;
+      if (!method.isFunction()) return fail("method %s isn't a function", name->cString());
+      klass->methods->set(name, method);
+    }
+    break;
+  }
+
+  // the fields take the same transitions they took when they were added.
+  case ObjectType::Instance: {
+    Instance *instance = static_cast<Instance*>(object);
+    cursor.u32();
+    uint32_t count = cursor.u32();
+    if (!fits(count, 5 * sizeof(uint32_t))) return fail("record %u is truncated", index);
+
+    for (uint32_t i = 0; i < count; i++) {
+      String *name = string(cursor);
+      Value field;
+      if (name == nullptr || !value(cursor, &field)) return false;
+      if (!name->isInterned()) return fail("field %s isn't interned", name->cString());
+      instance->addField(vm, instance->shape->transition(vm, name), field);
+    }
+    break;
+  }
+
+  case ObjectType::Map: {
+    ValueMap *entries = static_cast<Map*>(object)->entries;
+    uint32_t count = cursor.u32();
+    if (!fits(count, 8 * sizeof(uint32_t))) return fail("record %u is truncated", index);
+
+    for (uint32_t i = 0; i < count; i++) {
+      Value key, entry;
+      if (!value(cursor, &key) || !value(cursor, &entry)) return false;
+      if (key.isNil() || (key.isDouble() && (double)key != (double)key)) return fail("bad map key");
+      entries->set(key, entry);
+    }
+    break;
+  }
+
+  case ObjectType::Array: {
+    Array *array = static_cast<Array*>(object);
+    uint32_t count = cursor.u32();
+    if (!fits(count, 4 * sizeof(uint32_t))) return fail("record %u is truncated", index);
+
+    for (uint32_t i = 0; i < count; i++) {
+      Value element;
+      if (!value(cursor, &element)) return false;
+      array->append(vm, element);
+    }
+    break;
+  }
+
+  case ObjectType::BoundMethod: {
+    BoundMethod *bound = static_cast<BoundMethod*>(object);
+    cursor.u32();
+    return value(cursor, &bound->receiver);
+  }
+
+  default:
+    UNREACHABLE();
+  }
+
+  return !cursor.failed || fail("record %u is truncated", index);
+}
+
+bool ImageReader::module(uint32_t index) {
+  Cursor cursor;
+  if (!record(index, &cursor)) return false;
+
+  String *name = string(cursor);
+  String *path = string(cursor, true);
+  String *src = string(cursor, true);
+  if (name == nullptr || !error_.empty()) return false;
+
+  Module *module = Module::create(vm, name, path, src);
+  modules_.push_back(module);
+  module->setBody(Chunk::create(vm));
+
+  uint32_t count = cursor.u32();
+  if (count > (size_t)(cursor.end - cursor.at) / (5 * sizeof(uint32_t))) {
+    return fail("record %u is truncated", index);
+  }
+  for (uint32_t i = 0; i < count; i++) {
+    String *variable = string(cursor);
+    Value value;
+    if (variable == nullptr || !this->value(cursor, &value)) return false;
+    module->addVariable(variable, value);
+  }
+  return chunk(cursor, module->getBody());
+}
+
+// verify - verifies the module bodies & the functions declared in them,
+//  as [VM::run] would. The checksum only catches corruption, whatever
+//  wrote the image may not be a VM, so nothing loaded is trusted. A
+//  function declared nowhere is refused, it would be run unverified.
+bool ImageReader::verify() {
+  if (!vm.verify_) return true;
+
+  for (Module *module : modules_) {
+    VerifyError error;
+    if (!VerifyChunk(module->getBody(), &error)) {
+      return fail("malformed bytecode at %d: %s", error.offset, error.reason);
+    }
+  }
+  for (Object *object : objects_) {
+    if (object->type != ObjectType::Function) continue;
+    Function *function = static_cast<Function*>(object);
+    if (function->chunk->maxStack_ == -1) {
+      return fail("%s isn't declared in any module", function->cString());
+    }
+  }
+  return true;
+}
+
+bool ImageReader::read(const char *path, std::vector<Module*> *modules) {
+  bool loaded = map(path);
+  if (loaded) objects_.reserve(header_->objects);
+
+  for (uint32_t i = 0; loaded && i < header_->objects; i++) loaded = create(i);
+  for (uint32_t i = 0; loaded && i < header_->objects; i++) loaded = fill(i);
+  for (uint32_t i = 0; loaded && i < header_->modules; i++) loaded = module(header_->objects + i);
+  loaded = loaded && verify();
+
+  // the objects made are left to the collector.
+  if (!loaded) {
+    for (Module *&module : modules_) Module::destroy(vm, &module);
+  } else {
+    for (Module *module : modules_) {
+      vm.addModule(module);
+      modules->push_back(module);
+    }
+  }
+  objects_.clear();
+  modules_.clear();
+  return loaded;
+}
+
+void ImageReader::mark() const {
+  for (Object *object : objects_) vm.markObject(object);
+  for (Module *module : modules_) module->mark();
+}
+
+// class VM
+//
+bool VM::saveImage(const char *path) {
+  ImageWriter writer(*this);
+  if (!writer.write(path)) {
+    fprintf(stderr, "Could not save image \"%s\": %s\n", path, writer.error().c_str());
+    return false;
+  }
+  return true;
+}
+
+bool VM::loadImage(const char *path, Module *module) {
+  ImageReader reader(*this);
+  std::vector<Module*> modules;
+
+  image_ = &reader;
+  bool loaded = reader.read(path, &modules);
+  image_ = nullptr;
+
+  if (!loaded) {
+    fprintf(stderr, "Could not load image \"%s\": %s\n", path, reader.error().c_str());
+    return false;
+  }
+  if (module != nullptr) {
+    for (Module *loaded : modules) module->importVariables(loaded);
+  }
+  return true;
+}
+
+} // namespace loxy
@@ -0,0 +1,163 @@
+#ifndef loxy_image_h
+#define loxy_image_h
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "Common.h"
+#include "Value.h"
+
+namespace loxy {
+
+class Chunk;
+class Module;
+class VM;
+
+// An image is the heap of a VM saved to a file: its modules, their globals
+// & compiled code, & every object they reach. Loading one is reading
+// records back instead of compiling & running the code that made them.
+//
+// The file is an ImageHeader, the offsets of the records, objects then
+// modules, & the records, each 8-aligned. Records refer to objects by
+// their 1-based index, 0 for none, so the file means the same wherever
+// it's mapped. Objects come in kind order, see [rank] in Image.cc: the
+// objects a record needs to be created from come before it.
+//
+// Values take 16 bytes, a ValueType & a payload: the bits of numbers &
+// booleans, the index of objects.
+
+// ImageHeader - the start of an image.
+struct ImageHeader {
+  // IMAGE_MAGIC.
+  char magic[8];
+  uint32_t version;
+
+  // IMAGE_BYTE_ORDER as the writer stored it.
+  uint32_t byteOrder;
+
+  uint32_t objects;
+  uint32_t modules;
+
+  // of the whole file, & the FNV-1a hash of what follows the header,
+  // see [checksum] in Image.cc.
+  uint64_t size;
+  uint64_t checksum;
+};
+
+// class ImageWriter - saves the modules of a VM & what they reach into an
+//  image. Natives in globals are left out, the host adds them again.
+//  Fibers, other natives & upvalues still open on a stack have no image
+//  & fail the save.
+class ImageWriter {
+private:
+  VM &vm;
+
+  // objects by index - 1, & the index of each.
+  std::vector<Object*> objects_;
+  std::unordered_map<Object*, uint32_t> ids_;
+
+  std::vector<uint8_t> out_;
+  std::string error_;
+
+  // add - collects [object] & what it reaches. returns false on the
+  //  first one that can't be saved.
+  bool add(Object *object, std::vector<Object*> &pending);
+  bool addValue(Value value, std::vector<Object*> &pending);
+  bool addChunk(const Chunk *chunk, std::vector<Object*> &pending);
+  bool collect();
+
+  void u32(uint32_t value);
+  void u64(uint64_t value);
+  void bytes(const void *data, size_t size);
+  void align();
+  void id(const Object *object);
+  void value(Value value);
+  void chunk(const Chunk *chunk);
+  void object(Object *object);
+  void module(Module *module);
+
+  bool fail(const char *format, ...);
+
+public:
+  explicit ImageWriter(VM &vm) : vm(vm) {}
+
+  // write - saves the image to [path]. returns false, with [error] set,
+  //  if it can't.
+  bool write(const char *path);
+
+  const std::string &error() const { return error_; }
+};
+
+// class ImageReader - loads an image into a VM, mapping the file & making
+//  the objects of its records. Objects are made in two passes: the first
+//  creates them all, the second fills them in, once the objects they
+//  refer to exist. Their code is verified again before it's run, saved
+//  code isn't trusted.
+class ImageReader {
+private:
+  // Cursor - reads a record, failing at the end of the image.
+  struct Cursor {
+    const uint8_t *at;
+    const uint8_t *end;
+    bool failed;
+
+    uint32_t u32();
+    uint64_t u64();
+    const uint8_t *bytes(size_t size);
+  };
+
+  VM &vm;
+
+  // the mapped image.
+  const uint8_t *data_;
+  size_t size_;
+  const ImageHeader *header_;
+
+  // the objects made so far by index - 1, & the modules. Roots until
+  // they're added to the VM, see [mark].
+  std::vector<Object*> objects_;
+  std::vector<Module*> modules_;
+
+  std::string error_;
+
+  bool map(const char *path);
+
+  // record - a cursor at record [index], objects first.
+  bool record(uint32_t index, Cursor *cursor);
+
+  // object - the object of [id] if it's made already & of [type], nullptr
+  //  for 0 if [optional]. Fails otherwise.
+  Object *object(uint32_t id, ObjectType type, bool optional = false);
+  bool value(Cursor &cursor, Value *value);
+  String *string(Cursor &cursor, bool optional = false);
+
+  bool create(uint32_t index);
+  bool fill(uint32_t index);
+  bool chunk(Cursor &cursor, Chunk *chunk);
+  bool module(uint32_t index);
+  bool verify();
+
+  bool fail(const char *format, ...);
+
+public:
+  explicit ImageReader(VM &vm)
+  : vm(vm), data_(nullptr), size_(0), header_(nullptr) {}
+  ~ImageReader();
+
+  ImageReader(const ImageReader&) = delete;
+  ImageReader &operator=(const ImageReader&) = delete;
+
+  // read - loads the image at [path], adding its modules to the VM, which
+  //  go into [modules]. returns false, with [error] set & adding none, if
+  //  it can't.
+  bool read(const char *path, std::vector<Module*> *modules);
+
+  const std::string &error() const { return error_; }
+
+  // mark - marks what's been made so far.
+  void mark() const;
+};
+
+} // namespace loxy
+
+#endif
@@ -0,0 +1,298 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "Module.h"
+#include "Value.h"
+#include "VM.h"
+
+namespace loxy {
+
+// class Io - the I/O natives of scripts, on file descriptors made non
+//  blocking. A read or write that would block blocks its fiber instead,
+//  & is tried again once the event loop sees the fd ready. See
+//  [VM::waitFor]. Along with the natives making & running the fibers.
+class Io {
+private:
+  // fd - [value] as a file descriptor into [fd]. returns false, failing
+  //  the native [name], if it isn't one.
+  static bool fd(VM &vm, const char *name, Value value, int *fd) {
+    if (!value.isNumber() || (double)value < 0 || (double)value != (int)(double)value) {
+      vm.nativeError("%s takes a file descriptor", name);
+      return false;
+    }
+    *fd = (int)(double)value;
+    return true;
+  }
+
+  // string - [value] as a string, failing the native [name] like [fd].
+  static String *string(VM &vm, const char *name, Value value) {
+    if (!value.isString()) {
+      vm.nativeError("%s takes a string", name);
+      return nullptr;
+    }
+    return (String*)value;
+  }
+
+  // failed - fails the native [name] with the error in errno.
+  static bool failed(VM &vm, const char *name) {
+    vm.nativeError("%s failed: %s", name, strerror(errno));
+    return false;
+  }
+
+  // pair - an array of the fds [a] & [b], the result of the native.
+  static bool pair(VM &vm, Value *args, int a, int b) {
+    Array *array = Array::create(vm, 2);
+    args[-1] = Value(array);
+    array->append(vm, Value((int64_t)a));
+    array->append(vm, Value((int64_t)b));
+    return true;
+  }
+
+  // unixAddress - the address of the socket file at [path].
+  static bool unixAddress(VM &vm, const char *name, String *path, struct sockaddr_un *address) {
+    memset(address, 0, sizeof(*address));
+    address->sun_family = AF_UNIX;
+    if (path->length() >= (int)sizeof(address->sun_path)) {
+      vm.nativeError("%s: path too long", name);
+      return false;
+    }
+    memcpy(address->sun_path, path->cString(), path->length());
+    return true;
+  }
+
+public:
+  // read(fd) - up to IO_READ_SIZE bytes, nil at the end of the file.
+  static bool read(VM &vm, Value *args, int) {
+    int fd;
+    if (!Io::fd(vm, "read", args[0], &fd)) return false;
+
+    char buffer[IO_READ_SIZE];
+    ssize_t count;
+    do {
+      count = ::read(fd, buffer, sizeof(buffer));
+    } while (count < 0 && errno == EINTR);
+
+    if (count < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) return vm.waitFor(fd, false);
+      return failed(vm, "read");
+    }
+    args[-1] = count == 0 ? Value::Nil
+                          : Value(String::createTransient(vm, buffer, (int)count), ValueType::String);
+    return true;
+  }
+
+  // write(fd, string) - writes all of [string], returning its length.
+  static bool write(VM &vm, Value *args, int) {
+    int fd;
+    String *string = Io::string(vm, "write", args[1]);
+    if (!Io::fd(vm, "write", args[0], &fd) || string == nullptr) return false;
+
+    // print's buffer goes first, the output keeps its order.
+    if (fd == STDOUT_FILENO) vm.output().flush();
+
+    // what a write that blocked got out is kept, see [VM::ioProgress].
+    size_t written = vm.ioProgress();
+    while (written < (size_t)string->length()) {
+      ssize_t count = ::write(fd, string->cString() + written, string->length() - written);
+      if (count < 0) {
+        if (errno == EINTR) continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK) return vm.waitFor(fd, true, written);
+        return failed(vm, "write");
+      }
+      written += count;
+    }
+    args[-1] = Value((int64_t)string->length());
+    return true;
+  }
+
+  // open(path, mode) - a fd of the file at [path], read for "r", written
+  //  over for "w" & appended to for "a".
+  static bool open(VM &vm, Value *args, int) {
+    String *path = string(vm, "open", args[0]);
+    String *mode = string(vm, "open", args[1]);
+    if (path == nullptr || mode == nullptr) return false;
+
+    int flags;
+    if (strcmp(mode->cString(), "r") == 0) {
+      flags = O_RDONLY;
+    } else if (strcmp(mode->cString(), "w") == 0) {
+      flags = O_WRONLY | O_CREAT | O_TRUNC;
+    } else if (strcmp(mode->cString(), "a") == 0) {
+      flags = O_WRONLY | O_CREAT | O_APPEND;
+    } else {
+      vm.nativeError("open takes mode \"r\", \"w\" or \"a\"");
+      return false;
+    }
+
+    int fd = ::open(path->cString(), flags | O_NONBLOCK | O_CLOEXEC, 0644);
+    if (fd < 0) return failed(vm, "open");
+    args[-1] = Value((int64_t)fd);
+    return true;
+  }
+
+  // close(fd) - closes [fd], failing the fibers waiting on it.
+  static bool close(VM &vm, Value *args, int) {
+    int fd;
+    if (!Io::fd(vm, "close", args[0], &fd)) return false;
+
+    vm.loop_.forget(vm, fd);
+    if (::close(fd) < 0) return failed(vm, "close");
+    args[-1] = Value::Nil;
+    return true;
+  }
+
+  // pipe() - [read end, write end].
+  static bool pipe(VM &vm, Value *args, int) {
+    int fds[2];
+    if (pipe2(fds, O_NONBLOCK | O_CLOEXEC) < 0) return failed(vm, "pipe");
+    return pair(vm, args, fds[0], fds[1]);
+  }
+
+  // socketpair() - both ends of a local stream socket.
+  static bool socketpair(VM &vm, Value *args, int) {
+    int fds[2];
+    if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, fds) < 0) {
+      return failed(vm, "socketpair");
+    }
+    return pair(vm, args, fds[0], fds[1]);
+  }
+
+  // listen(path) - a local socket listening at [path], replacing the file
+  //  there.
+  static bool listen(VM &vm, Value *args, int) {
+    String *path = string(vm, "listen", args[0]);
+    struct sockaddr_un address;
+    if (path == nullptr || !unixAddress(vm, "listen", path, &address)) return false;
+
+    int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) return failed(vm, "listen");
+    unlink(address.sun_path);
+    if (bind(fd, (struct sockaddr*)&address, sizeof(address)) < 0 ||
+        ::listen(fd, SOMAXCONN) < 0) {
+      int error = errno;
+      ::close(fd);
+      errno = error;
+      return failed(vm, "listen");
+    }
+    args[-1] = Value((int64_t)fd);
+    return true;
+  }
+
+  // accept(fd) - the fd of the next connection to the listening [fd].
+  static bool accept(VM &vm, Value *args, int) {
+    int fd;
+    if (!Io::fd(vm, "accept", args[0], &fd)) return false;
+
+    int connection;
+    do {
+      connection = accept4(fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    } while (connection < 0 && errno == EINTR);
+
+    if (connection < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) return vm.waitFor(fd, false);
+      return failed(vm, "accept");
+    }
+    args[-1] = Value((int64_t)connection);
+    return true;
+  }
+
+  // connect(path) - a fd connected to the local socket at [path]. Local
+  //  connects don't wait on the peer, it's made non blocking after.
+  static bool connect(VM &vm, Value *args, int) {
+    String *path = string(vm, "connect", args[0]);
+    struct sockaddr_un address;
+    if (path == nullptr || !unixAddress(vm, "connect", path, &address)) return false;
+
+    int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return failed(vm, "connect");
+    if (::connect(fd, (struct sockaddr*)&address, sizeof(address)) < 0 ||
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) < 0) {
+      int error = errno;
+      ::close(fd);
+      errno = error;
+      return failed(vm, "connect");
+    }
+    args[-1] = Value((int64_t)fd);
+    return true;
+  }
+
+  // sleep(ms) - nil after [ms] milliseconds, other fibers run meanwhile.
+  static bool sleep(VM &vm, Value *args, int) {
+    if (!args[0].isNumber()) {
+      vm.nativeError("sleep takes milliseconds");
+      return false;
+    }
+    vm.sleep((double)args[0]);
+    args[-1] = Value::Nil;
+    return true;
+  }
+
+  // spawn(f) - a fiber calling [f] scheduled to run, the loop runs it
+  //  alongside the others.
+  static bool spawn(VM &vm, Value *args, int) {
+    Fiber *fiber = vm.spawn(vm.fiber_->module, args[0]);
+    if (fiber == nullptr) {
+      vm.nativeError("spawn takes a function of at most 1 argument");
+      return false;
+    }
+    args[-1] = Value(fiber);
+    return true;
+  }
+
+  // fiber(f) - a fiber calling [f] on its first resume.
+  static bool fiber(VM &vm, Value *args, int) {
+    if (Fiber::functionOf(args[0]) == nullptr) {
+      vm.nativeError("Fibers run functions taking at most 1 argument");
+      return false;
+    }
+    args[-1] = Value(Fiber::create(vm, vm.fiber_->module, args[0]));
+    return true;
+  }
+
+  // resume(fiber, value) - runs [fiber] from where it left off, with
+  //  [value], nil if there's none, as the result of its yield or the
+  //  argument of its function on the first resume. Returns what it yields
+  //  or returns next. See [VM::handOff].
+  static bool resume(VM &vm, Value *args, int argCount) {
+    if (argCount < 1 || argCount > 2) {
+      vm.nativeError("Expected 1 or 2 arguments but got %d", argCount);
+      return false;
+    }
+    if (!args[0].isFiber()) {
+      vm.nativeError("Only fibers can be resumed");
+      return false;
+    }
+
+    Fiber *fiber = static_cast<Fiber*>((Object*)args[0]);
+    if (fiber->state != FiberState::New && fiber->state != FiberState::Suspended) {
+      vm.nativeError(fiber->state == FiberState::Done ? "Can't resume a finished fiber"
+                     : fiber->state == FiberState::Running ? "Can't resume a running fiber"
+                                                           : "Can't resume a blocked fiber");
+      return false;
+    }
+    vm.handOff(fiber, argCount == 2 ? args[1] : Value::Nil);
+    args[-1] = Value::Nil;
+    return true;
+  }
+};
+
+void VM::addIo(Module *module) {
+  module->addNative("read", 1, Io::read);
+  module->addNative("write", 2, Io::write);
+  module->addNative("open", 2, Io::open);
+  module->addNative("close", 1, Io::close);
+  module->addNative("pipe", 0, Io::pipe);
+  module->addNative("socketpair", 0, Io::socketpair);
+  module->addNative("listen", 1, Io::listen);
+  module->addNative("accept", 1, Io::accept);
+  module->addNative("connect", 1, Io::connect);
+  module->addNative("sleep", 1, Io::sleep);
+  module->addNative("spawn", 1, Io::spawn);
+  module->addNative("fiber", 1, Io::fiber);
+  module->addNative("resume", -1, Io::resume);
+}
+
+} // namespace loxy
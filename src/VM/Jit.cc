@@ -0,0 +1,851 @@
+#include "Jit.h"
+
+#ifdef JIT_SUPPORTED
+#include <stddef.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "Data/SmallVector.h"
+#include "Chunk.h"
+#include "Module.h"
+#include "OpCode.h"
+#include "Value.h"
+#include "VM.h"
+#endif
+
+namespace loxy {
+
+#ifdef JIT_SUPPORTED
+
+// the code runs on these registers, the rest is scratch:
+//  rbx - the stack top, [JitState::top] while in the code.
+//  r12 - the JitState.
+//  r13 - the stack base, where locals are.
+//  r14d - the fuel budget of the VM, see [checkFuel].
+enum Reg : uint8_t {
+  RAX = 0, RCX = 1, RDX = 2, RBX = 3, RSP = 4, RBP = 5, RSI = 6, RDI = 7,
+  R12 = 12, R13 = 13, R14 = 14,
+};
+
+// condition codes of jcc & setcc.
+enum class Cond : uint8_t {
+  Overflow = 0x0, Equal = 0x4, NotEqual = 0x5, Above = 0x7, Sign = 0x8,
+  NotParity = 0xb, Less = 0xc, GreaterEqual = 0xd, LessEqual = 0xe, Greater = 0xf,
+};
+
+// the code is entered at [target] with the state in [state], & returns the
+// instruction to resume at.
+typedef int (*JitEntry)(JitState *state, const uint8_t *target);
+
+// class JitCompiler - emits a template per instruction of a chunk.
+class JitCompiler {
+  // the code leaves at [ip] from the rel32 at [pos], see [emitExits].
+  struct Exit {
+    int32_t pos;
+    int ip;
+    bool guard;
+  };
+
+  // a rel32 at [pos] to the instruction at [ip].
+  struct Jump {
+    int32_t pos;
+    int ip;
+  };
+
+  VM &vm;
+  const Chunk *chunk_;
+
+  SmallVector<uint8_t, 1024> code_;
+  SmallVector<int32_t, 256> entries_;
+  SmallVector<Exit, 32> exits_;
+  SmallVector<Jump, 32> jumps_;
+
+  // while emitting an unchecked op, failed guards jump from these rel32s
+  // to its slow path instead of leaving, see [unchecked].
+  bool unchecked_;
+  SmallVector<int32_t, 8> slowPaths_;
+
+  // operand offsets relative to the stack top.
+  static const int32_t VALUE = sizeof(Value);
+  static const int32_t TYPE = 0;
+  static const int32_t AS = 8;
+
+public:
+  JitCompiler(VM &vm, const Chunk *chunk)
+    : vm(vm), chunk_(chunk), code_(vm), entries_(vm), exits_(vm), jumps_(vm),
+      unchecked_(false), slowPaths_(vm) {}
+
+  JitCode *compile();
+
+private:
+
+  int32_t here() const { return code_.count(); }
+
+  void byte(uint8_t b) { code_.push(b); }
+
+  void imm32(int32_t value) {
+    for (int i = 0; i < 4; i++) byte((uint8_t)(value >> (8 * i)));
+  }
+
+  void imm64(uint64_t value) {
+    for (int i = 0; i < 8; i++) byte((uint8_t)(value >> (8 * i)));
+  }
+
+  void patch32(int32_t pos, int32_t value) {
+    for (int i = 0; i < 4; i++) code_[pos + i] = (uint8_t)(value >> (8 * i));
+  }
+
+  // rex - the REX prefix for [reg] & [base], left out when it's empty &
+  //  not 64-bit.
+  void rex(bool wide, int reg, int base) {
+    uint8_t prefix = 0x40 | (wide << 3) | ((reg >> 3) << 2) | (base >> 3);
+    if (prefix != 0x40) byte(prefix);
+  }
+
+  // mem - the ModRM (& SIB) bytes of [base + disp] for [reg].
+  void mem(int reg, int base, int32_t disp) {
+    bool small = disp >= -128 && disp <= 127;
+    byte((small ? 0x40 : 0x80) | ((reg & 7) << 3) | (base & 7));
+    if ((base & 7) == RSP) byte(0x24);
+    if (small) {
+      byte((uint8_t)disp);
+    } else {
+      imm32(disp);
+    }
+  }
+
+  // op r64, [base + disp] & the like, for one byte [opcode]s.
+  void op(uint8_t opcode, int reg, int base, int32_t disp, bool wide = true) {
+    rex(wide, reg, base);
+    byte(opcode);
+    mem(reg, base, disp);
+  }
+
+  // sse ops on [xmm] & [base + disp], [prefix] 0 for none.
+  void sse(uint8_t prefix, uint8_t opcode, int base, int32_t disp, int xmm = 0, bool wide = false) {
+    if (prefix != 0) byte(prefix);
+    rex(wide, xmm, base);
+    byte(0x0f);
+    byte(opcode);
+    mem(xmm, base, disp);
+  }
+
+  void load(Reg dst, Reg base, int32_t disp)   { op(0x8b, dst, base, disp); }
+  void store(Reg base, int32_t disp, Reg src)  { op(0x89, src, base, disp); }
+
+  void movImm(Reg dst, uint64_t value) {
+    rex(true, 0, dst);
+    byte(0xb8 + (dst & 7));
+    imm64(value);
+  }
+
+  // mov qword [base + disp], imm32. Values are moved a word at a time, so
+  // the padding is written too to let loads be forwarded from stores.
+  void storeType(Reg base, int32_t disp, ValueType type) {
+    op(0xc7, 0, base, disp);
+    imm32((int32_t)type);
+  }
+
+  // cmp dword [base + disp], imm8.
+  void cmpType(Reg base, int32_t disp, ValueType type) {
+    op(0x83, 7, base, disp, false);
+    byte((uint8_t)type);
+  }
+
+  // add/sub rbx, imm8.
+  void growStack(int values)   { byte(0x48); byte(0x83); byte(0xc3); byte(VALUE * values); }
+  void shrinkStack(int values) { byte(0x48); byte(0x83); byte(0xeb); byte(VALUE * values); }
+
+  // setcc al.
+  void setcc(Cond cond, Reg reg = RAX) { byte(0x0f); byte(0x90 + (uint8_t)cond); byte(0xc0 + reg); }
+
+  // jcc rel32 to the exit of [ip].
+  void exitIf(Cond cond, int ip, bool guard) {
+    byte(0x0f);
+    byte(0x80 + (uint8_t)cond);
+    exits_.push(Exit{here(), ip, guard});
+    imm32(0);
+  }
+
+  // bail - leaves at [ip] through a failed guard if [cond] holds, see
+  //  [unchecked] for unchecked ops.
+  void bail(Cond cond, int ip) {
+    if (!unchecked_) {
+      exitIf(cond, ip, true);
+      return;
+    }
+    byte(0x0f);
+    byte(0x80 + (uint8_t)cond);
+    slowPaths_.push(here());
+    imm32(0);
+  }
+
+  // binds the rel32 at [pos] to here.
+  void bindNear(int32_t pos) { patch32(pos, here() - (pos + 4)); }
+
+  // leaves the code unconditionally at [ip].
+  void exitAt(int ip) {
+    byte(0xe9);
+    exits_.push(Exit{here(), ip, false});
+    imm32(0);
+  }
+
+  // jmp/jcc rel32 to the instruction at [ip].
+  void jumpTo(int ip) {
+    byte(0xe9);
+    jumps_.push(Jump{here(), ip});
+    imm32(0);
+  }
+
+  void jumpTo(int ip, Cond cond) {
+    byte(0x0f);
+    byte(0x80 + (uint8_t)cond);
+    jumps_.push(Jump{here(), ip});
+    imm32(0);
+  }
+
+  // jcc/jmp rel8 forward within a template, see [bind].
+  int32_t jumpShort(Cond cond) {
+    byte(0x70 + (uint8_t)cond);
+    byte(0);
+    return here();
+  }
+
+  int32_t jumpShort() {
+    byte(0xeb);
+    byte(0);
+    return here();
+  }
+
+  // jmp rel32 forward within a template, see [bindNear].
+  int32_t jumpNear() {
+    byte(0xe9);
+    imm32(0);
+    return here() - 4;
+  }
+
+  void bind(int32_t from) {
+    int32_t distance = here() - from;
+    assert(distance < 128 && "Short jump too far");
+    code_[from - 1] = (uint8_t)distance;
+  }
+
+  // copies the value at [from + fromDisp] to [to + toDisp].
+  void moveValue(Reg to, int32_t toDisp, Reg from, int32_t fromDisp) {
+    load(RAX, from, fromDisp);
+    load(RCX, from, fromDisp + AS);
+    store(to, toDisp, RAX);
+    store(to, toDisp + AS, RCX);
+  }
+
+  // pushes a value known at compile time.
+  void pushValue(Value value) {
+    uint64_t words[2];
+    memcpy(words, &value, sizeof(words));
+
+    movImm(RAX, words[0]);
+    store(RBX, 0, RAX);
+    movImm(RAX, words[1]);
+    store(RBX, AS, RAX);
+    growStack(1);
+  }
+
+  // guards - leaves at [ip] unless both operands are of [type].
+  void guards(int ip, ValueType type) {
+    cmpType(RBX, -2 * VALUE + TYPE, type);
+    bail(Cond::NotEqual, ip);
+    cmpType(RBX, -VALUE + TYPE, type);
+    bail(Cond::NotEqual, ip);
+  }
+
+  // replaces both operands with the bool in al.
+  void pushBool() {
+    byte(0x0f); byte(0xb6); byte(0xc0);   // movzx eax, al
+    store(RBX, -2 * VALUE + AS, RAX);
+    storeType(RBX, -2 * VALUE + TYPE, ValueType::Bool);
+    shrinkStack(1);
+  }
+
+  // checkFuel - leaves at [ip] once the fuel budget of the VM is spent,
+  //  for the interpreter to run the instruction & take the next slice,
+  //  see [VM::refuel]. [chargeFuel] charges a unit. The budget is kept in
+  //  r14d while in the code.
+  void checkFuel(int ip) {
+    byte(0x45); byte(0x85); byte(0xf6);         // test r14d, r14d
+    exitIf(Cond::LessEqual, ip, false);
+  }
+
+  void chargeFuel() {
+    byte(0x41); byte(0xff); byte(0xce);         // dec r14d
+  }
+
+  // loads the budget into r14d, or stores it back.
+  void loadFuel() {
+    movImm(RCX, (uint64_t)(uintptr_t)&vm.budget_);
+    op(0x8b, R14, RCX, 0, false);               // mov r14d, [rcx]
+  }
+
+  void storeFuel() {
+    movImm(RCX, (uint64_t)(uintptr_t)&vm.budget_);
+    op(0x89, R14, RCX, 0, false);               // mov [rcx], r14d
+  }
+
+  // jumps to [ip] if the top of the stack is falsey.
+  void jumpIfFalsey(int ip) {
+    cmpType(RBX, -VALUE + TYPE, ValueType::Nil);
+    jumpTo(ip, Cond::Equal);
+    cmpType(RBX, -VALUE + TYPE, ValueType::Bool);
+    int32_t truthy = jumpShort(Cond::NotEqual);
+    op(0x80, 7, RBX, -VALUE + AS, false);  // cmp byte [rbx - 8], 0
+    byte(0);
+    jumpTo(ip, Cond::Equal);
+    bind(truthy);
+  }
+
+  void callHelper(const void *helper, const void *arg) {
+    store(R12, offsetof(JitState, top), RBX);
+    byte(0x4c); byte(0x89); byte(0xe7);   // mov rdi, r12
+    if (arg != nullptr) movImm(RSI, (uint64_t)arg);
+    movImm(RAX, (uint64_t)helper);
+    byte(0xff); byte(0xd0);               // call rax
+    load(RBX, R12, offsetof(JitState, top));
+  }
+
+  // int ops.
+  void intArithmetics(int ip, uint8_t opcode);
+  void intMultiply(int ip);
+  void intCompare(int ip, Cond cond);
+
+  // double ops.
+  void numberArithmetics(int ip, uint8_t opcode);
+  void numberCompare(int ip, bool swap, Cond cond);
+
+  // unchecked ops, on proven numbers.
+  void toDouble(int xmm, int32_t disp);
+  void unchecked(int ip, OpCode opcode);
+
+  // counting loops.
+  void intOperand(bool local, uint8_t operand);
+  void forLoop(int ip);
+
+  // instruction - emits the template of the instruction at [ip], returns
+  //  the offset of the next one.
+  int instruction(int ip);
+
+  void emitPrologue();
+  void emitExits();
+  void patchJumps();
+};
+
+void JitCompiler::intArithmetics(int ip, uint8_t opcode) {
+  guards(ip, ValueType::Int);
+  load(RAX, RBX, -2 * VALUE + AS);
+  op(opcode, RAX, RBX, -VALUE + AS);
+  bail(Cond::Overflow, ip);
+  store(RBX, -2 * VALUE + AS, RAX);
+  shrinkStack(1);
+}
+
+void JitCompiler::intMultiply(int ip) {
+  guards(ip, ValueType::Int);
+  load(RAX, RBX, -2 * VALUE + AS);
+  rex(true, RAX, RBX);                      // imul rax, [rbx - 8]
+  byte(0x0f); byte(0xaf);
+  mem(RAX, RBX, -VALUE + AS);
+  bail(Cond::Overflow, ip);
+
+  // a 0 product with a negative operand is -0, a double.
+  byte(0x48); byte(0x85); byte(0xc0);       // test rax, rax
+  int32_t nonZero = jumpShort(Cond::NotEqual);
+  load(RCX, RBX, -2 * VALUE + AS);
+  op(0x0b, RCX, RBX, -VALUE + AS);          // or rcx, [rbx - 8]
+  bail(Cond::Sign, ip);
+  bind(nonZero);
+
+  store(RBX, -2 * VALUE + AS, RAX);
+  shrinkStack(1);
+}
+
+void JitCompiler::intCompare(int ip, Cond cond) {
+  guards(ip, ValueType::Int);
+  load(RAX, RBX, -2 * VALUE + AS);
+  op(0x3b, RAX, RBX, -VALUE + AS);          // cmp rax, [rbx - 8]
+  setcc(cond);
+  pushBool();
+}
+
+void JitCompiler::numberArithmetics(int ip, uint8_t opcode) {
+  guards(ip, ValueType::Number);
+  sse(0xf2, 0x10, RBX, -2 * VALUE + AS);    // movsd xmm0, a
+  sse(0xf2, opcode, RBX, -VALUE + AS);
+  sse(0xf2, 0x11, RBX, -2 * VALUE + AS);    // movsd a, xmm0
+  shrinkStack(1);
+}
+
+void JitCompiler::numberCompare(int ip, bool swap, Cond cond) {
+  guards(ip, ValueType::Number);
+  // ucomisd sets the flags like an unsigned compare, NaNs as unordered.
+  sse(0xf2, 0x10, RBX, swap ? -VALUE + AS : -2 * VALUE + AS);
+  sse(0x66, 0x2e, RBX, swap ? -2 * VALUE + AS : -VALUE + AS);
+  setcc(cond);
+  if (cond == Cond::Equal) {
+    setcc(Cond::NotParity, RCX);
+    byte(0x20); byte(0xc8);                 // and al, cl
+  }
+  pushBool();
+}
+
+// loads the number at [rbx + disp] into [xmm] as a double.
+void JitCompiler::toDouble(int xmm, int32_t disp) {
+  cmpType(RBX, disp + TYPE, ValueType::Int);
+  int32_t isDouble = jumpShort(Cond::NotEqual);
+  sse(0xf2, 0x2a, RBX, disp + AS, xmm, true);  // cvtsi2sd xmm, qword
+  int32_t done = jumpShort();
+  bind(isDouble);
+  sse(0xf2, 0x10, RBX, disp + AS, xmm);        // movsd xmm, qword
+  bind(done);
+}
+
+// unchecked ops run two ints inline behind guards, which fall back to
+// doubles: the operands are numbers, so anything else, an int & a double
+// or an int overflow, is a double op. NEGATE & comparisons of an int & a
+// double call the VM.
+void JitCompiler::unchecked(int ip, OpCode opcode) {
+  if (opcode == OpCode::NEGATE_NUM) {
+    byte(0xbe); imm32((int32_t)OpCode::NEGATE);  // mov esi, op
+    callHelper((const void*)&JitCode::generic, nullptr);
+    return;
+  }
+
+  unchecked_ = true;
+  int32_t done = -1;
+  switch (opcode) {
+  case OpCode::GREATER_NUM:   intCompare(ip, Cond::Greater); break;
+  case OpCode::LESS_NUM:      intCompare(ip, Cond::Less); break;
+  case OpCode::ADD_NUM:       intArithmetics(ip, 0x03); break;
+  case OpCode::SUBTRACT_NUM:  intArithmetics(ip, 0x2b); break;
+  case OpCode::MULTIPLY_NUM:  intMultiply(ip); break;
+  default:                    break;
+  }
+  if (slowPaths_.count() > 0) {
+    done = jumpNear();
+    for (int32_t pos : slowPaths_) bindNear(pos);
+    slowPaths_.clear();
+  }
+  unchecked_ = false;
+
+  switch (opcode) {
+  case OpCode::GREATER_NUM:
+  case OpCode::LESS_NUM: {
+    // an int & a double compare exactly in the VM, see [Value::intGreater].
+    cmpType(RBX, -2 * VALUE + TYPE, ValueType::Int);
+    int32_t mixed = jumpShort(Cond::Equal);
+    cmpType(RBX, -VALUE + TYPE, ValueType::Int);
+    int32_t mixedToo = jumpShort(Cond::Equal);
+
+    // ucomisd a, b or b, a, unordered NaNs aren't above.
+    bool swap = opcode == OpCode::LESS_NUM;
+    sse(0xf2, 0x10, RBX, swap ? -VALUE + AS : -2 * VALUE + AS);
+    sse(0x66, 0x2e, RBX, swap ? -2 * VALUE + AS : -VALUE + AS);
+    setcc(Cond::Above);
+    pushBool();
+    int32_t compared = jumpShort();
+
+    bind(mixed);
+    bind(mixedToo);
+    byte(0xbe);                                 // mov esi, op
+    imm32((int32_t)(swap ? OpCode::LESS : OpCode::GREATER));
+    callHelper((const void*)&JitCode::generic, nullptr);
+    bind(compared);
+    break;
+  }
+
+  default: {
+    toDouble(0, -2 * VALUE);
+    toDouble(1, -VALUE);
+    uint8_t op = opcode == OpCode::ADD_NUM      ? 0x58
+               : opcode == OpCode::SUBTRACT_NUM ? 0x5c
+               : opcode == OpCode::MULTIPLY_NUM ? 0x59
+               : 0x5e;
+    byte(0xf2); byte(0x0f); byte(op); byte(0xc1);  // op xmm0, xmm1
+    sse(0xf2, 0x11, RBX, -2 * VALUE + AS);        // movsd a, xmm0
+    storeType(RBX, -2 * VALUE + TYPE, ValueType::Number);
+    shrinkStack(1);
+    break;
+  }
+  }
+
+  if (done >= 0) bindNear(done);
+}
+
+// loads the int local or constant [operand] of a FOR_LOOP into rcx.
+void JitCompiler::intOperand(bool local, uint8_t operand) {
+  if (local) {
+    load(RCX, R13, operand * VALUE + AS);
+  } else {
+    movImm(RCX, (uint64_t)chunk_->getConstant(operand).asInt());
+  }
+}
+
+// counters of ints step inline. Anything else, or an overflow, runs the
+// loop's own increment & condition, right after the FOR_LOOP.
+void JitCompiler::forLoop(int ip) {
+  const uint8_t *bytes = chunk_->code().data() + ip;
+  int32_t counter = bytes[1] * VALUE;
+  uint8_t flags = bytes[2];
+  uint8_t limit = bytes[3];
+  uint8_t step = bytes[4];
+  int next = ip + 9;
+  int body = next - (bytes[5] << 8 | bytes[6]);
+  int done = next + (bytes[7] << 8 | bytes[8]);
+
+  bool limitLocal = flags & FOR_LIMIT_LOCAL;
+  bool stepLocal = flags & FOR_STEP_LOCAL;
+  if ((!limitLocal && !chunk_->getConstant(limit).isInt()) ||
+      (!stepLocal && !chunk_->getConstant(step).isInt())) {
+    jumpTo(next);
+    return;
+  }
+
+  // the limit is checked before the counter changes, the generic code
+  // mustn't step it twice. Fuel too, it's charged if it loops.
+  checkFuel(ip);
+  cmpType(R13, counter + TYPE, ValueType::Int);
+  jumpTo(next, Cond::NotEqual);
+  if (stepLocal) {
+    cmpType(R13, step * VALUE + TYPE, ValueType::Int);
+    jumpTo(next, Cond::NotEqual);
+  }
+  if (limitLocal) {
+    cmpType(R13, limit * VALUE + TYPE, ValueType::Int);
+    jumpTo(next, Cond::NotEqual);
+  }
+
+  load(RAX, R13, counter + AS);
+  intOperand(stepLocal, step);
+  byte(0x48); byte(flags & FOR_SUBTRACT ? 0x29 : 0x01); byte(0xc8);  // add/sub rax, rcx
+  jumpTo(next, Cond::Overflow);
+  store(R13, counter + AS, RAX);
+
+  // the limit may be the counter itself, it's read after the step.
+  intOperand(limitLocal, limit);
+  byte(0x48); byte(0x39); byte(0xc8);       // cmp rax, rcx
+  Cond loops = flags & FOR_GREATER
+    ? (flags & FOR_NEGATE ? Cond::LessEqual : Cond::Greater)
+    : (flags & FOR_NEGATE ? Cond::GreaterEqual : Cond::Less);
+  jumpTo(done, (Cond)((uint8_t)loops ^ 1));     // the negated condition
+  chargeFuel();
+  jumpTo(body);
+}
+
+int JitCompiler::instruction(int ip) {
+  const uint8_t *bytes = chunk_->code().data();
+  OpCode opcode = (OpCode)bytes[ip];
+
+  switch (opcode) {
+  case OpCode::CONSTANT:  pushValue(chunk_->getConstant(bytes[ip + 1])); return ip + 2;
+  case OpCode::NIL:       pushValue(Value::Nil); return ip + 1;
+  case OpCode::TRUE:      pushValue(Value::True); return ip + 1;
+  case OpCode::FALSE:     pushValue(Value::False); return ip + 1;
+  case OpCode::POP:       shrinkStack(1); return ip + 1;
+
+  case OpCode::GET_LOCAL:
+    moveValue(RBX, 0, R13, bytes[ip + 1] * VALUE);
+    growStack(1);
+    return ip + 2;
+
+  case OpCode::SET_LOCAL:
+    moveValue(R13, bytes[ip + 1] * VALUE, RBX, -VALUE);
+    return ip + 2;
+
+  case OpCode::GET_GLOBAL:
+  case OpCode::SET_GLOBAL: {
+    // undefined globals leave, the interpreter reports them.
+    const void *helper = opcode == OpCode::GET_GLOBAL ? (const void*)&JitCode::getGlobal
+                                                  : (const void*)&JitCode::setGlobal;
+    callHelper(helper, (Object*)chunk_->getConstant(bytes[ip + 1]));
+    byte(0x84); byte(0xc0);                     // test al, al
+    exitIf(Cond::Equal, ip, false);
+    return ip + 2;
+  }
+
+  case OpCode::PRINT:
+    callHelper((const void*)&JitCode::print, nullptr);
+    return ip + 1;
+
+  case OpCode::NOT: {
+    byte(0x31); byte(0xc0);                     // xor eax, eax
+    cmpType(RBX, -VALUE + TYPE, ValueType::Nil);
+    int32_t nil = jumpShort(Cond::Equal);
+    cmpType(RBX, -VALUE + TYPE, ValueType::Bool);
+    int32_t notBool = jumpShort(Cond::NotEqual);
+    op(0x80, 7, RBX, -VALUE + AS, false);       // cmp byte [rbx - 8], 0
+    byte(0);
+    int32_t truthy = jumpShort(Cond::NotEqual);
+    bind(nil);
+    byte(0xb0); byte(1);                        // mov al, 1
+    bind(notBool);
+    bind(truthy);
+    byte(0x0f); byte(0xb6); byte(0xc0);         // movzx eax, al
+    store(RBX, -VALUE + AS, RAX);
+    storeType(RBX, -VALUE + TYPE, ValueType::Bool);
+    return ip + 1;
+  }
+
+  case OpCode::FOR_LOOP:
+    forLoop(ip);
+    return ip + 9;
+
+  case OpCode::JUMP:
+  case OpCode::JUMP_IF_FALSE:
+  case OpCode::LOOP: {
+    int offset = bytes[ip + 1] << 8 | bytes[ip + 2];
+    int target = opcode == OpCode::LOOP ? ip + 3 - offset : ip + 3 + offset;
+    if (opcode == OpCode::JUMP_IF_FALSE) {
+      jumpIfFalsey(target);
+    } else if (opcode == OpCode::LOOP) {
+      checkFuel(ip);
+      chargeFuel();
+      jumpTo(target);
+    } else {
+      jumpTo(target);
+    }
+    return ip + 3;
+  }
+
+  case OpCode::EQUAL_INT:       intCompare(ip, Cond::Equal); return ip + 2;
+  case OpCode::GREATER_INT:     intCompare(ip, Cond::Greater); return ip + 2;
+  case OpCode::LESS_INT:        intCompare(ip, Cond::Less); return ip + 2;
+  case OpCode::ADD_INT:         intArithmetics(ip, 0x03); return ip + 2;
+  case OpCode::SUBTRACT_INT:    intArithmetics(ip, 0x2b); return ip + 2;
+  case OpCode::MULTIPLY_INT:    intMultiply(ip); return ip + 2;
+
+  case OpCode::EQUAL_NUMBER:    numberCompare(ip, false, Cond::Equal); return ip + 2;
+  case OpCode::GREATER_NUMBER:  numberCompare(ip, false, Cond::Above); return ip + 2;
+  case OpCode::LESS_NUMBER:     numberCompare(ip, true, Cond::Above); return ip + 2;
+  case OpCode::ADD_NUMBER:      numberArithmetics(ip, 0x58); return ip + 2;
+  case OpCode::SUBTRACT_NUMBER: numberArithmetics(ip, 0x5c); return ip + 2;
+  case OpCode::MULTIPLY_NUMBER: numberArithmetics(ip, 0x59); return ip + 2;
+
+  case OpCode::GREATER_NUM:
+  case OpCode::LESS_NUM:
+  case OpCode::ADD_NUM:
+  case OpCode::SUBTRACT_NUM:
+  case OpCode::MULTIPLY_NUM:
+    unchecked(ip, opcode);
+    return ip + 2;
+
+  case OpCode::DIVIDE_NUM:
+  case OpCode::NEGATE_NUM:
+    unchecked(ip, opcode);
+    return ip + 1;
+
+  // generic ops leave for anything but numbers, the interpreter concats
+  // strings & reports errors.
+  case OpCode::EQUAL:
+  case OpCode::GREATER:
+  case OpCode::LESS:
+  case OpCode::ADD:
+  case OpCode::SUBTRACT:
+  case OpCode::MULTIPLY:
+  case OpCode::DIVIDE:
+  case OpCode::NEGATE: {
+    byte(0xbe); imm32((int32_t)opcode);         // mov esi, op
+    callHelper((const void*)&JitCode::generic, nullptr);
+    byte(0x84); byte(0xc0);                     // test al, al
+    exitIf(Cond::Equal, ip, false);
+    bool cached = opcode != OpCode::DIVIDE && opcode != OpCode::NEGATE;
+    return ip + (cached ? 2 : 1);
+  }
+
+  // left to the interpreter.
+  case OpCode::DEFINE_GLOBAL:
+  case OpCode::CALL:
+  case OpCode::TAIL_CALL:
+  case OpCode::CLOSURE:
+  case OpCode::GET_UPVALUE:
+  case OpCode::SET_UPVALUE:
+  case OpCode::GET_OUTER:
+  case OpCode::SET_OUTER:
+  case OpCode::CLASS:
+  case OpCode::METHOD:
+  case OpCode::ARRAY:
+    exitAt(ip);
+    return ip + 2;
+
+  case OpCode::GET_PROPERTY:
+  case OpCode::SET_PROPERTY:
+    exitAt(ip);
+    return ip + 3;
+
+  case OpCode::INVOKE:
+    exitAt(ip);
+    return ip + 4;
+
+  case OpCode::MAP:
+  case OpCode::MAP_INSERT:
+  case OpCode::GET_INDEX:
+  case OpCode::SET_INDEX:
+  case OpCode::CLOSE_UPVALUE:
+  case OpCode::YIELD:
+  case OpCode::RETURN:
+    exitAt(ip);
+    return ip + 1;
+  }
+
+  UNREACHABLE();
+  return ip + 1;
+}
+
+void JitCompiler::emitPrologue() {
+  // callee saved, 5 pushes also align the stack for calls.
+  byte(0x53);                                 // push rbx
+  byte(0x55);                                 // push rbp
+  byte(0x41); byte(0x54);                     // push r12
+  byte(0x41); byte(0x55);                     // push r13
+  byte(0x41); byte(0x56);                     // push r14
+
+  byte(0x49); byte(0x89); byte(0xfc);         // mov r12, rdi
+  load(RBX, R12, offsetof(JitState, top));
+  load(R13, R12, offsetof(JitState, stack));
+  loadFuel();
+  byte(0xff); byte(0xe6);                     // jmp rsi
+}
+
+void JitCompiler::emitExits() {
+  SmallVector<int32_t, 32> leaves(vm);
+
+  for (const Exit &site : exits_) {
+    patch32(site.pos, here() - (site.pos + 4));
+
+    if (site.guard) {
+      op(0xff, 0, R12, offsetof(JitState, guardExits));  // inc qword
+    }
+    byte(0xb8); imm32(site.ip);               // mov eax, ip
+    byte(0xe9);
+    leaves.push(here());
+    imm32(0);
+  }
+
+  for (int32_t pos : leaves) patch32(pos, here() - (pos + 4));
+
+  store(R12, offsetof(JitState, top), RBX);
+  storeFuel();
+  byte(0x41); byte(0x5e);                     // pop r14
+  byte(0x41); byte(0x5d);                     // pop r13
+  byte(0x41); byte(0x5c);                     // pop r12
+  byte(0x5d);                                 // pop rbp
+  byte(0x5b);                                 // pop rbx
+  byte(0xc3);                                 // ret
+}
+
+void JitCompiler::patchJumps() {
+  for (const Jump &jump : jumps_) {
+    assert(entries_[jump.ip] >= 0 && "Jump into an instruction");
+    patch32(jump.pos, entries_[jump.ip] - (jump.pos + 4));
+  }
+}
+
+JitCode *JitCompiler::compile() {
+  int count = (int)chunk_->size();
+  for (int i = 0; i < count; i++) entries_.push(-1);
+
+  emitPrologue();
+  for (int ip = 0; ip < count;) {
+    entries_[ip] = here();
+    ip = instruction(ip);
+  }
+  emitExits();
+  patchJumps();
+
+  size_t size = code_.count();
+  void *pages = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (pages == MAP_FAILED) return nullptr;
+
+  memcpy(pages, code_.data(), size);
+  if (mprotect(pages, size, PROT_READ | PROT_EXEC) != 0) {
+    munmap(pages, size);
+    return nullptr;
+  }
+
+  int32_t *entries = (int32_t*)vm.reallocate(nullptr, 0, sizeof(int32_t) * count);
+  assert(entries != nullptr && "Out of memory");
+  memcpy(entries, entries_.data(), sizeof(int32_t) * count);
+
+  void *mem = vm.reallocate(nullptr, 0, sizeof(JitCode));
+  assert(mem != nullptr && "Out of memory");
+  return ::new(mem) JitCode((uint8_t*)pages, size, entries, count);
+}
+
+JitCode *JitCode::compile(VM &vm, const Chunk *chunk) {
+  static_assert(sizeof(Value) == 16, "Templates assume 16-byte values");
+  static_assert(offsetof(Value, type) == 0 && offsetof(Value, as) == 8,
+                "Templates assume a value is its type followed by its payload");
+
+  return JitCompiler(vm, chunk).compile();
+}
+
+void JitCode::destroy(VM &vm, JitCode **codePtr) {
+  if (*codePtr == nullptr) return;
+
+  JitCode *code = *codePtr;
+  munmap(code->code_, code->size_);
+  vm.reallocate(code->entries_, sizeof(int32_t) * code->count_, 0);
+  vm.reallocate(code, sizeof(JitCode), 0);
+  *codePtr = nullptr;
+}
+
+int JitCode::run(JitState &state, int ip) {
+  assert(ip < count_ && entries_[ip] >= 0 && "Entering the code mid instruction");
+
+  JitEntry entry = (JitEntry)code_;
+  ip = entry(&state, code_ + entries_[ip]);
+  guardExits_ += state.guardExits;
+  return ip;
+}
+
+bool JitCode::getGlobal(JitState *state, String *name) {
+  state->vm->stackTop_ = state->top;
+
+  Value value;
+  if (!state->module->getVariable(name, &value)) return false;
+  *state->top++ = value;
+  return true;
+}
+
+bool JitCode::setGlobal(JitState *state, String *name) {
+  // setting may grow the table & collect, the stack must be up to date.
+  state->vm->stackTop_ = state->top;
+  return state->module->setVariable(name, state->top[-1]);
+}
+
+bool JitCode::generic(JitState *state, int op) {
+  if (!VM::arithmetic((OpCode)op, state->top)) return false;
+  if ((OpCode)op != OpCode::NEGATE) state->top--;
+  return true;
+}
+
+void JitCode::print(JitState *state) {
+  state->vm->stackTop_ = state->top;
+
+  Output &out = state->vm->output();
+  out.writeValue(state->top[-1]);
+  out.newline();
+  state->top--;
+}
+
+#else
+
+JitCode *JitCode::compile(VM &vm, const Chunk *chunk) {
+  return nullptr;
+}
+
+void JitCode::destroy(VM &vm, JitCode **codePtr) {}
+
+int JitCode::run(JitState &state, int ip) {
+  UNREACHABLE();
+  return ip;
+}
+
+#endif
+
+} // namespace loxy
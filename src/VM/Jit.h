@@ -0,0 +1,81 @@
+#ifndef loxy_jit_h
+#define loxy_jit_h
+
+#include "Common.h"
+
+namespace loxy {
+
+class Chunk;
+class Module;
+class String;
+class Value;
+class VM;
+
+// JitState - what jitted code runs on, shared with the interpreter.
+struct JitState {
+  VM *vm;
+  Module *module;
+
+  // the operand stack of [VM::run]. [top] is up to date whenever the code
+  // calls into the VM & once it left.
+  Value *stack;
+  Value *top;
+
+  // times the code left because an operand failed a type guard.
+  size_t guardExits;
+};
+
+// class JitCode - the baseline x86-64 code of a chunk, a machine code
+//  template per instruction.
+//
+//  The code keeps the interpreter's stack layout, so it can be entered at,
+//  & left before, any instruction. Specialized binary ops run inline behind
+//  type guards; generic arithmetics on numbers, globals & print call into
+//  the VM; anything else leaves the code for the interpreter to run it.
+//
+//  Code is written to writable pages which are then made executable,
+//  never both at once.
+class JitCode {
+  // mmap'ed, [size_] bytes.
+  uint8_t *code_;
+  size_t size_;
+
+  // machine code offset of each instruction, by its offset in the
+  // chunk. -1 for operand bytes.
+  int32_t *entries_;
+  int count_;
+
+  size_t guardExits_;
+
+  JitCode(uint8_t *code, size_t size, int32_t *entries, int count)
+    : code_(code), size_(size), entries_(entries), count_(count), guardExits_(0) {}
+
+  // helpers called by the code, see [JitState].
+  static bool getGlobal(JitState *state, String *name);
+  static bool setGlobal(JitState *state, String *name);
+  static void print(JitState *state);
+  static bool generic(JitState *state, int op);
+
+  friend class JitCompiler;
+
+public:
+
+  // compile - compiles [chunk] as it is now, quickened ops included.
+  //  returns nullptr where there's no JIT, see JIT_SUPPORTED.
+  static JitCode *compile(VM &vm, const Chunk *chunk);
+
+  static void destroy(VM &vm, JitCode **codePtr);
+
+  // run - runs from the instruction at [ip] until the code leaves, &
+  //  returns the instruction the interpreter resumes at.
+  int run(JitState &state, int ip);
+
+  size_t size() const { return size_; }
+
+  // guardExits - times the code left through failed guards so far.
+  size_t guardExits() const { return guardExits_; }
+};
+
+} // namespace loxy
+
+#endif
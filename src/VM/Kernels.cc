@@ -0,0 +1,126 @@
+#include <math.h>
+#include <string.h>
+#include "Kernels.h"
+
+namespace loxy {
+
+namespace {
+
+// two doubles, an SSE2 or a NEON register. The compiler lowers them to
+// scalar code on targets with neither.
+typedef double Lanes __attribute__((vector_size(16)));
+typedef int64_t Mask __attribute__((vector_size(16)));
+
+const size_t LANES = 2;
+
+// elements needn't be aligned.
+inline Lanes load(const double *p) {
+  Lanes lanes;
+  memcpy(&lanes, p, sizeof(lanes));
+  return lanes;
+}
+
+inline void store(double *p, Lanes lanes) {
+  memcpy(p, &lanes, sizeof(lanes));
+}
+
+inline Lanes splat(double k) {
+  Lanes lanes = { k, k };
+  return lanes;
+}
+
+// pick - [a] in the lanes set in [mask], [b] in the others.
+inline Lanes pick(Mask mask, Lanes a, Lanes b) {
+  return (Lanes)(((Mask)a & mask) | ((Mask)b & ~mask));
+}
+
+} // namespace
+
+// sums & products run two registers at once, the adds of one don't wait
+// on the other.
+double sumNumbers(const double *a, size_t count) {
+  Lanes sum0 = splat(0), sum1 = splat(0);
+  size_t i = 0;
+  for (; i + 2 * LANES <= count; i += 2 * LANES) {
+    sum0 += load(a + i);
+    sum1 += load(a + i + LANES);
+  }
+
+  Lanes sum = sum0 + sum1;
+  double result = sum[0] + sum[1];
+  for (; i < count; i++) result += a[i];
+  return result;
+}
+
+// a NaN compares false, the lane keeps what it had.
+double minNumbers(const double *a, size_t count) {
+  Lanes least = splat(INFINITY);
+  size_t i = 0;
+  for (; i + LANES <= count; i += LANES) {
+    Lanes lanes = load(a + i);
+    least = pick((Mask)(lanes < least), lanes, least);
+  }
+
+  double result = least[0] < least[1] ? least[0] : least[1];
+  for (; i < count; i++) {
+    if (a[i] < result) result = a[i];
+  }
+  return result;
+}
+
+double maxNumbers(const double *a, size_t count) {
+  Lanes greatest = splat(-INFINITY);
+  size_t i = 0;
+  for (; i + LANES <= count; i += LANES) {
+    Lanes lanes = load(a + i);
+    greatest = pick((Mask)(lanes > greatest), lanes, greatest);
+  }
+
+  double result = greatest[0] > greatest[1] ? greatest[0] : greatest[1];
+  for (; i < count; i++) {
+    if (a[i] > result) result = a[i];
+  }
+  return result;
+}
+
+double dotNumbers(const double *a, const double *b, size_t count) {
+  Lanes sum0 = splat(0), sum1 = splat(0);
+  size_t i = 0;
+  for (; i + 2 * LANES <= count; i += 2 * LANES) {
+    sum0 += load(a + i) * load(b + i);
+    sum1 += load(a + i + LANES) * load(b + i + LANES);
+  }
+
+  Lanes sum = sum0 + sum1;
+  double result = sum[0] + sum[1];
+  for (; i < count; i++) result += a[i] * b[i];
+  return result;
+}
+
+void addScalar(double *out, const double *a, double k, size_t count) {
+  Lanes lanes = splat(k);
+  size_t i = 0;
+  for (; i + LANES <= count; i += LANES) store(out + i, load(a + i) + lanes);
+  for (; i < count; i++) out[i] = a[i] + k;
+}
+
+void multiplyScalar(double *out, const double *a, double k, size_t count) {
+  Lanes lanes = splat(k);
+  size_t i = 0;
+  for (; i + LANES <= count; i += LANES) store(out + i, load(a + i) * lanes);
+  for (; i < count; i++) out[i] = a[i] * k;
+}
+
+void addNumbers(double *out, const double *a, const double *b, size_t count) {
+  size_t i = 0;
+  for (; i + LANES <= count; i += LANES) store(out + i, load(a + i) + load(b + i));
+  for (; i < count; i++) out[i] = a[i] + b[i];
+}
+
+void multiplyNumbers(double *out, const double *a, const double *b, size_t count) {
+  size_t i = 0;
+  for (; i + LANES <= count; i += LANES) store(out + i, load(a + i) * load(b + i));
+  for (; i < count; i++) out[i] = a[i] * b[i];
+}
+
+} // namespace loxy
@@ -0,0 +1,33 @@
+#ifndef loxy_kernels_h
+#define loxy_kernels_h
+
+#include "Common.h"
+
+namespace loxy {
+
+// bulk operations on [count] packed doubles, for the elements of arrays.
+// They run two lanes at a time in SSE2 or NEON registers, one at a time
+// on targets with neither. See [Array].
+
+// sumNumbers - the sum of [a]. Lanes add up separately, so the result may
+//  differ from adding in order in the last bits.
+double sumNumbers(const double *a, size_t count);
+
+// minNumbers, maxNumbers - the least & the greatest of [a], NaNs are
+//  skipped. +infinity & -infinity respectively if there's nothing else.
+double minNumbers(const double *a, size_t count);
+double maxNumbers(const double *a, size_t count);
+
+// dotNumbers - the dot product of [a] & [b], summed like [sumNumbers].
+double dotNumbers(const double *a, const double *b, size_t count);
+
+// elementwise [a] + [k], [a] * [k], [a] + [b] & [a] * [b] into [out],
+// which may be one of the operands.
+void addScalar(double *out, const double *a, double k, size_t count);
+void multiplyScalar(double *out, const double *a, double k, size_t count);
+void addNumbers(double *out, const double *a, const double *b, size_t count);
+void multiplyNumbers(double *out, const double *a, const double *b, size_t count);
+
+} // namespace loxy
+
+#endif
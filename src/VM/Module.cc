@@ -1,5 +1,6 @@
 #include "Compiler/Compiler.h"
 #include "Module.h"
+#include "Chunk.h"
 #include "Value.h"
 #include "VM.h"
 
@@ -7,11 +8,10 @@ namespace loxy {
 
 Module *Module::create(VM &vm, String *name, String *path, String *src) {
   void *mem = vm.reallocate(nullptr, 0, sizeof(Module));
-  auto imports = SmallVector<Module*>::create(vm);
   auto variables = HashMap::create(vm);
 
   assert(mem != nullptr && "Out of memory");
-  return ::new Module(vm, name, path, src, variables, imports);
+  return ::new(mem) Module(vm, name, path, src, variables);
 }
 
 void Module::destroy(VM &vm, Module **modPtr) {
@@ -19,8 +19,9 @@ void Module::destroy(VM &vm, Module **modPtr) {
   if (module == nullptr) return;
 
   // free owned resources
-  SmallVector<Module*>::destroy(vm, &module->imports_);
   HashMap::destroy(vm, &module->variables_);
+  Chunk::destroy(vm, &module->bytecode_);
+  module->~Module();
 
   // free itself
   vm.reallocate(module, sizeof(Module), 0);
@@ -35,13 +36,69 @@ void Module::addVariable(String *name, Value initializer) {
 bool Module::setVariable(String *name, Value value) {
   // if [name] is a new key, then it means [name] wasn't declared,
   // thus failed.
-  return !variables_->set(name, value);
+  if (variables_->set(name, value)) {
+    variables_->del(name);
+    return false;
+  }
+  return true;
+}
+
+// addNativeVariable - the name & the native stay reachable until they're
+//  in [variables_].
+template <typename... Args>
+static void addNativeVariable(VM &vm, Module *module, const char *name, Args... args) {
+  String *string = String::create(vm, name);
+  vm.pushRoot(string);
+  NativeFunction *native = NativeFunction::create(vm, string, args...);
+  vm.pushRoot(native);
+  module->addVariable(string, Value(native));
+  vm.popRoot();
+  vm.popRoot();
+}
+
+void Module::addNative(const char *name, int arity, NativeFn function) {
+  addNativeVariable(vm, this, name, arity, function);
+}
+
+void Module::addNative(const char *name, double (*function)()) {
+  addNativeVariable(vm, this, name, function);
+}
+
+void Module::addNative(const char *name, double (*function)(double)) {
+  addNativeVariable(vm, this, name, function);
+}
+
+void Module::addNative(const char *name, double (*function)(double, double)) {
+  addNativeVariable(vm, this, name, function);
+}
+
+void Module::addNative(const char *name, double (*function)(double, double, double)) {
+  addNativeVariable(vm, this, name, function);
+}
+
+void Module::importVariables(const Module *module) {
+  if (module == this) return;
+
+  // the values stay reachable from [module].
+  module->variables_->each([this](String *name, Value value) {
+    variables_->set(name, value);
+  });
 }
 
 bool Module::getVariable(String *name, Value *result) {
   return variables_->get(name, result);
 }
 
+void Module::mark() {
+  vm.markObject(name_);
+  vm.markObject(path_);
+  vm.markObject(src_);
+  variables_->mark();
+  if (bytecode_ != nullptr) bytecode_->mark(vm);
+
+  // imported modules are reachable from [VM::modules_] as well.
+}
+
 bool Module::compile() {
   assert(src_ != nullptr && "Source code can't be NULL");
 
@@ -4,6 +4,7 @@
 #include "Data/HashMap.h"
 #include "Data/SmallVector.h"
 #include "Managed.h"
+#include "Value.h"
 
 namespace loxy {
 
@@ -14,21 +15,24 @@ class VM;
 class HashMap;
 
 class Module : public Managed {
+  // images save & restore modules as they are.
+  friend class ImageWriter;
+  friend class ImageReader;
+
 private:
 
   Module(VM &vm,
         String *name,
         String *path,
         String *src,
-        HashMap *variables,
-        SmallVector<Module*> *imports)
+        HashMap *variables)
   : vm(vm),
     name_(name),
     path_(path),
     src_(src),
     bytecode_(nullptr),
     variables_(variables),
-    imports_(imports) {}
+    imports_(vm) {}
 
 public:
   static Module *create(VM &vm, String *name, String *path, String *src);
@@ -43,6 +47,15 @@ public:
 
   bool setVariable(String *name, Value value);
 
+  // addNative - adds the host [function] as the variable [name], see
+  //  [NativeFunction]. Natives of doubles are called with the numbers of
+  //  their arguments.
+  void addNative(const char *name, int arity, NativeFn function);
+  void addNative(const char *name, double (*function)());
+  void addNative(const char *name, double (*function)(double));
+  void addNative(const char *name, double (*function)(double, double));
+  void addNative(const char *name, double (*function)(double, double, double));
+
   // module's name.
   String *getName() const { return name_; }
   void setName(String *name) { name_ = name; }
@@ -50,17 +63,25 @@ public:
   String *getPath() const { return path_; }
   void setPath(String *path) { path_ = path; }
 
-  void addImports(Module *module) { imports_->push(module); }
+  void addImports(Module *module) { imports_.push(module); }
+
+  // importVariables - adds the top-level variables of [module], replacing
+  //  those of the same names.
+  void importVariables(const Module *module);
 
   // compiles from [src_].
   bool compile();
 
+  // mark - marks objects reachable from this module, called by the collector.
+  void mark();
+
   // source code.
   const char *getSrc() const { return src_->cString(); }
   void setSrc(String *src) { src_ = src; }
 
   // the compiled bytecode of this module.
   const Chunk *getBody() const { return bytecode_; }
+  Chunk *getBody() { return bytecode_; }
   void setBody(Chunk *body) { bytecode_ = body; }
 
 private:
@@ -85,7 +106,7 @@ private:
   HashMap *variables_;
 
   // imported modules
-  SmallVector<Module*> *imports_;
+  SmallVector<Module*, 4> imports_;
 };
 
 } // namespace loxy
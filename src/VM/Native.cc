@@ -0,0 +1,427 @@
+#include <dlfcn.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include "Data/SmallVector.h"
+#include "Data/ValueMap.h"
+#include "Chunk.h"
+#include "Module.h"
+#include "Runtime.h"
+#include "Value.h"
+#include "VM.h"
+
+namespace loxy {
+
+// class NativeRuntime - the VM side of Runtime.h, for modules translated
+//  to C by [EmitC]. The ops follow [VM::run], errors included.
+class NativeRuntime {
+public:
+  static VM &vm(LoxyFrame *f) { return *static_cast<VM*>(f->vm); }
+  static Module *module(LoxyFrame *f) { return static_cast<Module*>(f->module); }
+  static Value *top(LoxyFrame *f) { return reinterpret_cast<Value*>(f->top); }
+
+  static String *constant(LoxyFrame *f, int index) {
+    return (String*)reinterpret_cast<const Value*>(f->constants)[index];
+  }
+
+  // sync - hands the stack over to the VM before anything that may
+  //  collect.
+  static void sync(LoxyFrame *f) { vm(f).stackTop_ = top(f); }
+
+  static bool validKey(LoxyFrame *f, Value key, int line) {
+    if (key.isNil() || (key.isNumber() && (double)key != (double)key)) {
+      vm(f).error(line, "Map keys can't be nil or NaN");
+      return false;
+    }
+    return true;
+  }
+
+  static ValueMap *entries(LoxyFrame *f, Value object, int line) {
+    if (!object.isMap()) {
+      vm(f).error(line, "Only maps can be indexed");
+      return nullptr;
+    }
+    return static_cast<Map*>((Object*)object)->entries;
+  }
+
+  static bool arithmetic(LoxyFrame *f, int op, int line);
+  static bool getGlobal(LoxyFrame *f, int constant, int line);
+  static bool setGlobal(LoxyFrame *f, int constant, int line);
+  static void defineGlobal(LoxyFrame *f, int constant);
+  static void print(LoxyFrame *f);
+  static void map(LoxyFrame *f);
+  static bool mapInsert(LoxyFrame *f, int line);
+  static bool getIndex(LoxyFrame *f, int line);
+  static bool setIndex(LoxyFrame *f, int line);
+  static bool call(LoxyFrame *f, int argCount, int line);
+
+  // run - runs [native] as a new module of [vm].
+  static InterpretResult run(VM &vm, const LoxyModule *native);
+};
+
+static_assert((int)ValueType::Number == LOXY_NUMBER && (int)ValueType::Int == LOXY_INT &&
+              (int)ValueType::String == LOXY_STRING, "Runtime.h value types are stale");
+static_assert((int)NativeSignature::Values == LOXY_NATIVE_VALUES &&
+              (int)NativeSignature::Numbers == LOXY_NATIVE_NUMBERS,
+              "Runtime.h native signatures are stale");
+static_assert((int)FOR_SUBTRACT == LOXY_FOR_SUBTRACT && (int)FOR_GREATER == LOXY_FOR_GREATER &&
+              (int)FOR_NEGATE == LOXY_FOR_NEGATE, "Runtime.h for loop flags are stale");
+
+bool NativeRuntime::arithmetic(LoxyFrame *f, int op, int line) {
+  static const OpCode ops[] = {
+    OpCode::EQUAL, OpCode::GREATER, OpCode::LESS, OpCode::ADD,
+    OpCode::SUBTRACT, OpCode::MULTIPLY, OpCode::DIVIDE, OpCode::NEGATE,
+  };
+  OpCode code = ops[op];
+  Value *operands = top(f);
+
+  if (VM::arithmetic(code, operands)) {
+    if (code != OpCode::NEGATE) f->top--;
+    return true;
+  }
+
+  switch (code) {
+  case OpCode::NEGATE:
+    vm(f).error(line, "Operand must be a number");
+    return false;
+
+  case OpCode::ADD: {
+    Value a = operands[-2];
+    Value b = operands[-1];
+    if (!a.isString() || !b.isString()) {
+      vm(f).error(line, "Operands must be two numbers or two strings");
+      return false;
+    }
+
+    // operands stay on the stack while allocating the result.
+    sync(f);
+    String *result = String::concat(vm(f), (String*)a, (String*)b);
+    operands[-2] = Value(result, ValueType::String);
+    f->top--;
+    return true;
+  }
+
+  default:
+    vm(f).error(line, "Both operands must be numbers");
+    return false;
+  }
+}
+
+bool NativeRuntime::getGlobal(LoxyFrame *f, int index, int line) {
+  String *name = constant(f, index);
+  Value value;
+  if (!module(f)->getVariable(name, &value)) {
+    vm(f).error(line, "Undefined variable '%s'", name->cString());
+    return false;
+  }
+  *top(f) = value;
+  f->top++;
+  return true;
+}
+
+bool NativeRuntime::setGlobal(LoxyFrame *f, int index, int line) {
+  String *name = constant(f, index);
+  sync(f);
+  if (!module(f)->setVariable(name, top(f)[-1])) {
+    vm(f).error(line, "Undefined variable '%s'", name->cString());
+    return false;
+  }
+  return true;
+}
+
+void NativeRuntime::defineGlobal(LoxyFrame *f, int index) {
+  // keep the value on the stack in case adding it triggers a collection.
+  sync(f);
+  module(f)->addVariable(constant(f, index), top(f)[-1]);
+  f->top--;
+}
+
+void NativeRuntime::print(LoxyFrame *f) {
+  Output &out = vm(f).output();
+  out.writeValue(top(f)[-1]);
+  out.newline();
+  f->top--;
+}
+
+void NativeRuntime::map(LoxyFrame *f) {
+  sync(f);
+  Map *map = Map::create(vm(f));
+  *top(f) = Value(map);
+  f->top++;
+}
+
+bool NativeRuntime::mapInsert(LoxyFrame *f, int line) {
+  // everything stays on the stack while inserting.
+  Value *operands = top(f);
+  Map *map = static_cast<Map*>((Object*)operands[-3]);
+  if (!validKey(f, operands[-2], line)) return false;
+
+  sync(f);
+  map->entries->set(operands[-2], operands[-1]);
+  f->top -= 2;
+  return true;
+}
+
+bool NativeRuntime::getIndex(LoxyFrame *f, int line) {
+  Value *operands = top(f);
+  ValueMap *map = entries(f, operands[-2], line);
+  if (map == nullptr) return false;
+
+  Value index = operands[-1];
+  Value value;
+  bool found = index.isDouble() ? map->getNumber((double)index, &value)
+                                : map->get(index, &value);
+
+  // missing keys read as nil.
+  operands[-2] = found ? value : Value::Nil;
+  f->top--;
+  return true;
+}
+
+bool NativeRuntime::setIndex(LoxyFrame *f, int line) {
+  Value *operands = top(f);
+  ValueMap *map = entries(f, operands[-3], line);
+  if (map == nullptr || !validKey(f, operands[-2], line)) return false;
+
+  Value index = operands[-2];
+  Value value = operands[-1];
+  sync(f);
+  if (index.isDouble()) {
+    map->setNumber((double)index, value);
+  } else {
+    map->set(index, value);
+  }
+
+  // the assignment evaluates to [value].
+  operands[-3] = value;
+  f->top -= 2;
+  return true;
+}
+
+bool NativeRuntime::call(LoxyFrame *f, int argCount, int line) {
+  // translated code holds no functions or classes, natives are all it can
+  // call.
+  Value callee = top(f)[-argCount - 1];
+  if (!callee.isNative()) {
+    vm(f).error(line, "Can only call functions and classes");
+    return false;
+  }
+
+  NativeFunction *native = static_cast<NativeFunction*>((Object*)callee);
+  VM &vm = NativeRuntime::vm(f);
+  sync(f);
+  if (!vm.callNative(native, argCount, line)) return false;
+
+  // the body can't be suspended, a native blocking its fiber waits on the
+  // loop right there & runs again on its arguments once it wakes, as in
+  // [VM::resume].
+  Fiber *fiber = vm.fiber_;
+  while (fiber->state != FiberState::Running) {
+    if (fiber->state == FiberState::Woken) {
+      fiber->state = FiberState::Running;
+      int retryArgs = fiber->retryArgs;
+      if (retryArgs < 0) break;
+      fiber->retryArgs = -1;
+      if (!vm.callNative(native, retryArgs, fiber->retryLine)) return false;
+      if (fiber->state == FiberState::Running) fiber->progress = 0;
+      continue;
+    }
+
+    if (vm.interrupt_.load(std::memory_order_relaxed) == (int)Interrupt::Abort) {
+      vm.interrupt_.store((int)Interrupt::None, std::memory_order_relaxed);
+      vm.error(line, "Interrupted");
+      return false;
+    }
+    vm.loop_.poll(vm);
+  }
+
+  f->top = reinterpret_cast<LoxyValue*>(vm.stackTop_);
+  return true;
+}
+
+InterpretResult NativeRuntime::run(VM &vm, const LoxyModule *native) {
+  static_assert(sizeof(LoxyValue) == sizeof(Value) &&
+                offsetof(LoxyValue, type) == offsetof(Value, type) &&
+                offsetof(LoxyValue, as) == offsetof(Value, as),
+                "LoxyValue must be laid out as Value");
+
+  String *name = String::create(vm, native->name);
+  vm.pushRoot(name);
+  Module *module = Module::create(vm, name, nullptr, nullptr);
+  vm.popRoot();
+  vm.addModule(module);
+
+  // the natives of I/O are globals of translated scripts too.
+  vm.addIo(module);
+
+  // the chunk only holds the constants, for the collector.
+  Chunk *chunk = Chunk::create(vm);
+  module->setBody(chunk);
+
+  for (int i = 0; i < native->constantCount; i++) {
+    const LoxyConstant &constant = native->constants[i];
+
+    switch (constant.type) {
+    case LOXY_NUMBER: {
+      double number;
+      memcpy(&number, &constant.bits, sizeof(number));
+      chunk->constants().push(Value(number));
+      break;
+    }
+    case LOXY_INT:
+      chunk->constants().push(Value((int64_t)constant.bits));
+      break;
+    case LOXY_STRING: {
+      String *string = String::create(vm, constant.chars, constant.length);
+      vm.pushRoot(string);
+      chunk->constants().push(Value(string, ValueType::String));
+      vm.popRoot();
+      break;
+    }
+    default:
+      UNREACHABLE();
+    }
+  }
+
+  // translated code isn't verified, it gets as much stack as unverified
+  // bytecode, on a fiber of its own like the module body of [VM::run].
+  Fiber *fiber = Fiber::create(vm, module, Value::Nil);
+  vm.enterFiber(fiber, Value::Nil);
+  LoxyFrame frame = {
+    &vm, module,
+    reinterpret_cast<LoxyValue*>(vm.stack_),
+    reinterpret_cast<LoxyValue*>(vm.stack_),
+    reinterpret_cast<const LoxyValue*>(chunk->constants().data()),
+  };
+  bool ok = native->body(&frame);
+  vm.stackTop_ = reinterpret_cast<Value*>(frame.top);
+  vm.switchTo(nullptr);
+
+  return ok ? InterpretResult::Ok : InterpretResult::Runtime_Error;
+}
+
+InterpretResult VM::interpretNative(const char *path) {
+  void *handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+  if (handle == nullptr) {
+    fprintf(stderr, "Could not load \"%s\": %s\n", path, dlerror());
+    return InterpretResult::Compile_Error;
+  }
+
+  const LoxyModule *native = (const LoxyModule*)dlsym(handle, "loxy_module");
+  if (native == nullptr || native->abi != LOXY_ABI_VERSION) {
+    fprintf(stderr, "\"%s\" isn't a module built for this loxy.\n", path);
+    dlclose(handle);
+    return InterpretResult::Compile_Error;
+  }
+
+  InterpretResult result = NativeRuntime::run(*this, native);
+  dlclose(handle);
+  return result;
+}
+
+bool VM::loadNatives(Module *module, const char *path) {
+  void *handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+  if (handle == nullptr) {
+    fprintf(stderr, "Could not load \"%s\": %s\n", path, dlerror());
+    return false;
+  }
+
+  const LoxyNative *natives = (const LoxyNative*)dlsym(handle, "loxy_natives");
+  if (natives == nullptr) {
+    fprintf(stderr, "\"%s\" doesn't export loxy_natives.\n", path);
+    dlclose(handle);
+    return false;
+  }
+
+  // all of them are checked first, a bad one adds none.
+  for (const LoxyNative *native = natives; native->name != nullptr; native++) {
+    bool valid = native->function != nullptr &&
+      (native->signature == LOXY_NATIVE_NUMBERS ? native->arity >= 0 && native->arity <= 3
+                                                : native->signature == LOXY_NATIVE_VALUES &&
+                                                  native->arity >= -1);
+    if (!valid) {
+      fprintf(stderr, "\"%s\": native %s has a bad signature.\n", path, native->name);
+      dlclose(handle);
+      return false;
+    }
+  }
+
+  for (const LoxyNative *native = natives; native->name != nullptr; native++) {
+    LoxyFunction function = native->function;
+    if (native->signature == LOXY_NATIVE_VALUES) {
+      // the VM is passed by reference, as a pointer.
+      module->addNative(native->name, native->arity, reinterpret_cast<NativeFn>(function));
+      continue;
+    }
+
+    switch (native->arity) {
+    case 0:
+      module->addNative(native->name, reinterpret_cast<double (*)()>(function));
+      break;
+    case 1:
+      module->addNative(native->name, reinterpret_cast<double (*)(double)>(function));
+      break;
+    case 2:
+      module->addNative(native->name, reinterpret_cast<double (*)(double, double)>(function));
+      break;
+    default:
+      module->addNative(native->name, reinterpret_cast<double (*)(double, double, double)>(function));
+      break;
+    }
+  }
+
+  // natives of it may be called as long as the VM lives.
+  libraries_.push_back(handle);
+  return true;
+}
+
+} // namespace loxy
+
+using loxy::NativeRuntime;
+
+extern "C" {
+
+bool loxy_arithmetic(LoxyFrame *f, int op, int line) {
+  return NativeRuntime::arithmetic(f, op, line);
+}
+
+bool loxy_get_global(LoxyFrame *f, int constant, int line) {
+  return NativeRuntime::getGlobal(f, constant, line);
+}
+
+bool loxy_set_global(LoxyFrame *f, int constant, int line) {
+  return NativeRuntime::setGlobal(f, constant, line);
+}
+
+void loxy_define_global(LoxyFrame *f, int constant) {
+  NativeRuntime::defineGlobal(f, constant);
+}
+
+void loxy_print(LoxyFrame *f) { NativeRuntime::print(f); }
+void loxy_map(LoxyFrame *f)   { NativeRuntime::map(f); }
+
+bool loxy_map_insert(LoxyFrame *f, int line) { return NativeRuntime::mapInsert(f, line); }
+bool loxy_get_index(LoxyFrame *f, int line)  { return NativeRuntime::getIndex(f, line); }
+bool loxy_set_index(LoxyFrame *f, int line)  { return NativeRuntime::setIndex(f, line); }
+
+bool loxy_call(LoxyFrame *f, int argCount, int line) {
+  return NativeRuntime::call(f, argCount, line);
+}
+
+void loxy_native_error(void *vm, const char *message) {
+  static_cast<loxy::VM*>(vm)->nativeError("%s", message);
+}
+
+int loxy_main(const LoxyModule *module) {
+  if (module->abi != LOXY_ABI_VERSION) {
+    fprintf(stderr, "Module built for another loxy.\n");
+    return 70;
+  }
+
+  loxy::VM vm;
+  loxy::InterpretResult result = NativeRuntime::run(vm, module);
+  vm.output().flush();
+  return result == loxy::InterpretResult::Ok ? 0 : 70;
+}
+
+} // extern "C"
@@ -0,0 +1,525 @@
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <locale.h>
+#include <string>
+#include "Number.h"
+
+namespace loxy {
+
+//----=== Grisu2 ===----//
+//
+// Florian Loitsch, "Printing Floating-Point Numbers Quickly and Accurately
+// with Integers". Produces the shortest digits in the vast majority of
+// cases & digits that round-trip in all of them.
+
+namespace {
+
+struct DiyFp {
+  uint64_t f;
+  int e;
+
+  DiyFp(uint64_t f, int e) : f(f), e(e) {}
+
+  explicit DiyFp(double d) {
+    uint64_t bits;
+    memcpy(&bits, &d, sizeof(bits));
+
+    int biased = (int)((bits & EXPONENT_MASK) >> 52);
+    uint64_t significand = bits & SIGNIFICAND_MASK;
+    if (biased != 0) {
+      f = significand + HIDDEN_BIT;
+      e = biased - EXPONENT_BIAS;
+    } else {
+      // subnormal.
+      f = significand;
+      e = 1 - EXPONENT_BIAS;
+    }
+  }
+
+  DiyFp operator-(const DiyFp &rhs) const { return DiyFp(f - rhs.f, e); }
+
+  // the upper 64 bits of the product, rounded.
+  DiyFp operator*(const DiyFp &rhs) const {
+    unsigned __int128 p = (unsigned __int128)f * rhs.f;
+    uint64_t h = (uint64_t)(p >> 64);
+    uint64_t l = (uint64_t)p;
+    return DiyFp(h + (l >> 63), e + rhs.e + 64);
+  }
+
+  DiyFp normalize() const {
+    int shift = __builtin_clzll(f);
+    return DiyFp(f << shift, e - shift);
+  }
+
+  // boundaries m- & m+ of the double, normalized to the same exponent.
+  void normalizedBoundaries(DiyFp *minus, DiyFp *plus) const {
+    DiyFp pl = DiyFp((f << 1) + 1, e - 1).normalize();
+    DiyFp mi = f == HIDDEN_BIT ? DiyFp((f << 2) - 1, e - 2)
+                               : DiyFp((f << 1) - 1, e - 1);
+    mi.f <<= mi.e - pl.e;
+    mi.e = pl.e;
+    *plus = pl;
+    *minus = mi;
+  }
+
+  static const uint64_t EXPONENT_MASK = 0x7ff0000000000000ULL;
+  static const uint64_t SIGNIFICAND_MASK = 0x000fffffffffffffULL;
+  static const uint64_t HIDDEN_BIT = 0x0010000000000000ULL;
+  static const int EXPONENT_BIAS = 0x3ff + 52;
+};
+
+// normalized 10^k for k = -348, -340, ..., 340.
+const struct { uint64_t f; int e; } CACHED_POWERS[] = {
+  {0xfa8fd5a0081c0288ULL, -1220}, {0xbaaee17fa23ebf76ULL, -1193}, {0x8b16fb203055ac76ULL, -1166},
+  {0xcf42894a5dce35eaULL, -1140}, {0x9a6bb0aa55653b2dULL, -1113}, {0xe61acf033d1a45dfULL, -1087},
+  {0xab70fe17c79ac6caULL, -1060}, {0xff77b1fcbebcdc4fULL, -1034}, {0xbe5691ef416bd60cULL, -1007},
+  {0x8dd01fad907ffc3cULL, -980}, {0xd3515c2831559a83ULL, -954}, {0x9d71ac8fada6c9b5ULL, -927},
+  {0xea9c227723ee8bcbULL, -901}, {0xaecc49914078536dULL, -874}, {0x823c12795db6ce57ULL, -847},
+  {0xc21094364dfb5637ULL, -821}, {0x9096ea6f3848984fULL, -794}, {0xd77485cb25823ac7ULL, -768},
+  {0xa086cfcd97bf97f4ULL, -741}, {0xef340a98172aace5ULL, -715}, {0xb23867fb2a35b28eULL, -688},
+  {0x84c8d4dfd2c63f3bULL, -661}, {0xc5dd44271ad3cdbaULL, -635}, {0x936b9fcebb25c996ULL, -608},
+  {0xdbac6c247d62a584ULL, -582}, {0xa3ab66580d5fdaf6ULL, -555}, {0xf3e2f893dec3f126ULL, -529},
+  {0xb5b5ada8aaff80b8ULL, -502}, {0x87625f056c7c4a8bULL, -475}, {0xc9bcff6034c13053ULL, -449},
+  {0x964e858c91ba2655ULL, -422}, {0xdff9772470297ebdULL, -396}, {0xa6dfbd9fb8e5b88fULL, -369},
+  {0xf8a95fcf88747d94ULL, -343}, {0xb94470938fa89bcfULL, -316}, {0x8a08f0f8bf0f156bULL, -289},
+  {0xcdb02555653131b6ULL, -263}, {0x993fe2c6d07b7facULL, -236}, {0xe45c10c42a2b3b06ULL, -210},
+  {0xaa242499697392d3ULL, -183}, {0xfd87b5f28300ca0eULL, -157}, {0xbce5086492111aebULL, -130},
+  {0x8cbccc096f5088ccULL, -103}, {0xd1b71758e219652cULL, -77}, {0x9c40000000000000ULL, -50},
+  {0xe8d4a51000000000ULL, -24}, {0xad78ebc5ac620000ULL, 3}, {0x813f3978f8940984ULL, 30},
+  {0xc097ce7bc90715b3ULL, 56}, {0x8f7e32ce7bea5c70ULL, 83}, {0xd5d238a4abe98068ULL, 109},
+  {0x9f4f2726179a2245ULL, 136}, {0xed63a231d4c4fb27ULL, 162}, {0xb0de65388cc8ada8ULL, 189},
+  {0x83c7088e1aab65dbULL, 216}, {0xc45d1df942711d9aULL, 242}, {0x924d692ca61be758ULL, 269},
+  {0xda01ee641a708deaULL, 295}, {0xa26da3999aef774aULL, 322}, {0xf209787bb47d6b85ULL, 348},
+  {0xb454e4a179dd1877ULL, 375}, {0x865b86925b9bc5c2ULL, 402}, {0xc83553c5c8965d3dULL, 428},
+  {0x952ab45cfa97a0b3ULL, 455}, {0xde469fbd99a05fe3ULL, 481}, {0xa59bc234db398c25ULL, 508},
+  {0xf6c69a72a3989f5cULL, 534}, {0xb7dcbf5354e9beceULL, 561}, {0x88fcf317f22241e2ULL, 588},
+  {0xcc20ce9bd35c78a5ULL, 614}, {0x98165af37b2153dfULL, 641}, {0xe2a0b5dc971f303aULL, 667},
+  {0xa8d9d1535ce3b396ULL, 694}, {0xfb9b7cd9a4a7443cULL, 720}, {0xbb764c4ca7a44410ULL, 747},
+  {0x8bab8eefb6409c1aULL, 774}, {0xd01fef10a657842cULL, 800}, {0x9b10a4e5e9913129ULL, 827},
+  {0xe7109bfba19c0c9dULL, 853}, {0xac2820d9623bf429ULL, 880}, {0x80444b5e7aa7cf85ULL, 907},
+  {0xbf21e44003acdd2dULL, 933}, {0x8e679c2f5e44ff8fULL, 960}, {0xd433179d9c8cb841ULL, 986},
+  {0x9e19db92b4e31ba9ULL, 1013}, {0xeb96bf6ebadf77d9ULL, 1039}, {0xaf87023b9bf0ee6bULL, 1066},
+};
+
+const uint32_t POW10[] = {
+  1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000
+};
+
+// a cached power c = 10^-k such that the product of c & a number with
+// binary exponent [e] has its exponent in [-60, -32].
+DiyFp cachedPower(int e, int *k) {
+  double dk = (-61 - e) * 0.30102999566398114 + 347;
+  int ik = (int)dk;
+  if (dk - ik > 0.0) ik++;
+
+  unsigned index = (unsigned)((ik >> 3) + 1);
+  *k = -(-348 + (int)(index << 3));
+  return DiyFp(CACHED_POWERS[index].f, CACHED_POWERS[index].e);
+}
+
+int countDigits(uint32_t n) {
+  int digits = 1;
+  while (digits < 10 && n >= POW10[digits]) digits++;
+  return digits;
+}
+
+// moves the last digit closer to the exact value while staying inside
+// the rounding interval.
+void roundWeed(char *buffer, int length, uint64_t delta, uint64_t rest,
+               uint64_t tenKappa, uint64_t distance) {
+  while (rest < distance && delta - rest >= tenKappa &&
+         (rest + tenKappa < distance || distance - rest > rest + tenKappa - distance)) {
+    buffer[length - 1]--;
+    rest += tenKappa;
+  }
+}
+
+int generateDigits(const DiyFp &w, const DiyFp &mp, uint64_t delta,
+                   char *buffer, int *k) {
+  const DiyFp one(1ULL << -mp.e, mp.e);
+  const uint64_t distance = (mp - w).f;
+
+  uint32_t p1 = (uint32_t)(mp.f >> -one.e);
+  uint64_t p2 = mp.f & (one.f - 1);
+  int kappa = countDigits(p1);
+  int length = 0;
+
+  // integral part.
+  while (kappa > 0) {
+    uint32_t d = p1 / POW10[kappa - 1];
+    p1 %= POW10[kappa - 1];
+    if (d != 0 || length != 0) buffer[length++] = (char)('0' + d);
+    kappa--;
+
+    uint64_t rest = ((uint64_t)p1 << -one.e) + p2;
+    if (rest <= delta) {
+      *k += kappa;
+      roundWeed(buffer, length, delta, rest, (uint64_t)POW10[kappa] << -one.e, distance);
+      return length;
+    }
+  }
+
+  // fractional part.
+  while (true) {
+    p2 *= 10;
+    delta *= 10;
+    char d = (char)(p2 >> -one.e);
+    if (d != 0 || length != 0) buffer[length++] = (char)('0' + d);
+    p2 &= one.f - 1;
+    kappa--;
+
+    if (p2 < delta) {
+      *k += kappa;
+      int index = -kappa;
+      roundWeed(buffer, length, delta, p2, one.f, distance * (index < 10 ? POW10[index] : 0));
+      return length;
+    }
+  }
+}
+
+// writes the digits of positive [value] to [buffer], returns their count.
+//  value = digits * 10^k.
+int grisu2(double value, char *buffer, int *k) {
+  DiyFp v(value);
+  DiyFp minus(0, 0), plus(0, 0);
+  v.normalizedBoundaries(&minus, &plus);
+
+  DiyFp c = cachedPower(plus.e, k);
+  DiyFp w = v.normalize() * c;
+  DiyFp wPlus = plus * c;
+  DiyFp wMinus = minus * c;
+
+  // stay strictly inside the interval.
+  wMinus.f++;
+  wPlus.f--;
+  return generateDigits(w, wPlus, wPlus.f - wMinus.f, buffer, k);
+}
+
+//----=== layout ===----//
+
+int writeExponent(int exponent, char *buffer) {
+  char *p = buffer;
+  *p++ = 'e';
+  if (exponent < 0) {
+    *p++ = '-';
+    exponent = -exponent;
+  } else {
+    *p++ = '+';
+  }
+
+  if (exponent >= 100) {
+    *p++ = (char)('0' + exponent / 100);
+    exponent %= 100;
+    *p++ = (char)('0' + exponent / 10);
+  } else if (exponent >= 10) {
+    *p++ = (char)('0' + exponent / 10);
+  }
+  *p++ = (char)('0' + exponent % 10);
+  return (int)(p - buffer);
+}
+
+// lays out [length] digits times 10^k: plain notation for decimal
+// exponents in [-6, 21), scientific otherwise.
+int prettify(char *buffer, int length, int k) {
+  // 10^(kk - 1) <= value < 10^kk
+  const int kk = length + k;
+
+  if (k >= 0 && kk <= 21) {
+    // 1234e7 -> 12340000000
+    for (int i = length; i < kk; i++) buffer[i] = '0';
+    return kk;
+  }
+
+  if (kk > 0 && kk <= 21) {
+    // 1234e-2 -> 12.34
+    memmove(buffer + kk + 1, buffer + kk, length - kk);
+    buffer[kk] = '.';
+    return length + 1;
+  }
+
+  if (kk > -6 && kk <= 0) {
+    // 1234e-6 -> 0.001234
+    const int offset = 2 - kk;
+    memmove(buffer + offset, buffer, length);
+    buffer[0] = '0';
+    buffer[1] = '.';
+    for (int i = 2; i < offset; i++) buffer[i] = '0';
+    return length + offset;
+  }
+
+  if (length == 1) {
+    // 1e30
+    return 1 + writeExponent(kk - 1, buffer + 1);
+  }
+
+  // 1234e30 -> 1.234e+33
+  memmove(buffer + 2, buffer + 1, length - 1);
+  buffer[1] = '.';
+  return length + 1 + writeExponent(kk - 1, buffer + length + 1);
+}
+
+// writes [value] < 2^64 in decimal, returns the length.
+int writeInteger(uint64_t value, char *buffer) {
+  char digits[20];
+  int length = 0;
+  do {
+    digits[length++] = (char)('0' + value % 10);
+    value /= 10;
+  } while (value != 0);
+
+  for (int i = 0; i < length; i++) buffer[i] = digits[length - 1 - i];
+  return length;
+}
+
+} // namespace
+
+int formatNumber(double number, char *buffer) {
+  char *p = buffer;
+
+  if (std::isnan(number)) {
+    memcpy(p, "nan", 4);
+    return 3;
+  }
+
+  if (std::signbit(number)) {
+    *p++ = '-';
+    number = -number;
+  }
+
+  if (std::isinf(number)) {
+    memcpy(p, "inf", 4);
+    return (int)(p - buffer) + 3;
+  }
+
+  int length;
+  if (number < 9007199254740992.0 && number == (double)(uint64_t)number) {
+    // integers below 2^53 are exact, print them as such.
+    length = writeInteger((uint64_t)number, p);
+  } else {
+    int k = 0;
+    length = grisu2(number, p, &k);
+    length = prettify(p, length, k);
+  }
+
+  p[length] = '\0';
+  return (int)(p - buffer) + length;
+}
+
+int formatInteger(int64_t integer, char *buffer) {
+  char *p = buffer;
+  uint64_t magnitude = (uint64_t)integer;
+  if (integer < 0) {
+    *p++ = '-';
+    magnitude = 0 - magnitude;
+  }
+
+  int length = writeInteger(magnitude, p);
+  p[length] = '\0';
+  return (int)(p - buffer) + length;
+}
+
+//----=== Eisel-Lemire ===----//
+//
+// Daniel Lemire, "Number Parsing at a Gigabyte per Second". Multiplies the
+// decimal significand by a 128-bit approximation of the power of ten, which
+// settles the rounding in all but a handful of cases; those fall back to
+// strtod.
+
+namespace {
+
+const uint64_t POWERS_OF_FIVE[] = {
+#include "PowersOfFive.inc"
+};
+
+const int SMALLEST_POWER = -342;
+const int LARGEST_POWER = 308;
+
+// powers of ten that are exact doubles.
+const double EXACT_POWERS[] = {
+  1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+const uint64_t MAX_EXACT_INTEGER = 1ULL << 53;
+
+double fromBits(uint64_t bits) {
+  double d;
+  memcpy(&d, &bits, sizeof(d));
+  return d;
+}
+
+// w * 10^q, returns false if the result can't be decided this way.
+bool eiselLemire(uint64_t w, int q, double *result) {
+  if (w == 0 || q < SMALLEST_POWER) {
+    *result = 0;
+    return true;
+  }
+  if (q > LARGEST_POWER) {
+    *result = HUGE_VAL;
+    return true;
+  }
+
+  int lz = __builtin_clzll(w);
+  w <<= lz;
+
+  // 55 bits are needed: 53 of mantissa, one to round & one more because
+  // the product may lack its top bit.
+  const uint64_t *power = &POWERS_OF_FIVE[2 * (q - SMALLEST_POWER)];
+  const uint64_t precisionMask = ~0ULL >> 55;
+
+  unsigned __int128 product = (unsigned __int128)w * power[0];
+  uint64_t high = (uint64_t)(product >> 64);
+  uint64_t low = (uint64_t)product;
+
+  if ((high & precisionMask) == precisionMask) {
+    // the truncated power may matter, add its lower half.
+    unsigned __int128 second = (unsigned __int128)w * power[1];
+    uint64_t secondHigh = (uint64_t)(second >> 64);
+    low += secondHigh;
+    if (secondHigh > low) high++;
+
+    // still ambiguous, only provably fine where 5^q is exact.
+    if (low == ~0ULL && (q < -27 || q > 55)) return false;
+  }
+
+  int upperBit = (int)(high >> 63);
+  int shift = upperBit + 64 - 52 - 3;
+  uint64_t mantissa = high >> shift;
+
+  // floor(log2(10^q)) + 63, plus the bias.
+  int power2 = (((152170 + 65536) * q) >> 16) + 63 + upperBit - lz + 1023;
+
+  if (power2 <= 0) {
+    // subnormal.
+    if (-power2 + 1 >= 64) {
+      *result = 0;
+      return true;
+    }
+    mantissa >>= -power2 + 1;
+    mantissa += mantissa & 1;
+    mantissa >>= 1;
+    power2 = mantissa < (1ULL << 52) ? 0 : 1;
+    *result = fromBits(((uint64_t)power2 << 52) | (mantissa & ((1ULL << 52) - 1)));
+    return true;
+  }
+
+  // exactly halfway between two doubles, round to even.
+  if (low <= 1 && q >= -4 && q <= 23 && (mantissa & 3) == 1 &&
+      (mantissa << shift) == high) {
+    mantissa &= ~1ULL;
+  }
+
+  mantissa += mantissa & 1;
+  mantissa >>= 1;
+  if (mantissa >= (2ULL << 52)) {
+    mantissa = 1ULL << 52;
+    power2++;
+  }
+
+  if (power2 >= 0x7ff) {
+    *result = HUGE_VAL;
+    return true;
+  }
+
+  mantissa &= ~(1ULL << 52);
+  *result = fromBits(((uint64_t)power2 << 52) | mantissa);
+  return true;
+}
+
+// strtod in the "C" locale, whatever the process' locale is.
+double slowParse(const char *chars, int length) {
+  static locale_t cLocale = newlocale(LC_ALL_MASK, "C", (locale_t)0);
+
+  std::string copy(chars, length);
+  return strtod_l(copy.c_str(), nullptr, cLocale);
+}
+
+} // namespace
+
+double parseNumber(const char *chars, int length) {
+  const char *p = chars;
+  const char *end = chars + length;
+
+  // the first 19 significant digits fit in [w].
+  uint64_t w = 0;
+  int digits = 0;
+  int exponent = 0;
+  bool truncated = false;
+
+  while (p < end && *p == '0') p++;
+  for (; p < end && *p >= '0' && *p <= '9'; p++) {
+    if (digits < 19) {
+      w = w * 10 + (*p - '0');
+      digits++;
+    } else {
+      exponent++;
+      truncated |= *p != '0';
+    }
+  }
+
+  if (p < end && *p == '.') {
+    p++;
+    if (digits == 0) {
+      // leading zeros of the fraction only move the point.
+      while (p < end && *p == '0') { p++; exponent--; }
+    }
+    for (; p < end && *p >= '0' && *p <= '9'; p++) {
+      if (digits < 19) {
+        w = w * 10 + (*p - '0');
+        digits++;
+        exponent--;
+      } else {
+        truncated |= *p != '0';
+      }
+    }
+  }
+
+  if (p < end && (*p == 'e' || *p == 'E')) {
+    p++;
+    bool negative = p < end && *p == '-';
+    if (p < end && (*p == '-' || *p == '+')) p++;
+
+    int e = 0;
+    for (; p < end && *p >= '0' && *p <= '9'; p++) {
+      // saturate, anything past this is 0 or infinity anyway.
+      if (e < 100000) e = e * 10 + (*p - '0');
+    }
+    exponent += negative ? -e : e;
+  }
+
+  // integers & small exponents are exact in doubles.
+  if (!truncated && w <= MAX_EXACT_INTEGER) {
+    if (exponent == 0) return (double)w;
+    if (exponent > 0 && exponent <= 22) return (double)w * EXACT_POWERS[exponent];
+    if (exponent < 0 && exponent >= -22) return (double)w / EXACT_POWERS[-exponent];
+  }
+
+  double result;
+  if (!eiselLemire(w, exponent, &result)) return slowParse(chars, length);
+  if (!truncated) return result;
+
+  // the dropped digits lie between w & w + 1, both must agree.
+  double upper;
+  if (!eiselLemire(w + 1, exponent, &upper) || upper != result) {
+    return slowParse(chars, length);
+  }
+  return result;
+}
+
+bool parseInteger(const char *chars, int length, int64_t *result) {
+  uint64_t value = 0;
+
+  for (int i = 0; i < length; i++) {
+    if (chars[i] < '0' || chars[i] > '9') return false;
+
+    uint64_t digit = chars[i] - '0';
+    if (value > (INT64_MAX - digit) / 10) return false;
+    value = value * 10 + digit;
+  }
+
+  *result = (int64_t)value;
+  return true;
+}
+
+} // namespace loxy
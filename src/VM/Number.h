@@ -0,0 +1,46 @@
+#ifndef loxy_number_h
+#define loxy_number_h
+
+#include "Common.h"
+
+namespace loxy {
+
+// formatNumber - writes the shortest decimal form of [number] that reads
+//  back as the same double, plus a terminating '\0', to [buffer], which
+//  must hold NUMBER_BUFFER_SIZE chars. returns the length, without '\0'.
+//
+//  integers below 2^53 print as integers, other numbers in plain notation
+//  for decimal exponents in [-6, 21) & as e.g. 1.5e+300 otherwise.
+int formatNumber(double number, char *buffer);
+
+// formatInteger - writes [integer] in decimal, like [formatNumber].
+int formatInteger(int64_t integer, char *buffer);
+
+// parseNumber - reads the number literal of [length] chars at [chars]:
+//  digits, an optional fraction & an optional exponent. Rounds correctly
+//  & doesn't depend on the locale. [chars] needn't be terminated.
+double parseNumber(const char *chars, int length);
+
+// parseInteger - reads a literal of digits only into [result]. returns
+//  false if it has a fraction or an exponent or doesn't fit.
+bool parseInteger(const char *chars, int length, int64_t *result);
+
+// integer fast paths of the arithmetics. They return false where the result
+// must be a double: on overflow, & for products of 0 with a negative
+// operand, which are -0.
+inline bool addInt(int64_t a, int64_t b, int64_t *result) {
+  return !__builtin_add_overflow(a, b, result);
+}
+
+inline bool subtractInt(int64_t a, int64_t b, int64_t *result) {
+  return !__builtin_sub_overflow(a, b, result);
+}
+
+inline bool multiplyInt(int64_t a, int64_t b, int64_t *result) {
+  if (__builtin_mul_overflow(a, b, result)) return false;
+  return *result != 0 || (a >= 0 && b >= 0);
+}
+
+} // namespace loxy
+
+#endif
@@ -35,6 +35,13 @@ enum class OpCode: uint8_t {
   GET_LOCAL,
   SET_LOCAL,
   DEFINE_GLOBAL,
+
+  /// binary ops EQUAL to MULTIPLY are followed by a 1-byte inline cache,
+  /// the quickening state of the instruction. Starts as 0.
+  /// e.g: a + b
+  ///   GET_LOCAL 0
+  ///   GET_LOCAL 1
+  ///   ADD 0
   EQUAL,
   GREATER,
   LESS,
@@ -47,10 +54,260 @@ enum class OpCode: uint8_t {
   JUMP,
   JUMP_IF_FALSE,
   LOOP,
+
+  /// the step of a counting for loop, placed after its body:
+  ///   for (var i = a; i < limit; i = i + step)
+  /// adds [step] to the counter in a local slot, & jumps back to the body
+  /// while it's still below [limit], or past the loop. Either of [limit] &
+  /// [step] is a constant or a local, see ForFlags. Falls through to the
+  /// loop's own increment & condition where they aren't numbers.
+  /// e.g: FOR_LOOP counter, flags, limit, step, 2-byte back to the body,
+  ///   2-byte forward past the loop.
+  FOR_LOOP,
+
+  /// pushes a new empty map.
+  MAP,
+
+  /// pops a key & a value & inserts them to the map below them.
+  /// e.g: { "a": 1 }
+  ///   MAP
+  ///   CONSTANT 0
+  ///   CONSTANT 1
+  ///   MAP_INSERT
+  MAP_INSERT,
+
+  /// pops as many elements as the arg & pushes a new array of them.
+  /// e.g: [1, 2]
+  ///   CONSTANT 0
+  ///   CONSTANT 1
+  ///   ARRAY 2
+  ARRAY,
+
+  /// pops an index & the indexed object, pushes the element. Packed
+  /// arrays are read without checking their elements.
+  GET_INDEX,
+
+  /// pops a value, an index & the indexed object, stores the element &
+  /// pushes the value back.
+  SET_INDEX,
+
+  /// type specialized forms of the binary ops for two ints or two
+  /// doubles. The VM rewrites a generic op into one of them once its
+  /// operands keep fitting, & back when they don't. See [VM::run].
+  EQUAL_INT,
+  EQUAL_NUMBER,
+  GREATER_INT,
+  GREATER_NUMBER,
+  LESS_INT,
+  LESS_NUMBER,
+  ADD_INT,
+  ADD_NUMBER,
+  SUBTRACT_INT,
+  SUBTRACT_NUMBER,
+  MULTIPLY_INT,
+  MULTIPLY_NUMBER,
+
+  /// unchecked forms of the arithmetics & comparisons, emitted where the
+  /// compiler proved both operands numbers, ints or doubles. They never
+  /// fail. GREATER_NUM to MULTIPLY_NUM keep the unused inline cache of
+  /// their generic ops, so the compiler can patch either into the other.
+  /// See [Parser::emitNumeric].
+  GREATER_NUM,
+  LESS_NUM,
+  ADD_NUM,
+  SUBTRACT_NUM,
+  MULTIPLY_NUM,
+  DIVIDE_NUM,
+  NEGATE_NUM,
+
+  /// calls the function below its arguments, the arg is the number of
+  /// arguments. The function & its arguments become the first locals of
+  /// the callee's frame, see [CallFrame].
+  /// e.g: f(1, 2)
+  ///   GET_GLOBAL 0
+  ///   CONSTANT 1
+  ///   CONSTANT 2
+  ///   CALL 2
+  CALL,
+
+  /// a CALL in tail position, e.g: return f(1, 2). The callee & its
+  /// arguments replace the caller's frame rather than pushing another,
+  /// so tail calls run in constant stack. Only falls through calling a
+  /// class without init, onto the RETURN the compiler emits after it,
+  /// where jumps land too.
+  TAIL_CALL,
+
+  /// pushes a closure of the function constant at the arg, capturing the
+  /// variables listed in its [Function::captures]. Functions capturing
+  /// nothing are pushed with CONSTANT instead.
+  CLOSURE,
+
+  /// reads or assigns the boxed variable the closure captured at the arg,
+  /// through its Upvalue. SET_UPVALUE leaves the value on the stack.
+  GET_UPVALUE,
+  SET_UPVALUE,
+
+  /// reads or assigns the variable the closure captured at the arg, in
+  /// place on the stack. The compiler only emits these where the closure
+  /// can't outlive the variable's frame, see [Parser::settleLocal].
+  GET_OUTER,
+  SET_OUTER,
+
+  /// closes the upvalue of the local on top of the stack & pops it, in
+  /// place of POP at the end of a scope.
+  CLOSE_UPVALUE,
+
+  /// pushes a new class named by the string constant at the arg.
+  CLASS,
+
+  /// pops a function & adds it as a method, named by the string constant
+  /// at the arg, to the class below it.
+  /// e.g: class A { f() {} }
+  ///   CLASS 0
+  ///   DEFINE_GLOBAL 0
+  ///   GET_GLOBAL 0
+  ///   CONSTANT 1
+  ///   METHOD 2
+  ///   POP
+  METHOD,
+
+  /// pops an instance & pushes its property, a field or a method bound to
+  /// it. The args are the string constant of the name & the index of the
+  /// property's inline cache in the chunk, see [PropertyCache].
+  /// e.g: a.x
+  ///   GET_LOCAL 1
+  ///   GET_PROPERTY 0, 0
+  GET_PROPERTY,
+
+  /// pops a value & an instance, stores the value in the field & pushes it
+  /// back. The args are as for GET_PROPERTY.
+  SET_PROPERTY,
+
+  /// calls a method of the instance below the arguments without binding
+  /// it, or a field holding a callee. The args are the name, the number
+  /// of arguments & the cache, as for GET_PROPERTY.
+  /// e.g: a.f(1)
+  ///   GET_LOCAL 1
+  ///   CONSTANT 1
+  ///   INVOKE 0, 1, 0
+  INVOKE,
+
+  /// pops a value & suspends the running fiber, handing the value to the
+  /// fiber that resumed it, see the native resume in Io.cc. Pushes the
+  /// value it's resumed with next.
+  YIELD,
+
   PRINT,
+
+  /// pops the value on top of the stack & returns it to the caller, along
+  /// with the frame. The module body returns nil to the VM.
   RETURN,
 };
 
+// ForFlags - the shape of a FOR_LOOP.
+enum ForFlags : uint8_t {
+  // [limit] & [step] are local slots, constants otherwise.
+  FOR_LIMIT_LOCAL = 1 << 0,
+  FOR_STEP_LOCAL  = 1 << 1,
+  // the counter counts down, i = i - step.
+  FOR_SUBTRACT    = 1 << 2,
+  // loops while the counter is greater than the limit, less otherwise.
+  FOR_GREATER     = 1 << 3,
+  // negates the test, as for <= & >=.
+  FOR_NEGATE      = 1 << 4,
+};
+
+// uncheckedOp - the unchecked form of the arithmetic or comparison [op].
+inline OpCode uncheckedOp(OpCode op) {
+  switch (op) {
+  case OpCode::GREATER:   return OpCode::GREATER_NUM;
+  case OpCode::LESS:      return OpCode::LESS_NUM;
+  case OpCode::ADD:       return OpCode::ADD_NUM;
+  case OpCode::SUBTRACT:  return OpCode::SUBTRACT_NUM;
+  case OpCode::MULTIPLY:  return OpCode::MULTIPLY_NUM;
+  case OpCode::DIVIDE:    return OpCode::DIVIDE_NUM;
+  case OpCode::NEGATE:    return OpCode::NEGATE_NUM;
+  default:                UNREACHABLE(); return op;
+  }
+}
+
+// checkedOp - the checked form of the unchecked [op], any other op as is.
+inline OpCode checkedOp(OpCode op) {
+  switch (op) {
+  case OpCode::GREATER_NUM:   return OpCode::GREATER;
+  case OpCode::LESS_NUM:      return OpCode::LESS;
+  case OpCode::ADD_NUM:       return OpCode::ADD;
+  case OpCode::SUBTRACT_NUM:  return OpCode::SUBTRACT;
+  case OpCode::MULTIPLY_NUM:  return OpCode::MULTIPLY;
+  case OpCode::DIVIDE_NUM:    return OpCode::DIVIDE;
+  case OpCode::NEGATE_NUM:    return OpCode::NEGATE;
+  default:                    return op;
+  }
+}
+
+// instructionSize - the size of an instruction of [op], with its operands.
+inline int instructionSize(OpCode op) {
+  switch (op) {
+  case OpCode::FOR_LOOP:
+    return 9;
+
+  case OpCode::INVOKE:
+    return 4;
+
+  case OpCode::JUMP:
+  case OpCode::JUMP_IF_FALSE:
+  case OpCode::LOOP:
+  case OpCode::GET_PROPERTY:
+  case OpCode::SET_PROPERTY:
+    return 3;
+
+  case OpCode::CONSTANT:
+  case OpCode::GET_GLOBAL:
+  case OpCode::SET_GLOBAL:
+  case OpCode::DEFINE_GLOBAL:
+  case OpCode::GET_LOCAL:
+  case OpCode::SET_LOCAL:
+  case OpCode::CALL:
+  case OpCode::TAIL_CALL:
+  case OpCode::CLOSURE:
+  case OpCode::ARRAY:
+  case OpCode::GET_UPVALUE:
+  case OpCode::SET_UPVALUE:
+  case OpCode::GET_OUTER:
+  case OpCode::SET_OUTER:
+  case OpCode::CLASS:
+  case OpCode::METHOD:
+  // binary ops & their inline cache.
+  case OpCode::EQUAL:
+  case OpCode::GREATER:
+  case OpCode::LESS:
+  case OpCode::ADD:
+  case OpCode::SUBTRACT:
+  case OpCode::MULTIPLY:
+  case OpCode::EQUAL_INT:
+  case OpCode::EQUAL_NUMBER:
+  case OpCode::GREATER_INT:
+  case OpCode::GREATER_NUMBER:
+  case OpCode::LESS_INT:
+  case OpCode::LESS_NUMBER:
+  case OpCode::ADD_INT:
+  case OpCode::ADD_NUMBER:
+  case OpCode::SUBTRACT_INT:
+  case OpCode::SUBTRACT_NUMBER:
+  case OpCode::MULTIPLY_INT:
+  case OpCode::MULTIPLY_NUMBER:
+  case OpCode::GREATER_NUM:
+  case OpCode::LESS_NUM:
+  case OpCode::ADD_NUM:
+  case OpCode::SUBTRACT_NUM:
+  case OpCode::MULTIPLY_NUM:
+    return 2;
+
+  default:
+    return 1;
+  }
+}
+
 } // namespace loxy
 
 #endif
\ No newline at end of file
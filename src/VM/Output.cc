@@ -0,0 +1,117 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "Number.h"
+#include "Output.h"
+#include "Value.h"
+
+namespace loxy {
+
+Output::Output(int fd, FlushPolicy policy)
+  : fd_(fd), policy_(policy),
+    buffer_((char*)malloc(OUTPUT_BUFFER_SIZE)),
+    length_(0), capacity_(OUTPUT_BUFFER_SIZE),
+    syscalls_(0) {
+  assert(buffer_ != nullptr && "Out of memory");
+}
+
+Output::~Output() {
+  flush();
+  free(buffer_);
+}
+
+void Output::setPolicy(FlushPolicy policy) {
+  // an explicit buffer may have grown past what other policies keep.
+  if (policy_ == FlushPolicy::Explicit) flush();
+  policy_ = policy;
+}
+
+void Output::reserve(size_t size) {
+  if (capacity_ - length_ >= size) return;
+
+  if (policy_ != FlushPolicy::Explicit) {
+    flush();
+    if (capacity_ >= size) return;
+  }
+
+  size_t capacity = capacity_ * 2;
+  while (capacity - length_ < size) capacity *= 2;
+
+  buffer_ = (char*)realloc(buffer_, capacity);
+  assert(buffer_ != nullptr && "Out of memory");
+  capacity_ = capacity;
+}
+
+void Output::writeAll(const char *chars, size_t length) {
+  while (length > 0) {
+    ssize_t written = ::write(fd_, chars, length);
+    syscalls_++;
+
+    if (written < 0) {
+      if (errno == EINTR) continue;
+      // nowhere to report it, drop the output.
+      return;
+    }
+    chars += written;
+    length -= written;
+  }
+}
+
+void Output::write(const char *chars, size_t length) {
+  if (length > capacity_ - length_ && policy_ != FlushPolicy::Explicit) {
+    flush();
+
+    // too large to be worth copying.
+    if (length >= capacity_) {
+      writeAll(chars, length);
+      return;
+    }
+  }
+
+  reserve(length);
+  memcpy(buffer_ + length_, chars, length);
+  length_ += length;
+
+  if (policy_ == FlushPolicy::Line && memchr(chars, '\n', length) != nullptr) flush();
+}
+
+void Output::write(char c) {
+  reserve(1);
+  buffer_[length_++] = c;
+
+  if (policy_ == FlushPolicy::Line && c == '\n') flush();
+}
+
+void Output::writeNumber(double number) {
+  reserve(NUMBER_BUFFER_SIZE);
+  length_ += formatNumber(number, buffer_ + length_);
+}
+
+void Output::writeValue(Value value) {
+  if (value.isInt()) {
+    reserve(NUMBER_BUFFER_SIZE);
+    length_ += formatInteger(value.asInt(), buffer_ + length_);
+  } else if (value.isNumber()) {
+    writeNumber((double)value);
+  } else if (value.isString()) {
+    String *string = (String*)value;
+    write(string->cString(), string->length());
+  } else {
+    const char *chars = value.cString();
+    write(chars, strlen(chars));
+  }
+}
+
+void Output::newline() {
+  write('\n');
+}
+
+void Output::flush() {
+  if (length_ == 0) return;
+
+  writeAll(buffer_, length_);
+  length_ = 0;
+}
+
+} // namespace loxy
@@ -0,0 +1,71 @@
+#ifndef loxy_output_h
+#define loxy_output_h
+
+#include "Common.h"
+
+namespace loxy {
+
+class Value;
+
+// FlushPolicy - when an [Output] hands its buffer to the file descriptor.
+enum class FlushPolicy {
+  // after every write that ends a line, like an interactive terminal.
+  Line,
+
+  // whenever the buffer is full.
+  Size,
+
+  // only on [Output::flush]. The buffer grows to hold everything before.
+  Explicit,
+};
+
+// class Output - buffered output of a VM, written with as few write(2)
+//  calls as the flush policy allows.
+class Output {
+private:
+  int fd_;
+  FlushPolicy policy_;
+
+  char *buffer_;
+  size_t length_;
+  size_t capacity_;
+
+  // number of write(2) calls issued so far.
+  size_t syscalls_;
+
+  // makes room for [size] more chars, flushing or growing the buffer.
+  void reserve(size_t size);
+
+  // writes [length] chars straight to the file descriptor.
+  void writeAll(const char *chars, size_t length);
+
+public:
+  Output(int fd, FlushPolicy policy);
+  ~Output();
+
+  Output(const Output &) = delete;
+  Output &operator=(const Output &) = delete;
+
+  FlushPolicy policy() const { return policy_; }
+  void setPolicy(FlushPolicy policy);
+
+  size_t syscalls() const { return syscalls_; }
+
+  void write(const char *chars, size_t length);
+  void write(char c);
+
+  // writeNumber - formats [number] right into the buffer.
+  void writeNumber(double number);
+
+  // writeValue - writes [value] the way print shows it.
+  void writeValue(Value value);
+
+  // ends the current line, flushing it under [FlushPolicy::Line].
+  void newline();
+
+  void flush();
+};
+
+} // namespace loxy
+
+#endif
@@ -0,0 +1,289 @@
+/* Runtime.h - the runtime of loxy modules translated to C, see [EmitC].
+ *
+ * Generated code keeps the interpreter's operand stack & calls into the VM
+ * for everything but the number fast paths below. Build it against this
+ * header into a shared object loaded by `loxy --native`:
+ *
+ *   loxy --emit-c script.lox > script.c
+ *   cc -O2 -shared -fPIC -Isrc/VM script.c -o script.so
+ *   loxy --native script.so
+ *
+ * or, with LOXY_EXECUTABLE, into an executable linked with loxycore:
+ *
+ *   c++ -O2 -DLOXY_EXECUTABLE -Isrc/VM -x c script.c -x none -lloxycore -o script
+ *
+ * Shared objects of native functions for `loxy --load` declare them with
+ * LoxyNative below.
+ *
+ * This header is C, it's included by generated code & natives only. */
+#ifndef loxy_runtime_h
+#define loxy_runtime_h
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* bumped whenever generated code & the VM would disagree. */
+#define LOXY_ABI_VERSION 1
+
+/* value types, as ValueType. */
+enum {
+  LOXY_UNDEF,
+  LOXY_BOOL,
+  LOXY_NIL,
+  LOXY_NUMBER,
+  LOXY_INT,
+  LOXY_OBJ,
+  LOXY_STRING,
+};
+
+/* generic ops of [loxy_arithmetic], the VM maps them to OpCodes. */
+enum {
+  LOXY_EQUAL,
+  LOXY_GREATER,
+  LOXY_LESS,
+  LOXY_ADD,
+  LOXY_SUBTRACT,
+  LOXY_MULTIPLY,
+  LOXY_DIVIDE,
+  LOXY_NEGATE,
+};
+
+/* flags of a counting loop, as ForFlags. */
+enum {
+  LOXY_FOR_SUBTRACT = 1 << 2,
+  LOXY_FOR_GREATER  = 1 << 3,
+  LOXY_FOR_NEGATE   = 1 << 4,
+};
+
+/* LoxyValue - laid out as a Value. */
+typedef struct LoxyValue {
+  int32_t type;
+  union {
+    bool boolean;
+    double number;
+    int64_t integer;
+    void *obj;
+  } as;
+} LoxyValue;
+
+/* LoxyFrame - what a module body runs on. [top] must be up to date on
+ * every call into the VM. */
+typedef struct LoxyFrame {
+  void *vm;
+  void *module;
+  LoxyValue *stack;
+  LoxyValue *top;
+  const LoxyValue *constants;
+} LoxyFrame;
+
+/* LoxyConstant - a constant of the module, [bits] of a number or an int,
+ * [chars] & [length] of a string. */
+typedef struct LoxyConstant {
+  int32_t type;
+  uint64_t bits;
+  const char *chars;
+  int32_t length;
+} LoxyConstant;
+
+/* LoxyModule - the module a translation unit defines, see [LOXY_MODULE].
+ * [body] returns false after a runtime error. */
+typedef struct LoxyModule {
+  int32_t abi;
+  const char *name;
+  int32_t constantCount;
+  const LoxyConstant *constants;
+  bool (*body)(LoxyFrame *frame);
+} LoxyModule;
+
+/* signatures of LoxyNative, as NativeSignature. */
+enum {
+  LOXY_NATIVE_VALUES,
+  LOXY_NATIVE_NUMBERS,
+};
+
+typedef void (*LoxyFunction)(void);
+
+/* LoxyNativeFn - a native of values, see NativeFn: [vm] is the VM, it
+ * stores its result in args[-1] & returns false after loxy_native_error. */
+typedef bool (*LoxyNativeFn)(void *vm, LoxyValue *args, int count);
+
+/* LoxyNative - a native function of a shared object loaded by `loxy
+ * --load`. The object exports loxy_natives, an array of them ending with
+ * one named NULL. Natives of numbers take [arity] doubles, 3 at most, &
+ * return a double; natives of values take [arity] values, -1 for any:
+ *
+ *   static double hypot2(double a, double b) { return a * a + b * b; }
+ *
+ *   const LoxyNative loxy_natives[] = {
+ *     { "hypot2", LOXY_NATIVE_NUMBERS, 2, (LoxyFunction)hypot2 },
+ *     { 0 },
+ *   };
+ *
+ * See [VM::loadNatives]. */
+typedef struct LoxyNative {
+  const char *name;
+  int32_t signature;
+  int32_t arity;
+  LoxyFunction function;
+} LoxyNative;
+
+/* loxy_native_error - the message of a native of values failing. */
+void loxy_native_error(void *vm, const char *message);
+
+/* the VM side. Ops taking a [line] return false after reporting a
+ * runtime error at it. */
+bool loxy_arithmetic(LoxyFrame *f, int op, int line);
+bool loxy_get_global(LoxyFrame *f, int constant, int line);
+bool loxy_set_global(LoxyFrame *f, int constant, int line);
+void loxy_define_global(LoxyFrame *f, int constant);
+void loxy_print(LoxyFrame *f);
+void loxy_map(LoxyFrame *f);
+bool loxy_map_insert(LoxyFrame *f, int line);
+bool loxy_get_index(LoxyFrame *f, int line);
+bool loxy_set_index(LoxyFrame *f, int line);
+
+/* calls the callee [argCount] values below the top on them, leaving its
+ * result in their place. Translated scripts only call natives. */
+bool loxy_call(LoxyFrame *f, int argCount, int line);
+
+/* runs [module] in a new VM, returns the exit status of `loxy`. */
+int loxy_main(const LoxyModule *module);
+
+/* fast paths, inlined into generated code. */
+
+static inline void loxy_push_bool(LoxyFrame *f, bool value) {
+  LoxyValue v;
+  v.type = LOXY_BOOL;
+  v.as.integer = 0;
+  v.as.boolean = value;
+  *f->top++ = v;
+}
+
+static inline void loxy_push_nil(LoxyFrame *f) {
+  LoxyValue v;
+  v.type = LOXY_NIL;
+  v.as.obj = 0;
+  *f->top++ = v;
+}
+
+static inline bool loxy_falsey(const LoxyValue *v) {
+  return v->type == LOXY_NIL || (v->type == LOXY_BOOL && !v->as.boolean);
+}
+
+static inline void loxy_not(LoxyFrame *f) {
+  bool falsey = loxy_falsey(f->top - 1);
+  f->top--;
+  loxy_push_bool(f, falsey);
+}
+
+/* two ints or two doubles, the rest is up to the VM. */
+#define LOXY_BOTH(f, t) ((f)->top[-2].type == (t) && (f)->top[-1].type == (t))
+
+#define LOXY_ARITHMETIC(name, OP, op, overflow)                         \
+  static inline bool loxy_##name(LoxyFrame *f, int line) {             \
+    LoxyValue *a = f->top - 2, *b = f->top - 1;                         \
+    int64_t result;                                                     \
+    if (LOXY_BOTH(f, LOXY_INT) &&                                       \
+        !overflow(a->as.integer, b->as.integer, &result) &&            \
+        (OP != LOXY_MULTIPLY || result != 0 ||                          \
+         (a->as.integer >= 0 && b->as.integer >= 0))) {                 \
+      a->as.integer = result;                                           \
+      f->top--;                                                         \
+      return true;                                                      \
+    }                                                                   \
+    if (LOXY_BOTH(f, LOXY_NUMBER)) {                                    \
+      a->as.number = a->as.number op b->as.number;                      \
+      f->top--;                                                         \
+      return true;                                                      \
+    }                                                                   \
+    return loxy_arithmetic(f, OP, line);                                \
+  }
+
+/* products of 0 & a negative int are -0, a double. */
+LOXY_ARITHMETIC(add, LOXY_ADD, +, __builtin_add_overflow)
+LOXY_ARITHMETIC(subtract, LOXY_SUBTRACT, -, __builtin_sub_overflow)
+LOXY_ARITHMETIC(multiply, LOXY_MULTIPLY, *, __builtin_mul_overflow)
+
+#define LOXY_COMPARE(name, OP, op)                                      \
+  static inline bool loxy_##name(LoxyFrame *f, int line) {             \
+    LoxyValue *a = f->top - 2, *b = f->top - 1;                         \
+    bool result;                                                        \
+    if (LOXY_BOTH(f, LOXY_INT)) {                                       \
+      result = a->as.integer op b->as.integer;                          \
+    } else if (LOXY_BOTH(f, LOXY_NUMBER)) {                             \
+      result = a->as.number op b->as.number;                            \
+    } else {                                                            \
+      return loxy_arithmetic(f, OP, line);                              \
+    }                                                                   \
+    f->top -= 2;                                                        \
+    loxy_push_bool(f, result);                                          \
+    return true;                                                        \
+  }
+
+LOXY_COMPARE(equal, LOXY_EQUAL, ==)
+LOXY_COMPARE(greater, LOXY_GREATER, >)
+LOXY_COMPARE(less, LOXY_LESS, <)
+
+static inline bool loxy_divide(LoxyFrame *f, int line) {
+  if (LOXY_BOTH(f, LOXY_NUMBER)) {
+    f->top[-2].as.number /= f->top[-1].as.number;
+    f->top--;
+    return true;
+  }
+  return loxy_arithmetic(f, LOXY_DIVIDE, line);
+}
+
+static inline bool loxy_negate(LoxyFrame *f, int line) {
+  if (f->top[-1].type == LOXY_NUMBER) {
+    f->top[-1].as.number = -f->top[-1].as.number;
+    return true;
+  }
+  return loxy_arithmetic(f, LOXY_NEGATE, line);
+}
+
+/* steps the int [counter] of a counting loop. returns whether to run the
+ * body again, or -1, changing nothing, for the loop's own increment &
+ * condition to run. */
+static inline int loxy_for_loop(LoxyValue *counter, const LoxyValue *limit,
+                                const LoxyValue *step, int flags) {
+  int64_t next;
+  bool test;
+  if (counter->type != LOXY_INT || limit->type != LOXY_INT || step->type != LOXY_INT) {
+    return -1;
+  }
+  if (flags & LOXY_FOR_SUBTRACT
+        ? __builtin_sub_overflow(counter->as.integer, step->as.integer, &next)
+        : __builtin_add_overflow(counter->as.integer, step->as.integer, &next)) {
+    return -1;
+  }
+  counter->as.integer = next;
+
+  /* the limit may be the counter itself, it's read after the step. */
+  test = flags & LOXY_FOR_GREATER ? counter->as.integer > limit->as.integer
+                                  : counter->as.integer < limit->as.integer;
+  return flags & LOXY_FOR_NEGATE ? !test : test;
+}
+
+/* defines the module of the translation unit, & main() with
+ * LOXY_EXECUTABLE. */
+#ifdef LOXY_EXECUTABLE
+  #define LOXY_MAIN int main(void) { return loxy_main(&loxy_module); }
+#else
+  #define LOXY_MAIN
+#endif
+
+#define LOXY_MODULE(name, count, constants, body)                        \
+  const LoxyModule loxy_module = {                                      \
+    LOXY_ABI_VERSION, name, count, constants, body                      \
+  };                                                                    \
+  LOXY_MAIN
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,11 +1,20 @@
+#include <dlfcn.h>
 #include <stdarg.h>
 #include <stdlib.h>
+#include <unistd.h>
 
+#include "Compiler/Parser.h"
+#include "Image.h"
+#include "Jit.h"
+#include "Kernels.h"
 #include "Module.h"
+#include "Number.h"
 #include "VM.h"
 #include "Value.h"
+#include "Verifier.h"
 #include "Data/SmallVector.h"
 #include "Data/HashMap.h"
+#include "Data/ValueMap.h"
 
 namespace loxy {
 // class String
@@ -28,42 +37,72 @@ void StringPool::destroy(VM &vm, StringPool **poolPtr) {
 }
 
 String *StringPool::findString(const char *chars, int length, uint32_t hash) const {
-  Entry *entries = map_->entries_;
-
-  // there isn't anything yet,
-  if (entries == nullptr) return nullptr;
-  uint32_t index = hash & map_->capacityMask_;
-  
-  // The loop is similar to HashMap::_find
-  while (true) {
-    Entry *entry = &entries[index];
-    if (HashMap::isEmpty(entry))  return nullptr;
-    if (HashMap::isTombstone(entry))  continue;
-    if (entry->key->hash() == hash &&
-        entry->key->length() == length &&
-        memcmp(entry->key->cString(), chars, length) == 0) return entry->key;
-
-    index = (index + 1) & map_->capacityMask_;
-  }
+  return map_->findString(chars, length, hash);
 }
 
 void StringPool::addString(String *string) {
   map_->set(string, Value::True);
 }
 
+void StringPool::removeUnmarked() {
+  map_->removeUnmarked();
+}
+
+HashMapStats StringPool::stats() const {
+  return map_->stats();
+}
+
 // class VM.
 VM::VM():
   allocatedBytes(0),
-  nextGC(1024 * 1024),
-  first(nullptr) {
+  nextGC(INITIAL_HEAP_SIZE),
+  first(nullptr),
+  numTempRoots_(0),
+  parser_(nullptr),
+  image_(nullptr),
+  fiber_(nullptr),
+  stack_(nullptr),
+  stackSize_(0),
+  stackTop_(nullptr),
+  frames_(nullptr),
+  frameCapacity_(0),
+  frameCount_(0),
+  openUpvalues_(nullptr),
+  result_(Value::Nil),
+  unverified_(false),
+  stopped_(nullptr),
+  retry_(false),
+  handOff_(nullptr),
+  handOffValue_(Value::Nil),
+  budget_(FUEL_SLICE),
+  fuel_(-1),
+  interrupt_((int)Interrupt::None),
+  out_(STDOUT_FILENO, isatty(STDOUT_FILENO) ? FlushPolicy::Line : FlushPolicy::Size),
+  quickenStats_(),
+  inferenceStats_(),
+  captureStats_(),
+  propertyStats_(),
+  verify_(true),
+  jitEnabled_(false),
+  jitStats_() {
+  setJit(true);
 
-  modules_ = SmallVector<Module*>::create(*this);
+  modules_ = SmallVector<Module*, 8>::create(*this);
   stringPool = StringPool::create(*this);
 }
 
 VM::~VM() {
-  SmallVector<Module*>::destroy(*this, &modules_);
+  for (int i = 0; i < modules_->count(); i++) Module::destroy(*this, &(*modules_)[i]);
+  for (void *library : libraries_) dlclose(library);
+  SmallVector<Module*, 8>::destroy(*this, &modules_);
   StringPool::destroy(*this, &stringPool);
+
+  // free all objects.
+  while (first != nullptr) {
+    Object *object = first;
+    first = static_cast<Object*>(object->next);
+    freeObject(object);
+  }
 }
 
 void *VM::reallocate(void *prev, size_t oldSize, size_t newSize) {
@@ -88,6 +127,10 @@ void *VM::reallocate(void *prev, size_t oldSize, size_t newSize) {
   return realloc(prev, newSize);
 }
 
+void VM::addModule(Module *module) {
+  modules_->push(module);
+}
+
 String *VM::findString(const char *chars,
                        int length,
                        uint32_t hash) {
@@ -98,41 +141,930 @@ void VM::addString(String *string) {
   stringPool->addString(string);
 }
 
+String *VM::intern(String *string) {
+  if (string->isInterned()) return string;
+
+  String *interned = findString(string->cString(), string->length(), string->hash());
+  if (interned != nullptr) return interned;
+
+  string->interned_ = true;
+  pushRoot(string);
+  addString(string);
+  popRoot();
+  return string;
+}
+
+// quickening. The inline cache after a binary op counts its runs with
+// fitting operands in the low bits & its failed guards in the high bits.
+static const uint8_t WARMUP_MASK = 0x0f;
+static const int DEOPTS_SHIFT = 4;
+
+static_assert(QUICKEN_WARMUP <= WARMUP_MASK && QUICKEN_MAX_DEOPTS <= 0x0f,
+              "Quickening state doesn't fit the inline cache");
+
+// quicken - counts a run of the generic op at [site] on [a] & [b]. Rewrites
+//  it into [intOp] for two ints or [numberOp] for two doubles once its
+//  operands fit one of them QUICKEN_WARMUP times in a row.
+static inline void quicken(uint8_t *site, Value a, Value b,
+                           OpCode intOp, OpCode numberOp, QuickenStats &stats) {
+  uint8_t &cache = site[1];
+  if ((cache >> DEOPTS_SHIFT) >= QUICKEN_MAX_DEOPTS) return;
+
+  OpCode specialized;
+  if (a.isInt() && b.isInt()) {
+    specialized = intOp;
+  } else if (a.isDouble() && b.isDouble()) {
+    specialized = numberOp;
+  } else {
+    cache &= ~WARMUP_MASK;
+    return;
+  }
+
+  if ((cache & WARMUP_MASK) + 1 < QUICKEN_WARMUP) {
+    cache++;
+    return;
+  }
+  cache &= ~WARMUP_MASK;
+  site[0] = (uint8_t)specialized;
+  stats.quickened++;
+}
+
+// deoptimize - rewrites the specialized op at [site] back into [generic].
+static inline void deoptimize(uint8_t *site, OpCode generic, QuickenStats &stats) {
+  int deopts = (site[1] >> DEOPTS_SHIFT) + 1;
+  site[0] = (uint8_t)generic;
+  site[1] = (uint8_t)(deopts << DEOPTS_SHIFT);
+
+  stats.deopts++;
+  if (deopts == QUICKEN_MAX_DEOPTS) stats.unstable++;
+}
+
+// cachedProperty - the entry of [cache] for instances of [shape], nullptr
+//  on a miss.
+static inline const PropertyCache::Entry *cachedProperty(const PropertyCache &cache,
+    const Shape *shape, PropertyCacheStats &stats) {
+  for (int i = 0; i < cache.count; i++) {
+    if (cache.entries[i].shape == shape) {
+      stats.hits++;
+      return &cache.entries[i];
+    }
+  }
+  return nullptr;
+}
+
+// arrayIndex - the element of [array] at [index] into [element]. returns
+//  false unless [index] is an integer in bounds.
+static inline bool arrayIndex(const Array *array, Value index, int *element) {
+  if (index.isInt()) {
+    int64_t i = index.asInt();
+    if (i < 0 || i >= array->count) return false;
+    *element = (int)i;
+    return true;
+  }
+
+  if (!index.isDouble()) return false;
+  double d = (double)index;
+  if (!(d >= 0 && d < array->count) || d != (double)(int)d) return false;
+  *element = (int)d;
+  return true;
+}
+
+// ArrayMethod - the built in methods of arrays, see [VM::invokeArray].
+enum class ArrayMethod {
+  Length,
+  Push,
+  Pop,
+  // bulk operations on packed arrays.
+  Sum,
+  Min,
+  Max,
+  Dot,
+  Add,
+  Multiply,
+};
+
+static const struct {
+  const char *name;
+  ArrayMethod method;
+  int arity;
+} arrayMethods[] = {
+  { "length", ArrayMethod::Length,   0 },
+  { "push",   ArrayMethod::Push,     1 },
+  { "pop",    ArrayMethod::Pop,      0 },
+  { "sum",    ArrayMethod::Sum,      0 },
+  { "min",    ArrayMethod::Min,      0 },
+  { "max",    ArrayMethod::Max,      0 },
+  { "dot",    ArrayMethod::Dot,      1 },
+  { "add",    ArrayMethod::Add,      1 },
+  { "mul",    ArrayMethod::Multiply, 1 },
+};
+
+// forLoop - steps the counter of a FOR_LOOP, see ForFlags. returns whether
+//  to run the body again, or -1, changing nothing, for the loop's own
+//  increment & condition to run where an operand isn't a number.
+static inline int forLoop(Value *counter, const Value *limit, Value step, uint8_t flags) {
+  Value i = *counter;
+  if (!i.isNumber() || !step.isNumber() || !limit->isNumber()) return -1;
+
+  bool subtract = flags & FOR_SUBTRACT;
+  int64_t result;
+  if (i.isInt() && step.isInt() &&
+      (subtract ? subtractInt(i.asInt(), step.asInt(), &result)
+                : addInt(i.asInt(), step.asInt(), &result))) {
+    *counter = Value(result);
+  } else {
+    *counter = Value(subtract ? (double)i - (double)step : (double)i + (double)step);
+  }
+
+  // the limit may be the counter itself, it's read after the step.
+  bool test = flags & FOR_GREATER ? *counter > *limit : *limit > *counter;
+  return (flags & FOR_NEGATE) ? !test : test;
+}
+
+Module *VM::compile(const char *source, const char *module) {
+  String *name = String::create(*this, module);
+  pushRoot(name);
+  String *src = String::createTransient(*this, source);
+  pushRoot(src);
+
+  Module *mod = Module::create(*this, name, nullptr, src);
+  popRoot();
+  popRoot();
+  addModule(mod);
+
+  return mod->compile() ? mod : nullptr;
+}
+
+InterpretResult VM::interpret(const char *source, const char *module) {
+  Module *mod = compile(source, module);
+  if (mod == nullptr) return InterpretResult::Compile_Error;
+  return run(mod);
+}
+
 InterpretResult VM::run(Module *module) {
-  const Chunk *code = module->getBody();
-  Value stack[STACK_MAX];
-  Value *stackTop = stack;
-  int ip = 0;
+  Chunk *code = module->getBody();
+
+  if (verify_ && code->maxStack_ == -1) {
+    VerifyError verifyError;
+    if (!VerifyChunk(code, &verifyError)) {
+      const Chunk *chunk = verifyError.chunk;
+      int offset = verifyError.offset;
+      error(offset < (int)chunk->size() ? chunk->lines()[offset] : 0,
+            "Malformed bytecode at %d: %s", offset, verifyError.reason);
+      return InterpretResult::Compile_Error;
+    }
+  }
+
+  // the module body runs on a fiber of its own, which can't yield. The
+  // fibers it spawned & the I/O it waits on run on once it's done.
+  Fiber *fiber = Fiber::create(*this, module, Value::Nil);
+  Value result;
+  pushRoot(fiber);
+  InterpretResult status = resume(fiber, Value::Nil, &result);
+  popRoot();
+  if (status != InterpretResult::Ok) return status;
+  return runLoop();
+}
+
+Fiber *VM::spawn(Module *module, Value callee) {
+  if (Fiber::functionOf(callee) == nullptr) return nullptr;
+
+  Fiber *fiber = Fiber::create(*this, module, callee);
+  schedule(fiber);
+  return fiber;
+}
+
+void VM::schedule(Fiber *fiber, Value value) {
+  assert(fiber->state != FiberState::Done && "Scheduling a finished fiber");
+  scheduled_.push_back({ fiber, value });
+}
+
+InterpretResult VM::resume(Fiber *fiber, Value value, Value *result) {
+  assert(fiber_ == nullptr && "Resuming a fiber from a running one");
+  assert((fiber->state == FiberState::New || fiber->state == FiberState::Suspended ||
+          fiber->state == FiberState::Woken) && "Resuming a running or blocked fiber");
+
+  // verified code runs on a stack of the size it needs, anything else on
+  // STACK_MAX values a frame, checked for overflows.
+  Function *function = fiber->frames[0].function;
+  Chunk *code = function != nullptr ? function->chunk : fiber->module->getBody();
+  InterpretResult status = InterpretResult::Ok;
+  if (fiber->state == FiberState::Woken) {
+    // still resumed by the fibers it was, it finishes the native it
+    // blocked in first.
+    switchTo(fiber);
+    fiber->state = FiberState::Running;
+    int argCount = fiber->retryArgs;
+    if (argCount >= 0) {
+      fiber->retryArgs = -1;
+      NativeFunction *native = static_cast<NativeFunction*>((Object*)stackTop_[-argCount - 1]);
+      if (!callNative(native, argCount, fiber->retryLine)) status = InterpretResult::Runtime_Error;
+      if (fiber->state == FiberState::Running) fiber->progress = 0;
+    }
+  } else {
+    fiber->resumer = nullptr;
+    enterFiber(fiber, value);
+  }
+  if (status == InterpretResult::Ok && fiber_->state == FiberState::Running) {
+    status = code->maxStack_ >= 0 ? execute<true>(fiber->module)
+                                  : execute<false>(fiber->module);
+  }
+  if (unverified_) {
+    // verified code called, returned or switched to code that isn't.
+    unverified_ = false;
+    if (status == InterpretResult::Ok) status = execute<false>(fiber_->module);
+  }
+
+  if (status == InterpretResult::Ok) {
+    *result = result_;
+    stopped_ = fiber_;
+  } else {
+    // the failed fiber & the ones waiting on it can't go on.
+    Fiber *failed = fiber_;
+    while (failed != nullptr) {
+      Fiber *resumer = failed->resumer;
+      failed->state = FiberState::Done;
+      failed->resumer = nullptr;
+      failed = resumer;
+    }
+  }
+  result_ = Value::Nil;
+  switchTo(nullptr);
+  return status;
+}
+
+InterpretResult VM::runScheduled() {
+  while (!scheduled_.empty()) {
+    Scheduled next = scheduled_.front();
+    scheduled_.pop_front();
+
+    // a suspended fiber may have been resumed by another meanwhile, &
+    // be done or blocked since.
+    FiberState state = next.fiber->state;
+    if (state == FiberState::Done || state == FiberState::Running ||
+        state == FiberState::Blocked) {
+      continue;
+    }
+
+    // a woken fiber hands control back once the fibers that resumed it
+    // do, those yielding go on in turn. Blocked ones wait on the loop.
+    Value result;
+    pushRoot(next.fiber);
+    InterpretResult status = resume(next.fiber, next.value, &result);
+    popRoot();
+    if (status != InterpretResult::Ok) return status;
+    if (stopped_->state == FiberState::Suspended) schedule(stopped_);
+    stopped_ = nullptr;
+  }
+  return InterpretResult::Ok;
+}
+
+InterpretResult VM::runLoop() {
+  for (;;) {
+    InterpretResult status = runScheduled();
+    if (status != InterpretResult::Ok || !loop_.pending()) return status;
+
+    // fibers waiting on I/O run no code to see an abort.
+    if (interrupt_.load(std::memory_order_relaxed) == (int)Interrupt::Abort) {
+      interrupt_.store((int)Interrupt::None, std::memory_order_relaxed);
+      error(0, "Interrupted");
+      return InterpretResult::Runtime_Error;
+    }
+    loop_.poll(*this);
+  }
+}
+
+void VM::setFuel(int64_t fuel) {
+  if (fuel < 0) {
+    budget_ = FUEL_SLICE;
+    fuel_ = -1;
+    return;
+  }
+  budget_ = fuel < FUEL_SLICE ? (int32_t)fuel : FUEL_SLICE;
+  fuel_ = fuel - budget_;
+}
+
+int64_t VM::fuel() const {
+  if (fuel_ < 0) return -1;
+  return fuel_ + (budget_ > 0 ? budget_ : 0);
+}
+
+Interrupt VM::refuel(int line) {
+  Interrupt asked = (Interrupt)interrupt_.exchange((int)Interrupt::None,
+                                                   std::memory_order_relaxed);
+  if (asked == Interrupt::Abort) {
+    budget_ = 0;
+    error(line, "Interrupted");
+    return Interrupt::Abort;
+  }
+  if (fuel_ == 0) {
+    budget_ = 0;
+    error(line, "Out of fuel");
+    return Interrupt::Abort;
+  }
+
+  // the charge that spent the budget takes the first unit of the slice.
+  int64_t slice = fuel_ < 0 || fuel_ > FUEL_SLICE ? FUEL_SLICE : fuel_;
+  if (fuel_ > 0) fuel_ -= slice;
+  budget_ = (int32_t)slice - 1;
+  return asked;
+}
+
+void VM::wake(Fiber *fiber) {
+  if (fiber->state != FiberState::Blocked) return;
+  fiber->state = FiberState::Woken;
+  schedule(fiber);
+}
+
+bool VM::waitFor(int fd, bool write, size_t progress) {
+  if (!loop_.watch(*this, fd, write, fiber_)) return false;
+  fiber_->state = FiberState::Blocked;
+  fiber_->progress = progress;
+  retry_ = true;
+  return true;
+}
+
+void VM::sleep(double ms) {
+  loop_.sleep(ms, fiber_);
+  fiber_->state = FiberState::Blocked;
+  retry_ = false;
+}
+
+void VM::handOff(Fiber *fiber, Value value) {
+  assert((fiber->state == FiberState::New || fiber->state == FiberState::Suspended) &&
+         "Handing off to a running or blocked fiber");
+  handOff_ = fiber;
+  handOffValue_ = value;
+}
+
+void VM::switchTo(Fiber *fiber) {
+  if (fiber_ != nullptr) {
+    fiber_->stack = stack_;
+    fiber_->stackSize = stackSize_;
+    fiber_->stackTop = stackTop_;
+    fiber_->frames = frames_;
+    fiber_->frameCapacity = frameCapacity_;
+    fiber_->frameCount = frameCount_;
+    fiber_->openUpvalues = openUpvalues_;
+  }
+
+  fiber_ = fiber;
+  if (fiber == nullptr) {
+    stack_ = stackTop_ = nullptr;
+    stackSize_ = 0;
+    frames_ = nullptr;
+    frameCapacity_ = frameCount_ = 0;
+    openUpvalues_ = nullptr;
+    return;
+  }
+  stack_ = fiber->stack;
+  stackSize_ = fiber->stackSize;
+  stackTop_ = fiber->stackTop;
+  frames_ = fiber->frames;
+  frameCapacity_ = fiber->frameCapacity;
+  frameCount_ = fiber->frameCount;
+  openUpvalues_ = fiber->openUpvalues;
+}
+
+void VM::enterFiber(Fiber *fiber, Value value) {
+  switchTo(fiber);
+
+  // the stack has room: a yield popped the value it pushes back, & a new
+  // fiber's stack fits its function's argument.
+  if (fiber->state != FiberState::New) {
+    *stackTop_++ = value;
+  } else if (frames_[0].function != nullptr && frames_[0].function->arity == 1) {
+    *stackTop_++ = value;
+  }
+  fiber->state = FiberState::Running;
+}
+
+void VM::growFrames() {
+  int capacity = frameCapacity_ * 2 < FRAMES_MAX ? frameCapacity_ * 2 : FRAMES_MAX;
+  frames_ = (CallFrame*)reallocate(frames_, sizeof(CallFrame) * frameCapacity_,
+                                   sizeof(CallFrame) * capacity);
+  assert(frames_ != nullptr && "Out of memory");
+  frameCapacity_ = capacity;
+}
+
+void VM::reserveStack(int size) {
+  if (size <= stackSize_) return;
+
+  // sized exactly at first, deeper calls grow it twice as large.
+  int capacity = size > stackSize_ * 2 ? size : stackSize_ * 2;
+  int top = (int)(stackTop_ - stack_);
+  uintptr_t old = (uintptr_t)stack_;
+  stack_ = (Value*)reallocate(stack_, sizeof(Value) * stackSize_, sizeof(Value) * capacity);
+  assert(stack_ != nullptr && "Out of memory");
+  stackSize_ = capacity;
+  stackTop_ = stack_ + top;
+
+  for (Upvalue *upvalue = openUpvalues_; upvalue != nullptr; upvalue = upvalue->nextOpen) {
+    upvalue->location = (Value*)((uintptr_t)stack_ + ((uintptr_t)upvalue->location - old));
+  }
+}
+
+Upvalue *VM::captureUpvalue(Value *slot) {
+  Upvalue **link = &openUpvalues_;
+  while (*link != nullptr && (*link)->location > slot) link = &(*link)->nextOpen;
+  if (*link != nullptr && (*link)->location == slot) return *link;
+
+  Upvalue *upvalue = Upvalue::create(*this, slot, fiber_);
+  upvalue->nextOpen = *link;
+  *link = upvalue;
+  return upvalue;
+}
+
+void VM::closeUpvalues(Value *last) {
+  while (openUpvalues_ != nullptr && openUpvalues_->location >= last) {
+    Upvalue *upvalue = openUpvalues_;
+    upvalue->closed = *upvalue->location;
+    upvalue->location = &upvalue->closed;
+    openUpvalues_ = upvalue->nextOpen;
+  }
+}
+
+bool VM::lookupProperty(PropertyCache &cache, Shape *shape, String *name, bool set,
+                        PropertyCache::Entry *entry) {
+  propertyStats_.misses++;
+
+  // fields shadow methods.
+  int slot = shape->find(name);
+  if (slot >= 0) {
+    *entry = { shape, slot, nullptr };
+  } else if (set) {
+    *entry = { shape, shape->count, shape->transition(*this, name) };
+  } else {
+    Value method;
+    if (!shape->klass->methods->get(name, &method)) return false;
+    *entry = { shape, -1, (Object*)method };
+  }
+
+  if (cache.megamorphic) return true;
+  if (cache.count == PROPERTY_CACHE_WAYS) {
+    cache.megamorphic = true;
+    propertyStats_.megamorphic++;
+    return true;
+  }
+  if (cache.count == 1) propertyStats_.polymorphic++;
+  cache.entries[cache.count++] = *entry;
+  return true;
+}
+
+bool VM::callNative(NativeFunction *native, int argCount, int line) {
+  if (native->arity >= 0 && argCount != native->arity) {
+    error(line, "Expected %d arguments but got %d", native->arity, argCount);
+    return false;
+  }
+
+  Value *args = stackTop_ - argCount;
+  if (native->signature == NativeSignature::Numbers) {
+    for (int i = 0; i < argCount; i++) {
+      if (!args[i].isNumber()) {
+        error(line, "Arguments of %s must be numbers", native->name->cString());
+        return false;
+      }
+    }
+
+    double result;
+    switch (argCount) {
+    case 0:  result = native->function.numbers0(); break;
+    case 1:  result = native->function.numbers1((double)args[0]); break;
+    case 2:  result = native->function.numbers2((double)args[0], (double)args[1]); break;
+    default:
+      result = native->function.numbers3((double)args[0], (double)args[1], (double)args[2]);
+      break;
+    }
+    args[-1] = Value(result);
+  } else {
+    // the arguments stay on the stack while it runs, it may collect.
+    nativeError_.clear();
+    if (!native->function.values(*this, args, argCount)) {
+      if (nativeError_.empty()) {
+        error(line, "%s failed", native->name->cString());
+      } else {
+        error(line, "%s", nativeError_.c_str());
+      }
+      return false;
+    }
+
+    // it's called again on its arguments once the fiber wakes.
+    if (fiber_->state == FiberState::Blocked && retry_) {
+      fiber_->retryArgs = argCount;
+      fiber_->retryLine = line;
+      return true;
+    }
+  }
+
+  stackTop_ = args;
+  return true;
+}
+
+bool VM::invokeArray(String *name, int argCount, int line) {
+  int found = -1;
+  for (int i = 0; i < (int)(sizeof(arrayMethods) / sizeof(arrayMethods[0])); i++) {
+    if ((int)strlen(arrayMethods[i].name) == name->length() &&
+        memcmp(arrayMethods[i].name, name->cString(), name->length()) == 0) {
+      found = i;
+      break;
+    }
+  }
+  if (found == -1) {
+    error(line, "Undefined property '%s'", name->cString());
+    return false;
+  }
+  if (argCount != arrayMethods[found].arity) {
+    error(line, "Expected %d arguments but got %d", arrayMethods[found].arity, argCount);
+    return false;
+  }
+
+  // the array & the argument stay on the stack until the result replaces
+  // them.
+  Value *receiver = stackTop_ - argCount - 1;
+  Array *array = static_cast<Array*>((Object*)*receiver);
+  ArrayMethod method = arrayMethods[found].method;
+  Value result = Value::Nil;
+
+  // arrays that held something else once are packed again if they can.
+  if (method >= ArrayMethod::Sum && !array->repack(*this)) {
+    error(line, "'%s' needs an array of numbers", name->cString());
+    return false;
+  }
+
+  // the other operand of Dot, Add & Multiply, if it's an array.
+  Array *other = nullptr;
+  if (method >= ArrayMethod::Dot) {
+    Value operand = receiver[1];
+    if (operand.isArray()) {
+      other = static_cast<Array*>((Object*)operand);
+      if (!other->repack(*this)) {
+        error(line, "'%s' needs an array of numbers", name->cString());
+        return false;
+      }
+      if (other->count != array->count) {
+        error(line, "Arrays of %d & %d elements can't be combined", array->count, other->count);
+        return false;
+      }
+    } else if (method == ArrayMethod::Dot || !operand.isNumber()) {
+      error(line, "Operand must be %s", method == ArrayMethod::Dot ? "an array" : "a number or an array");
+      return false;
+    }
+  }
+
+  size_t count = array->count;
+  switch (method) {
+  case ArrayMethod::Length:
+    result = Value((int64_t)array->count);
+    break;
+
+  case ArrayMethod::Push:
+    array->append(*this, receiver[1]);
+    break;
+
+  case ArrayMethod::Pop:
+    // popping an empty array reads nil.
+    if (array->count > 0) {
+      result = array->get(array->count - 1);
+      array->count--;
+    }
+    break;
+
+  case ArrayMethod::Sum:
+    result = Value(sumNumbers(array->numbers, count));
+    break;
+
+  case ArrayMethod::Min:
+    if (count > 0) result = Value(minNumbers(array->numbers, count));
+    break;
+
+  case ArrayMethod::Max:
+    if (count > 0) result = Value(maxNumbers(array->numbers, count));
+    break;
+
+  case ArrayMethod::Dot:
+    result = Value(dotNumbers(array->numbers, other->numbers, count));
+    break;
+
+  case ArrayMethod::Add:
+  case ArrayMethod::Multiply: {
+    // a new array, the operands are left as they were.
+    Array *out = Array::create(*this, array->count);
+    out->count = array->count;
+    if (other != nullptr) {
+      if (method == ArrayMethod::Add) {
+        addNumbers(out->numbers, array->numbers, other->numbers, count);
+      } else {
+        multiplyNumbers(out->numbers, array->numbers, other->numbers, count);
+      }
+    } else {
+      double k = (double)receiver[1];
+      if (method == ArrayMethod::Add) {
+        addScalar(out->numbers, array->numbers, k, count);
+      } else {
+        multiplyScalar(out->numbers, array->numbers, k, count);
+      }
+    }
+    result = Value(out);
+    break;
+  }
+  }
+
+  stackTop_ -= argCount;
+  stackTop_[-1] = result;
+  return true;
+}
+
+bool VM::invokeFiber(String *name, int argCount, int line) {
+  if (name->length() != 4 || memcmp(name->cString(), "done", 4) != 0) {
+    error(line, "Undefined property '%s'", name->cString());
+    return false;
+  }
+  if (argCount != 0) {
+    error(line, "Expected 0 arguments but got %d", argCount);
+    return false;
+  }
+
+  Fiber *fiber = static_cast<Fiber*>((Object*)stackTop_[-1]);
+  stackTop_[-1] = fiber->state == FiberState::Done ? Value::True : Value::False;
+  return true;
+}
+
+template <bool verified>
+InterpretResult VM::execute(Module *module) {
+  CallFrame *frame = &frames_[frameCount_ - 1];
+
+  // the code & locals of [frame]. Not const, binary ops are quickened in
+  // place.
+  Chunk *code;
+  uint8_t *bytes;
+  const Value *constants;
+  PropertyCache *caches;
+  Value *stack;
+  Value *stackEnd;
+  int ip;
 
 //----=== helpers ===----//
 
 #define validate_numbers(a, b)                            \
   if (!(a).isNumber() || !(b).isNumber()) {               \
-    error("Both operands must be numbers", code->lines()[ip]);               \
+    error(current_line(), "Both operands must be numbers"); \
     return InterpretResult::Runtime_Error;                \
   }
 
-#define arithmetics(op)                                   \
+#define arithmetics(op, intOp)                            \
   do {                                                    \
     Value b = pop(); Value a = pop();                     \
+    int64_t result;                                       \
+    if (a.isInt() && b.isInt() &&                         \
+        intOp(a.asInt(), b.asInt(), &result)) {           \
+      push(Value(result));                                \
+      break;                                              \
+    }                                                     \
     validate_numbers(a, b);                               \
-    double result = (double)a op (double)b;               \
-    push(Value(result));                                  \
+    push(Value((double)a op (double)b));                  \
   } while (false)
 
-#define read_byte()     code->read(ip++)
-#define read_short()    (uint16_t)read_byte() << 8 | read_byte()
+// unchecked - arithmetics on operands proven numbers, see
+//  [Parser::emitNumeric].
+#define unchecked(op, intOp)                              \
+  do {                                                    \
+    Value b = peek(0); Value a = peek(1);                 \
+    int64_t result;                                       \
+    stackTop_--;                                          \
+    if (a.isInt() && b.isInt() &&                         \
+        intOp(a.asInt(), b.asInt(), &result)) {           \
+      stackTop_[-1] = Value(result);                      \
+    } else {                                              \
+      stackTop_[-1] = Value((double)a op (double)b);      \
+    }                                                     \
+  } while (false)
+
+// profile - counts a run of the generic op at [ip - 1], see [quicken], &
+//  skips its inline cache. Operands are still on the stack.
+#define profile(intOp, numberOp)                          \
+  quicken(&bytes[ip - 1], peek(1), peek(0),        \
+          OpCode::intOp, OpCode::numberOp, quickenStats_); \
+  ip++
+
+// specialized - runs a specialized op on operands [a] & [b], pushing
+//  [result] if [guard] holds. Otherwise rewrites the op back into
+//  [generic] & runs that instead.
+#define specialized(guard, generic, result)               \
+  {                                                       \
+    Value b = peek(0); Value a = peek(1);                 \
+    if (!(guard)) {                                       \
+      deoptimize(&bytes[ip - 1], OpCode::generic, quickenStats_); \
+      ip--;                                               \
+      break;                                              \
+    }                                                     \
+    ip++;                                                 \
+    drop(2);                                              \
+    push(result);                                         \
+  }
+
+#define both_ints       (a.isInt() && b.isInt())
+#define both_doubles    (a.isDouble() && b.isDouble())
+#define as_bool(v)      ((v) ? Value::True : Value::False)
+
+#define current_line()  code->lines()[ip - 1]
+
+// verified code is read without bounds checks, see [VerifyChunk].
+#define byte_at(i)      (verified ? bytes[i] : code->read(i))
+#define constant_at(i)  (verified ? constants[i] : code->getConstant(i))
+#define cache_at(i)     (verified ? caches[i] : code->caches()[i])
+#define read_byte()     byte_at(ip++)
+#define read_short()    (ip += 2, (uint16_t)(byte_at(ip - 2) << 8 | byte_at(ip - 1)))
 #define read_string()   (String*)read_constant()
-#define read_constant() code->getConstant(read_byte())
+#define read_constant() constant_at(read_byte())
 
-#define push(value)     *stackTop++ = value
-#define pop()           *stackTop--
-#define peek(distance)  *(stackTop - 1 - distance)
+// only unverified code can overflow the stack.
+#define push(value)                                       \
+  do {                                                    \
+    if (!verified && stackTop_ == stackEnd) {             \
+      error(current_line(), "Stack overflow");            \
+      return InterpretResult::Runtime_Error;              \
+    }                                                     \
+    *stackTop_++ = value;                                 \
+  } while (false)
+
+#define pop()           (*--stackTop_)
+#define drop(count)     (stackTop_ -= (count))
+#define peek(distance)  *(stackTop_ - 1 - distance)
   
 #define isFalsey(v)     (v).isNil() || ((v).isBool() && !((bool)(v)))
 
+// load_frame - switches to running [frame] from where it left off.
+//  Verified code leaves code that isn't to execute<false>, see [resume].
+#define load_frame()                                      \
+  do {                                                    \
+    code = frame->function != nullptr ? frame->function->chunk \
+                                      : module->getBody(); \
+    if (verified && code->maxStack_ < 0) {                \
+      unverified_ = true;                                 \
+      return InterpretResult::Ok;                         \
+    }                                                     \
+    bytes = code->code().data();                          \
+    constants = code->constants().data();                 \
+    caches = code->caches().data();                       \
+    stack = stack_ + frame->base;                         \
+    stackEnd = stack_ + stackSize_;                       \
+    ip = frame->ip;                                       \
+  } while (false)
+
+// check_arity - checks [function] takes [argCount] arguments.
+#define check_arity(function, argCount)                   \
+  do {                                                    \
+    if ((argCount) != (function)->arity) {                \
+      error(current_line(), "Expected %d arguments but got %d", \
+            (function)->arity, argCount);                 \
+      return InterpretResult::Runtime_Error;              \
+    }                                                     \
+  } while (false)
+
+// validate_call - finds the function to run for the callee [argCount]
+//  below the top, checks it takes [argCount] arguments & assigns it to
+//  [function]. Bound methods run on their receiver & classes on a new
+//  instance, in place of the callee. nullptr for a class without init,
+//  the instance is the result.
+#define validate_call(function, argCount)                 \
+  do {                                                    \
+    Value callee = peek(argCount);                        \
+    if (callee.isClosure()) {                             \
+      function = static_cast<Closure*>((Object*)callee)->function; \
+    } else if (callee.isFunction()) {                     \
+      function = static_cast<Function*>((Object*)callee); \
+    } else if (callee.isBoundMethod()) {                  \
+      BoundMethod *bound = static_cast<BoundMethod*>((Object*)callee); \
+      function = bound->method;                           \
+      peek(argCount) = bound->receiver;                   \
+    } else if (callee.isNative()) {                       \
+      /* runs right away, without a frame. */             \
+      NativeFunction *native = static_cast<NativeFunction*>((Object*)callee); \
+      if (!callNative(native, argCount, current_line())) { \
+        return InterpretResult::Runtime_Error;            \
+      }                                                   \
+      if (fiber_->state == FiberState::Blocked) {         \
+        /* to the host, the loop wakes it. see [waitFor]. */ \
+        frame->ip = ip;                                   \
+        return InterpretResult::Ok;                       \
+      }                                                   \
+      if (handOff_ != nullptr) {                          \
+        /* the fiber pushes what it yields or returns back in place of */ \
+        /* the result, see YIELD & RETURN. */             \
+        Fiber *resumed = handOff_;                        \
+        handOff_ = nullptr;                               \
+        stackTop_--;                                      \
+        frame->ip = ip;                                   \
+        resumed->resumer = fiber_;                        \
+        enterFiber(resumed, handOffValue_);               \
+        switch_fiber();                                   \
+      }                                                   \
+      function = nullptr;                                 \
+      break;                                              \
+    } else if (callee.isClass()) {                        \
+      /* the class stays in place while it's instantiated. */ \
+      Class *klass = static_cast<Class*>((Object*)callee); \
+      peek(argCount) = Value(Instance::create(*this, klass)); \
+      function = klass->initializer;                      \
+      if (function == nullptr) {                          \
+        if ((argCount) != 0) {                            \
+          error(current_line(), "Expected 0 arguments but got %d", argCount); \
+          return InterpretResult::Runtime_Error;          \
+        }                                                 \
+        break;                                            \
+      }                                                   \
+    } else {                                              \
+      error(current_line(), "Can only call functions and classes"); \
+      return InterpretResult::Runtime_Error;              \
+    }                                                     \
+    check_arity(function, argCount);                      \
+  } while (false)
+
+// charge_fuel - charges a unit of fuel at a back-edge or a call, see
+//  [refuel]. A preempted fiber goes on at [ip] once the scheduler runs it
+//  again, errors are reported at the line of instruction [at].
+#define charge_fuel(at)                                   \
+  do {                                                    \
+    if (--budget_ >= 0) break;                            \
+    Interrupt asked = refuel(code->lines()[at]);          \
+    if (asked == Interrupt::Abort) return InterpretResult::Runtime_Error; \
+    if (asked == Interrupt::Yield) {                      \
+      frame->ip = ip;                                     \
+      fiber_->state = FiberState::Woken;                  \
+      schedule(fiber_);                                   \
+      return InterpretResult::Ok;                         \
+    }                                                     \
+  } while (false)
+
+// stack_for - the values a frame running [chunk] gets on the stack: as
+//  many as verified code needs, STACK_MAX checked for overflows otherwise.
+#define stack_for(chunk)                                  \
+  (verified && (chunk)->maxStack_ >= 0 ? (chunk)->maxStack_ : STACK_MAX)
+
+// call_frame - runs [function] in a new frame, on the callee & [argCount]
+//  arguments on top of the stack, charging it a unit of fuel.
+#define call_frame(function, argCount)                    \
+  do {                                                    \
+    if (frameCount_ == FRAMES_MAX) {                      \
+      error(current_line(), "Stack overflow");            \
+      return InterpretResult::Runtime_Error;              \
+    }                                                     \
+    /* the callee & its arguments are the first locals of its frame. */ \
+    int base = (int)(stackTop_ - stack_) - (argCount) - 1; \
+    int size = stack_for((function)->chunk);              \
+    reserveStack(base + size);                            \
+                                                          \
+    frame->ip = ip;                                       \
+    if (frameCount_ == frameCapacity_) growFrames();      \
+    frame = &frames_[frameCount_++];                      \
+    *frame = { function, 0, base };                       \
+    load_frame();                                         \
+    charge_fuel(0);                                       \
+  } while (false)
+
+// switch_fiber - runs the fiber switched to from where it left off.
+#define switch_fiber()                                    \
+  do {                                                    \
+    module = fiber_->module;                              \
+    frame = &frames_[frameCount_ - 1];                    \
+    load_frame();                                         \
+  } while (false)
+
+// find_property - the cache entry of property [name] of [instance] at
+//  cache [index] into [entry], looked up on a miss. Fails if there's no
+//  such property.
+#define find_property(entry, instance, name, index, set)  \
+  PropertyCache::Entry missed;                            \
+  const PropertyCache::Entry *entry =                     \
+    cachedProperty(cache_at(index), (instance)->shape, propertyStats_); \
+  if (entry == nullptr) {                                 \
+    if (!lookupProperty(cache_at(index), (instance)->shape, name, set, &missed)) { \
+      error(current_line(), "Undefined property '%s'", (name)->cString()); \
+      return InterpretResult::Runtime_Error;              \
+    }                                                     \
+    entry = &missed;                                      \
+  }
+
+// the closure running in the current frame, in its first slot.
+#define current_closure() static_cast<Closure*>((Object*)stack[0])
+
+#define validate_key(key)                                 \
+  if ((key).isNil() ||                                    \
+      ((key).isNumber() && (double)(key) != (double)(key))) { \
+    error(current_line(), "Map keys can't be nil or NaN"); \
+    return InterpretResult::Runtime_Error;                \
+  }
+
+#define validate_element(array, index, element)           \
+  if (!arrayIndex((array), (index), &(element))) {        \
+    error(current_line(), "Array index out of bounds");   \
+    return InterpretResult::Runtime_Error;                \
+  }
+
 //----================----//
 
+  load_frame();
+
   while (true) {
     OpCode instruction = (OpCode)read_byte();
     switch (instruction) {
@@ -144,20 +1076,21 @@ InterpretResult VM::run(Module *module) {
     case OpCode::NIL:   push(Value::Nil); break;
     case OpCode::TRUE:  push(Value::True); break;
     case OpCode::FALSE: push(Value::False); break;
-    case OpCode::POP:   pop(); break;
+    case OpCode::POP:   drop(1); break;
 
     case OpCode::DEFINE_GLOBAL: {
       String *name = read_string();
-      Value value = pop();
-      module->addVariable(name, value);
+      // keep the value on the stack in case adding it triggers a collection.
+      module->addVariable(name, peek(0));
+      drop(1);
+      break;
     }
 
     case OpCode::GET_GLOBAL: {
       String *name = read_string();
       Value value;
       if (!module->getVariable(name, &value)) {
-        // TODO:
-        // report runtime error
+        error(current_line(), "Undefined variable '%s'", name->cString());
         return InterpretResult::Runtime_Error;
       }
       push(value);
@@ -168,8 +1101,7 @@ InterpretResult VM::run(Module *module) {
       String *name = read_string();
       Value value = peek(0);
       if (!module->setVariable(name, value)) {
-        // TODO:
-        // report runtime error
+        error(current_line(), "Undefined variable '%s'", name->cString());
         return InterpretResult::Runtime_Error;
       }
       break;
@@ -188,6 +1120,7 @@ InterpretResult VM::run(Module *module) {
     }
 
     case OpCode::EQUAL: {
+      profile(EQUAL_INT, EQUAL_NUMBER);
       Value b = pop();
       Value a = pop();
       push(a == b ? Value::True : Value::False);
@@ -195,40 +1128,67 @@ InterpretResult VM::run(Module *module) {
     }
 
     case OpCode::GREATER: {
+      profile(GREATER_INT, GREATER_NUMBER);
       Value b = pop();
       Value a = pop();
 
       validate_numbers(a, b);
-      push(a > b);
+      push(a > b ? Value::True : Value::False);
+      break;
     }
 
     case OpCode::LESS: {
+      profile(LESS_INT, LESS_NUMBER);
       Value b = pop();
       Value a = pop();
 
       validate_numbers(a, b);
-      push(b > a);
+      push(b > a ? Value::True : Value::False);
+      break;
     }
 
     case OpCode::ADD: {
-      Value b = pop();
-      Value a = pop();
+      profile(ADD_INT, ADD_NUMBER);
+      Value b = peek(0);
+      Value a = peek(1);
+      int64_t sum;
 
-      if (a.isString() && b.isString()) {
-        // TODO
-      } else if (a.isNumber() && b.isNumber()) {
-        double sum = (double)a + (double)b;
+      if (a.isInt() && b.isInt() && addInt(a.asInt(), b.asInt(), &sum)) {
+        drop(2);
         push(Value(sum));
+      } else if (a.isString() && b.isString()) {
+        // operands stay on the stack while allocating the result.
+        String *result = String::concat(*this, (String*)a, (String*)b);
+        drop(2);
+        push(Value(result, ValueType::String));
+      } else if (a.isNumber() && b.isNumber()) {
+        drop(2);
+        push(Value((double)a + (double)b));
       } else {
-        // TODO:
-        // report error
+        error(current_line(), "Operands must be two numbers or two strings");
         return InterpretResult::Runtime_Error;
       }
       break;
     }
-    case OpCode::SUBTRACT:  arithmetics(-); break;
-    case OpCode::MULTIPLY:  arithmetics(*); break;
-    case OpCode::DIVIDE:    arithmetics(/); break;
+    case OpCode::SUBTRACT:
+      profile(SUBTRACT_INT, SUBTRACT_NUMBER);
+      arithmetics(-, subtractInt);
+      break;
+
+    case OpCode::MULTIPLY:
+      profile(MULTIPLY_INT, MULTIPLY_NUMBER);
+      arithmetics(*, multiplyInt);
+      break;
+
+    case OpCode::DIVIDE: {
+      // quotients are doubles, even of ints.
+      Value b = pop();
+      Value a = pop();
+
+      validate_numbers(a, b);
+      push(Value((double)a / (double)b));
+      break;
+    }
 
     case OpCode::NOT: {
       Value v = pop();
@@ -239,18 +1199,244 @@ InterpretResult VM::run(Module *module) {
     case OpCode::NEGATE: {
       Value v = pop();
       if (!v.isNumber()) {
-        // TODO:
-        // report error
+        error(current_line(), "Operand must be a number");
+        return InterpretResult::Runtime_Error;
+      }
+      if (v.isInt() && v.asInt() != 0 && v.asInt() != INT64_MIN) {
+        push(Value(-v.asInt()));
+      } else {
+        // -0 & -INT64_MIN are doubles.
+        push(Value(-(double)v));
+      }
+      break;
+    }
+
+    case OpCode::MAP: {
+      Map *map = Map::create(*this);
+      push(Value(map));
+      break;
+    }
+
+    case OpCode::MAP_INSERT: {
+      // everything stays on the stack while inserting.
+      Value value = peek(0);
+      Value key = peek(1);
+      Map *map = static_cast<Map*>((Object*)peek(2));
+
+      validate_key(key);
+      map->entries->set(key, value);
+      drop(2);
+      break;
+    }
+
+    case OpCode::ARRAY: {
+      int count = read_byte();
+
+      // the elements stay on the stack while they're copied, they may
+      // not fit packed.
+      Array *array = Array::create(*this, count);
+      pushRoot(array);
+      for (Value *element = stackTop_ - count; element < stackTop_; element++) {
+        array->append(*this, *element);
+      }
+      popRoot();
+
+      stackTop_ -= count;
+      push(Value(array));
+      break;
+    }
+
+    case OpCode::GET_INDEX: {
+      Value index = pop();
+      Value object = pop();
+
+      if (object.isArray()) {
+        Array *array = static_cast<Array*>((Object*)object);
+        int element;
+        validate_element(array, index, element);
+        push(array->get(element));
+        break;
+      }
+
+      if (!object.isMap()) {
+        error(current_line(), "Only maps & arrays can be indexed");
+        return InterpretResult::Runtime_Error;
+      }
+
+      ValueMap *entries = static_cast<Map*>((Object*)object)->entries;
+      Value value;
+      bool found = index.isDouble() ? entries->getNumber((double)index, &value)
+                                    : entries->get(index, &value);
+
+      // missing keys read as nil.
+      push(found ? value : Value::Nil);
+      break;
+    }
+
+    case OpCode::SET_INDEX: {
+      Value value = peek(0);
+      Value index = peek(1);
+      Value object = peek(2);
+
+      if (object.isArray()) {
+        Array *array = static_cast<Array*>((Object*)object);
+        int element;
+        validate_element(array, index, element);
+
+        // everything stays on the stack while the elements are unpacked.
+        array->set(*this, element, value);
+        drop(3);
+        push(value);
+        break;
+      }
+
+      if (!object.isMap()) {
+        error(current_line(), "Only maps & arrays can be indexed");
         return InterpretResult::Runtime_Error;
       }
-      push(Value(-(double)v));
+      validate_key(index);
+
+      ValueMap *entries = static_cast<Map*>((Object*)object)->entries;
+      if (index.isDouble()) {
+        entries->setNumber((double)index, value);
+      } else {
+        entries->set(index, value);
+      }
+
+      // the assignment evaluates to [value].
+      drop(3);
+      push(value);
       break;
     }
 
+    // int results that overflow fail the guard, the generic op makes them
+    // doubles.
+    case OpCode::EQUAL_INT:
+      specialized(both_ints, EQUAL, as_bool(a.asInt() == b.asInt()));
+      break;
+    case OpCode::EQUAL_NUMBER:
+      specialized(both_doubles, EQUAL, as_bool((double)a == (double)b));
+      break;
+    case OpCode::GREATER_INT:
+      specialized(both_ints, GREATER, as_bool(a.asInt() > b.asInt()));
+      break;
+    case OpCode::GREATER_NUMBER:
+      specialized(both_doubles, GREATER, as_bool((double)a > (double)b));
+      break;
+    case OpCode::LESS_INT:
+      specialized(both_ints, LESS, as_bool(a.asInt() < b.asInt()));
+      break;
+    case OpCode::LESS_NUMBER:
+      specialized(both_doubles, LESS, as_bool((double)a < (double)b));
+      break;
+    case OpCode::ADD_INT: {
+      int64_t result;
+      specialized(both_ints && addInt(a.asInt(), b.asInt(), &result), ADD, Value(result));
+      break;
+    }
+    case OpCode::ADD_NUMBER:
+      specialized(both_doubles, ADD, Value((double)a + (double)b));
+      break;
+    case OpCode::SUBTRACT_INT: {
+      int64_t result;
+      specialized(both_ints && subtractInt(a.asInt(), b.asInt(), &result), SUBTRACT, Value(result));
+      break;
+    }
+    case OpCode::SUBTRACT_NUMBER:
+      specialized(both_doubles, SUBTRACT, Value((double)a - (double)b));
+      break;
+    case OpCode::MULTIPLY_INT: {
+      int64_t result;
+      specialized(both_ints && multiplyInt(a.asInt(), b.asInt(), &result), MULTIPLY, Value(result));
+      break;
+    }
+    case OpCode::MULTIPLY_NUMBER:
+      specialized(both_doubles, MULTIPLY, Value((double)a * (double)b));
+      break;
+
+    // proven numbers, the inline cache is unused.
+    case OpCode::GREATER_NUM: {
+      ip++;
+      Value b = pop();
+      Value a = pop();
+      push(as_bool(a > b));
+      break;
+    }
+    case OpCode::LESS_NUM: {
+      ip++;
+      Value b = pop();
+      Value a = pop();
+      push(as_bool(b > a));
+      break;
+    }
+    case OpCode::ADD_NUM:
+      ip++;
+      unchecked(+, addInt);
+      break;
+    case OpCode::SUBTRACT_NUM:
+      ip++;
+      unchecked(-, subtractInt);
+      break;
+    case OpCode::MULTIPLY_NUM:
+      ip++;
+      unchecked(*, multiplyInt);
+      break;
+    case OpCode::DIVIDE_NUM: {
+      Value b = pop();
+      Value a = pop();
+      push(Value((double)a / (double)b));
+      break;
+    }
+    case OpCode::NEGATE_NUM:
+      VM::arithmetic(OpCode::NEGATE, stackTop_);
+      break;
+
     case OpCode::PRINT: {
-      Value v = pop();
-      // TODO:
-      // print value
+      out_.writeValue(peek(0));
+      out_.newline();
+      drop(1);
+      break;
+    }
+
+    case OpCode::LOOP: {
+      uint16_t offset = read_short();
+      ip -= offset;
+      charge_fuel(ip + offset - 1);
+
+      // hot loops run as baseline code.
+      if (jitEnabled_ && (code->jit_ != nullptr ||
+          (code->hotness_ < JIT_THRESHOLD && ++code->hotness_ == JIT_THRESHOLD))) {
+        ip = runJit(module, code, stack, ip);
+      }
+      break;
+    }
+
+    case OpCode::FOR_LOOP: {
+      uint8_t slot = read_byte();
+      uint8_t flags = read_byte();
+      uint8_t limit = read_byte();
+      uint8_t step = read_byte();
+      uint16_t back = read_short();
+      uint16_t done = read_short();
+
+      Value limitConstant = flags & FOR_LIMIT_LOCAL ? Value::Nil : constant_at(limit);
+      int next = forLoop(&stack[slot],
+        flags & FOR_LIMIT_LOCAL ? &stack[limit] : &limitConstant,
+        flags & FOR_STEP_LOCAL ? stack[step] : constant_at(step), flags);
+      if (next < 0) break;
+      if (next == 0) {
+        ip += done;
+        break;
+      }
+
+      // a back edge, like LOOP.
+      ip -= back;
+      charge_fuel(ip + back - 1);
+      if (jitEnabled_ && (code->jit_ != nullptr ||
+          (code->hotness_ < JIT_THRESHOLD && ++code->hotness_ == JIT_THRESHOLD))) {
+        ip = runJit(module, code, stack, ip);
+      }
+      break;
     }
 
     case OpCode::JUMP: {
@@ -265,8 +1451,247 @@ InterpretResult VM::run(Module *module) {
       break;
     }
 
+    case OpCode::CALL: {
+      int argCount = read_byte();
+      Function *function;
+      validate_call(function, argCount);
+      if (function == nullptr) break;
+
+      call_frame(function, argCount);
+      break;
+    }
+
+    case OpCode::TAIL_CALL: {
+      int argCount = read_byte();
+      Function *function;
+      validate_call(function, argCount);
+
+      // a new instance or a native's result, returned by the RETURN after
+      // it.
+      if (function == nullptr) break;
+
+      // the callee & its arguments move down over the caller's locals, its
+      // frame takes the caller's place.
+      if (openUpvalues_ != nullptr) closeUpvalues(stack);
+      Value *args = stackTop_ - argCount - 1;
+      for (int i = 0; i <= argCount; i++) stack[i] = args[i];
+      stackTop_ = stack + argCount + 1;
+
+      int size = stack_for(function->chunk);
+      reserveStack(frame->base + size);
+
+      *frame = { function, 0, frame->base };
+      load_frame();
+      charge_fuel(0);
+      break;
+    }
+
+    case OpCode::CLOSURE: {
+      Function *function = static_cast<Function*>((Object*)read_constant());
+      Closure *closure = Closure::create(*this, function);
+
+      // on the stack before capturing, upvalues are allocated.
+      push(Value(closure));
+      for (int i = 0; i < closure->count; i++) {
+        const Capture &capture = function->captures[i];
+        Captured &captured = closure->captured[i];
+        if (!(capture.flags & CAPTURE_LOCAL)) {
+          captured = current_closure()->captured[capture.index];
+        } else if (capture.flags & CAPTURE_BOXED) {
+          captured.upvalue = captureUpvalue(&stack[capture.index]);
+        } else {
+          captured.slot = frame->base + capture.index;
+        }
+      }
+      break;
+    }
+
+    case OpCode::GET_UPVALUE: {
+      uint8_t index = read_byte();
+      push(*current_closure()->captured[index].upvalue->location);
+      break;
+    }
+
+    case OpCode::SET_UPVALUE: {
+      uint8_t index = read_byte();
+      *current_closure()->captured[index].upvalue->location = peek(0);
+      break;
+    }
+
+    case OpCode::GET_OUTER: {
+      uint8_t index = read_byte();
+      push(stack_[current_closure()->captured[index].slot]);
+      break;
+    }
+
+    case OpCode::SET_OUTER: {
+      uint8_t index = read_byte();
+      stack_[current_closure()->captured[index].slot] = peek(0);
+      break;
+    }
+
+    case OpCode::CLOSE_UPVALUE:
+      closeUpvalues(stackTop_ - 1);
+      drop(1);
+      break;
+
+    case OpCode::CLASS: {
+      String *name = read_string();
+      push(Value(Class::create(*this, name)));
+      break;
+    }
+
+    case OpCode::METHOD: {
+      String *name = read_string();
+      Value method = peek(0);
+      Value klass = peek(1);
+
+      // runs once a method, checked in verified code too.
+      if (!klass.isClass() || !method.isFunction()) {
+        error(current_line(), "Methods can only be functions added to classes");
+        return InterpretResult::Runtime_Error;
+      }
+
+      // both stay on the stack while the methods grow.
+      Class *target = static_cast<Class*>((Object*)klass);
+      target->methods->set(name, method);
+      if (name->length() == 4 && memcmp(name->cString(), "init", 4) == 0) {
+        target->initializer = static_cast<Function*>((Object*)method);
+      }
+      drop(1);
+      break;
+    }
+
+    case OpCode::GET_PROPERTY: {
+      String *name = read_string();
+      uint8_t index = read_byte();
+      Value object = peek(0);
+      if (!object.isInstance()) {
+        error(current_line(), "Only instances have properties");
+        return InterpretResult::Runtime_Error;
+      }
+
+      Instance *instance = static_cast<Instance*>((Object*)object);
+      find_property(entry, instance, name, index, false);
+      if (entry->slot >= 0) {
+        stackTop_[-1] = instance->fields[entry->slot];
+        break;
+      }
+
+      // methods read off the instance are bound to it, it stays on the
+      // stack meanwhile.
+      Function *method = static_cast<Function*>(entry->target);
+      stackTop_[-1] = Value(BoundMethod::create(*this, object, method));
+      break;
+    }
+
+    case OpCode::SET_PROPERTY: {
+      String *name = read_string();
+      uint8_t index = read_byte();
+      Value value = peek(0);
+      Value object = peek(1);
+      if (!object.isInstance()) {
+        error(current_line(), "Only instances have fields");
+        return InterpretResult::Runtime_Error;
+      }
+
+      // both stay on the stack while the fields grow.
+      Instance *instance = static_cast<Instance*>((Object*)object);
+      find_property(entry, instance, name, index, true);
+      if (entry->target != nullptr) {
+        instance->addField(*this, static_cast<Shape*>(entry->target), value);
+      } else {
+        instance->fields[entry->slot] = value;
+      }
+
+      // the assignment evaluates to [value].
+      drop(2);
+      push(value);
+      break;
+    }
+
+    case OpCode::INVOKE: {
+      String *name = read_string();
+      int argCount = read_byte();
+      uint8_t index = read_byte();
+      Value receiver = peek(argCount);
+      if (receiver.isArray()) {
+        if (!invokeArray(name, argCount, current_line())) return InterpretResult::Runtime_Error;
+        break;
+      }
+      if (receiver.isFiber()) {
+        if (!invokeFiber(name, argCount, current_line())) return InterpretResult::Runtime_Error;
+        break;
+      }
+      if (!receiver.isInstance()) {
+        error(current_line(), "Only instances, arrays & fibers have methods");
+        return InterpretResult::Runtime_Error;
+      }
+
+      Instance *instance = static_cast<Instance*>((Object*)receiver);
+      find_property(entry, instance, name, index, false);
+      Function *function;
+      if (entry->slot >= 0) {
+        // a field, called like any callee in place of the instance.
+        peek(argCount) = instance->fields[entry->slot];
+        validate_call(function, argCount);
+        if (function == nullptr) break;
+      } else {
+        // the method runs on the instance, left in the callee's slot.
+        function = static_cast<Function*>(entry->target);
+        check_arity(function, argCount);
+      }
+
+      call_frame(function, argCount);
+      break;
+    }
+
+    case OpCode::YIELD: {
+      Value value = pop();
+      Fiber *resumer = fiber_->resumer;
+      if (frames_[0].function == nullptr) {
+        error(current_line(), "Can't yield outside of a fiber");
+        return InterpretResult::Runtime_Error;
+      }
+
+      frame->ip = ip;
+      fiber_->state = FiberState::Suspended;
+      fiber_->resumer = nullptr;
+      if (resumer == nullptr) {
+        result_ = value;
+        return InterpretResult::Ok;
+      }
+      switchTo(resumer);
+      *stackTop_++ = value;
+      switch_fiber();
+      break;
+    }
+
     case OpCode::RETURN: {
-      return InterpretResult::Ok;
+      Value result = pop();
+      if (openUpvalues_ != nullptr) closeUpvalues(stack);
+      if (--frameCount_ == 0) {
+        // the fiber is done, its result goes to whoever resumed it.
+        Fiber *resumer = fiber_->resumer;
+        stackTop_ = stack_;
+        fiber_->state = FiberState::Done;
+        fiber_->resumer = nullptr;
+        if (resumer == nullptr) {
+          result_ = result;
+          return InterpretResult::Ok;
+        }
+        switchTo(resumer);
+        *stackTop_++ = result;
+        switch_fiber();
+        break;
+      }
+
+      // the callee's locals go with its frame.
+      stackTop_ = stack;
+      push(result);
+      frame = &frames_[frameCount_ - 1];
+      load_frame();
+      break;
     }
 
     default:  UNREACHABLE();
@@ -274,17 +1699,383 @@ InterpretResult VM::run(Module *module) {
   }
 
 #undef validate_numbers
+#undef profile
+#undef specialized
+#undef both_ints
+#undef both_doubles
+#undef as_bool
+#undef current_line
+#undef validate_key
+#undef validate_element
+#undef check_arity
+#undef validate_call
+#undef charge_fuel
+#undef stack_for
+#undef call_frame
+#undef switch_fiber
+#undef find_property
+#undef cache_at
+#undef current_closure
 #undef arithmetics
+#undef unchecked
 #undef read_bytes
 #undef read_short
 #undef read_string
 #undef read_constant
+#undef constant_at
+#undef byte_at
+#undef load_frame
+}
+
+bool VM::arithmetic(OpCode op, Value *top) {
+  if (op == OpCode::NEGATE) {
+    Value v = top[-1];
+    if (!v.isNumber()) return false;
+
+    // -0 & -INT64_MIN are doubles.
+    bool exact = v.isInt() && v.asInt() != 0 && v.asInt() != INT64_MIN;
+    top[-1] = exact ? Value(-v.asInt()) : Value(-(double)v);
+    return true;
+  }
+
+  Value b = top[-1];
+  Value a = top[-2];
+  if (op == OpCode::EQUAL) {
+    top[-2] = a == b ? Value::True : Value::False;
+    return true;
+  }
+  if (!a.isNumber() || !b.isNumber()) return false;
+
+  int64_t result;
+  bool ints = a.isInt() && b.isInt();
+  switch (op) {
+  case OpCode::GREATER:   top[-2] = a > b ? Value::True : Value::False; break;
+  case OpCode::LESS:      top[-2] = b > a ? Value::True : Value::False; break;
+  case OpCode::DIVIDE:    top[-2] = Value((double)a / (double)b); break;
+  case OpCode::ADD:
+    top[-2] = ints && addInt(a.asInt(), b.asInt(), &result) ? Value(result)
+                                                            : Value((double)a + (double)b);
+    break;
+  case OpCode::SUBTRACT:
+    top[-2] = ints && subtractInt(a.asInt(), b.asInt(), &result) ? Value(result)
+                                                                 : Value((double)a - (double)b);
+    break;
+  case OpCode::MULTIPLY:
+    top[-2] = ints && multiplyInt(a.asInt(), b.asInt(), &result) ? Value(result)
+                                                                 : Value((double)a * (double)b);
+    break;
+  default:                UNREACHABLE();
+  }
+  return true;
+}
+
+void VM::setJit(bool enabled) {
+#ifdef JIT_SUPPORTED
+  jitEnabled_ = enabled;
+#else
+  jitEnabled_ = false;
+#endif
+}
+
+int VM::runJit(Module *module, Chunk *code, Value *base, int ip) {
+  if (code->jit_ == nullptr) {
+    code->jit_ = JitCode::compile(*this, code);
+    if (code->jit_ == nullptr) return ip;
+
+    code->compilations_++;
+    jitStats_.compiled++;
+  }
+
+  JitState state = { this, module, base, stackTop_, 0 };
+  ip = code->jit_->run(state, ip);
+  stackTop_ = state.top;
+
+  jitStats_.exits++;
+  jitStats_.guardExits += state.guardExits;
+
+  if (code->jit_->guardExits() >= JIT_MAX_GUARD_EXITS) {
+    // operand types changed since it was compiled, compile it again once
+    // the interpreter quickened the ops anew.
+    JitCode::destroy(*this, &code->jit_);
+    jitStats_.dropped++;
+    if (code->compilations_ < JIT_MAX_COMPILATIONS) code->hotness_ = 0;
+  }
+  return ip;
+}
+
+void VM::error(int line, const char *format, ...) {
+  // keep what's printed so far in order with the error.
+  out_.flush();
+
+  fprintf(stderr, "[line %d]: ", line);
+  va_list args;
+  va_start(args, format);
+  vfprintf(stderr, format, args);
+  va_end(args);
+  fputc('\n', stderr);
+}
+
+void VM::nativeError(const char *format, ...) {
+  char message[256];
+  va_list args;
+  va_start(args, format);
+  vsnprintf(message, sizeof(message), format, args);
+  va_end(args);
+  nativeError_ = message;
+}
+
+void VM::pushRoot(Object *object) {
+  assert(numTempRoots_ < MAX_TEMP_ROOTS && "Too many temporary roots");
+  tempRoots_[numTempRoots_++] = object;
+}
+
+void VM::popRoot() {
+  assert(numTempRoots_ > 0 && "No temporary roots to pop");
+  numTempRoots_--;
+}
+
+void VM::markObject(Object *object) {
+  if (object == nullptr || object->isDark) return;
+  object->isDark = true;
+
+  // strings have nothing to trace.
+  if (object->type != ObjectType::String) gray_.push_back(object);
+}
+
+void VM::blacken(Object *object) {
+  switch (object->type) {
+  // strings don't reference other objects.
+  case ObjectType::String:  break;
+  case ObjectType::Map:     static_cast<Map*>(object)->entries->mark(); break;
+  case ObjectType::Array: {
+    Array *array = static_cast<Array*>(object);
+    if (!array->packed) {
+      for (int i = 0; i < array->count; i++) markValue(array->values[i]);
+    }
+    break;
+  }
+  case ObjectType::Function: {
+    Function *function = static_cast<Function*>(object);
+    markObject(function->name);
+    function->chunk->mark(*this);
+    break;
+  }
+  case ObjectType::Closure: {
+    Closure *closure = static_cast<Closure*>(object);
+    markObject(closure->function);
+    for (int i = 0; i < closure->count; i++) markObject(closure->captured[i].upvalue);
+    break;
+  }
+  // open upvalues point into the stack of their fiber, closed ones hold
+  // [closed].
+  case ObjectType::Upvalue: {
+    Upvalue *upvalue = static_cast<Upvalue*>(object);
+    if (upvalue->isOpen()) {
+      markObject(upvalue->fiber);
+    } else {
+      markValue(upvalue->closed);
+    }
+    break;
+  }
+  case ObjectType::Class: {
+    Class *klass = static_cast<Class*>(object);
+    markObject(klass->name);
+    klass->methods->mark();
+    markObject(klass->initializer);
+    markObject(klass->shape);
+    break;
+  }
+  case ObjectType::Instance: {
+    Instance *instance = static_cast<Instance*>(object);
+    markObject(instance->shape);
+    for (int i = 0; i < instance->shape->count; i++) markValue(instance->fields[i]);
+    break;
+  }
+  // a shape keeps its class & the whole transition tree alive.
+  case ObjectType::Shape: {
+    Shape *shape = static_cast<Shape*>(object);
+    markObject(shape->klass);
+    markObject(shape->parent);
+    markObject(shape->name);
+    markObject(shape->transitions);
+    markObject(shape->sibling);
+    break;
+  }
+  case ObjectType::BoundMethod: {
+    BoundMethod *bound = static_cast<BoundMethod*>(object);
+    markValue(bound->receiver);
+    markObject(bound->method);
+    break;
+  }
+  case ObjectType::NativeFunction:
+    markObject(static_cast<NativeFunction*>(object)->name);
+    break;
+  // the running fiber's stack & frames are the VM's, see [markRoots].
+  case ObjectType::Fiber: {
+    Fiber *fiber = static_cast<Fiber*>(object);
+    markObject(fiber->resumer);
+    if (fiber == fiber_) break;
+
+    for (Value *slot = fiber->stack; slot < fiber->stackTop; slot++) markValue(*slot);
+    for (int i = 0; i < fiber->frameCount; i++) markObject(fiber->frames[i].function);
+    for (Upvalue *upvalue = fiber->openUpvalues; upvalue != nullptr; upvalue = upvalue->nextOpen) {
+      markObject(upvalue);
+    }
+    break;
+  }
+  }
+}
+
+void VM::markValue(Value value) {
+  if (value.isObj() || value.isString()) markObject((Object*)value);
 }
 
-void VM::error(const char *msg, int line) {
-  fprintf(stderr, "[line %d]: %s", line, msg);
+void VM::trace() {
+  while (!gray_.empty()) {
+    Object *object = gray_.back();
+    gray_.pop_back();
+    blacken(object);
+  }
 }
 
-void VM::collectGarbage() {}
+void VM::markRoots() {
+  markObject(fiber_);
+  loop_.mark(*this);
+  for (const Scheduled &scheduled : scheduled_) {
+    markObject(scheduled.fiber);
+    markValue(scheduled.value);
+  }
+
+  for (Value *slot = stack_; slot < stackTop_; slot++) markValue(*slot);
+  for (int i = 0; i < frameCount_; i++) markObject(frames_[i].function);
+  for (Upvalue *upvalue = openUpvalues_; upvalue != nullptr; upvalue = upvalue->nextOpen) {
+    markObject(upvalue);
+  }
+
+  for (int i = 0; i < numTempRoots_; i++) markObject(tempRoots_[i]);
+
+  for (int i = 0; i < modules_->count(); i++) (*modules_)[i]->mark();
+
+  if (parser_ != nullptr) parser_->markRoots();
+  if (image_ != nullptr) image_->mark();
+}
+
+void VM::freeObject(Object *object) {
+  switch (object->type) {
+  case ObjectType::String: {
+    String *string = static_cast<String*>(object);
+    String::destroy(*this, &string);
+    break;
+  }
+  case ObjectType::Map: {
+    Map *map = static_cast<Map*>(object);
+    Map::destroy(*this, &map);
+    break;
+  }
+  case ObjectType::Array: {
+    Array *array = static_cast<Array*>(object);
+    Array::destroy(*this, &array);
+    break;
+  }
+  case ObjectType::Function: {
+    Function *function = static_cast<Function*>(object);
+    Function::destroy(*this, &function);
+    break;
+  }
+  case ObjectType::Closure: {
+    Closure *closure = static_cast<Closure*>(object);
+    Closure::destroy(*this, &closure);
+    break;
+  }
+  case ObjectType::Upvalue: {
+    Upvalue *upvalue = static_cast<Upvalue*>(object);
+    Upvalue::destroy(*this, &upvalue);
+    break;
+  }
+  case ObjectType::Class: {
+    Class *klass = static_cast<Class*>(object);
+    Class::destroy(*this, &klass);
+    break;
+  }
+  case ObjectType::Instance: {
+    Instance *instance = static_cast<Instance*>(object);
+    Instance::destroy(*this, &instance);
+    break;
+  }
+  case ObjectType::Shape: {
+    Shape *shape = static_cast<Shape*>(object);
+    Shape::destroy(*this, &shape);
+    break;
+  }
+  case ObjectType::BoundMethod: {
+    BoundMethod *bound = static_cast<BoundMethod*>(object);
+    BoundMethod::destroy(*this, &bound);
+    break;
+  }
+  case ObjectType::NativeFunction: {
+    NativeFunction *native = static_cast<NativeFunction*>(object);
+    NativeFunction::destroy(*this, &native);
+    break;
+  }
+  case ObjectType::Fiber: {
+    Fiber *fiber = static_cast<Fiber*>(object);
+    Fiber::destroy(*this, &fiber);
+    break;
+  }
+  }
+}
+
+void VM::sweep() {
+  Object *previous = nullptr;
+  Object *object = first;
+
+  while (object != nullptr) {
+    if (object->isDark) {
+      // reached, unmark it for the next collection.
+      object->isDark = false;
+      previous = object;
+      object = static_cast<Object*>(object->next);
+      continue;
+    }
+
+    Object *unreached = object;
+    object = static_cast<Object*>(object->next);
+    if (previous != nullptr) {
+      previous->next = object;
+    } else {
+      first = object;
+    }
+
+    freeObject(unreached);
+  }
+}
+
+void VM::collectGarbage() {
+#ifdef DEBUG_TRACE_GC
+  size_t before = allocatedBytes;
+#endif
+
+  markRoots();
+  trace();
+
+  // the pool must drop the strings about to be freed, it doesn't mark them.
+  stringPool->removeUnmarked();
+  sweep();
+
+  nextGC = allocatedBytes + allocatedBytes * HEAP_GROW_PERCENT;
+  if (nextGC < INITIAL_HEAP_SIZE) nextGC = INITIAL_HEAP_SIZE;
+
+#ifdef DEBUG_TRACE_GC
+  HashMapStats pool = stringPool->stats();
+  fprintf(stderr, "-- gc collected %zu bytes (from %zu to %zu) next at %zu\n",
+    before - allocatedBytes, before, allocatedBytes, nextGC);
+  fprintf(stderr, "-- string pool: %d strings, %d tombstones, capacity %d, load %.2f, probe avg %.2f max %d\n",
+    pool.count, pool.tombstones, pool.capacity, pool.loadFactor, pool.avgProbe, pool.maxProbe);
+#endif
+}
+
+HashMapStats VM::stringPoolStats() const {
+  return stringPool->stats();
+}
 
 } // namespace loxy
\ No newline at end of file
@@ -1,15 +1,20 @@
 #ifndef loxy_vm_h
 #define loxy_vm_h
 
+#include <atomic>
+#include <deque>
 #include <map>
+#include <string>
 #include <vector>
 #include "Common.h"
-#include "Chunk.h"
+#include "EventLoop.h"
+#include "OpCode.h"
+#include "Output.h"
 #include "Value.h"
 
 namespace loxy {
 
-template<typename T>
+template<typename T, int N>
 class SmallVector;
 class HashMap;
 class Chunk;
@@ -17,9 +22,18 @@ class Value;
 class Object;
 class String;
 class Module;
+class Function;
+class Upvalue;
+class Shape;
+class Parser;
+class ImageReader;
+struct HashMapStats;
 
 typedef uint32_t Hash;
 
+// class StringPool - interned strings. The pool holds its strings weakly:
+//  it never marks them, & strings that nothing else reaches are removed
+//  from it during collection.
 class StringPool {
   HashMap *map_;
 
@@ -30,6 +44,78 @@ public:
   static void destroy(VM &vm, StringPool **poolPtr);
   String *findString(const char *chars, int length, uint32_t hash) const;
   void addString(String *string);
+
+  // removeUnmarked - drops strings not marked by the current collection.
+  void removeUnmarked();
+
+  // stats - size, load factor & probe lengths of the pool.
+  HashMapStats stats() const;
+};
+
+// QuickenStats - how often [VM::run] rewrote binary ops in place.
+struct QuickenStats {
+  // sites rewritten into a type specialized op.
+  size_t quickened;
+  // specialized ops whose guard failed & were rewritten back.
+  size_t deopts;
+  // sites left generic after failing QUICKEN_MAX_DEOPTS times.
+  size_t unstable;
+};
+
+// InferenceStats - what the compiler proved of numeric ops, see
+//  [Parser::emitNumeric].
+struct InferenceStats {
+  // arithmetics & comparisons compiled.
+  size_t sites;
+  // of those, ones on proven numbers, emitted unchecked.
+  size_t unchecked;
+  // unchecked ops patched back once a later assignment disproved them.
+  size_t reverted;
+};
+
+// CaptureStats - how the compiler kept locals captured by closures, see
+//  [Parser::settleLocal].
+struct CaptureStats {
+  // read in place on the stack.
+  size_t unboxed;
+  // boxed into Upvalues, captured by closures that may outlive them.
+  size_t boxed;
+};
+
+// PropertyCacheStats - how property accesses fared with their inline
+//  caches, see [PropertyCache].
+struct PropertyCacheStats {
+  // accesses to a shape the site's cache held, & ones looked up.
+  size_t hits;
+  size_t misses;
+  // sites that saw a second shape, & ones that saw too many to cache.
+  size_t polymorphic;
+  size_t megamorphic;
+};
+
+// JitStats - what the baseline JIT did, see [VM::runJit].
+struct JitStats {
+  size_t compiled;
+  // times the code was left for the interpreter, & how many of them
+  // because of a failed guard.
+  size_t exits;
+  size_t guardExits;
+  // code dropped because its guards kept failing.
+  size_t dropped;
+};
+
+// CallFrame - a call in progress. Frames are kept in an array of their
+//  fiber & their locals on its operand stack, so calls don't allocate.
+struct CallFrame {
+  // the callee, nullptr for the module body.
+  Function *function;
+
+  // where it resumes once its callee returns.
+  int ip;
+
+  // the first stack slot of the frame, holding the callee, followed by
+  // its arguments.
+  int base;
 };
 
 enum class InterpretResult {
@@ -38,9 +124,38 @@ enum class InterpretResult {
   Runtime_Error,
 };
 
+// Interrupt - what [VM::interrupt] asks of the running fiber.
+enum class Interrupt : int {
+  None,
+  // to hand control to the scheduler, which runs it again after the
+  // others.
+  Yield,
+  // to fail with "Interrupted".
+  Abort,
+};
+
 class VM {
   friend class String;
+  friend class Map;
+  friend class Array;
+  friend class Function;
+  friend class Closure;
+  friend class Upvalue;
+  friend class Shape;
+  friend class Class;
+  friend class Instance;
+  friend class BoundMethod;
+  friend class NativeFunction;
+  friend class Fiber;
   friend class Module;
+  friend class Parser;
+  friend class JitCode;
+  friend class NativeRuntime;
+  friend class JitCompiler;
+  friend class Io;
+  friend class EventLoop;
+  friend class ImageWriter;
+  friend class ImageReader;
 
 private:
   size_t allocatedBytes;
@@ -48,12 +163,107 @@ private:
 
   // TODO:
   // change this to a hashmap.
-  SmallVector<Module*> *modules_;
+  SmallVector<Module*, 8> *modules_;
 
   Object *first;
 
   StringPool *stringPool;
 
+  // objects that are not reachable from other roots yet, e.g. a newly
+  // created string about to be stored. See [pushRoot].
+  Object *tempRoots_[MAX_TEMP_ROOTS];
+  int numTempRoots_;
+
+  // the parser compiling right now, if any. Its chunk is a root.
+  Parser *parser_;
+
+  // the image loading right now, if any. What it made so far are roots.
+  ImageReader *image_;
+
+  // the running fiber, nullptr between runs. Its stack, frames & open
+  // upvalues are kept below while it runs, see [switchTo].
+  Fiber *fiber_;
+
+  // operand stack of the running fiber, [stackSize_] values. Sized to the
+  //  code run on it, see [reserveStack].
+  Value *stack_;
+  int stackSize_;
+  Value *stackTop_;
+
+  // calls in progress, the fiber's function or the module body first.
+  // Grows up to FRAMES_MAX, see [growFrames].
+  CallFrame *frames_;
+  int frameCapacity_;
+  int frameCount_;
+
+  // upvalues of locals still on the stack, the topmost first.
+  Upvalue *openUpvalues_;
+
+  // what the fiber handing control back to the host yielded or returned,
+  // see [resume].
+  Value result_;
+
+  // set by verified code reaching code that isn't, [resume] runs the rest
+  // checked.
+  bool unverified_;
+
+  // Scheduled - a fiber waiting in [scheduled_] & what it's resumed with.
+  struct Scheduled {
+    Fiber *fiber;
+    Value value;
+  };
+
+  // fibers to run by [runScheduled], in order.
+  std::deque<Scheduled> scheduled_;
+
+  // the fiber that handed control back to the host last, see
+  // [runScheduled].
+  Fiber *stopped_;
+
+  // fds & timers blocked fibers wait on, see [runLoop].
+  EventLoop loop_;
+
+  // whether the native blocking right now is called again once its fiber
+  // wakes, see [waitFor] & [sleep].
+  bool retry_;
+
+  // the fiber the running native hands control to & what it's resumed
+  // with, see [handOff].
+  Fiber *handOff_;
+  Value handOffValue_;
+
+  // units of fuel left in the current slice, charged at back-edges &
+  // calls, & the fuel left beyond it, -1 for no limit. See [refuel].
+  int32_t budget_;
+  int64_t fuel_;
+
+  // the Interrupt asked for, taken by [refuel].
+  std::atomic<int> interrupt_;
+
+  // where print writes to, stdout.
+  Output out_;
+
+  QuickenStats quickenStats_;
+  InferenceStats inferenceStats_;
+  CaptureStats captureStats_;
+  PropertyCacheStats propertyStats_;
+
+  // whether code is verified before it's run, see [setVerify].
+  bool verify_;
+
+  // the message of the native failing right now, see [nativeError].
+  std::string nativeError_;
+
+  // shared objects natives were loaded from, open as long as the VM.
+  std::vector<void*> libraries_;
+
+  // whether hot loops are compiled, see [setJit].
+  bool jitEnabled_;
+  JitStats jitStats_;
+
+  // objects marked but not traced yet during a collection, see [trace].
+  std::vector<Object*> gray_;
+
 public:
   VM();
   ~VM();
@@ -61,26 +271,260 @@ public:
   /// Interpret - interprets the [source] code, in the context of [module].
   InterpretResult interpret(const char *source, const char *module);
 
+  // compile - compiles [source] into a new module named [module], without
+  //  running it. returns nullptr on compile errors.
+  Module *compile(const char *source, const char *module);
+
+  // interpretNative - loads & runs a module translated to C by
+  //  [EmitC] & built into the shared object at [path].
+  InterpretResult interpretNative(const char *path);
+
+  // loadNatives - adds the native functions the shared object at [path]
+  //  exports, see LoxyNative in Runtime.h, as variables of [module].
+  //  returns false, reporting why to stderr, if it can't be loaded.
+  bool loadNatives(Module *module, const char *path);
+
+  // saveImage - saves the modules run so far, their globals & all they
+  //  reach into an image at [path], see Image.h. Natives in globals are
+  //  left out, the host adds them again. returns false, reporting why to
+  //  stderr, if it can't: fibers & variables still on a stack aren't
+  //  saved.
+  bool saveImage(const char *path);
+
+  // loadImage - adds the modules saved in the image at [path], as they
+  //  were, & their globals to those of [module] unless it's nullptr.
+  //  Their code is verified again, like code compiled here. returns
+  //  false, reporting why to stderr & adding nothing, if the image can't
+  //  be loaded.
+  bool loadImage(const char *path, Module *module = nullptr);
+
+  // output - the buffered stdout of print. Line flushed on terminals &
+  //  size flushed otherwise, see [Output::setPolicy].
+  Output &output() { return out_; }
+
   // reallocate - garbage collected resources are alloacted from this
   //  method.
   void *reallocate(void *prev, size_t oldSize, size_t newSize);
 
   void collectGarbage();
 
+  // pushRoot - keeps [object] alive until the matching [popRoot].
+  void pushRoot(Object *object);
+  void popRoot();
+
+  // markObject/markValue - marks an object reachable during collection,
+  //  leaving what it references for [trace].
+  void markObject(Object *object);
+  void markValue(Value value);
+
+  // setJit - turns the baseline JIT on or off, on by default where it's
+  //  supported. See JIT_SUPPORTED.
+  void setJit(bool enabled);
+
+  // setVerify - turns verifying code before it's run on or off, on by
+  //  default. Verified code runs without per-instruction checks, see
+  //  [VerifyChunk].
+  void setVerify(bool enabled) { verify_ = enabled; }
+
+  // jitStats - what the JIT did for all code run so far.
+  const JitStats &jitStats() const { return jitStats_; }
+
+  // quickenStats - quickening of all code run so far.
+  const QuickenStats &quickenStats() const { return quickenStats_; }
+
+  // inferenceStats - numeric ops compiled unchecked, for all code compiled
+  //  so far.
+  const InferenceStats &inferenceStats() const { return inferenceStats_; }
+
+  // captureStats - captured locals kept unboxed, for all code compiled so
+  //  far.
+  const CaptureStats &captureStats() const { return captureStats_; }
+
+  // propertyCacheStats - inline cache hits of property accesses, for all
+  //  code run so far.
+  const PropertyCacheStats &propertyCacheStats() const { return propertyStats_; }
+
+  // stringPoolStats - occupancy of the string pool, for monitoring.
+  HashMapStats stringPoolStats() const;
+
   // run - runs [module].
   InterpretResult run(Module *module);
 
+  // spawn - a fiber of [module] calling [callee] on its first resume, &
+  //  scheduled to. [callee] is a function, closure or bound method taking
+  //  at most 1 argument, nil for the first resume. nullptr otherwise.
+  Fiber *spawn(Module *module, Value callee);
+
+  // schedule - queues [fiber] to be resumed with [value] by
+  //  [runScheduled]. The fiber must not be done, it's kept alive until it
+  //  runs.
+  void schedule(Fiber *fiber, Value value = Value::Nil);
+
+  // resume - runs [fiber] from where it left off, with [value] as the
+  //  result of its yield, or the argument of its function on the first
+  //  resume. [result] gets what it yields or returns, the fiber is done
+  //  once it returned or failed. Called by the host only, between runs.
+  //  A blocked fiber goes on with the native it blocked in, [value] is
+  //  ignored, & returns to the host once the fibers it was resumed by do.
+  InterpretResult resume(Fiber *fiber, Value value, Value *result);
+
+  // runScheduled - resumes the scheduled fibers in turn, scheduling those
+  //  that yield again, until none is left. Stops at the first error.
+  InterpretResult runScheduled();
+
+  // runLoop - runs the scheduled fibers, then waits for the blocked ones
+  //  to wake & runs them, until none is left. Stops at the first error.
+  //  See [EventLoop].
+  InterpretResult runLoop();
+
+  // addIo - adds the natives of fibers & I/O as variables of [module], see
+  //  Io.cc.
+  void addIo(Module *module);
+
+  // waitFor - blocks the fiber calling the running native until [fd] is
+  //  readable, or writable if [write]. The native returns true right
+  //  after, & is called again on the same arguments once it is, with
+  //  [progress] kept for it. returns false if [fd] can't be waited on.
+  bool waitFor(int fd, bool write, size_t progress = 0);
+
+  // ioProgress - the progress the running native blocked with last, see
+  //  [waitFor]. 0 unless it's called again.
+  size_t ioProgress() const { return fiber_->progress; }
+
+  // sleep - blocks the fiber calling the running native for [ms]
+  //  milliseconds. The native returns its result right after, the fiber
+  //  goes on with it once it wakes.
+  void sleep(double ms);
+
+  // handOff - runs [fiber] once the running native returns, resumed with
+  //  [value] like by [resume]. What it yields or returns next is the
+  //  native's result. The fiber must be new or suspended.
+  void handOff(Fiber *fiber, Value value);
+
+  // setFuel - lets the code run from now on charge [fuel] units, one a
+  //  loop iteration or call, before it fails with "Out of fuel". -1, the
+  //  default, for no limit.
+  void setFuel(int64_t fuel);
+
+  // fuel - the units left, -1 for no limit.
+  int64_t fuel() const;
+
+  // interrupt - asks the running fiber to yield or fail, see [Interrupt],
+  //  within FUEL_SLICE back-edges & calls. Safe to call from other
+  //  threads & signal handlers.
+  void interrupt(Interrupt how) { interrupt_.store((int)how, std::memory_order_relaxed); }
+
+  // heapSize - bytes allocated through [reallocate] & not freed yet.
+  size_t heapSize() const { return allocatedBytes; }
+
   // loadModule - loads a module of [name].
   Module *loadModule(const char *name);
 
+  // addModule - registers [module] with the VM, which owns it from now on.
+  //  registered modules & everything they reach are roots.
+  void addModule(Module *module);
+
   // findString - finds a String* from underlying string pool.
   String *findString(const char *chars, int length, uint32_t hash);
 
   // addString - adds the give string to string pool.
   void addString(String *string);
+
+  // intern - returns the interned string with the same chars as [string],
+  //  interning [string] itself if there's none yet. Called where strings are
+  //  needed by identity, e.g. as keys.
+  String *intern(String *string);
+
+  // error - reports a runtime error at [line], printf style.
+  void error(int line, const char *format, ...);
+
+  // nativeError - the message of the error a native returns false for,
+  //  printf style. Reported at the line of the call.
+  void nativeError(const char *format, ...);
+
 private:
 
-  void error(const char *msg, int line);
+  // arithmetic - runs the generic binary [op] or NEGATE on the operands
+  //  below [top], leaving the result in place of the first. returns false,
+  //  changing nothing, if they aren't numbers. EQUAL takes any values.
+  static bool arithmetic(OpCode op, Value *top);
+
+  // execute - the interpreter loop of [run]. [verified] code is read
+  //  without bounds checks & pushes onto the stack without overflow checks.
+  template <bool verified>
+  InterpretResult execute(Module *module);
+
+  // reserveStack - makes room for [size] values on the stack, keeping the
+  //  values on it. The stack may move, callers find their frames by
+  //  [CallFrame::base]. Open upvalues move along.
+  void reserveStack(int size);
+
+  // growFrames - makes room for twice as many frames, up to FRAMES_MAX.
+  //  The frames may move.
+  void growFrames();
+
+  // switchTo - saves the stack, frames & open upvalues of the running
+  //  fiber into it & runs on [fiber]'s instead, on none for nullptr. Only
+  //  pointers change hands.
+  void switchTo(Fiber *fiber);
+
+  // wake - schedules [fiber], blocked until now, to go on. See
+  //  [EventLoop].
+  void wake(Fiber *fiber);
+
+  // enterFiber - switches to [fiber] resumed with [value], pushed as the
+  //  result of its yield, or as the argument of its function if it takes
+  //  one on the first resume.
+  void enterFiber(Fiber *fiber, Value value);
+
+  // captureUpvalue - the open upvalue of [slot], created if there's none.
+  Upvalue *captureUpvalue(Value *slot);
+
+  // closeUpvalues - closes the open upvalues of [last] & the slots above.
+  void closeUpvalues(Value *last);
+
+  // lookupProperty - looks property [name] of instances of [shape] up on
+  //  a miss of [cache]: a field or, unless [set], a method. SET_PROPERTY
+  //  adds the fields it doesn't find. Fills [entry] & caches it unless the
+  //  site went megamorphic. Returns false if there's no such property.
+  bool lookupProperty(PropertyCache &cache, Shape *shape, String *name, bool set,
+                      PropertyCache::Entry *entry);
+
+  // invokeArray - runs the built in method [name] of the array below its
+  //  [argCount] arguments on the stack, leaving the result in its place.
+  //  Returns false after reporting an error at [line].
+  bool invokeArray(String *name, int argCount, int line);
+
+  // invokeFiber - runs the built in method [name] of the fiber below its
+  //  [argCount] arguments, like [invokeArray]. done() is its only one.
+  bool invokeFiber(String *name, int argCount, int line);
+
+  // callNative - runs [native] on the [argCount] arguments on top of the
+  //  stack, leaving its result in place of the callee. Returns false after
+  //  reporting an error at [line]. The arguments stay if it blocked to be
+  //  called again, see [waitFor].
+  bool callNative(NativeFunction *native, int argCount, int line);
+
+  // refuel - takes the next slice of fuel once [budget_] is spent, & the
+  //  interrupt asked for meanwhile. Reports running out or aborting at
+  //  [line].
+  Interrupt refuel(int line);
+
+  // runJit - runs [code] of [module] as baseline code from [ip] on the
+  //  frame at [base], compiling it first if needed. Returns where to
+  //  resume interpreting.
+  int runJit(Module *module, Chunk *code, Value *base, int ip);
+
+  // helpers for [collectGarbage].
+  void markRoots();
+
+  // trace - marks what the gray objects reference until there are none
+  //  left. Objects go gray instead of being traced as they're marked, so
+  //  long chains of them don't overflow the native stack.
+  void trace();
+  void blacken(Object *object);
+  void sweep();
+  void freeObject(Object *object);
 };
 
 } // namespace loxy
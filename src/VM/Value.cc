@@ -1,13 +1,15 @@
+#include <cstdio>
 #include <cstring>
-#include <sstream>
+#include "Data/HashMap.h"
+#include "Data/ValueMap.h"
+#include "Chunk.h"
+#include "Module.h"
+#include "Number.h"
 #include "Value.h"
 #include "VM.h"
 
 namespace loxy {
 
-Value::Value(double number) : type(ValueType::Number), as(number) {}
-Value::Value(Object* ref, ValueType type) : type(type), as(ref) {}
-
 const Value Value::Nil(ValueType::Nil, Variant((double)0));
 const Value Value::Undef(ValueType::Undef, Variant((double)0));
 const Value Value::True(ValueType::Bool, Variant(true));
@@ -18,13 +20,36 @@ Value::operator String* () const {
   return static_cast<String*>((Object*)(*this));
 }
 
+Hash Value::hash() const {
+  switch (type) {
+  case ValueType::Bool:   return as.boolean ? 3 : 5;
+  case ValueType::Nil:    return 7;
+  case ValueType::Undef:  return 11;
+  case ValueType::Number: return hashNumber(as.number);
+  // equal ints & doubles must hash the same.
+  case ValueType::Int:    return hashNumber((double)as.integer);
+  case ValueType::String: return static_cast<String*>(as.obj)->hash();
+  case ValueType::Obj: {
+    uintptr_t bits = reinterpret_cast<uintptr_t>(as.obj);
+    return (Hash)(bits >> 4) ^ (Hash)((uint64_t)bits >> 32);
+  }
+  }
+  return 0;
+}
+
 const char *Value::cString() const {
   switch (type) {
   case ValueType::Bool:   return bool(*this) ? "true" : "false";
   case ValueType::Number: {
-    std::stringstream ss;
-    ss << (double)(*this);
-    return ss.str().c_str();
+    // valid until the next call.
+    static char buffer[NUMBER_BUFFER_SIZE];
+    formatNumber((double)(*this), buffer);
+    return buffer;
+  }
+  case ValueType::Int: {
+    static char buffer[NUMBER_BUFFER_SIZE];
+    formatInteger(as.integer, buffer);
+    return buffer;
   }
   case ValueType::Nil:    return "nil";
   case ValueType::Undef:  return "undef";
@@ -36,6 +61,18 @@ const char *Value::cString() const {
 
 // class String
 //
+String *String::allocate(VM &vm, const char *chars, int length) {
+  char *rawStr = reinterpret_cast<char*>(vm.reallocate(nullptr, 0, length + 1));
+  if (chars != nullptr) memcpy(rawStr, chars, length);
+  rawStr[length] = '\0';
+
+  void *mem = vm.reallocate(nullptr, 0, sizeof(String));
+  String *string = ::new(mem) String(rawStr, length);
+  string->next = vm.first;
+  vm.first = string;
+  return string;
+}
+
 String *String::create(VM &vm, const char *chars, int length) {
   length = length == -1 ? strlen(chars) : length;
   Hash hash = hashString(chars, length);
@@ -46,19 +83,39 @@ String *String::create(VM &vm, const char *chars, int length) {
   }
 
   // create & intern this new string.
-  void *mem = vm.reallocate(nullptr, 0, sizeof(String));
-
-  std::unique_ptr<char> rawStr(reinterpret_cast<char*>(vm.reallocate(nullptr, 0, length + 1)));
-  memcpy(rawStr.get(), chars, length);
-  (rawStr.get())[length] = '\0';
+  interned = allocate(vm, chars, length);
+  interned->hash_ = hash;
+  interned->hashed_ = true;
+  interned->interned_ = true;
 
-  interned = ::new(mem) String(std::move(rawStr), length, hash);
+  // adding it to the pool might trigger a collection.
+  vm.pushRoot(interned);
   vm.addString(interned);
-  interned->next = vm.first;
-  vm.first = interned;
+  vm.popRoot();
   return interned;
 }
 
+String *String::createTransient(VM &vm, const char *chars, int length) {
+  length = length == -1 ? strlen(chars) : length;
+  return allocate(vm, chars, length);
+}
+
+String *String::concat(VM &vm, const String *a, const String *b) {
+  String *result = allocate(vm, nullptr, a->length_ + b->length_);
+  memcpy(result->chars, a->chars, a->length_);
+  memcpy(result->chars + a->length_, b->chars, b->length_);
+  return result;
+}
+
+void String::destroy(VM &vm, String **strPtr) {
+  String *string = *strPtr;
+  if (string == nullptr) return;
+
+  vm.reallocate(string->chars, string->length_ + 1, 0);
+  vm.reallocate(string, sizeof(String), 0);
+  *strPtr = nullptr;
+}
+
 // length is required in case [chars] does not terminate at proper place.
 Hash String::hashString(const char *chars, int length) {
   Hash hash = 2166136261u;
@@ -71,4 +128,395 @@ Hash String::hashString(const char *chars, int length) {
   return hash;
 }
 
-} // namespace loxy
\ No newline at end of file
+// class Map
+//
+Map *Map::create(VM &vm) {
+  ValueMap *entries = ValueMap::create(vm);
+
+  void *mem = vm.reallocate(nullptr, 0, sizeof(Map));
+  Map *map = ::new(mem) Map(entries);
+  map->next = vm.first;
+  vm.first = map;
+  return map;
+}
+
+void Map::destroy(VM &vm, Map **mapPtr) {
+  Map *map = *mapPtr;
+  if (map == nullptr) return;
+
+  ValueMap::destroy(vm, &map->entries);
+  vm.reallocate(map, sizeof(Map), 0);
+  *mapPtr = nullptr;
+}
+
+// class Array
+//
+Array *Array::create(VM &vm, int capacity) {
+  // the elements aren't an object, a collection allocating the array
+  // can't miss them.
+  double *numbers = capacity > 0 ? (double*)vm.reallocate(nullptr, 0, sizeof(double) * capacity)
+                                 : nullptr;
+
+  void *mem = vm.reallocate(nullptr, 0, sizeof(Array));
+  Array *array = ::new(mem) Array(capacity);
+  array->numbers = numbers;
+  array->next = vm.first;
+  vm.first = array;
+  return array;
+}
+
+void Array::destroy(VM &vm, Array **arrayPtr) {
+  Array *array = *arrayPtr;
+  if (array == nullptr) return;
+
+  size_t element = array->packed ? sizeof(double) : sizeof(Value);
+  vm.reallocate(array->numbers, element * array->capacity, 0);
+  vm.reallocate(array, sizeof(Array), 0);
+  *arrayPtr = nullptr;
+}
+
+void Array::grow(VM &vm) {
+  int grown = capacity < 8 ? 8 : capacity * 2;
+  size_t element = packed ? sizeof(double) : sizeof(Value);
+
+  // a collection meanwhile marks the elements where they were.
+  void *elements = vm.reallocate(nullptr, 0, element * grown);
+  if (count > 0) memcpy(elements, numbers, element * count);
+  vm.reallocate(numbers, element * capacity, 0);
+  numbers = (double*)elements;
+  capacity = grown;
+}
+
+void Array::append(VM &vm, Value value) {
+  // the first element decides the kind of the packed ones.
+  if (packed && count == 0) ints = value.isInt();
+  if (packed && !fits(value, ints)) unpack(vm);
+  if (count == capacity) grow(vm);
+
+  if (packed) {
+    numbers[count++] = (double)value;
+  } else {
+    values[count++] = value;
+  }
+}
+
+void Array::unpack(VM &vm) {
+  assert(packed && "Unpacking the elements twice");
+
+  Value *unpacked = capacity > 0 ? (Value*)vm.reallocate(nullptr, 0, sizeof(Value) * capacity)
+                                 : nullptr;
+  for (int i = 0; i < count; i++) unpacked[i] = get(i);
+  vm.reallocate(numbers, sizeof(double) * capacity, 0);
+  values = unpacked;
+  packed = false;
+}
+
+bool Array::repack(VM &vm) {
+  if (packed) return true;
+  bool allInts = count > 0 && values[0].isInt();
+  for (int i = 0; i < count; i++) {
+    if (!fits(values[i], allInts)) return false;
+  }
+
+  double *repacked = capacity > 0 ? (double*)vm.reallocate(nullptr, 0, sizeof(double) * capacity)
+                                  : nullptr;
+  for (int i = 0; i < count; i++) repacked[i] = (double)values[i];
+  vm.reallocate(values, sizeof(Value) * capacity, 0);
+  numbers = repacked;
+  packed = true;
+  ints = allInts;
+  return true;
+}
+
+// class Function
+//
+Function *Function::create(VM &vm, String *name) {
+  Chunk *chunk = Chunk::create(vm);
+
+  void *mem = vm.reallocate(nullptr, 0, sizeof(Function));
+  Function *function = ::new(mem) Function(chunk, name);
+  function->next = vm.first;
+  vm.first = function;
+  return function;
+}
+
+void Function::destroy(VM &vm, Function **functionPtr) {
+  Function *function = *functionPtr;
+  if (function == nullptr) return;
+
+  Chunk::destroy(vm, &function->chunk);
+  vm.reallocate(function->captures, sizeof(Capture) * function->captureCount, 0);
+  vm.reallocate(function, sizeof(Function), 0);
+  *functionPtr = nullptr;
+}
+
+void Function::setCaptures(VM &vm, const Capture *captures, int count) {
+  this->captures = (Capture*)vm.reallocate(this->captures,
+    sizeof(Capture) * captureCount, sizeof(Capture) * count);
+  memcpy(this->captures, captures, sizeof(Capture) * count);
+  captureCount = count;
+}
+
+const char *Function::cString() const {
+  static char buffer[128];
+  snprintf(buffer, sizeof(buffer), "<fn %s>", name->cString());
+  return buffer;
+}
+
+Upvalue *Upvalue::create(VM &vm, Value *location, Fiber *fiber) {
+  void *mem = vm.reallocate(nullptr, 0, sizeof(Upvalue));
+  Upvalue *upvalue = ::new(mem) Upvalue(location, fiber);
+  upvalue->next = vm.first;
+  vm.first = upvalue;
+  return upvalue;
+}
+
+void Upvalue::destroy(VM &vm, Upvalue **upvaluePtr) {
+  vm.reallocate(*upvaluePtr, sizeof(Upvalue), 0);
+  *upvaluePtr = nullptr;
+}
+
+Closure *Closure::create(VM &vm, Function *function) {
+  int count = function->captureCount;
+  void *mem = vm.reallocate(nullptr, 0, sizeof(Closure) + sizeof(Captured) * count);
+  Closure *closure = ::new(mem) Closure(function);
+
+  // nothing captured yet, for the collector.
+  for (int i = 0; i < count; i++) closure->captured[i] = { nullptr, 0 };
+  closure->next = vm.first;
+  vm.first = closure;
+  return closure;
+}
+
+void Closure::destroy(VM &vm, Closure **closurePtr) {
+  Closure *closure = *closurePtr;
+  vm.reallocate(closure, sizeof(Closure) + sizeof(Captured) * closure->count, 0);
+  *closurePtr = nullptr;
+}
+
+Shape *Shape::create(VM &vm, Class *klass, Shape *parent, String *name) {
+  void *mem = vm.reallocate(nullptr, 0, sizeof(Shape));
+  Shape *shape = ::new(mem) Shape(klass, parent, name);
+  shape->next = vm.first;
+  vm.first = shape;
+
+  // reachable from its parent from now on.
+  if (parent != nullptr) {
+    shape->sibling = parent->transitions;
+    parent->transitions = shape;
+  }
+  return shape;
+}
+
+void Shape::destroy(VM &vm, Shape **shapePtr) {
+  vm.reallocate(*shapePtr, sizeof(Shape), 0);
+  *shapePtr = nullptr;
+}
+
+int Shape::find(const String *name) const {
+  for (const Shape *shape = this; shape->parent != nullptr; shape = shape->parent) {
+    if (shape->name == name) return shape->count - 1;
+  }
+  return -1;
+}
+
+Shape *Shape::transition(VM &vm, String *name) {
+  for (Shape *shape = transitions; shape != nullptr; shape = shape->sibling) {
+    if (shape->name == name) return shape;
+  }
+  return create(vm, klass, this, name);
+}
+
+Class *Class::create(VM &vm, String *name) {
+  HashMap *methods = HashMap::create(vm);
+
+  void *mem = vm.reallocate(nullptr, 0, sizeof(Class));
+  Class *klass = ::new(mem) Class(name, methods);
+  klass->next = vm.first;
+  vm.first = klass;
+
+  vm.pushRoot(klass);
+  klass->shape = Shape::create(vm, klass, nullptr, nullptr);
+  vm.popRoot();
+  return klass;
+}
+
+void Class::destroy(VM &vm, Class **classPtr) {
+  Class *klass = *classPtr;
+  HashMap::destroy(vm, &klass->methods);
+  vm.reallocate(klass, sizeof(Class), 0);
+  *classPtr = nullptr;
+}
+
+const char *Class::cString() const {
+  static char buffer[128];
+  snprintf(buffer, sizeof(buffer), "<class %s>", name->cString());
+  return buffer;
+}
+
+Instance *Instance::create(VM &vm, Class *klass) {
+  int capacity = klass->fieldHint;
+  void *mem = vm.reallocate(nullptr, 0, sizeof(Instance) + sizeof(Value) * capacity);
+  Instance *instance = ::new(mem) Instance(klass->shape, capacity);
+  instance->next = vm.first;
+  vm.first = instance;
+  return instance;
+}
+
+void Instance::destroy(VM &vm, Instance **instancePtr) {
+  Instance *instance = *instancePtr;
+  if (instance->fields != reinterpret_cast<Value*>(instance + 1)) {
+    vm.reallocate(instance->fields, sizeof(Value) * instance->capacity, 0);
+  }
+  vm.reallocate(instance, sizeof(Instance) + sizeof(Value) * instance->inlineCapacity, 0);
+  *instancePtr = nullptr;
+}
+
+void Instance::addField(VM &vm, Shape *next, Value value) {
+  assert(next->parent == shape && "Not a transition of the instance's shape");
+
+  if (next->count > capacity) {
+    int grown = capacity * 2;
+    Value *fields = (Value*)vm.reallocate(nullptr, 0, sizeof(Value) * grown);
+    memcpy(fields, this->fields, sizeof(Value) * shape->count);
+    if (this->fields != reinterpret_cast<Value*>(this + 1)) {
+      vm.reallocate(this->fields, sizeof(Value) * capacity, 0);
+    }
+    this->fields = fields;
+    capacity = grown;
+
+    // later instances of the class start out with room for as many.
+    if (next->count > klass()->fieldHint) klass()->fieldHint = next->count;
+  }
+
+  fields[next->count - 1] = value;
+  shape = next;
+}
+
+const char *Instance::cString() const {
+  static char buffer[128];
+  snprintf(buffer, sizeof(buffer), "<%s instance>", klass()->name->cString());
+  return buffer;
+}
+
+BoundMethod *BoundMethod::create(VM &vm, Value receiver, Function *method) {
+  void *mem = vm.reallocate(nullptr, 0, sizeof(BoundMethod));
+  BoundMethod *bound = ::new(mem) BoundMethod(receiver, method);
+  bound->next = vm.first;
+  vm.first = bound;
+  return bound;
+}
+
+void BoundMethod::destroy(VM &vm, BoundMethod **boundPtr) {
+  vm.reallocate(*boundPtr, sizeof(BoundMethod), 0);
+  *boundPtr = nullptr;
+}
+
+// class NativeFunction
+//
+NativeFunction *NativeFunction::allocate(VM &vm, String *name, int arity,
+                                         NativeSignature signature) {
+  void *mem = vm.reallocate(nullptr, 0, sizeof(NativeFunction));
+  NativeFunction *native = ::new(mem) NativeFunction(name, arity, signature);
+  native->next = vm.first;
+  vm.first = native;
+  return native;
+}
+
+NativeFunction *NativeFunction::create(VM &vm, String *name, int arity, NativeFn function) {
+  NativeFunction *native = allocate(vm, name, arity, NativeSignature::Values);
+  native->function.values = function;
+  return native;
+}
+
+NativeFunction *NativeFunction::create(VM &vm, String *name, double (*function)()) {
+  NativeFunction *native = allocate(vm, name, 0, NativeSignature::Numbers);
+  native->function.numbers0 = function;
+  return native;
+}
+
+NativeFunction *NativeFunction::create(VM &vm, String *name, double (*function)(double)) {
+  NativeFunction *native = allocate(vm, name, 1, NativeSignature::Numbers);
+  native->function.numbers1 = function;
+  return native;
+}
+
+NativeFunction *NativeFunction::create(VM &vm, String *name, double (*function)(double, double)) {
+  NativeFunction *native = allocate(vm, name, 2, NativeSignature::Numbers);
+  native->function.numbers2 = function;
+  return native;
+}
+
+NativeFunction *NativeFunction::create(VM &vm, String *name,
+                                       double (*function)(double, double, double)) {
+  NativeFunction *native = allocate(vm, name, 3, NativeSignature::Numbers);
+  native->function.numbers3 = function;
+  return native;
+}
+
+void NativeFunction::destroy(VM &vm, NativeFunction **nativePtr) {
+  vm.reallocate(*nativePtr, sizeof(NativeFunction), 0);
+  *nativePtr = nullptr;
+}
+
+const char *NativeFunction::cString() const {
+  static char buffer[128];
+  snprintf(buffer, sizeof(buffer), "<native fn %s>", name->cString());
+  return buffer;
+}
+
+Function *Fiber::functionOf(Value callee) {
+  Function *function;
+  if (callee.isClosure()) {
+    function = static_cast<Closure*>((Object*)callee)->function;
+  } else if (callee.isFunction()) {
+    function = static_cast<Function*>((Object*)callee);
+  } else if (callee.isBoundMethod()) {
+    function = static_cast<BoundMethod*>((Object*)callee)->method;
+  } else {
+    return nullptr;
+  }
+  return function->arity <= 1 ? function : nullptr;
+}
+
+Fiber *Fiber::create(VM &vm, Module *module, Value callee) {
+  Function *function = callee.isNil() ? nullptr : functionOf(callee);
+  assert((callee.isNil() || function != nullptr) && "Fiber of a non function");
+  Chunk *code = function != nullptr ? function->chunk : module->getBody();
+
+  void *mem = vm.reallocate(nullptr, 0, sizeof(Fiber));
+  Fiber *fiber = ::new(mem) Fiber(module);
+  fiber->next = vm.first;
+  vm.first = fiber;
+
+  // verified code gets a stack of the size it needs, like a call does.
+  int size = code->maxStack_ >= 0 ? code->maxStack_ : STACK_MAX;
+  vm.pushRoot(fiber);
+  fiber->stack = (Value*)vm.reallocate(nullptr, 0, sizeof(Value) * size);
+  fiber->stackSize = size;
+  fiber->stackTop = fiber->stack;
+  CallFrame *frames = (CallFrame*)vm.reallocate(nullptr, 0, sizeof(CallFrame) * FIBER_FRAMES);
+  vm.popRoot();
+
+  // a function runs on its callee in the first slot, as if called. Bound
+  // methods on their receiver.
+  if (function != nullptr) {
+    *fiber->stackTop++ = callee.isBoundMethod()
+      ? static_cast<BoundMethod*>((Object*)callee)->receiver : callee;
+  }
+  frames[0] = { function, 0, 0 };
+  fiber->frames = frames;
+  fiber->frameCapacity = FIBER_FRAMES;
+  fiber->frameCount = 1;
+  return fiber;
+}
+
+void Fiber::destroy(VM &vm, Fiber **fiberPtr) {
+  Fiber *fiber = *fiberPtr;
+  vm.reallocate(fiber->stack, sizeof(Value) * fiber->stackSize, 0);
+  vm.reallocate(fiber->frames, sizeof(CallFrame) * fiber->frameCapacity, 0);
+  vm.reallocate(fiber, sizeof(Fiber), 0);
+  *fiberPtr = nullptr;
+}
+
+} // namespace loxy
@@ -14,8 +14,16 @@ namespace loxy {
 class Managed;
 class Object;
 class String;
+class Chunk;
 class Module;
 class VM;
+class ValueMap;
+class HashMap;
+class Class;
+class Fiber;
+struct CallFrame;
+
+typedef uint32_t Hash;
 
 // Value representation.
 
@@ -26,23 +34,35 @@ enum class ValueType {
 
   Bool,
   Nil,
+
+  // numbers are doubles or, while they fit, 64-bit integers. Scripts can't
+  // tell them apart, see [Value::isNumber].
   Number,
+  Int,
+
   Obj,
   String,
 };
 
 union Variant {
   Variant(double n) : number(n) {}
+  Variant(int64_t n) : integer(n) {}
   Variant(bool v) : boolean(v) {}
   Variant(Object *obj): obj(obj) {}
   Variant() : obj(nullptr) {}
 
   bool boolean;
   double number;
+  int64_t integer;
   Object* obj;
 };
 
 class Value {
+  // jitted & native code read & write values in place.
+  friend class JitCode;
+  friend class JitCompiler;
+  friend class NativeRuntime;
+
 private:
 
   ValueType type;
@@ -51,34 +71,101 @@ private:
 public:
   Value() {}
   Value(ValueType type, Variant as) : type(type), as(as) {}
-  Value(double number);
-  Value(Object *ref, ValueType type = ValueType::Obj);
+  Value(double number) : type(ValueType::Number), as(number) {}
+  Value(int64_t integer) : type(ValueType::Int), as(integer) {}
+  Value(Object *ref, ValueType type = ValueType::Obj) : type(type), as(ref) {}
 
   static const Value Nil;
   static const Value Undef;
   static const Value True;
   static const Value False;
 
+  // cString - the value as text. Numbers are formatted into a static
+  //  buffer, valid until the next call.
   const char *cString() const;
 
-  uint32_t hash();
+  // hash - numbers hash by their bits, with -0 folded into 0 & ints
+  //  hashing as the double they convert to, strings by
+  //  their chars & other objects by identity.
+  Hash hash() const;
+
+  // hashNumber - hash of a number key, see [hash].
+  static Hash hashNumber(double number) {
+    // -0 == 0, they must hash the same.
+    if (number == 0) number = 0;
+
+    uint64_t bits;
+    memcpy(&bits, &number, sizeof(bits));
+
+    // 64-bit finalizer of MurmurHash3.
+    bits ^= bits >> 33;
+    bits *= 0xff51afd7ed558ccdULL;
+    bits ^= bits >> 33;
+    bits *= 0xc4ceb9fe1a85ec53ULL;
+    bits ^= bits >> 33;
+    return (Hash)bits;
+  }
 
   // helpers for determining [value] type.
   bool isBool()   const { return type == ValueType::Bool; }
   bool isNil()    const { return type == ValueType::Nil; }
   bool isUndef()  const { return type == ValueType::Undef; }
-  bool isNumber() const { return type == ValueType::Number; }
+  bool isNumber() const { return type == ValueType::Number || type == ValueType::Int; }
+  bool isDouble() const { return type == ValueType::Number; }
+  bool isInt()    const { return type == ValueType::Int; }
   bool isObj()    const { return type == ValueType::Obj; }
   bool isString() const { return type == ValueType::String; }
+  inline bool isMap() const;
+  inline bool isArray() const;
+  inline bool isFunction() const;
+  inline bool isClosure() const;
+  inline bool isClass() const;
+  inline bool isInstance() const;
+  inline bool isBoundMethod() const;
+  inline bool isNative() const;
+  inline bool isFiber() const;
 
   inline operator bool () const {
     assert(type == ValueType::Bool);
     return as.boolean;
   }
 
+  // ints convert to the nearest double.
   inline operator double () const {
-    assert(type == ValueType::Number);
-    return as.number;
+    assert(isNumber());
+    return type == ValueType::Int ? (double)as.integer : as.number;
+  }
+
+  inline int64_t asInt() const {
+    assert(type == ValueType::Int);
+    return as.integer;
+  }
+
+  // isExactDouble - true if [integer] converts to a double & back unchanged.
+  static bool isExactDouble(int64_t integer) {
+    double d = (double)integer;
+    return d < 9223372036854775808.0 && (int64_t)d == integer;
+  }
+
+  // intGreater, intLess - [integer] > [number] & [integer] < [number],
+  //  exactly: the integer isn't rounded to a double, the double's integer
+  //  part is compared & its fraction breaks ties. False for NaNs.
+  static bool intGreater(int64_t integer, double number) {
+    if (number != number || number >= 9223372036854775808.0) return false;
+    if (number < -9223372036854775808.0) return true;
+
+    int64_t truncated = (int64_t)number;
+    if (integer != truncated) return integer > truncated;
+    return (double)truncated > number;
+  }
+
+  static bool intLess(int64_t integer, double number) {
+    if (number != number || number < -9223372036854775808.0) return false;
+    if (number >= 9223372036854775808.0) return true;
+
+    int64_t truncated = (int64_t)number;
+    if (integer != truncated) return integer < truncated;
+    return (double)truncated < number;
   }
 
   inline operator Object* () const {
@@ -88,23 +175,15 @@ public:
 
   operator String* () const;
 
-  bool operator == (const Value &other) const {
-    if (type != other.type) return false;
-
-    switch (type) {
-    case ValueType::Bool:   return (bool)other == (bool)(*this);
-    case ValueType::Nil:    return true;
-    case ValueType::Undef:  return true;
-    case ValueType::Number: return (double)other == (double)(*this);
-
-    case ValueType::String:
-    case ValueType::Obj:    return (Object*)other == (Object*)(*this);
-    }
-  }
+  // strings compare by content, see [String::equals].
+  inline bool operator == (const Value &other) const;
 
   bool operator > (const Value &other) const {
-    assert(type == ValueType::Number && other.type == ValueType::Number && "Ordering on non number values");
-    return (double)(*this) > (double)other;
+    assert(isNumber() && other.isNumber() && "Ordering on non number values");
+    if (isInt() && other.isInt()) return as.integer > other.as.integer;
+    if (isInt()) return intGreater(as.integer, other.as.number);
+    if (other.isInt()) return intLess(other.as.integer, as.number);
+    return as.number > other.as.number;
   }
 
   bool operator != (const Value &other) const {
@@ -114,24 +193,59 @@ public:
 
 // Object representations.
 //
+
+// ObjectType - type tag for each Object, used by the collector to
+//  free & trace objects.
+enum class ObjectType {
+  String,
+  Map,
+  Array,
+  Function,
+  Closure,
+  Upvalue,
+  Class,
+  Instance,
+  Shape,
+  BoundMethod,
+  NativeFunction,
+  Fiber,
+};
+
 class Object : public Managed {
 public:
+  const ObjectType type;
+
+  explicit Object(ObjectType type) : type(type) {}
+
   virtual const char *cString() const { return "[Loxy Object]"; };
 };
 
-typedef uint32_t Hash;
-
 /// String - string class.
+///   A string is either interned - the only String with its chars in the
+///   string pool, comparable by identity - or transient. Transient strings
+///   skip hashing & the pool lookup until they are interned by [VM::intern].
 class String : public Object {
+  friend class VM;
+
 private:
 
-  // TODO: change this for consistency.
-  std::unique_ptr<char> chars;
+  // allocated through VM::reallocate, [length_] + 1 bytes.
+  char *chars;
   int length_;
-  Hash hash_;
 
-  String(std::unique_ptr<char> chars, int length, Hash hash) :
-    chars(std::move(chars)), length_(length), hash_(hash) {}
+  // computed on first use for transient strings.
+  mutable Hash hash_;
+  mutable bool hashed_;
+
+  bool interned_;
+
+  String(char *chars, int length) :
+    Object(ObjectType::String), chars(chars), length_(length),
+    hash_(0), hashed_(false), interned_(false) {}
+
+  // allocate - creates a transient string of [length] chars, copied from
+  //  [chars] unless it's nullptr.
+  static String *allocate(VM &vm, const char *chars, int length);
 
 public:
 
@@ -139,15 +253,552 @@ public:
   //  note that this function takes care of interning strings.
   static String* create(VM &vm, const char *chars, int length = -1);
 
-  Hash hash() const { return hash_; }
+  // createTransient - creates a string without interning it, for runtime
+  //  values that are unlikely to be looked up by name.
+  static String *createTransient(VM &vm, const char *chars, int length = -1);
+
+  // concat - creates the transient string [a] + [b].
+  static String *concat(VM &vm, const String *a, const String *b);
+
+  // destroy - frees [*strPtr] & its chars. Called by the collector only,
+  //  the string must have been removed from the string pool.
+  static void destroy(VM &vm, String **strPtr);
+
+  Hash hash() const {
+    if (!hashed_) {
+      hash_ = hashString(chars, length_);
+      hashed_ = true;
+    }
+    return hash_;
+  }
+
   int length() const { return length_; }
+  bool isInterned() const { return interned_; }
 
-  const char *cString() const { return chars.get(); }
+  const char *cString() const { return chars; }
+
+  // equals - compares by identity when both strings are interned, by
+  //  length, hash & chars otherwise.
+  bool equals(const String *other) const {
+    if (this == other) return true;
+    if (interned_ && other->interned_) return false;
+
+    return length_ == other->length_ &&
+           hash() == other->hash() &&
+           memcmp(chars, other->chars, length_) == 0;
+  }
   
   // called by [create] to figure out the hash value.
   static Hash hashString(const char *s, int length);
 };  // class tring.
 
+/// Map - a loxy map, keyed by any value but nil & NaN.
+class Map : public Object {
+private:
+  Map(ValueMap *entries) : Object(ObjectType::Map), entries(entries) {}
+
+public:
+  ValueMap *entries;
+
+  static Map *create(VM &vm);
+  static void destroy(VM &vm, Map **mapPtr);
+
+  const char *cString() const { return "[Loxy Map]"; }
+};
+
+/// Array - a loxy array. Its elements are packed doubles while they're all
+///   numbers, for indexing without checks & for the bulk operations of
+///   Kernels.h, & Values from the first time anything else is stored until
+///   a bulk operation finds them all numbers again, see [repack].
+class Array : public Object {
+private:
+  Array(int capacity)
+    : Object(ObjectType::Array), numbers(nullptr), count(0),
+      capacity(capacity), packed(true), ints(false) {}
+
+  // grow - makes room for one more element.
+  void grow(VM &vm);
+
+public:
+  // [capacity] elements, the first [count] in use. doubles in [numbers]
+  // while [packed], Values in [values] otherwise. Packed elements are all
+  // ints if [ints], read back as ints, all doubles otherwise.
+  union {
+    double *numbers;
+    Value *values;
+  };
+  int count;
+  int capacity;
+  bool packed;
+  bool ints;
+
+  // create - an empty, packed array with room for [capacity] elements.
+  static Array *create(VM &vm, int capacity = 0);
+  static void destroy(VM &vm, Array **arrayPtr);
+
+  // fits - true if [value] can be stored packed next to numbers that are
+  //  all ints if [ints], all doubles otherwise: numbers of the same kind,
+  //  but ints that don't convert to a double exactly.
+  static bool fits(Value value, bool ints) {
+    if (value.isDouble()) return !ints;
+    return ints && value.isInt() && Value::isExactDouble(value.asInt());
+  }
+
+  Value get(int index) const {
+    assert(index >= 0 && index < count && "Index out of bounds");
+    if (!packed) return values[index];
+    return ints ? Value((int64_t)numbers[index]) : Value(numbers[index]);
+  }
+
+  // set - stores [value] at [index]. The array & [value] must be
+  //  reachable, the elements may be unpacked.
+  void set(VM &vm, int index, Value value) {
+    assert(index >= 0 && index < count && "Index out of bounds");
+    if (packed && fits(value, ints)) {
+      numbers[index] = (double)value;
+      return;
+    }
+    if (packed) unpack(vm);
+    values[index] = value;
+  }
+
+  // append - adds [value] at the end, like [set].
+  void append(VM &vm, Value value);
+
+  // unpack - turns the packed doubles into Values.
+  void unpack(VM &vm);
+
+  // repack - turns the Values back into packed doubles if they all [fits]
+  //  as ints, or all as doubles.
+  //  returns whether the elements are packed. The array must be reachable.
+  bool repack(VM &vm);
+
+  const char *cString() const { return "[Loxy Array]"; }
+};
+
+// CaptureFlags - where a variable captured by a closure comes from.
+enum CaptureFlags : uint8_t {
+  // a local of the enclosing function, a capture of the enclosing
+  // closure otherwise.
+  CAPTURE_LOCAL = 1 << 0,
+  // the variable may outlive its frame, it's shared through an Upvalue.
+  // Read in place on the stack otherwise, see [Parser::settleLocal].
+  CAPTURE_BOXED = 1 << 1,
+};
+
+// Capture - a variable captured by a function, see OpCode::CLOSURE.
+struct Capture {
+  // the local slot or the index of the enclosing closure's capture.
+  uint8_t index;
+  uint8_t flags;
+};
+
+/// Function - a loxy function, compiled into its own chunk.
+class Function : public Object {
+private:
+  Function(Chunk *chunk, String *name)
+    : Object(ObjectType::Function), chunk(chunk), name(name), arity(0),
+      captures(nullptr), captureCount(0) {}
+
+public:
+  // owned by the function.
+  Chunk *chunk;
+  String *name;
+  int arity;
+
+  // the variables it captures, functions capturing any are instantiated
+  // as Closures.
+  Capture *captures;
+  int captureCount;
+
+  // create - creates a function of [name] with an empty chunk, for the
+  //  parser to compile its body into.
+  static Function *create(VM &vm, String *name);
+  static void destroy(VM &vm, Function **functionPtr);
+
+  // setCaptures - copies the [count] variables it captures.
+  void setCaptures(VM &vm, const Capture *captures, int count);
+
+  // formatted into a static buffer, valid until the next call.
+  const char *cString() const;
+};
+
+/// Upvalue - a boxed captured variable. Open while its local is live,
+///   pointing to its slot on the stack, closed over its last value once
+///   the local's scope or frame ends. See [VM::captureUpvalue].
+class Upvalue : public Object {
+private:
+  Upvalue(Value *location, Fiber *fiber)
+    : Object(ObjectType::Upvalue), location(location), closed(Value::Nil),
+      nextOpen(nullptr), fiber(fiber) {}
+
+public:
+  // the slot while open, [closed] after.
+  Value *location;
+  Value closed;
+
+  // open upvalues of the fiber, by slot from the top of the stack down.
+  Upvalue *nextOpen;
+
+  // the fiber whose stack the slot is on, kept alive while it's open.
+  Fiber *fiber;
+
+  bool isOpen() const { return location != &closed; }
+
+  static Upvalue *create(VM &vm, Value *location, Fiber *fiber);
+  static void destroy(VM &vm, Upvalue **upvaluePtr);
+};
+
+// Captured - a variable captured by a closure: its Upvalue if it's boxed,
+//  the index of its stack slot otherwise.
+struct Captured {
+  Upvalue *upvalue;
+  int slot;
+};
+
+/// Closure - a function & the variables it captured.
+class Closure : public Object {
+private:
+  Closure(Function *function)
+    : Object(ObjectType::Closure), function(function),
+      count(function->captureCount),
+      captured(reinterpret_cast<Captured*>(this + 1)) {}
+
+public:
+  Function *function;
+
+  // [count] entries allocated past the closure, one per capture of
+  // [function]. Kept here, the function may be freed first.
+  int count;
+  Captured *captured;
+
+  static Closure *create(VM &vm, Function *function);
+  static void destroy(VM &vm, Closure **closurePtr);
+
+  const char *cString() const { return function->cString(); }
+};
+
+/// Shape - the layout of instances, which field is in which slot. Shapes
+///   form a transition tree from the empty shape of each class: instances
+///   adding the same fields in the same order share their shapes, so
+///   property accesses can cache where a field is by shape. See
+///   [PropertyCache].
+class Shape : public Object {
+private:
+  Shape(Class *klass, Shape *parent, String *name)
+    : Object(ObjectType::Shape), klass(klass), parent(parent), name(name),
+      count(parent != nullptr ? parent->count + 1 : 0),
+      transitions(nullptr), sibling(nullptr) {}
+
+public:
+  // the class of instances of this shape.
+  Class *klass;
+
+  // the shape it transitions from by adding field [name], in slot
+  // [count] - 1. nullptr for the empty shape.
+  Shape *parent;
+  String *name;
+
+  // number of fields.
+  int count;
+
+  // the shapes it transitions to, linked by [sibling].
+  Shape *transitions;
+  Shape *sibling;
+
+  static Shape *create(VM &vm, Class *klass, Shape *parent, String *name);
+  static void destroy(VM &vm, Shape **shapePtr);
+
+  // find - the slot of field [name], -1 if there's none. [name] must be
+  //  interned.
+  int find(const String *name) const;
+
+  // transition - the shape adding field [name], created on first use.
+  Shape *transition(VM &vm, String *name);
+};
+
+// PropertyCache - the inline cache of a GET_PROPERTY, SET_PROPERTY or
+//  INVOKE: where the property is on instances of the shapes it saw.
+//  Monomorphic with one entry, polymorphic with up to PROPERTY_CACHE_WAYS,
+//  & megamorphic once more shapes show up, looking properties up from then
+//  on. See [VM::lookupProperty].
+struct PropertyCache {
+  struct Entry {
+    Shape *shape;
+
+    // the slot of the field, -1 for a method.
+    int slot;
+
+    // the method, or the shape SET_PROPERTY transitions to adding the
+    // field. nullptr otherwise.
+    Object *target;
+  };
+
+  Entry entries[PROPERTY_CACHE_WAYS];
+  int count;
+  bool megamorphic;
+};
+
+/// Class - a loxy class: its methods & the empty shape of its instances.
+class Class : public Object {
+private:
+  Class(String *name, HashMap *methods)
+    : Object(ObjectType::Class), name(name), methods(methods),
+      initializer(nullptr), shape(nullptr), fieldHint(INSTANCE_MIN_FIELDS) {}
+
+public:
+  String *name;
+
+  // owned by the class, methods by name. See OpCode::METHOD.
+  HashMap *methods;
+
+  // the init method, run on new instances. nullptr if there's none.
+  Function *initializer;
+
+  // the shape of new instances.
+  Shape *shape;
+
+  // fields new instances have room for inline, the most an instance had
+  // so far.
+  int fieldHint;
+
+  static Class *create(VM &vm, String *name);
+  static void destroy(VM &vm, Class **classPtr);
+
+  // formatted into a static buffer, valid until the next call.
+  const char *cString() const;
+};
+
+/// Instance - an instance of a class. Its fields are in the slots of
+///   [fields], laid out by its shape.
+class Instance : public Object {
+private:
+  Instance(Shape *shape, int capacity)
+    : Object(ObjectType::Instance), shape(shape),
+      fields(reinterpret_cast<Value*>(this + 1)),
+      capacity(capacity), inlineCapacity(capacity) {}
+
+public:
+  Shape *shape;
+
+  // [capacity] slots, the first [shape->count] in use. Allocated past the
+  // instance, [inlineCapacity] of them, until they outgrow it.
+  Value *fields;
+  int capacity;
+  int inlineCapacity;
+
+  // create - an instance of [klass] without fields.
+  static Instance *create(VM &vm, Class *klass);
+  static void destroy(VM &vm, Instance **instancePtr);
+
+  Class *klass() const { return shape->klass; }
+
+  // addField - moves to [next], a transition of its shape, storing
+  //  [value] in the field it adds. The instance & [value] must be
+  //  reachable, the fields may grow.
+  void addField(VM &vm, Shape *next, Value value);
+
+  // formatted into a static buffer, valid until the next call.
+  const char *cString() const;
+};
+
+/// BoundMethod - a method read off an instance, to be called on it.
+class BoundMethod : public Object {
+private:
+  BoundMethod(Value receiver, Function *method)
+    : Object(ObjectType::BoundMethod), receiver(receiver), method(method) {}
+
+public:
+  Value receiver;
+  Function *method;
+
+  static BoundMethod *create(VM &vm, Value receiver, Function *method);
+  static void destroy(VM &vm, BoundMethod **boundPtr);
+
+  const char *cString() const { return method->cString(); }
+};
+
+// NativeFn - a host function called by scripts. [args] points at its
+//  [argCount] arguments on the operand stack, it stores its result in
+//  args[-1], the callee's slot. Returns false on errors, see
+//  [VM::nativeError].
+typedef bool (*NativeFn)(VM &vm, Value *args, int argCount);
+
+// NativeSignature - how a NativeFunction is called: with the values of its
+//  arguments, or with their numbers as doubles, returning a double.
+enum class NativeSignature : uint8_t {
+  Values,
+  Numbers,
+};
+
+/// NativeFunction - a host function. Calls run it in place, without a
+///   frame. Natives of numbers skip Values altogether, the interpreter
+///   checks the arguments are numbers & calls them with the doubles.
+class NativeFunction : public Object {
+private:
+  NativeFunction(String *name, int arity, NativeSignature signature)
+    : Object(ObjectType::NativeFunction), name(name), arity(arity),
+      signature(signature) {}
+
+  // allocate - a native of [signature], its function left to set.
+  static NativeFunction *allocate(VM &vm, String *name, int arity, NativeSignature signature);
+
+public:
+  String *name;
+
+  // arguments it takes, -1 for any number of Values.
+  int arity;
+  NativeSignature signature;
+
+  // by [signature], & [arity] for numbers.
+  union {
+    NativeFn values;
+    double (*numbers0)();
+    double (*numbers1)(double);
+    double (*numbers2)(double, double);
+    double (*numbers3)(double, double, double);
+  } function;
+
+  static NativeFunction *create(VM &vm, String *name, int arity, NativeFn function);
+  static NativeFunction *create(VM &vm, String *name, double (*function)());
+  static NativeFunction *create(VM &vm, String *name, double (*function)(double));
+  static NativeFunction *create(VM &vm, String *name, double (*function)(double, double));
+  static NativeFunction *create(VM &vm, String *name, double (*function)(double, double, double));
+  static void destroy(VM &vm, NativeFunction **nativePtr);
+
+  // formatted into a static buffer, valid until the next call.
+  const char *cString() const;
+};
+
+// FiberState - how far a fiber got, see [Fiber].
+enum class FiberState : uint8_t {
+  // its function isn't called yet.
+  New,
+  // yielded, it resumes where it left off.
+  Suspended,
+  // running, or waiting on a fiber it resumed.
+  Running,
+  // waiting on I/O or a timer in a native, resumed by the event loop. The
+  // fibers it was resumed by stay waiting on it. See [VM::waitFor].
+  Blocked,
+  // woke from blocking, scheduled to go on.
+  Woken,
+  // its function returned, or failed.
+  Done,
+};
+
+/// Fiber - a coroutine: a function running on an operand stack & frames
+///   of its own, suspended by yield & resumed where it left off. The VM
+///   runs on the stack & frames of one fiber at a time, switching fibers
+///   swaps them, see [VM::switchTo].
+class Fiber : public Object {
+private:
+  Fiber(Module *module)
+    : Object(ObjectType::Fiber), module(module), stack(nullptr), stackSize(0),
+      stackTop(nullptr), frames(nullptr), frameCapacity(0), frameCount(0),
+      openUpvalues(nullptr), resumer(nullptr), state(FiberState::New),
+      retryArgs(-1), retryLine(0), progress(0) {}
+
+public:
+  // where its globals are.
+  Module *module;
+
+  // the operand stack, [stackSize] values up to [stackTop] in use, & the
+  // calls in progress. Saved here while it isn't running, the VM's own
+  // while it is.
+  Value *stack;
+  int stackSize;
+  Value *stackTop;
+  CallFrame *frames;
+  int frameCapacity;
+  int frameCount;
+  Upvalue *openUpvalues;
+
+  // the fiber that resumed it while it runs, nullptr if the host did.
+  Fiber *resumer;
+  FiberState state;
+
+  // the arguments of the native it blocked in, called again on them at
+  // [retryLine] once it wakes, -1 if there's none. [progress] is what the
+  // native got done before, see [VM::ioProgress].
+  int retryArgs;
+  int retryLine;
+  size_t progress;
+
+  // create - a fiber of [module] calling [callee] on its first resume, or
+  //  running the module body for nil. [callee] must be one [functionOf]
+  //  accepts, & reachable.
+  static Fiber *create(VM &vm, Module *module, Value callee);
+  static void destroy(VM &vm, Fiber **fiberPtr);
+
+  // functionOf - the function a fiber of [callee] runs: a function,
+  //  closure or bound method taking at most 1 argument. nullptr otherwise.
+  static Function *functionOf(Value callee);
+
+  const char *cString() const { return "[Loxy Fiber]"; }
+};
+
+bool Value::isMap() const {
+  return type == ValueType::Obj && as.obj->type == ObjectType::Map;
+}
+
+bool Value::isArray() const {
+  return type == ValueType::Obj && as.obj->type == ObjectType::Array;
+}
+
+bool Value::isFunction() const {
+  return type == ValueType::Obj && as.obj->type == ObjectType::Function;
+}
+
+bool Value::isClosure() const {
+  return type == ValueType::Obj && as.obj->type == ObjectType::Closure;
+}
+
+bool Value::isClass() const {
+  return type == ValueType::Obj && as.obj->type == ObjectType::Class;
+}
+
+bool Value::isInstance() const {
+  return type == ValueType::Obj && as.obj->type == ObjectType::Instance;
+}
+
+bool Value::isBoundMethod() const {
+  return type == ValueType::Obj && as.obj->type == ObjectType::BoundMethod;
+}
+
+bool Value::isNative() const {
+  return type == ValueType::Obj && as.obj->type == ObjectType::NativeFunction;
+}
+
+bool Value::isFiber() const {
+  return type == ValueType::Obj && as.obj->type == ObjectType::Fiber;
+}
+
+bool Value::operator == (const Value &other) const {
+  if (type != other.type) {
+    // an int equals a double of exactly the same value.
+    if (isInt() && other.isDouble()) return other == *this;
+    if (!isDouble() || !other.isInt()) return false;
+
+    double d = as.number;
+    return d >= -9223372036854775808.0 && d < 9223372036854775808.0 &&
+           (double)(int64_t)d == d && (int64_t)d == other.as.integer;
+  }
+
+  switch (type) {
+  case ValueType::Bool:   return (bool)other == (bool)(*this);
+  case ValueType::Nil:    return true;
+  case ValueType::Undef:  return true;
+  case ValueType::Number: return (double)other == (double)(*this);
+  case ValueType::Int:    return other.as.integer == as.integer;
+
+  case ValueType::String:
+    return static_cast<String*>(as.obj)->equals(static_cast<String*>(other.as.obj));
+  case ValueType::Obj:    return (Object*)other == (Object*)(*this);
+  }
+  return false;
+}
+
 } // namespace loxy
 
 #endif
\ No newline at end of file
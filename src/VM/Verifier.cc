@@ -0,0 +1,468 @@
+#include <map>
+#include <vector>
+#include "Data/SmallVector.h"
+#include "Chunk.h"
+#include "Value.h"
+#include "Verifier.h"
+
+namespace loxy {
+
+namespace {
+
+// what's known of a stack slot. MAP_INSERT takes its map on trust, so maps
+// built by MAP are told apart from any other value.
+enum class Kind : uint8_t {
+  Any,
+  Map,
+};
+
+// Frame - the stack before an instruction, as far as the verifier knows.
+struct Frame {
+  int depth;
+  Kind kinds[STACK_MAX];
+};
+
+// marks of each offset of the code.
+enum : uint8_t {
+  INSTRUCTION = 1 << 0,
+  TARGET      = 1 << 1,
+};
+
+// class Verifier - decodes a chunk once to find its instructions & jump
+//  targets, then walks every path from the start, merging the frames of
+//  paths that meet at a target until none of them changes.
+class Verifier {
+  Chunk *chunk_;
+  const uint8_t *code_;
+  int size_;
+
+  // the function of the chunk, nullptr for a module body.
+  const Function *function_;
+
+  // values on the stack on entry, a function & its arguments.
+  int entryDepth_;
+
+  std::vector<uint8_t> marks_;
+
+  // the frame at each target reached so far, & targets to walk from.
+  std::map<int, Frame> entries_;
+  std::vector<int> worklist_;
+
+  int maxStack_;
+  VerifyError error_;
+
+  // whether it failed only as the stack got deeper than STACK_MAX.
+  bool overflows_;
+
+public:
+  Verifier(Chunk *chunk, const Function *function, int entryDepth)
+    : chunk_(chunk), code_(chunk->code().data()), size_((int)chunk->size()),
+      function_(function), entryDepth_(entryDepth), marks_(chunk->size(), 0), maxStack_(entryDepth),
+      error_{chunk, 0, nullptr}, overflows_(false) {}
+
+  bool verify();
+  const VerifyError &error() const { return error_; }
+  int maxStack() const { return maxStack_; }
+  bool overflows() const { return overflows_; }
+
+private:
+  bool decode();
+  bool walk(int ip, Frame frame);
+
+  // merge - joins [frame] into the one at [target], reached from [from].
+  bool merge(int from, int target, const Frame &frame);
+
+  bool fail(int offset, const char *reason) {
+    error_ = { chunk_, offset, reason };
+    return false;
+  }
+
+  // helpers for [walk], checking the stack effects of the instruction at [ip].
+  bool pop(Frame &frame, int count, int ip) {
+    if (frame.depth < count) return fail(ip, "Stack underflow");
+    frame.depth -= count;
+    return true;
+  }
+
+  bool push(Frame &frame, Kind kind, int ip) {
+    if (frame.depth == STACK_MAX) {
+      overflows_ = true;
+      return fail(ip, "Stack deeper than STACK_MAX");
+    }
+    frame.kinds[frame.depth++] = kind;
+    if (frame.depth > maxStack_) maxStack_ = frame.depth;
+    return true;
+  }
+
+  bool local(const Frame &frame, uint8_t slot, int ip) {
+    return slot < frame.depth || fail(ip, "Local slot out of range");
+  }
+
+  bool constant(uint8_t index, int ip) {
+    return index < chunk_->constants().count() || fail(ip, "Constant out of range");
+  }
+
+  // [VM::run] reads names as strings unchecked.
+  bool name(uint8_t index, int ip) {
+    if (!constant(index, ip)) return false;
+    return chunk_->constants()[index].isString() || fail(ip, "Name isn't a string");
+  }
+
+  bool cache(uint8_t index, int ip) {
+    return index < chunk_->caches().count() || fail(ip, "Property cache out of range");
+  }
+
+  // checks the capture at [index] of the function is one of [flags].
+  bool capture(uint8_t index, uint8_t flags, int ip) {
+    if (function_ == nullptr || index >= function_->captureCount) {
+      return fail(ip, "Capture out of range");
+    }
+    return (function_->captures[index].flags & CAPTURE_BOXED) == flags ||
+           fail(ip, "Captured variable accessed as the wrong kind");
+  }
+
+  const Function *closureAt(int ip) const {
+    return static_cast<Function*>((Object*)chunk_->constants()[code_[ip + 1]]);
+  }
+
+  // the targets of the jumps at [ip].
+  int jumpTarget(int ip) const {
+    int offset = code_[ip + 1] << 8 | code_[ip + 2];
+    return (OpCode)code_[ip] == OpCode::LOOP ? ip + 3 - offset : ip + 3 + offset;
+  }
+  int forBody(int ip) const { return ip + 9 - (code_[ip + 5] << 8 | code_[ip + 6]); }
+  int forDone(int ip) const { return ip + 9 + (code_[ip + 7] << 8 | code_[ip + 8]); }
+};
+
+bool Verifier::verify() {
+  if (!decode()) return false;
+
+  Frame entry;
+  entry.depth = entryDepth_;
+  for (int i = 0; i < entryDepth_; i++) entry.kinds[i] = Kind::Any;
+  if (!merge(0, 0, entry)) return false;
+
+  while (!worklist_.empty()) {
+    int ip = worklist_.back();
+    worklist_.pop_back();
+    if (!walk(ip, entries_[ip])) return false;
+  }
+  return true;
+}
+
+bool Verifier::decode() {
+  if (size_ == 0) return fail(0, "Empty code");
+
+  int ip = 0;
+  while (ip < size_) {
+    if (code_[ip] > (uint8_t)OpCode::RETURN) return fail(ip, "Unknown opcode");
+
+    OpCode op = (OpCode)code_[ip];
+    int next = ip + instructionSize(op);
+    if (next > size_) return fail(ip, "Truncated instruction");
+    marks_[ip] |= INSTRUCTION;
+
+    switch (op) {
+    case OpCode::CONSTANT: {
+      if (!constant(code_[ip + 1], ip)) return false;
+
+      // captures are read through the closure in the callee's first slot.
+      Value value = chunk_->constants()[code_[ip + 1]];
+      if (value.isFunction() && static_cast<Function*>((Object*)value)->captureCount > 0) {
+        return fail(ip, "Function capturing variables pushed without a closure");
+      }
+      break;
+    }
+
+    case OpCode::GET_GLOBAL:
+    case OpCode::SET_GLOBAL:
+    case OpCode::DEFINE_GLOBAL:
+    case OpCode::CLASS:
+    case OpCode::METHOD:
+      if (!name(code_[ip + 1], ip)) return false;
+      break;
+
+    case OpCode::GET_PROPERTY:
+    case OpCode::SET_PROPERTY:
+      if (!name(code_[ip + 1], ip) || !cache(code_[ip + 2], ip)) return false;
+      break;
+
+    case OpCode::INVOKE:
+      if (!name(code_[ip + 1], ip) || !cache(code_[ip + 3], ip)) return false;
+      break;
+
+    case OpCode::CLOSURE: {
+      if (!constant(code_[ip + 1], ip)) return false;
+      if (!chunk_->constants()[code_[ip + 1]].isFunction()) {
+        return fail(ip, "Closure of a non function");
+      }
+
+      // captures of this function's captures, locals are checked by [walk].
+      const Function *closure = closureAt(ip);
+      for (int i = 0; i < closure->captureCount; i++) {
+        const Capture &captured = closure->captures[i];
+        if (captured.flags & CAPTURE_LOCAL) continue;
+        if (!capture(captured.index, captured.flags & CAPTURE_BOXED, ip)) return false;
+      }
+      break;
+    }
+
+    case OpCode::GET_UPVALUE:
+    case OpCode::SET_UPVALUE:
+      if (!capture(code_[ip + 1], CAPTURE_BOXED, ip)) return false;
+      break;
+
+    case OpCode::GET_OUTER:
+    case OpCode::SET_OUTER:
+      if (!capture(code_[ip + 1], 0, ip)) return false;
+      break;
+
+    case OpCode::JUMP:
+    case OpCode::JUMP_IF_FALSE:
+    case OpCode::LOOP: {
+      int target = jumpTarget(ip);
+      if (target < 0 || target >= size_) return fail(ip, "Jump out of the code");
+      marks_[target] |= TARGET;
+      break;
+    }
+
+    case OpCode::FOR_LOOP: {
+      uint8_t flags = code_[ip + 2];
+      if (!(flags & FOR_LIMIT_LOCAL) && !constant(code_[ip + 3], ip)) return false;
+      if (!(flags & FOR_STEP_LOCAL) && !constant(code_[ip + 4], ip)) return false;
+
+      int body = forBody(ip), done = forDone(ip);
+      if (body < 0 || done >= size_) return fail(ip, "Jump out of the code");
+      marks_[body] |= TARGET;
+      marks_[done] |= TARGET;
+      break;
+    }
+
+    default:
+      break;
+    }
+    ip = next;
+  }
+  return true;
+}
+
+bool Verifier::merge(int from, int target, const Frame &frame) {
+  if (!(marks_[target] & INSTRUCTION)) return fail(from, "Jump into an instruction");
+
+  auto found = entries_.find(target);
+  if (found == entries_.end()) {
+    entries_[target] = frame;
+    worklist_.push_back(target);
+    return true;
+  }
+
+  Frame &entry = found->second;
+  if (entry.depth != frame.depth) return fail(from, "Stack depths differ where paths meet");
+
+  // slots known on one path only are any values.
+  bool changed = false;
+  for (int i = 0; i < frame.depth; i++) {
+    if (entry.kinds[i] != frame.kinds[i] && entry.kinds[i] != Kind::Any) {
+      entry.kinds[i] = Kind::Any;
+      changed = true;
+    }
+  }
+  if (changed) worklist_.push_back(target);
+  return true;
+}
+
+bool Verifier::walk(int ip, Frame frame) {
+  while (true) {
+    OpCode op = (OpCode)code_[ip];
+    int next = ip + instructionSize(op);
+
+    switch (op) {
+    case OpCode::CONSTANT:
+    case OpCode::NIL:
+    case OpCode::TRUE:
+    case OpCode::FALSE:
+    case OpCode::GET_GLOBAL:
+    case OpCode::GET_UPVALUE:
+    case OpCode::GET_OUTER:
+    case OpCode::CLASS:
+      if (!push(frame, Kind::Any, ip)) return false;
+      break;
+
+    // a local function captures itself, in the slot the closure lands in.
+    case OpCode::CLOSURE: {
+      if (!push(frame, Kind::Any, ip)) return false;
+
+      const Function *closure = closureAt(ip);
+      for (int i = 0; i < closure->captureCount; i++) {
+        const Capture &captured = closure->captures[i];
+        if ((captured.flags & CAPTURE_LOCAL) && !local(frame, captured.index, ip)) return false;
+      }
+      break;
+    }
+
+    case OpCode::MAP:
+      if (!push(frame, Kind::Map, ip)) return false;
+      break;
+
+    case OpCode::POP:
+    case OpCode::DEFINE_GLOBAL:
+    case OpCode::PRINT:
+    case OpCode::CLOSE_UPVALUE:
+      if (!pop(frame, 1, ip)) return false;
+      break;
+
+    case OpCode::SET_GLOBAL:
+    case OpCode::SET_UPVALUE:
+    case OpCode::SET_OUTER:
+      if (!pop(frame, 1, ip)) return false;
+      frame.depth++;
+      break;
+
+    case OpCode::GET_LOCAL: {
+      uint8_t slot = code_[ip + 1];
+      if (!local(frame, slot, ip) || !push(frame, frame.kinds[slot], ip)) return false;
+      break;
+    }
+
+    case OpCode::SET_LOCAL: {
+      uint8_t slot = code_[ip + 1];
+      if (!pop(frame, 1, ip) || !local(frame, slot, ip)) return false;
+      frame.kinds[slot] = frame.kinds[frame.depth++];
+      break;
+    }
+
+    // the class below the method is checked by [VM::run].
+    case OpCode::METHOD:
+      if (frame.depth < 2) return fail(ip, "Stack underflow");
+      frame.depth--;
+      break;
+
+    case OpCode::NOT:
+    case OpCode::NEGATE:
+    case OpCode::NEGATE_NUM:
+    case OpCode::GET_PROPERTY:
+    case OpCode::YIELD:
+      if (!pop(frame, 1, ip) || !push(frame, Kind::Any, ip)) return false;
+      break;
+
+    case OpCode::EQUAL:
+    case OpCode::GREATER:
+    case OpCode::LESS:
+    case OpCode::ADD:
+    case OpCode::SUBTRACT:
+    case OpCode::MULTIPLY:
+    case OpCode::DIVIDE:
+    case OpCode::EQUAL_INT:
+    case OpCode::EQUAL_NUMBER:
+    case OpCode::GREATER_INT:
+    case OpCode::GREATER_NUMBER:
+    case OpCode::LESS_INT:
+    case OpCode::LESS_NUMBER:
+    case OpCode::ADD_INT:
+    case OpCode::ADD_NUMBER:
+    case OpCode::SUBTRACT_INT:
+    case OpCode::SUBTRACT_NUMBER:
+    case OpCode::MULTIPLY_INT:
+    case OpCode::MULTIPLY_NUMBER:
+    case OpCode::GREATER_NUM:
+    case OpCode::LESS_NUM:
+    case OpCode::ADD_NUM:
+    case OpCode::SUBTRACT_NUM:
+    case OpCode::MULTIPLY_NUM:
+    case OpCode::DIVIDE_NUM:
+    case OpCode::GET_INDEX:
+    case OpCode::SET_PROPERTY:
+      if (!pop(frame, 2, ip) || !push(frame, Kind::Any, ip)) return false;
+      break;
+
+    case OpCode::ARRAY:
+      if (!pop(frame, code_[ip + 1], ip) || !push(frame, Kind::Any, ip)) return false;
+      break;
+
+    case OpCode::MAP_INSERT:
+      if (frame.depth < 3) return fail(ip, "Stack underflow");
+      if (frame.kinds[frame.depth - 3] != Kind::Map) return fail(ip, "Inserting into a non map");
+      frame.depth -= 2;
+      break;
+
+    case OpCode::SET_INDEX:
+      if (!pop(frame, 3, ip) || !push(frame, Kind::Any, ip)) return false;
+      break;
+
+    // the callee & its arguments, checked when it's called.
+    // a TAIL_CALL of a class without init falls through to its RETURN.
+    case OpCode::CALL:
+    case OpCode::TAIL_CALL:
+      if (!pop(frame, code_[ip + 1] + 1, ip) || !push(frame, Kind::Any, ip)) return false;
+      break;
+
+    case OpCode::INVOKE:
+      if (!pop(frame, code_[ip + 2] + 1, ip) || !push(frame, Kind::Any, ip)) return false;
+      break;
+
+    case OpCode::JUMP:
+    case OpCode::LOOP:
+      return merge(ip, jumpTarget(ip), frame);
+
+    case OpCode::JUMP_IF_FALSE:
+      if (frame.depth < 1) return fail(ip, "Stack underflow");
+      if (!merge(ip, jumpTarget(ip), frame)) return false;
+      break;
+
+    case OpCode::FOR_LOOP: {
+      uint8_t slot = code_[ip + 1], flags = code_[ip + 2];
+      if (!local(frame, slot, ip)) return false;
+      if ((flags & FOR_LIMIT_LOCAL) && !local(frame, code_[ip + 3], ip)) return false;
+      if ((flags & FOR_STEP_LOCAL) && !local(frame, code_[ip + 4], ip)) return false;
+
+      frame.kinds[slot] = Kind::Any;
+      if (!merge(ip, forBody(ip), frame) || !merge(ip, forDone(ip), frame)) return false;
+      break;
+    }
+
+    case OpCode::RETURN:
+      return pop(frame, 1, ip);
+    }
+
+    if (next == size_) return fail(ip, "Code runs past its end");
+    ip = next;
+
+    // paths meeting here go on from the merged frame.
+    if (marks_[ip] & TARGET) return merge(ip, ip, frame);
+  }
+}
+
+} // namespace
+
+// verify - verifies [chunk] of [function], entered with [depth] values on
+//  the stack, & the functions declared in it. Chunks are only marked
+//  verified once all of those are. A stack deeper than STACK_MAX isn't
+//  malformed code, the compiler emits it for deep expressions: the chunk
+//  is left to run checked, overflowing like unverified code.
+static bool verify(Chunk *chunk, const Function *function, int depth, VerifyError *error) {
+  if (chunk->maxStack_ != -1) return true;
+
+  Verifier verifier(chunk, function, depth);
+  bool verified = verifier.verify();
+  if (!verified && !verifier.overflows()) {
+    *error = verifier.error();
+    return false;
+  }
+
+  for (int i = 0; i < chunk->constants().count(); i++) {
+    Value constant = chunk->constants()[i];
+    if (!constant.isFunction()) continue;
+
+    Function *declared = static_cast<Function*>((Object*)constant);
+    if (!verify(declared->chunk, declared, declared->arity + 1, error)) return false;
+  }
+
+  chunk->maxStack_ = verified ? verifier.maxStack() : -2;
+  return true;
+}
+
+bool VerifyChunk(Chunk *chunk, VerifyError *error) {
+  return verify(chunk, nullptr, 0, error);
+}
+
+} // namespace loxy
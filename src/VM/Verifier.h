@@ -0,0 +1,33 @@
+#ifndef loxy_verifier_h
+#define loxy_verifier_h
+
+#include "Common.h"
+
+namespace loxy {
+
+class Chunk;
+
+// VerifyError - where & why a chunk failed verification.
+struct VerifyError {
+  // the chunk, the verified one or a function's, & the offset of the
+  // offending instruction in its code.
+  const Chunk *chunk;
+  int offset;
+  const char *reason;
+};
+
+// VerifyChunk - checks [chunk] before it's run: known opcodes with all of
+//  their operands, constants, local slots & captures in range, jumps
+//  landing on instructions, the same stack depth wherever paths meet, no
+//  underflow & no path running past the end. Functions declared in
+//  [chunk] are verified along with it, though whether a capture read in
+//  place by GET_OUTER outlives its variable is left to the compiler.
+//  Records the deepest the stack gets in each [Chunk::maxStack_] & returns
+//  true if they're all well formed, fills [error] otherwise. Chunks whose
+//  stack gets deeper than STACK_MAX are well formed but left unverified,
+//  to run checked. See [VM::run].
+bool VerifyChunk(Chunk *chunk, VerifyError *error);
+
+} // namespace loxy
+
+#endif
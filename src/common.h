@@ -7,16 +7,74 @@
 
 #define UINT8_COUNT         (UINT8_MAX + 1)
 #define HEAP_GROW_PERCENT   0.5
-#define INITIAL_HEAP_SIZE   1024
+#define INITIAL_HEAP_SIZE   (1024 * 1024)
 #define MAX_TEMP_ROOTS      5
+#define TABLE_MAX_LOAD      0.75
+
+// tables with at least this many slots grow incrementally, migrating
+// TABLE_MIGRATE_GROUPS groups of slots per insertion/deletion.
+#define TABLE_INCREMENTAL_MIN 4096
+#define TABLE_MIGRATE_GROUPS  1
 
 #define STACK_MAX           256
 
+// calls nested deeper than this overflow the stack.
+#define FRAMES_MAX          256
+
+// fibers start with room for FIBER_FRAMES calls, growing twice as large
+// up to FRAMES_MAX. See [Fiber].
+#define FIBER_FRAMES        4
+
+// code is charged a unit of fuel at every loop back-edge & call, taken in
+// slices of FUEL_SLICE units. Interrupts are seen between slices. See
+// [VM::setFuel] & [VM::interrupt].
+#define FUEL_SLICE          1024
+
+// read() returns at most IO_READ_SIZE bytes at a time, & the event loop
+// takes up to IO_EVENTS ready fds a wait. See [EventLoop].
+#define IO_READ_SIZE        4096
+#define IO_EVENTS           64
+
+// a generic binary op is rewritten into a type specialized one after
+// QUICKEN_WARMUP runs with fitting operands, & stays generic once its
+// guard failed QUICKEN_MAX_DEOPTS times. See [VM::run].
+#define QUICKEN_WARMUP      8
+#define QUICKEN_MAX_DEOPTS  4
+
+// property accesses cache where a property is for up to
+// PROPERTY_CACHE_WAYS shapes each, & look it up every time once they saw
+// more. See [PropertyCache].
+#define PROPERTY_CACHE_WAYS 4
+
+// instances get room for as many fields inline as the largest instance of
+// their class had so far, & at least INSTANCE_MIN_FIELDS.
+#define INSTANCE_MIN_FIELDS 4
+
+// the baseline JIT, see [JitCode]. Built with LOXY_JIT on x86-64 Linux.
+#if defined(LOXY_JIT) && defined(__x86_64__) && defined(__linux__)
+  #define JIT_SUPPORTED
+#endif
+
+// a chunk is compiled after JIT_THRESHOLD loop back-edges in the
+// interpreter, & dropped once its guards failed JIT_MAX_GUARD_EXITS times,
+// to be compiled again up to JIT_MAX_COMPILATIONS times in all.
+#define JIT_THRESHOLD         1000
+#define JIT_MAX_GUARD_EXITS   100
+#define JIT_MAX_COMPILATIONS  3
+
+// see [formatNumber].
+#define NUMBER_BUFFER_SIZE  32
+
+// initial size of the buffered output of print.
+#define OUTPUT_BUFFER_SIZE  8192
+
 #define DEBUG
 #ifdef DEBUG
   #define DEBUG_PRINT_CODE
   #define DEBUG_TRACE_EXECUTION
-  #define DEBUG_TRACE_GC
+
+  // build with -DDEBUG_TRACE_GC to log each collection & the string pool
+  // after it to stderr.
 
   #include <stdio.h>
 
@@ -1,5 +1,12 @@
+#include <signal.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <vector>
 #include "Common.h"
+#include "Compiler/CEmitter.h"
+#include "VM/Module.h"
 #include "VM/VM.h"
 
 using namespace loxy;
@@ -34,17 +41,161 @@ static char *readFile(const char *f) {
   return buffer;
 }
 
-static void runFile(VM &vm, const char *source) {
+static void printStats(const VM &vm);
+
+// the VM --timeout aborts, from the SIGALRM handler.
+static VM *timed = nullptr;
+
+static void timeout(int) {
+  timed->interrupt(Interrupt::Abort);
+}
+
+// abortAfter - aborts the script running on [vm] after [ms] milliseconds.
+static void abortAfter(VM &vm, long ms) {
+  timed = &vm;
+  signal(SIGALRM, timeout);
+
+  struct itimerval timer;
+  memset(&timer, 0, sizeof(timer));
+  timer.it_value.tv_sec = ms / 1000;
+  timer.it_value.tv_usec = (ms % 1000) * 1000;
+  setitimer(ITIMER_REAL, &timer, nullptr);
+}
+
+// emitC - writes the module at [path] as C to stdout, see [EmitC].
+static void emitC(VM &vm, const char *path) {
+  char *source = readFile(path);
+  Module *module = vm.compile(source, path);
+  free(source);
+
+  if (module == nullptr || !EmitC(module->getBody(), path, stdout)) exit(65);
+}
+
+static void runNative(VM &vm, const char *path, bool stats) {
+  InterpretResult result = vm.interpretNative(path);
+  vm.output().flush();
+  if (stats) printStats(vm);
+
+  if (result == InterpretResult::Compile_Error) exit(65);
+  if (result == InterpretResult::Runtime_Error) exit(70);
+}
+
+static void runFile(VM &vm, const char *path, const std::vector<const char*> &libraries,
+                    const char *image, const char *saveImage, bool stats) {
+  char *source = readFile(path);
+  Module *module = vm.compile(source, path);
+  free(source);
+  if (module == nullptr) exit(65);
+
+  // natives are globals of the script, defined before it runs. The I/O
+  // ones first, loaded libraries may replace them.
+  vm.addIo(module);
+  for (const char *library : libraries) {
+    if (!vm.loadNatives(module, library)) exit(74);
+  }
+
+  // the globals of the image go last, as if its code ran before the script.
+  if (image != nullptr && !vm.loadImage(image, module)) exit(74);
+  InterpretResult result = vm.run(module);
+  if (result == InterpretResult::Ok && saveImage != nullptr && !vm.saveImage(saveImage)) {
+    vm.output().flush();
+    exit(74);
+  }
+
+  // print what's left before exiting.
+  vm.output().flush();
+  if (stats) printStats(vm);
+
+  if (result == InterpretResult::Compile_Error) exit(65);
+  if (result == InterpretResult::Runtime_Error) exit(70);
+}
+
+static void printStats(const VM &vm) {
+  const InferenceStats &inference = vm.inferenceStats();
+  fprintf(stderr, "-- compiled %zu of %zu numeric ops unchecked, %zu reverted\n",
+    inference.unchecked, inference.sites, inference.reverted);
+
+  const CaptureStats &captures = vm.captureStats();
+  fprintf(stderr, "-- kept %zu of %zu captured locals on the stack\n",
+    captures.unboxed, captures.unboxed + captures.boxed);
+
+  const PropertyCacheStats &properties = vm.propertyCacheStats();
+  size_t lookups = properties.hits + properties.misses;
+  fprintf(stderr, "-- property caches hit %zu of %zu accesses (%.1f%%), %zu sites polymorphic, %zu megamorphic\n",
+    properties.hits, lookups, lookups > 0 ? 100.0 * properties.hits / lookups : 0.0,
+    properties.polymorphic, properties.megamorphic);
+
+  const QuickenStats &quicken = vm.quickenStats();
+  fprintf(stderr, "-- quickened %zu sites, %zu deopts, %zu left generic\n",
+    quicken.quickened, quicken.deopts, quicken.unstable);
+
+  const JitStats &jit = vm.jitStats();
+  fprintf(stderr, "-- jit compiled %zu chunks, %zu exits (%zu guards), %zu dropped\n",
+    jit.compiled, jit.exits, jit.guardExits, jit.dropped);
 }
 
 int main(int argc, char *argv[]) {
   VM vm;
 
-  if (argc == 2) {
-    runFile(vm, argv[1]);
-  } else {
-    fprintf(stderr, "Usage: loxy [script]\n");
+  // --stats reports how the script ran to stderr. --no-jit interprets
+  // all code. --no-verify runs it unverified, with checks instead.
+  // --emit-c translates the script to C instead of running it, &
+  // --native runs a translated script built into a shared object.
+  // --load adds the native functions of a shared object to the script's
+  // globals, see LoxyNative. --fuel fails the script once it looped or
+  // called so many times, & --timeout once it ran so many ms. --image
+  // starts the script with the globals of an image, & --save-image saves
+  // what the script left into one once it ran, see VM::saveImage.
+  bool stats = false;
+  bool toC = false;
+  bool native = false;
+  std::vector<const char*> libraries;
+  const char *image = nullptr;
+  const char *saveImage = nullptr;
+  long timeoutMs = 0;
+  int arg = 1;
+  for (; arg < argc - 1; arg++) {
+    if (strcmp(argv[arg], "--load") == 0 && arg < argc - 2) {
+      libraries.push_back(argv[++arg]);
+    } else if (strcmp(argv[arg], "--image") == 0 && arg < argc - 2) {
+      image = argv[++arg];
+    } else if (strcmp(argv[arg], "--save-image") == 0 && arg < argc - 2) {
+      saveImage = argv[++arg];
+    } else if (strcmp(argv[arg], "--fuel") == 0 && arg < argc - 2) {
+      vm.setFuel(atoll(argv[++arg]));
+    } else if (strcmp(argv[arg], "--timeout") == 0 && arg < argc - 2) {
+      timeoutMs = atol(argv[++arg]);
+    } else if (strcmp(argv[arg], "--stats") == 0) {
+      stats = true;
+    } else if (strcmp(argv[arg], "--no-jit") == 0) {
+      vm.setJit(false);
+    } else if (strcmp(argv[arg], "--no-verify") == 0) {
+      vm.setVerify(false);
+    } else if (strcmp(argv[arg], "--emit-c") == 0) {
+      toC = true;
+    } else if (strcmp(argv[arg], "--native") == 0) {
+      native = true;
+    } else {
+      break;
+    }
+  }
+
+  bool images = image != nullptr || saveImage != nullptr;
+  if (arg != argc - 1 || ((toC || native) && (!libraries.empty() || images))) {
+    fprintf(stderr, "Usage: loxy [--stats] [--no-jit] [--no-verify] [--load library]... "
+                    "[--image file] [--save-image file] [--fuel n] [--timeout ms] "
+                    "[--emit-c | --native] [script]\n");
     exit(64);
   }
+
+  if (timeoutMs > 0) abortAfter(vm, timeoutMs);
+
+  if (toC) {
+    emitC(vm, argv[arg]);
+  } else if (native) {
+    runNative(vm, argv[arg], stats);
+  } else {
+    runFile(vm, argv[arg], libraries, image, saveImage, stats);
+  }
   exit(0);
 }
\ No newline at end of file
@@ -0,0 +1,68 @@
+// IoTest - what the scripts under test/ can't check of the I/O natives:
+//  closing an fd wakes every fiber waiting on it, each failing on its own
+//  run of the loop.
+//
+//  usage: io_test
+#include <cstdio>
+#include "VM/VM.h"
+#include "VM/Module.h"
+
+using namespace loxy;
+
+namespace {
+
+int failures = 0;
+
+void check(bool ok, const char *what) {
+  if (!ok) {
+    fprintf(stderr, "failed: %s\n", what);
+    failures++;
+  }
+}
+
+// a reader & a writer, its write larger than the socket buffer, block on
+// the same end of a socketpair until the main fiber closes it.
+const char *closeScript =
+  "var s = socketpair();"
+  "fun reader() { read(s[0]); }"
+  "fun writer() {"
+  "  var data = \"0123456789abcdef\";"
+  "  for (var i = 0; i < 16; i = i + 1) data = data + data;"
+  "  write(s[0], data);"
+  "}"
+  "var r = spawn(reader);"
+  "var w = spawn(writer);"
+  "sleep(10);"
+  "close(s[0]);";
+
+FiberState stateOf(VM &vm, Module *module, const char *name) {
+  Value value;
+  if (!module->getVariable(String::create(vm, name), &value) || !value.isFiber()) {
+    return FiberState::New;
+  }
+  return static_cast<Fiber*>((Object*)value)->state;
+}
+
+void closeWakesEveryWaiter() {
+  VM vm;
+  Module *module = vm.compile(closeScript, "close");
+  check(module != nullptr, "close script compiles");
+  if (module == nullptr) return;
+  vm.addIo(module);
+
+  // the loop stops at the first fiber that fails, the other is woken too
+  // & fails on the next run.
+  check(vm.run(module) == InterpretResult::Runtime_Error, "the first waiter fails");
+  check(vm.runLoop() == InterpretResult::Runtime_Error, "the second waiter fails");
+  check(vm.runLoop() == InterpretResult::Ok, "nothing is left waiting");
+  check(stateOf(vm, module, "r") == FiberState::Done, "the reader is done");
+  check(stateOf(vm, module, "w") == FiberState::Done, "the writer is done");
+}
+
+} // namespace
+
+int main() {
+  closeWakesEveryWaiter();
+  if (failures == 0) printf("ok\n");
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,77 @@
+# runs the script [SCRIPT] with [LOXY], failing unless what it prints &
+# its exit code match the .out file next to it. The first line of the
+# .out file is the exit code, the rest is stdout. What it reports to
+# stderr is checked too if there's an .err file next to it. Options for
+# loxy go in an .args file next to it.
+#
+# A script of the same name under test/image/ runs first, saving an image
+# under [WORK] that the script then runs on, see `loxy --image`.
+#
+# With [CC] set, the script is translated to C instead, built with [CC]
+# against [RUNTIME] into a shared object under [WORK] & run from that,
+# checked against the same files.
+string(REGEX REPLACE "\\.lox$" ".args" args_file ${SCRIPT})
+set(args "")
+if (EXISTS ${args_file})
+  file(READ ${args_file} args)
+  separate_arguments(args UNIX_COMMAND "${args}")
+endif()
+
+get_filename_component(dir ${SCRIPT} DIRECTORY)
+get_filename_component(name ${SCRIPT} NAME_WE)
+set(saver ${dir}/image/${name}.lox)
+if (EXISTS ${saver})
+  set(image ${WORK}/${name}.image)
+  execute_process(
+    COMMAND ${LOXY} --save-image ${image} ${saver}
+    OUTPUT_QUIET
+    ERROR_VARIABLE errors
+    RESULT_VARIABLE result)
+  if (NOT result EQUAL 0)
+    message(FATAL_ERROR "${saver} doesn't save an image\n${errors}")
+  endif()
+  list(APPEND args --image ${image})
+endif()
+
+if (CC)
+  set(source ${WORK}/${name}.c)
+  set(library ${WORK}/${name}.so)
+  execute_process(
+    COMMAND ${LOXY} --emit-c ${SCRIPT}
+    OUTPUT_FILE ${source}
+    RESULT_VARIABLE result)
+  if (NOT result EQUAL 0)
+    message(FATAL_ERROR "${SCRIPT} can't be translated to C")
+  endif()
+  execute_process(
+    COMMAND ${CC} -O2 -shared -fPIC -I${RUNTIME} ${source} -o ${library}
+    RESULT_VARIABLE result)
+  if (NOT result EQUAL 0)
+    message(FATAL_ERROR "${source} doesn't build")
+  endif()
+  set(command ${LOXY} ${args} --native ${library})
+else()
+  set(command ${LOXY} ${args} ${SCRIPT})
+endif()
+
+execute_process(
+  COMMAND ${command}
+  OUTPUT_VARIABLE output
+  ERROR_VARIABLE errors
+  RESULT_VARIABLE result)
+
+string(REGEX REPLACE "\\.lox$" ".out" expected_file ${SCRIPT})
+file(READ ${expected_file} expected)
+set(actual "${result}\n${output}")
+
+if (NOT actual STREQUAL expected)
+  message(FATAL_ERROR "${SCRIPT}\n-- expected:\n${expected}\n-- got:\n${actual}\n-- stderr:\n${errors}")
+endif()
+
+string(REGEX REPLACE "\\.lox$" ".err" expected_errors_file ${SCRIPT})
+if (EXISTS ${expected_errors_file})
+  file(READ ${expected_errors_file} expected_errors)
+  if (NOT errors STREQUAL expected_errors)
+    message(FATAL_ERROR "${SCRIPT}\n-- expected on stderr:\n${expected_errors}\n-- got:\n${errors}")
+  endif()
+endif()
@@ -0,0 +1,90 @@
+// VerifyTest - verified code running code that isn't: functions compiled
+//  while verification was off, called, returned into & switched to by code
+//  compiled once it's on. The rest runs checked, see [VM::resume].
+//
+//  usage: verify_test
+#include <cstdio>
+#include "VM/VM.h"
+#include "VM/Module.h"
+
+using namespace loxy;
+
+namespace {
+
+int failures = 0;
+
+void check(bool ok, const char *what) {
+  if (!ok) {
+    fprintf(stderr, "failed: %s\n", what);
+    failures++;
+  }
+}
+
+// compiled & run unverified.
+const char *unverifiedScript =
+  "fun deep(n) {"
+  "  if (n == 0) return 0;"
+  "  return 1 + deep(n - 1);"
+  "}"
+  "fun wide(a, b) {"
+  "  var x = a * 2;"
+  "  var y = [x, b, x + b];"
+  "  return y[2];"
+  "}"
+  "fun back(f) { return f() + 1; }"
+  "fun count() {"
+  "  yield(1);"
+  "  yield(2);"
+  "  return 3;"
+  "}";
+
+// compiled & run verified, on the globals of the other.
+const char *verifiedScript =
+  "fun seven() { return 7; }"
+  "fun later() {"
+  "  var x = deep(3);"
+  "  return x + 1;"
+  "}"
+  "var a = deep(50);"
+  "var b = wide(3, 4);"
+  "var c = back(seven);"
+  "var f = fiber(count);"
+  "var d = resume(f) + resume(f) + resume(f);"
+  "var e = later();";
+
+int64_t intOf(VM &vm, Module *module, const char *name) {
+  Value value;
+  if (!module->getVariable(String::create(vm, name), &value) || !value.isInt()) return -1;
+  return value.asInt();
+}
+
+void verifiedCallsUnverified() {
+  VM vm;
+  vm.setVerify(false);
+  Module *unverified = vm.compile(unverifiedScript, "unverified");
+  check(unverified != nullptr, "the unverified script compiles");
+  if (unverified == nullptr) return;
+  check(vm.run(unverified) == InterpretResult::Ok, "the unverified script runs");
+
+  vm.setVerify(true);
+  Module *verified = vm.compile(verifiedScript, "verified");
+  check(verified != nullptr, "the verified script compiles");
+  if (verified == nullptr) return;
+  verified->importVariables(unverified);
+  vm.addIo(verified);
+  check(vm.run(verified) == InterpretResult::Ok, "the verified script runs");
+
+  check(intOf(vm, verified, "a") == 50, "verified code calls unverified code");
+  check(intOf(vm, verified, "b") == 10, "unverified code gets the stack it needs");
+  check(intOf(vm, verified, "c") == 8, "unverified code calls & is returned into");
+  check(intOf(vm, verified, "d") == 6, "verified code switches to unverified fibers");
+  check(intOf(vm, verified, "e") == 4, "unverified code returns into verified code");
+}
+
+} // namespace
+
+int main() {
+  verifiedCallsUnverified();
+  if (failures == 0) printf("ok\n");
+  return failures == 0 ? 0 : 1;
+}